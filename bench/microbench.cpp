@@ -0,0 +1,423 @@
+#include <cairo.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cerrno>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <attitude.hpp>
+#include <attitude_filter.hpp>
+#include <denoise.hpp>
+#include <motion_watch.hpp>
+#include <overlay_layers.hpp>
+#include <pip.hpp>
+#include <trace.hpp>
+#include <undistort.hpp>
+#include <video.hpp>
+#include <warp.hpp>
+#include <worker_pool.hpp>
+
+// Microbenchmarks of the per-frame and per-sample code. Each benchmark runs a
+// warm up, then a timed loop, and reports the time, heap allocations and
+// (where perf_event is available) cache misses per operation. The output is
+// one JSON document with the benchmarks in a fixed order, so two runs can be
+// compared with a plain diff or a script.
+//
+//   MastheadCamera_microbench [--quick] [--check-allocations]
+//
+// --quick runs a tenth of the iterations, for a fast check.
+// --check-allocations fails the run if a benchmark allocates in its timed
+// loop, other than those in ALLOCATING_BENCHES. ctest runs it this way.
+
+// Benchmarks that make a new cairo context per frame, as cairooverlay does,
+// and so allocate inside cairo. Everything else must not allocate per frame.
+static const char *ALLOCATING_BENCHES[] = {"overlay_steady", "overlay_sweep", "overlay_static_layers"};
+
+// Heap allocations made by any thread. Counted by the malloc family below,
+// which also covers operator new and the allocations made inside cairo.
+static std::atomic<long> m_allocations {0};
+
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *pointer, size_t size);
+void *__libc_memalign(size_t alignment, size_t size);
+void  __libc_free(void *pointer);
+
+void *malloc(size_t size) {
+    m_allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size) {
+    m_allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *pointer, size_t size) {
+    m_allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_realloc(pointer, size);
+}
+
+void *memalign(size_t alignment, size_t size) {
+    m_allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_memalign(alignment, size);
+}
+
+void *aligned_alloc(size_t alignment, size_t size) {
+    return memalign(alignment, size);
+}
+
+int posix_memalign(void **pointer, size_t alignment, size_t size) {
+    *pointer = memalign(alignment, size);
+    return *pointer ? 0 : ENOMEM;
+}
+
+void free(void *pointer) {
+    __libc_free(pointer);
+}
+}
+
+// Result of one benchmark.
+struct BenchResult {
+    const char *name;
+    long        iterations;
+    double      ns_per_op;
+    double      allocations_per_op;
+    double      cache_misses_per_op;  // Negative when perf_event is not available.
+};
+
+/**
+ * @brief Open a cache miss counter for this thread.
+ *
+ * @return perf_event file descriptor, -1 if not available.
+ */
+static int openCacheMissCounter() {
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type           = PERF_TYPE_HARDWARE;
+    attr.size           = sizeof(attr);
+    attr.config         = PERF_COUNT_HW_CACHE_MISSES;
+    attr.disabled       = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv     = 1;
+    attr.inherit        = 1;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+/**
+ * @brief Run one benchmark.
+ *
+ * @param name       Benchmark name.
+ * @param iterations Timed operations.
+ * @param op         Operation, given the iteration number.
+ * @return result.
+ */
+template <typename Op>
+static BenchResult runBench(const char *name, long iterations, Op op) {
+    // Warm up caches, memoization and lazily made state
+    for (long i = 0; i < std::max(iterations / 10, 1L); i++) op(i);
+
+    int counter = openCacheMissCounter();
+    if (counter >= 0) {
+        ioctl(counter, PERF_EVENT_IOC_RESET, 0);
+        ioctl(counter, PERF_EVENT_IOC_ENABLE, 0);
+    }
+    long allocations = m_allocations.load();
+    auto start       = std::chrono::steady_clock::now();
+
+    for (long i = 0; i < iterations; i++) op(i);
+
+    auto end = std::chrono::steady_clock::now();
+    allocations = m_allocations.load() - allocations;
+
+    double cache_misses = -1.0;
+    if (counter >= 0) {
+        ioctl(counter, PERF_EVENT_IOC_DISABLE, 0);
+        long long count;
+        if (read(counter, &count, sizeof(count)) == sizeof(count)) cache_misses = (double)count / iterations;
+        close(counter);
+    }
+
+    double ns = std::chrono::duration<double, std::nano>(end - start).count();
+    return {name, iterations, ns / iterations, (double)allocations / iterations, cache_misses};
+}
+
+/**
+ * @brief Build a Gaming Rotation Vector report body for a quaternion.
+ *
+ * @param qx, qy, qz, qw Quaternion, normalized.
+ * @param data           Returned report body (after ID, Seq, Status, Delay).
+ */
+static void quaternionReport(double qx, double qy, double qz, double qw, uint8_t *data) {
+    const double q[4] = {qx, qy, qz, qw};
+    for (int i = 0; i < 4; i++) {
+        int16_t raw = (int16_t)lround(std::clamp(q[i], -1.99, 1.99) * 16384.0);
+        data[2 * i]     = raw & 0xFF;
+        data[2 * i + 1] = (raw >> 8) & 0xFF;
+    }
+}
+
+/**
+ * @brief Build a quaternion from pitch, roll and yaw in degrees.
+ */
+static void eulerQuaternion(double pitch, double roll, double yaw, double *qx, double *qy, double *qz, double *qw) {
+    double cr = cos(roll * DEG_TO_RAD / 2),  sr = sin(roll * DEG_TO_RAD / 2);
+    double cp = cos(pitch * DEG_TO_RAD / 2), sp = sin(pitch * DEG_TO_RAD / 2);
+    double cy = cos(yaw * DEG_TO_RAD / 2),   sy = sin(yaw * DEG_TO_RAD / 2);
+    *qw = cr * cp * cy + sr * sp * sy;
+    *qx = sr * cp * cy - cr * sp * sy;
+    *qy = cr * sp * cy + sr * cp * sy;
+    *qz = cr * cp * sy - sr * sp * cy;
+}
+
+/**
+ * @brief Build SHTP packets like the ones read from the sensor.
+ *
+ * The byte stream is synthetic but has the sensor's layout: input report
+ * packets with a varying number of timebase reports ahead of the rotation
+ * vector, mixed with control channel packets that are skipped.
+ *
+ * @param count Number of packets.
+ * @return packets of 128 bytes each.
+ */
+static std::vector<uint8_t> shtpPackets(int count) {
+    std::vector<uint8_t> packets(count * 128, 0);
+    for (int p = 0; p < count; p++) {
+        uint8_t *packet = &packets[p * 128];
+        packet[0] = 128;
+        packet[2] = (p % 8 == 7) ? 0x02 : 0x03;  // Every eighth packet is on the control channel
+        packet[3] = (uint8_t)p;
+
+        int i = 4;
+        for (int t = 0; t < p % 4; t++, i += 5) packet[i] = 0xFB;
+        packet[i]     = 0x08;
+        packet[i + 1] = (uint8_t)p;  // Report sequence number
+
+        double qx, qy, qz, qw;
+        eulerQuaternion(-20.0 + (p % 41), 90.0 - 30.0 + (p % 61), p % 360, &qx, &qy, &qz, &qw);
+        quaternionReport(qx, qy, qz, qw, &packet[i + 4]);
+    }
+    return packets;
+}
+
+/**
+ * @brief Make an NV12 frame with a test pattern.
+ */
+static Nv12Frame nv12Frame(std::vector<uint8_t> &storage, int width, int height) {
+    storage.resize(width * height * 3 / 2);
+    for (size_t i = 0; i < storage.size(); i++) storage[i] = (uint8_t)(i * 7 + (i / width) * 3);
+    return {storage.data(), storage.data() + width * height, width, height, width, width};
+}
+
+/**
+ * @brief Print the results as JSON.
+ */
+static void printResults(const std::vector<BenchResult> &results) {
+    printf("{\n  \"benchmarks\": [\n");
+    for (size_t i = 0; i < results.size(); i++) {
+        const BenchResult &r = results[i];
+        printf("    {\"name\": \"%s\", \"iterations\": %ld, \"ns_per_op\": %.1f, \"allocations_per_op\": %.3f, "
+               "\"cache_misses_per_op\": ", r.name, r.iterations, r.ns_per_op, r.allocations_per_op);
+        if (r.cache_misses_per_op < 0) printf("null}");
+        else                           printf("%.1f}", r.cache_misses_per_op);
+        printf("%s\n", i + 1 < results.size() ? "," : "");
+    }
+    printf("  ]\n}\n");
+}
+
+/**
+ * @brief Report the benchmarks that allocate in their timed loop.
+ *
+ * @return number of benchmarks that allocated and are not allowed to.
+ */
+static int checkAllocations(const std::vector<BenchResult> &results) {
+    int failures = 0;
+    for (const BenchResult &r : results) {
+        if (r.allocations_per_op <= 0.0) continue;
+        bool allowed = false;
+        for (const char *name : ALLOCATING_BENCHES) allowed = allowed || strcmp(r.name, name) == 0;
+        if (allowed) continue;
+        fprintf(stderr, "%s allocates %.3f times per operation\n", r.name, r.allocations_per_op);
+        failures++;
+    }
+    return failures;
+}
+
+int main(int argc, char *argv[]) {
+    long scale             = 1;
+    bool check_allocations = false;
+    for (int i = 1; i < argc; i++) {
+        if      (strcmp(argv[i], "--quick") == 0)             scale             = 10;
+        else if (strcmp(argv[i], "--check-allocations") == 0) check_allocations = true;
+        else {
+            fprintf(stderr, "Usage: %s [--quick] [--check-allocations]\n", argv[0]);
+            return 1;
+        }
+    }
+    std::vector<BenchResult> results;
+
+    // --- Overlay ---
+    // Drawn onto an offscreen BGRx frame (CAIRO_FORMAT_RGB24 is BGRx in memory on the Pi) with a
+    // new context per frame, as cairooverlay does. The layers are timed at a fixed wall clock, so a
+    // timer layer is drawn once in the warm up and composited from its cache after that.
+    cairo_surface_t *surface = cairo_image_surface_create(CAIRO_FORMAT_RGB24, WIDTH, HEIGHT);
+    OverlayEngine   *horizon = makeOverlayEngine("forward", HORIZON_OVERLAY_LAYERS,
+                                                 [](int width, int height) { return forwardCameraModel(); }, NULL);
+    const int64_t    now_ms  = 1700000000000;
+
+    results.push_back(runBench("overlay_steady", 2000 / scale, [&](long i) {
+        cairo_t *cr = cairo_create(surface);
+        drawOverlayLayers(horizon, cr, {2.0, 0.5, 0.0, now_ms, WIDTH, HEIGHT});
+        cairo_destroy(cr);
+    }));
+
+    // Pitch and roll sweep like a boat in a swell, so the ladder layer goes stale every frame
+    results.push_back(runBench("overlay_sweep", 2000 / scale, [&](long i) {
+        cairo_t *cr = cairo_create(surface);
+        drawOverlayLayers(horizon, cr, {8.0 * sin(i * 0.037), 15.0 * sin(i * 0.023), 0.0, now_ms, WIDTH, HEIGHT});
+        cairo_destroy(cr);
+    }));
+
+    // Static layers only: the docking guides and the badges, composited from their caches
+    OverlayEngine *docking = makeOverlayEngine("docking", DOCKING_OVERLAY_LAYERS, dockingCameraModel, NULL);
+    results.push_back(runBench("overlay_static_layers", 2000 / scale, [&](long i) {
+        cairo_t *cr = cairo_create(surface);
+        drawOverlayLayers(docking, cr, {8.0 * sin(i * 0.037), 15.0 * sin(i * 0.023), 0.0, now_ms, WIDTH, HEIGHT});
+        cairo_destroy(cr);
+    }));
+
+    // The same blended into NV12 planes, as on the docking camera
+    std::vector<uint8_t> nv12((size_t)WIDTH_2 * HEIGHT_2 * 3 / 2, 128);
+    results.push_back(runBench("overlay_static_layers_nv12", 2000 / scale, [&](long i) {
+        blendOverlayLayers(docking, nv12.data(), WIDTH_2, nv12.data() + (size_t)WIDTH_2 * HEIGHT_2, WIDTH_2,
+                           {8.0 * sin(i * 0.037), 15.0 * sin(i * 0.023), 0.0, now_ms, WIDTH_2, HEIGHT_2});
+    }));
+
+    freeOverlayEngine(docking);
+    freeOverlayEngine(horizon);
+    cairo_surface_destroy(surface);
+
+    // --- Attitude ---
+    const int            REPORTS = 1024;
+    const int64_t        ATTITUDE_BENCH_PERIOD_NS = (int64_t)(ATTITUDE_SAMPLE_PERIOD_S * 1e9);  // Reports at the sensor rate
+    std::vector<uint8_t> reports(REPORTS * 8), singular(REPORTS * 8);
+    for (int i = 0; i < REPORTS; i++) {
+        double qx, qy, qz, qw;
+        eulerQuaternion(-30.0 + (i % 61), 60.0 + (i % 61), (i * 7) % 360, &qx, &qy, &qz, &qw);
+        quaternionReport(qx, qy, qz, qw, &reports[i * 8]);
+        // Pitch at +/- 90 degrees takes the gimbal lock branch
+        eulerQuaternion(i % 2 ? 90.0 : -90.0, i % 45, (i * 7) % 360, &qx, &qy, &qz, &qw);
+        quaternionReport(qx, qy, qz, qw, &singular[i * 8]);
+    }
+
+    results.push_back(runBench("quaternion_to_euler", 2000000 / scale, [&](long i) {
+        parseAndRemap(&reports[(i % REPORTS) * 8], (uint8_t)i, i * ATTITUDE_BENCH_PERIOD_NS);
+    }));
+    results.push_back(runBench("quaternion_to_euler_singular", 2000000 / scale, [&](long i) {
+        parseAndRemap(&singular[(i % REPORTS) * 8], (uint8_t)i, i * ATTITUDE_BENCH_PERIOD_NS);
+    }));
+
+    std::vector<uint8_t> packets = shtpPackets(REPORTS);
+    results.push_back(runBench("shtp_report_scan", 2000000 / scale, [&](long i) {
+        parseAttitudeReport(&packets[(i % REPORTS) * 128], 128, i * ATTITUDE_BENCH_PERIOD_NS);
+    }));
+
+    // One smoothing step per filter, on samples swaying with a 4 Hz vibration on top
+    std::vector<double> samples(REPORTS * 4);
+    for (int i = 0; i < REPORTS; i++) {
+        double *q = &samples[i * 4];
+        eulerQuaternion(4.0 * sin(i * 0.03) + 0.6 * sin(i * 1.26), 90.0 + 8.0 * sin(i * 0.02), i * 0.02,
+                        &q[0], &q[1], &q[2], &q[3]);
+    }
+    static const char *FILTER_BENCHES[] = {"attitude_filter_one_euro", "attitude_filter_complementary",
+                                           "attitude_filter_kalman"};
+    const AttitudeFilterType filter_types[] = {AttitudeFilterType::ONE_EURO, AttitudeFilterType::COMPLEMENTARY,
+                                               AttitudeFilterType::KALMAN};
+    for (int f = 0; f < 3; f++) {
+        AttitudeFilterSettings settings = defaultAttitudeFilterSettings();
+        settings.type = filter_types[f];
+        AttitudeFilter filter;
+        resetAttitudeFilter(&filter, settings);
+        results.push_back(runBench(FILTER_BENCHES[f], 2000000 / scale, [&](long i) {
+            double q[4];
+            memcpy(q, &samples[(i % REPORTS) * 4], sizeof(q));
+            stepAttitudeFilter(&filter, q, ATTITUDE_SAMPLE_PERIOD_S);
+        }));
+    }
+
+    // --- Video stages ---
+    std::vector<uint8_t> src_storage, dst_storage, ref_storage;
+    Nv12Frame            src = nv12Frame(src_storage, WIDTH, HEIGHT);
+    Nv12Frame            dst = nv12Frame(dst_storage, WIDTH, HEIGHT);
+    Nv12Frame            ref = nv12Frame(ref_storage, WIDTH, HEIGHT);
+    WorkerPool           pool(4);
+    WorkerPool           single(1);
+
+    results.push_back(runBench("rotate_nv12_frame", 200 / scale, [&](long i) {
+        rotateNV12(src, dst, 0.05 + i * 1e-4, 1.1, pool);
+    }));
+    results.push_back(runBench("rotate_nv12_frame_1_thread", 50 / scale, [&](long i) {
+        rotateNV12(src, dst, 0.05 + i * 1e-4, 1.1, single);
+    }));
+
+    UndistortMap map;
+    buildUndistortMap(forwardCameraModel(), WIDTH, HEIGHT, map);
+    results.push_back(runBench("undistort_nv12_frame", 200 / scale, [&](long i) {
+        undistortNV12(src, dst, map, pool);
+    }));
+    results.push_back(runBench("undistort_map_build", 50 / scale, [&](long i) {
+        buildUndistortMap(forwardCameraModel(), WIDTH, HEIGHT, map);
+    }));
+
+    const int frame_bytes = WIDTH * HEIGHT * 3 / 2;
+    results.push_back(runBench("denoise_frame", 200 / scale, [&](long i) {
+        temporalBlendRow(src.y, ref.y, dst.y, frame_bytes);
+    }));
+
+    results.push_back(runBench("pip_halve_frame", 500 / scale, [&](long i) {
+        for (int row = 0; row < HEIGHT / 2; row++) {
+            halveRowY(src.y + 2 * row * WIDTH, src.y + (2 * row + 1) * WIDTH, dst.y + row * WIDTH, WIDTH / 2);
+        }
+        for (int row = 0; row < HEIGHT / 4; row++) {
+            halveRowUV(src.uv + 2 * row * WIDTH, src.uv + (2 * row + 1) * WIDTH, dst.uv + row * WIDTH, WIDTH / 4);
+        }
+    }));
+
+    results.push_back(runBench("pip_blend_inset", 500 / scale, [&](long i) {
+        for (int row = 0; row < HEIGHT / 2; row++) {
+            blendRow(dst.y + row * WIDTH, src.y + row * WIDTH, PIP_INSET_OPACITY, WIDTH / 2);
+        }
+    }));
+
+    // Motion watch check of a docking camera frame, which runs every MOTION_WATCH_INTERVAL frames
+    std::vector<uint8_t> watch_luma((size_t)WIDTH_2 * HEIGHT_2, 90);
+    MotionState          watch;
+    results.push_back(runBench("motion_watch_check", 2000 / scale, [&](long i) {
+        double changed;
+        watch_luma[(i * 4099) % watch_luma.size()] ^= 0x40;
+        checkMotion(&watch, watch_luma.data(), WIDTH_2, WIDTH_2, HEIGHT_2, i * 0.33, &changed);
+    }));
+
+    // --- Tracing ---
+    // The cost of a span and a counter while recording, through the macros the stages use, so a build
+    // without TRACE measures them compiled out
+    results.push_back(runBench("trace_span", 2000000 / scale, [&](long i) {
+        TRACE_SPAN("bench span");
+    }));
+    results.push_back(runBench("trace_counter", 2000000 / scale, [&](long i) {
+        TRACE_COUNTER("bench counter", i);
+    }));
+
+    printResults(results);
+    return check_allocations && checkAllocations(results) > 0 ? 1 : 0;
+}
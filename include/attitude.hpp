@@ -1,5 +1,7 @@
 #pragma once
 
+#include <cstdint>
+
 #define BNO08X_ADDR 0x4A
 
 // Public Function Prototypes
@@ -7,6 +9,24 @@
 // Initialize the BNo085 9DOF sensor. It communicated via I2C.
 int initAttitude();
 
+// Initialize the sensor on a background thread, so its boot message flush
+// does not hold up the cameras. The attitude reads as zero until it is ready.
+void startAttitude();
+
 // Get the current pitch, roll and heading values. If there is not
 // a new value, use the one stored from the previous reading.
-void getAttitude(double *pitch, double *roll, double *heading);
\ No newline at end of file
+void getAttitude(double *pitch, double *roll, double *heading);
+
+// Get the most recent pitch, roll and heading values without reading the
+// sensor. Safe to call from any thread.
+void peekAttitude(double *pitch, double *roll, double *heading);
+
+// Scan one SHTP packet read from the sensor for a Gaming Rotation Vector
+// report and store its attitude. read_ns is the steady clock time of the
+// read. Returns 1 if the packet held one.
+int parseAttitudeReport(const uint8_t *packet, int bytes, int64_t read_ns);
+
+// Convert the quaternion of a Gaming Rotation Vector report (header removed)
+// to pitch, roll and yaw and store them. sequence is the sequence number of
+// the report and read_ns the steady clock time it was read.
+void parseAndRemap(const uint8_t *data, uint8_t sequence, int64_t read_ns);
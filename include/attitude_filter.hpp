@@ -0,0 +1,92 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+// Attitude smoothing between the sensor parser and everything reading the
+// attitude. The rigging shakes the mast at a few Hz, which the 20 Hz Gaming
+// Rotation Vector passes straight through and the pitch ladder shows as
+// shimmer. A plain low pass filter would remove it only by lagging the real
+// motion of the boat, so the filters here all follow motion and smooth rest:
+//   NONE          - The sensor samples as they are.
+//   ONE_EURO      - One euro filter (Casiez et al. 2012). A low pass whose
+//                   cutoff rises from min_cutoff_hz by beta per degree per
+//                   second of the smoothed rotation rate.
+//   COMPLEMENTARY - The last output carried forward by the smoothed rotation
+//                   rate, blended with the sample. The blend time constant
+//                   is rest_time_constant_s at rest and shrinks as the rate
+//                   nears motion_rate_dps, so steady turns are not lagged.
+//   KALMAN        - Constant rate Kalman filter per quaternion component,
+//                   with the angular acceleration noise and measurement noise
+//                   given in degrees.
+// The filters run on the quaternion, so there is no gimbal lock or yaw wrap
+// to handle. Each sample is stepped by ATTITUDE_SAMPLE_PERIOD_S, the rate the
+// sensor is set to, times the reports since the previous one as counted by
+// the report sequence number. Dropped reports do not bend the rate, and
+// neither does when the reports happen to be read. A gap of
+// ATTITUDE_FILTER_RESET_S restarts the filter from the next sample. The
+// settings can be changed from the control socket (see control.hpp), which
+// also restarts it. The jitter and latency of each filter are measured by
+// MastheadCamera_attitude_smoothing.
+enum class AttitudeFilterType { NONE, ONE_EURO, COMPLEMENTARY, KALMAN };
+
+static const AttitudeFilterType ATTITUDE_FILTER_TYPE          = AttitudeFilterType::NONE;
+static const double ATTITUDE_SAMPLE_PERIOD_S                  = 0.05;
+static const double ATTITUDE_FILTER_RESET_S                   = 0.5;
+static const double ONE_EURO_MIN_CUTOFF_HZ                    = 1.0;
+static const double ONE_EURO_BETA                             = 0.1;    // Hz per degree per second.
+static const double ONE_EURO_DERIVATIVE_CUTOFF_HZ             = 1.0;
+static const double COMPLEMENTARY_REST_TIME_CONSTANT_S        = 0.2;
+static const double COMPLEMENTARY_MOTION_RATE_DPS             = 5.0;
+static const double KALMAN_ACCEL_NOISE_DPS2                   = 10.0;
+static const double KALMAN_MEASUREMENT_NOISE_DEG              = 1.0;
+
+// Filter choice and tuning.
+struct AttitudeFilterSettings {
+    AttitudeFilterType type;
+    double             min_cutoff_hz;           // ONE_EURO.
+    double             beta;
+    double             derivative_cutoff_hz;
+    double             rest_time_constant_s;    // COMPLEMENTARY.
+    double             motion_rate_dps;
+    double             accel_noise_dps2;        // KALMAN.
+    double             measurement_noise_deg;
+};
+
+// Filter state. The quaternions are (x, y, z, w).
+struct AttitudeFilter {
+    AttitudeFilterSettings settings;
+    bool                   primed;
+    double                 q[4];        // Last output, before normalizing.
+    double                 rate[4];     // Smoothed change of q per second.
+    double                 p[4][3];     // KALMAN covariance per component: xx, xv, vv.
+};
+
+// Public Function Prototypes
+
+// The compiled in settings.
+AttitudeFilterSettings defaultAttitudeFilterSettings();
+
+// Name of a filter type for the control socket, and back. attitudeFilterType
+// returns false for an unknown name.
+const char *attitudeFilterName(AttitudeFilterType type);
+bool        attitudeFilterType(const char *name, AttitudeFilterType *type);
+
+// Restart a filter with new settings. The next sample passes through as is.
+void resetAttitudeFilter(AttitudeFilter *filter, const AttitudeFilterSettings &settings);
+
+// Filter one unit quaternion sample, in place. dt is the time since the
+// previous sample in seconds.
+void stepAttitudeFilter(AttitudeFilter *filter, double q[4], double dt);
+
+// Filter stage of the sensor samples, used by parseAndRemap. sequence is the
+// sequence number of the sensor report and read_ns when it was read, in
+// steady clock nanoseconds. Thread safe.
+void filterAttitudeSample(double q[4], uint8_t sequence, int64_t read_ns);
+
+// Change the settings of the filter stage, and get them.
+void                   setAttitudeFilter(const AttitudeFilterSettings &settings);
+AttitudeFilterSettings attitudeFilterSettings();
+
+// Settings as a JSON object for the control socket.
+std::string attitudeFilterJson(const AttitudeFilterSettings &settings);
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <gst/gst.h>
+#include <cairo.h>
+#include <camera_model.hpp>
+#include <ladder.hpp>
+
+// Bridge underside detection. A downscaled copy of the luma is taken from
+// every few frames ahead of the overlay and analysed on its own thread. The
+// strongest near horizontal edge above the horizon is reported as an
+// elevation angle through the same camera model as the pitch ladder.
+static const bool  BRIDGE_DETECT_ENABLED       = false;
+static const int   BRIDGE_DETECT_SCALE         = 8;     // Luma is downscaled by this factor in each direction.
+static const int   BRIDGE_DETECT_MIN_INTERVAL  = 3;     // Analyse at most every Nth frame.
+static const int   BRIDGE_DETECT_MAX_INTERVAL  = 30;    // Analyse at least every Nth frame.
+static const float BRIDGE_DETECT_BUDGET_MS     = 2.0;   // Analysis time allowed per video frame, on average.
+static const float BRIDGE_DETECT_MAX_TILT_DEG  = 8.0;   // Edges tilted more than this from the ladder are ignored.
+static const int   BRIDGE_DETECT_EDGE_MIN      = 24;    // Minimum luma step (downscaled) counted as an edge.
+static const float BRIDGE_DETECT_MIN_LENGTH    = 0.25;  // Fraction of the frame width an edge must span.
+static const float BRIDGE_CLEARANCE_MARGIN_DEG = 1.0;   // Elevation above the 0 line needed for a go.
+
+// Where a readout was drawn, in pixels of the frame.
+struct BridgeReadoutArea {
+    int               points;                    // Points of the bridge line, 0 if it was not drawn.
+    double            x[LADDER_LINE_POINTS];
+    double            y[LADDER_LINE_POINTS];
+    double            line_width;
+    cairo_rectangle_t text;                      // Readout text, 0 wide if it was not drawn.
+};
+
+// Detector of one camera: the frame hand off, the analysis rate and the last
+// result.
+struct BridgeDetector;
+
+// Public Function Prototypes
+
+// Start the analysis thread and sample frames from the sink pad of the named
+// element. The element must carry BGRx frames. Returns NULL if the element
+// was not found.
+BridgeDetector *startBridgeDetector(GstElement *pipeline, const char *element_name);
+
+// Draw the last measured bridge line and its elevation with the camera model
+// and rotation used for the ladder of the current frame, and return where.
+// face is the overlay font, so none is made per frame.
+void drawBridgeReadout(BridgeDetector *detector, cairo_t *cr, cairo_font_face_t *face, const CameraModel &camera,
+                       const CameraRotation &rotation, BridgeReadoutArea *area);
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <vector>
+#include <camera_model.hpp>
+
+// Lens calibration from views of a flat target, such as a checkerboard. The
+// corners are found by any corner detector and given here with their place
+// on the target. The focal length, principal point, distortion and the pose
+// of every view are fitted together by Levenberg-Marquardt on the
+// reprojection error through lensPixel, so the result is exactly the model
+// the overlay draws with. PINHOLE fits k1 and k2, FISHEYE fits k1 - k4. The
+// fit starts from a nominal calibration, with each pose taken from the
+// homography of its view. MastheadCamera_calibrate runs it on a corner file.
+static const int    CALIBRATION_MIN_VIEWS  = 3;
+static const int    CALIBRATION_MIN_POINTS = 8;      // Per view, for its homography.
+static const int    CALIBRATION_ITERATIONS = 100;
+static const double CALIBRATION_TOLERANCE  = 1e-10;  // Relative change of the error that ends the fit.
+
+// One detected corner: its place on the target (z = 0) and its pixel.
+struct TargetPoint {
+    double x, y;
+    double u, v;
+};
+
+// All the corners found in one frame.
+struct TargetView {
+    std::vector<TargetPoint> points;
+};
+
+// Fitted calibration and how well it explains the corners.
+struct CalibrationResult {
+    CameraCalibration calibration;
+    double            rms_px;       // Reprojection error.
+    int               iterations;
+    bool              converged;    // false if the fit stopped at CALIBRATION_ITERATIONS.
+};
+
+// Public Function Prototypes
+
+// Fit a calibration to views of a width x height frame. The lens model is
+// that of initial. Returns 1 if there are too few views or corners, or the
+// fit cannot be solved.
+int calibrateCamera(const std::vector<TargetView> &views, int width, int height, const CameraCalibration &initial,
+                    CalibrationResult *result);
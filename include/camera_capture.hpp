@@ -0,0 +1,118 @@
+#pragma once
+
+#include <gst/gst.h>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include <camera_config.hpp>
+
+// Native camera capture, in place of libcamerasrc. The sensor buffers are
+// allocated once and each one is mapped once, when the camera starts. A
+// completed request is pushed into the pipeline without a copy: its planes are
+// wrapped as GstMemory, and when the last of them is freed the request is
+// queued back to the sensor. So the number of requests in flight is the
+// camera's capture_depth (see camera_config.hpp), shared between the sensor
+// and the frames held downstream. When downstream holds all of them the
+// sensor drops frames, which shows as a gap in the sequence numbers.
+//
+// The buffer PTS is the sensor timestamp (start of exposure) in running time.
+// The sensor timestamp itself is also attached as a GstReferenceTimestampMeta
+// with CAPTURE_TIMESTAMP_CAPS, and the per frame controls (exposure, gains,
+// colour temperature, frame duration) and the queue depth are kept for
+// captureStatusJson, which the control socket "capture_status" command
+// returns.
+//
+// The camera pipeline source becomes an appsrc of the same name. The sensor
+// named CAPTURE_FAKE_SENSOR is a fake camera that draws a moving pattern
+// into memfd buffers at the frame rate, with the same buffer handling, for
+// testing without a sensor.
+static const bool CAMERA_CAPTURE_ENABLED    = false;
+static const char CAPTURE_FAKE_SENSOR[]     = "fake";
+static const char CAPTURE_TIMESTAMP_CAPS[]  = "timestamp/x-masthead-sensor";
+
+// Per frame metadata from the sensor.
+struct CaptureFrameInfo {
+    bool     ok;                  // False if the frame is damaged or cancelled.
+    uint64_t sequence;            // Frame count of the sensor, gaps are dropped frames.
+    int64_t  sensor_ns;           // Start of exposure, CLOCK_MONOTONIC.
+    int32_t  exposure_us;
+    float    analogue_gain;
+    float    digital_gain;
+    int32_t  colour_temperature;  // Kelvin.
+    int64_t  frame_duration_us;
+};
+
+// Capture format. The backend fills in the stride it configured.
+struct CaptureFormat {
+    std::string pixel_format;     // "NV12" or "BGRx".
+    int         width;
+    int         height;
+    int         fps;
+    int         stride;           // Bytes per line of every plane.
+};
+
+// One plane of a sensor buffer. Planes can share a dmabuf at different offsets.
+struct CapturePlane {
+    int      fd;
+    unsigned offset;
+    unsigned length;
+};
+
+// Counters of one capture source.
+struct CaptureStatus {
+    long             frames;      // Pushed into the pipeline.
+    long             dropped;     // Skipped by the sensor or damaged.
+    int              queued;      // Requests with the sensor now.
+    int              depth;       // Requests in all.
+    CaptureFrameInfo last;        // Latest frame.
+};
+
+// Camera the capture source reads. Completions may come on any thread.
+class CaptureBackend {
+public:
+    using Completion = std::function<void(int buffer, const CaptureFrameInfo &info)>;
+    virtual ~CaptureBackend() = default;
+
+    // Configure the format with `depth` buffers. Sets the stride and the
+    // planes of each buffer. Returns 0 on success.
+    virtual int configure(CaptureFormat *format, int depth, std::vector<std::vector<CapturePlane>> *buffers) = 0;
+
+    // Start the sensor with every buffer queued.
+    virtual int start(Completion completion) = 0;
+
+    // Hand a buffer back to the sensor.
+    virtual int queue(int buffer) = 0;
+
+    virtual void stop() = 0;
+};
+
+// Public Function Prototypes
+
+// libcamera camera, by camera name as libcamerasrc camera-name.
+std::unique_ptr<CaptureBackend> makeLibcameraBackend(const std::string &camera_name);
+
+// Fake camera. Drops a frame whenever no buffer is queued, like a sensor.
+std::unique_ptr<CaptureBackend> makeFakeBackend();
+
+// Start capturing into the "<name>_source" appsrc of a camera pipeline.
+int startCapture(GstElement *pipeline, const CameraConfig &camera);
+
+// Start capturing into an appsrc from a given backend.
+int startCaptureSource(GstElement *source, std::unique_ptr<CaptureBackend> backend, const CaptureFormat &format,
+                       int depth, const char *name);
+
+// Restart the capture of a camera pipeline at another size and frame rate
+// while it plays, for docking mode (see docking_mode.hpp).
+int switchCapture(GstElement *pipeline, const CameraConfig &camera, int width, int height, int fps);
+
+// Counters of the named capture source. Returns 1 if there is none.
+int captureStatus(const char *name, CaptureStatus *status);
+
+// All capture sources as a JSON array, for the control socket.
+std::string captureStatusJson();
+
+// Stop all sensors and unmap their buffers. The pipelines must be stopped
+// first, so no frame is held.
+void stopCaptures();
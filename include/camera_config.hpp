@@ -0,0 +1,83 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+// Camera list the pipelines are built from. Read from CAMERA_CONFIG_FILE at
+// startup. Without the file the two cameras of the mast are used with the
+// settings from video.hpp. The file has one [camera] section per camera:
+//
+//   [camera]
+//   name        = forward        # Element name prefix and log label.
+//   sensor      = /base/axi/pcie@1000120000/rp1/i2c@88000/imx708@1a
+//                                # "videotestsrc" for a test pattern.
+//   width       = 1280
+//   height      = 1080
+//   fps         = 30
+//   port        = 5000           # SRT listener port.
+//   srt         = latency=20&... # SRT listener options, as SRT_DEFAULT_OPTIONS.
+//   proxy_srt   = latency=20&... # SRT options of the proxy stream, as srt if not given.
+//   capture_depth = 4            # Sensor requests in flight with native capture.
+//   overlay     = horizon        # Overlay layers, space separated.
+//   stages      =                # Processing stages, space separated.
+//   bitrate     = 8000           # Encoder profile.
+//   threads     = 4
+//   key_int_max = 30
+//   multicast   = 239.255.0.1:5004 # RTP multicast group and port, optional.
+//   multicast_ttl   = 1          # Router hops the multicast may cross.
+//   multicast_iface = eth0       # Interface it is sent on, the default route if empty.
+//
+// Layers and stages:
+//   horizon     - Pitch ladder and bridge readout, with the forward camera
+//                 processing (region of interest, undistortion, leveling,
+//                 picture in picture composite). Needs WIDTH x HEIGHT.
+//   docking     - Fender and distance guides, blended into the NV12 frames.
+//                 Also the camera docking mode speeds up (see docking_mode.hpp).
+//   denoise     - Temporal denoise.
+//   motion_watch, pip_inset - Motion watch and picture in picture inset.
+// horizon, docking and pip_inset can be given to one camera only. denoise and
+// motion_watch run per camera. Each still needs its own *_ENABLED switch.
+static const char CAMERA_CONFIG_FILE[]  = "/etc/masthead/cameras.conf";
+static const char TEST_SENSOR[]         = "videotestsrc";
+static const char SRT_DEFAULT_OPTIONS[] = "latency=20&payloadsize=1316&tlpktdrop=true&too_late_delay_ignore=true";
+static const int  CAPTURE_DEFAULT_DEPTH = 4;
+static const int  MULTICAST_DEFAULT_TTL = 1;    // Stays on the boat network.
+
+// Encoder settings of a camera stream.
+struct EncoderProfile {
+    int bitrate_kbps;
+    int threads;
+    int key_int_max;
+};
+
+// One camera.
+struct CameraConfig {
+    std::string    name;
+    std::string    sensor;          // libcamera camera name.
+    int            width;
+    int            height;
+    int            fps;
+    int            port;
+    std::string    srt;             // SRT listener options.
+    std::string    proxy_srt;       // SRT listener options of the proxy stream (see proxy.hpp).
+    int            capture_depth;   // Sensor requests in flight (see camera_capture.hpp).
+    bool           horizon;         // Overlay layers.
+    bool           docking;
+    bool           denoise;         // Processing stages.
+    bool           motion_watch;
+    bool           pip_inset;
+    EncoderProfile encoder;
+    std::string    multicast_group; // RTP multicast (see multicast.hpp), empty for none.
+    int            multicast_port;
+    int            multicast_ttl;
+    std::string    multicast_iface;
+};
+
+// Public Function Prototypes
+
+// The two cameras of the mast.
+std::vector<CameraConfig> defaultCameraConfig();
+
+// Read the camera list from a file. Falls back to defaultCameraConfig() when
+// the file does not exist or has errors, which are printed.
+std::vector<CameraConfig> loadCameraConfig(const char *path);
@@ -0,0 +1,96 @@
+#pragma once
+
+// Lens projection used to place the overlay graphics.
+//   PINHOLE - Rectilinear lens with Brown radial distortion k1, k2, k3.
+//   FISHEYE - Equidistant (Kannala-Brandt) lens with distortion k1 - k4.
+enum class LensModel { PINHOLE, FISHEYE };
+
+// Lens calibration. It is independent of the output resolution, as long as
+// the frame covers the full field of view: the focal length and principal
+// point are stored as fractions of the frame width and height.
+struct CameraCalibration {
+    LensModel model;
+    double    fx, fy;  // Focal length / frame width, focal length / frame height.
+    double    cx, cy;  // Principal point / frame width, principal point / frame height.
+    double    k[4];    // Distortion coefficients.
+};
+
+// Rotation of the camera relative to the IMU, in degrees. Pitch is positive
+// when the camera looks up, roll follows the IMU roll convention.
+struct Boresight {
+    double pitch_deg;
+    double roll_deg;
+    double yaw_deg;
+};
+
+// Forward camera (imx708) calibration. The defaults are an ideal pinhole lens
+// matching the 67 x 41 degree field of view and should be replaced by the
+// values from a checkerboard calibration.
+static const CameraCalibration FORWARD_CAMERA_CALIBRATION = {
+    LensModel::PINHOLE,
+    0.7554, 1.3373,          // 0.5 / tan(67 / 2), 0.5 / tan(41 / 2)
+    0.5,    0.5,
+    {0.0, 0.0, 0.0, 0.0}
+};
+
+// The camera is pitched up 10 degrees from the IMU.
+static const Boresight FORWARD_CAMERA_BORESIGHT = {10.0, 0.0, 0.0};
+
+// Docking camera (imx477) calibration, an ideal pinhole lens matching a
+// 90 x 80 degree field of view until it is calibrated the same way.
+static const CameraCalibration DOCKING_CAMERA_CALIBRATION = {
+    LensModel::PINHOLE,
+    0.5,    0.5959,          // 0.5 / tan(90 / 2), 0.5 / tan(80 / 2)
+    0.5,    0.5,
+    {0.0, 0.0, 0.0, 0.0}
+};
+
+// The docking camera looks straight down, with the bow at the top of the frame.
+static const Boresight DOCKING_CAMERA_BORESIGHT = {-90.0, 0.0, 0.0};
+
+// Calibration scaled to a frame, in pixels. The principal point includes the
+// offset of a crop window.
+struct CameraModel {
+    LensModel model;
+    double    fx, fy;
+    double    cx, cy;
+    double    k[4];
+    int       width, height;
+};
+
+// Rotation from the level frame (x right, y down, z forward along the boat)
+// to the camera frame (x right, y down, z along the optical axis).
+struct CameraRotation {
+    double m[3][3];
+};
+
+// Public Function Prototypes
+
+// Scale a calibration to a full field of view frame of width x height and
+// shift the principal point for a crop window whose origin is (left, top).
+CameraModel makeCameraModel(const CameraCalibration &calibration, int full_width, int full_height,
+                            int width, int height, int left, int top);
+
+// Rotation for an IMU attitude (degrees) and a camera boresight.
+CameraRotation cameraRotation(double pitch, double roll, const Boresight &boresight);
+
+// Project the direction at elevation / azimuth (degrees, level frame) to a
+// pixel. Returns false when the direction is behind the camera.
+bool projectDirection(const CameraModel &camera, const CameraRotation &rotation,
+                      double elevation, double azimuth, double *u, double *v);
+
+// Apply the lens model to the camera frame ray (x, y, z), z > 0, giving the
+// pixel it lands on.
+void lensPixel(const CameraModel &camera, double x, double y, double z, double *u, double *v);
+
+// Elevation (degrees, level frame) of the ray through pixel (u, v).
+double pixelElevation(const CameraModel &camera, const CameraRotation &rotation, double u, double v);
+
+// Camera frame ray through pixel (u, v), undoing the lens model, and the
+// elevation of such a ray. Splits pixelElevation so the ray of a fixed pixel
+// can be kept while the attitude changes.
+void   pixelRay(const CameraModel &camera, double u, double v, double ray[3]);
+double rayElevation(const CameraRotation &rotation, const double ray[3]);
+
+// Azimuth (degrees, level frame) the optical axis points at.
+double axisAzimuth(const CameraRotation &rotation);
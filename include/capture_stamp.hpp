@@ -0,0 +1,106 @@
+#pragma once
+
+#include <gst/gst.h>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+
+// Capture timestamps carried in the H.264 stream for glass to glass latency
+// measurement. Each access unit gets an SEI user data unregistered message,
+// ahead of its first slice, holding three CLOCK_REALTIME times in
+// nanoseconds (big endian): when the frame was captured, when it entered the
+// encoder and when it left it. The capture time is the buffer timestamp,
+// which libcamerasrc takes from the sensor timestamp in the libcamera request
+// metadata, carried over to the realtime clock. Players ignore the message.
+//
+// A receiver with a synchronised clock (NTP or PTP, or the same machine over
+// loopback) reads the stamps back with findCaptureStamp and can split the
+// latency into hops:
+//   processing - capture to encoder input (ISP, overlay, queues).
+//   encode     - encoder input to output.
+//   network    - encoder output to received (mux, SRT latency, network).
+//   decode     - received to decoded.
+//   end_to_end - capture to decoded, the glass to glass latency short of the display.
+// The sender exposes its own hops per camera in CAPTURE_STAMP_METRICS, as
+// Prometheus histograms for node_exporter.
+static const bool CAPTURE_STAMPS_ENABLED = false;
+static const char CAPTURE_STAMP_METRICS[] = "/var/lib/node_exporter/textfile_collector/masthead_latency.prom";
+
+static const uint8_t CAPTURE_STAMP_UUID[16] = {0x6d, 0x61, 0x73, 0x74, 0x68, 0x65, 0x61, 0x64,
+                                               0x2d, 0x63, 0x61, 0x70, 0x74, 0x75, 0x72, 0x65};  // "masthead-capture"
+static const int     CAPTURE_STAMP_NAL_MAX  = 92;  // Largest stamp NAL unit, escaped, with its start code.
+
+// Upper bounds of the latency histogram buckets.
+static const double LATENCY_BUCKETS_MS[] = {1, 2, 5, 10, 20, 35, 50, 75, 100, 150, 200, 300, 500, 1000, 2000};
+static const int    LATENCY_BUCKETS      = sizeof(LATENCY_BUCKETS_MS) / sizeof(LATENCY_BUCKETS_MS[0]);
+
+// Times of one frame, CLOCK_REALTIME nanoseconds.
+struct CaptureStamp {
+    int64_t capture_ns;
+    int64_t encoder_in_ns;
+    int64_t encoder_out_ns;
+};
+
+// Hops of the latency, as above.
+enum LatencyHop { HOP_PROCESSING, HOP_ENCODE, HOP_NETWORK, HOP_DECODE, HOP_END_TO_END, LATENCY_HOPS };
+static const char *LATENCY_HOP_NAMES[LATENCY_HOPS] = {"processing", "encode", "network", "decode", "end_to_end"};
+
+// Latency histogram. counts has one more entry for everything over the last bucket.
+struct LatencyHistogram {
+    long   counts[LATENCY_BUCKETS + 1];
+    long   count;
+    double sum_ms;
+};
+
+// Receiver side of the stamps. The stamps are read from the parsed stream and
+// matched to the decoded frames by their timestamps.
+static const int STAMP_RECEIVER_SLOTS = 64;  // Frames that can be inside the decoder at once.
+
+struct StampReceiver {
+    std::mutex       mutex;
+    GstClockTime     pts[STAMP_RECEIVER_SLOTS];
+    CaptureStamp     stamps[STAMP_RECEIVER_SLOTS];
+    int64_t          received_ns[STAMP_RECEIVER_SLOTS];
+    int              next = 0;
+    long             unstamped = 0;  // Access units without a stamp.
+    LatencyHistogram hops[LATENCY_HOPS] = {};
+};
+
+// Public Function Prototypes
+
+// CLOCK_REALTIME in nanoseconds.
+int64_t realtimeNs();
+
+// Add a sample to a histogram.
+void addLatency(LatencyHistogram *histogram, double ms);
+
+// Write a histogram in the Prometheus text format, as the series of `name`
+// with the given labels ("camera=\"forward\",hop=\"encode\""). The HELP and
+// TYPE lines are left to the caller, once per name.
+void writeLatencyHistogram(FILE *file, const char *name, const char *labels, const LatencyHistogram &histogram);
+
+// Latency below which the given part (0 to 1) of the samples fall, estimated
+// from the buckets. -1 without samples.
+double latencyQuantile(const LatencyHistogram &histogram, double part);
+
+// Build the SEI NAL unit carrying a stamp into nal, with a 4-byte start
+// code. nal must hold CAPTURE_STAMP_NAL_MAX bytes. Returns its size.
+size_t stampNal(const CaptureStamp &stamp, uint8_t *nal);
+
+// Find the capture stamp in an H.264 byte stream access unit. Returns 0 if
+// one was found.
+int findCaptureStamp(const uint8_t *data, size_t size, CaptureStamp *stamp);
+
+// Stamp every access unit of the named x264enc, and measure the processing
+// and encode hops of `camera`.
+int startCaptureStamps(GstElement *pipeline, const char *encoder_name, const char *camera);
+
+// Copy the sender hop histograms of a stamped camera, counted since it
+// started. Returns 1 if the camera is not stamped.
+int senderLatency(const char *camera, LatencyHistogram *processing, LatencyHistogram *encode);
+
+// Read the stamps of a receiving pipeline. parser_name is an h264parse with
+// byte stream access unit output, sink_name the sink of the decoded frames.
+// The receiver must outlive the pipeline.
+int attachStampReceiver(GstElement *pipeline, const char *parser_name, const char *sink_name, StampReceiver *receiver);
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <gst/gst.h>
+#include <vector>
+#include <pipeline_builder.hpp>
+
+// Control socket for changing settings while streaming, without restarting
+// the pipelines. Clients connect to the UNIX stream socket and send one JSON
+// object per line. Every line gets one JSON line back, either
+// {"ok":true,"version":N,"apply_us":T} or {"ok":false,"error":"..."}. A
+// command is checked as a whole before anything is applied, so a bad field
+// leaves every setting as it was. Each client is served on its own thread
+// and the commands run one at a time. Fields (all optional):
+//   camera1_bitrate, camera2_bitrate,
+//   ...                              - Encoder bitrate in kbps of the cameras
+//                                      in camera list order. The encoder
+//                                      starts a key frame with the change.
+//                                      With the stream profile stage this
+//                                      is the full rate, which caller
+//                                      profiles, docking mode and the
+//                                      quality governor scale down from.
+//   boresight_pitch, boresight_roll,
+//   boresight_yaw                    - Forward camera mounting angles in degrees.
+//   debug_text                       - Attitude readout on the overlay.
+//   ladder                           - Pitch ladder as [[angle, width_ratio,
+//                                      display_text], ...].
+//   trace_dump                       - true writes a trace snapshot (see
+//                                      trace.hpp). The reply gets its "trace"
+//                                      path.
+//   capture_status                   - true adds "capture", the queue depth,
+//                                      counters and latest sensor metadata
+//                                      of each native capture (see
+//                                      camera_capture.hpp).
+//   docking_mode                     - true or false switches docking mode
+//                                      (see docking_mode.hpp). The reply
+//                                      waits for the docking camera and gets
+//                                      "docking", the mode, the switch time
+//                                      and the latency per mode.
+//   attitude_filter                  - Attitude smoothing filter: "none",
+//                                      "one_euro", "complementary" or
+//                                      "kalman" (see attitude_filter.hpp).
+//   attitude_min_cutoff_hz, attitude_beta,
+//   attitude_derivative_cutoff_hz,
+//   attitude_rest_time_constant_s,
+//   attitude_motion_rate_dps,
+//   attitude_accel_noise_dps2,
+//   attitude_measurement_noise_deg   - Its tuning. Any attitude field
+//                                      restarts the filter, and the reply
+//                                      gets "attitude_filter", the settings.
+// For example: {"camera1_bitrate":4000,"boresight_pitch":9.5}
+static const bool CONTROL_ENABLED             = false;
+static const char CONTROL_SOCKET[]            = "/run/masthead/control.sock";
+static const int  CONTROL_MAX_LINE            = 4096;   // Longest accepted command.
+static const int  CONTROL_MAX_CLIENTS         = 4;      // Clients served at once.
+static const int  CONTROL_CLIENT_TIMEOUT_S    = 30;     // A quiet client is disconnected after this.
+static const int  CONTROL_ACCEPT_RETRY_MS     = 10;     // Wait after a failed accept, doubled on each
+static const int  CONTROL_ACCEPT_RETRY_MAX_MS = 1000;   // failure that follows, up to this.
+static const int  CONTROL_MIN_KBPS            = 100;    // Bitrate limits.
+static const int  CONTROL_MAX_KBPS            = 20000;
+
+// Public Function Prototypes
+
+// Start serving the control socket for the camera pipelines.
+int startControlSocket(const std::vector<CameraPipeline> &cameras);
+
+// Change the bitrate of a playing encoder as the bitrate fields do.
+void setEncoderBitrate(GstElement *encoder, int kbps);
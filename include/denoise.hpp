@@ -0,0 +1,26 @@
+#pragma once
+
+#include <gst/gst.h>
+#include <cstdint>
+
+// Temporal denoise for the downward camera. When enabled, each frame of
+// the camera is blended with the previous output frame. Pixels that barely
+// change take only DENOISE_STILL_WEIGHT / 128 of the new frame, which
+// averages the sensor noise over several frames. The weight rises linearly
+// with the difference and reaches the full new frame at DENOISE_MOTION_DIFF,
+// so moving edges do not smear. The cost is a fixed few operations per byte.
+static const bool DENOISE_ENABLED      = false;
+static const int  DENOISE_STILL_WEIGHT = 32;    // Weight of the new frame on still pixels, out of 128.
+static const int  DENOISE_MOTION_DIFF  = 48;    // Difference at which the new frame is taken as is.
+static const int  DENOISE_THREADS      = 4;     // Threads the blend is split across.
+static const int  DENOISE_RESET_MS     = 500;   // A gap in the frames longer than this drops the reference.
+
+// Public Function Prototypes
+
+// Blend `count` bytes of the current frame with the reference into out.
+// Works for the Y plane and for the interleaved UV plane alike.
+void temporalBlendRow(const uint8_t *current, const uint8_t *reference, uint8_t *out, int count);
+
+// Attach the denoise stage to the source pad of the named element. The
+// element must carry NV12 frames.
+int attachDenoise(GstElement *pipeline, const char *element_name);
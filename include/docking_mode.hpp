@@ -0,0 +1,52 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <pipeline_builder.hpp>
+
+// Docking mode, switched on and off from the control socket. Alongside a
+// dock the docking camera is all that matters, and it matters most that it is
+// current. In docking mode:
+//   - The docking camera (the one with "docking" in the camera list) captures
+//     at DOCKING_MODE_FPS, at DOCKING_MODE_SIZE_PERCENT of its size so the
+//     processing stages keep up.
+//   - Its encoder is set up for latency: a GOP of one second refreshed with a
+//     moving intra column instead of key frames, and a VBV buffer of
+//     DOCKING_MODE_VBV_MS, so no frame waits behind a large key frame.
+//     x264enc only takes these in READY, so the encoder alone is restarted
+//     with the frames feeding it held back for the restart.
+//   - Every other camera drops to DOCKING_STARVE_FPS at its capture and is
+//     streamed smaller and at a lower bitrate, handing over the CPU.
+// The sources are restarted in the new format and the stream profile stage is
+// pinned to it (see stream_profile.hpp). The muxers and SRT sinks keep
+// running, so connected callers stay connected and continue from a key frame.
+// A switch waits for the first frame of the new format to leave the docking
+// camera source, up to DOCKING_SWITCH_TIMEOUT_MS, and logs the time taken.
+//
+// With capture stamps (see capture_stamp.hpp) the sender hops of the docking
+// camera are also counted per mode, so dockingStatusJson shows the latency
+// gained: the median processing (capture to encoder) and encode hops in and
+// out of docking mode. The time of the last encoder restart is shown too.
+static const bool DOCKING_MODE_ENABLED            = false;
+static const int  DOCKING_MODE_FPS                = 60;
+static const int  DOCKING_MODE_SIZE_PERCENT       = 75;    // 960 x 810 for the 1280 x 1080 docking camera.
+static const int  DOCKING_MODE_VBV_MS             = 100;   // x264enc default is 600.
+static const int  DOCKING_STARVE_FPS              = 5;
+static const int  DOCKING_STARVE_SIZE_PERCENT     = 50;
+static const int  DOCKING_STARVE_BITRATE_PERCENT  = 25;
+static const int  DOCKING_SWITCH_TIMEOUT_MS       = 1000;
+
+// Public Function Prototypes
+
+// Find the docking camera and get ready to switch. The camera handles must
+// outlive docking mode. Returns 1 if there is no docking camera.
+int startDockingMode(const std::vector<CameraPipeline> &cameras);
+
+// Switch docking mode on or off. Waits for the docking camera to deliver the
+// new format and sets switch_ms to the time it took, -1 if it did not within
+// DOCKING_SWITCH_TIMEOUT_MS. Returns 1 if a camera could not be switched.
+int setDockingMode(bool on, double *switch_ms);
+
+// Docking mode state and the latency of the docking camera per mode, as a
+// JSON object for the control socket.
+std::string dockingStatusJson();
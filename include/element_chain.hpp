@@ -0,0 +1,41 @@
+#pragma once
+
+#include <gst/gst.h>
+#include <string>
+#include <vector>
+
+// Element construction shared by the camera pipelines (pipeline_builder.hpp)
+// and their branches (proxy.hpp, multicast.hpp, stream_profile.hpp). A chain
+// is a list of elements made here, added to the pipeline and linked in order.
+// An element that is not installed is made as NULL and reported, and fails
+// the chain it is in. Elements made for a failed chain still go into the bin,
+// so they are freed with the pipeline.
+
+// Public Function Prototypes
+
+// Make an element. An empty name lets GStreamer name it.
+GstElement *makeElement(const char *factory, const std::string &name);
+
+// Capsfilter with caps given in their string form, such as "video/x-raw,format=NV12".
+GstElement *makeCapsFilter(const std::string &name, const std::string &caps);
+
+// Valve, closed until a client or a preroll opens it (see stream_gate.hpp).
+GstElement *makeValve(const std::string &name);
+
+// One buffer leaky queue, putting what follows on its own thread.
+GstElement *makeQueue();
+
+// Low latency x264enc as all the streams use it.
+GstElement *makeX264Encoder(const std::string &name, int bitrate_kbps, int threads, int key_int_max);
+
+// MPEG-TS muxer for the iPad video players.
+GstElement *makeTsMux();
+
+// SRT listener on port, with the SRT listener options of cameras.conf. Waits
+// for a caller before the stream starts.
+GstElement *makeSrtSink(const std::string &name, int port, const std::string &srt);
+
+// Add the elements of a chain to the bin and link them in order, after
+// upstream if it is not NULL. A tee as upstream gets a new source pad.
+// Returns false if an element is missing or a link fails.
+bool addChain(GstBin *bin, GstElement *upstream, const std::vector<GstElement *> &chain);
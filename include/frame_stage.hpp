@@ -0,0 +1,50 @@
+#pragma once
+
+#include <gst/gst.h>
+#include <gst/video/video.h>
+#include <warp.hpp>
+
+// Plumbing shared by the NV12 pixel stages that write each frame into a new
+// buffer (stabilize.hpp, undistort.hpp, denoise.hpp, pip.hpp). A stage is a
+// buffer probe on the source pad of an identity. The output buffers come
+// from a pool of FRAME_STAGE_POOL_SIZE preallocated from the negotiated
+// caps with the first frame, so nothing is allocated per frame. A caps
+// event drops the pool, and the next frame sets it up again at the new size
+// (see docking_mode.hpp).
+static const int FRAME_STAGE_POOL_SIZE = 2;
+
+// Output pool of one stage of one camera.
+struct FrameStage {
+    const char    *name;                   // Stage name for the error messages.
+    GstBufferPool *buffer_pool = NULL;     // NULL until the caps are known.
+    GstVideoInfo   info;
+};
+
+// Pixel work of a stage: fill dst from src. context is the stage state.
+typedef void (*FrameStageWork)(const Nv12Frame &src, const Nv12Frame &dst, void *context);
+
+// Public Function Prototypes
+
+// View of a mapped NV12 video frame.
+Nv12Frame nv12View(GstVideoFrame *frame);
+
+// Copy the planes of src into dst, a frame of the same size.
+void copyNv12Frame(const Nv12Frame &src, const Nv12Frame &dst);
+
+// Set up the output pool from the current caps of the pad. Returns false,
+// leaving the stage idle, if there are no caps yet or they are not NV12.
+bool setupFrameStage(FrameStage *stage, GstPad *pad);
+
+// Drop the output pool. Frames still downstream are freed as they return.
+void releaseFrameStage(FrameStage *stage);
+
+// Run the pixel work from the probed buffer into a buffer from the pool and
+// hand that downstream instead. The probed frame passes unchanged if the
+// stage is not set up or a frame cannot be mapped.
+void runFrameStage(FrameStage *stage, GstPadProbeInfo *info, FrameStageWork work, void *context);
+
+// Add the caps probe and the frame probe of a stage to the source pad of the
+// named element. destroy frees user_data with the frame probe. Returns 1 if
+// the element was not found, and destroy is not called.
+int attachFrameStage(GstElement *pipeline, const char *element_name, FrameStage *stage,
+                     GstPadProbeCallback on_frame, gpointer user_data, GDestroyNotify destroy);
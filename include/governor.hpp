@@ -0,0 +1,83 @@
+#pragma once
+
+#include <vector>
+#include <pipeline_builder.hpp>
+#include <stream_profile.hpp>
+
+// Quality governor for a hot or overloaded Pi. Once a second it reads the
+// SoC temperature, whether the CPU is throttled and the measured encoder
+// latency. When the SoC gets close to its throttling point, is already
+// throttled, or the encoders fall behind the frame interval, the streams step
+// one level down GOVERNOR_LADDER. They step back up one level at a time once
+// everything has stayed calm for GOVERNOR_UP_HOLD_S. The stream profile
+// stage does the work, so each step starts with a key frame and no pipeline
+// is restarted. Every step is logged, and the state is written to
+// GOVERNOR_PATHS.metrics in the Prometheus text format for node_exporter.
+//
+// Throttling is read from the firmware flags of the Pi. Where there are none
+// it is a CPU clock limit (scaling_max_freq, which the thermal cpufreq
+// cooling lowers) below GOVERNOR_THROTTLED_RATIO of the maximum. The current
+// clock is not used, since the ondemand and schedutil cpufreq governors
+// clock an idle CPU down with no throttling at all.
+static const bool     GOVERNOR_ENABLED           = false;
+static const double   GOVERNOR_HOT_C             = 75.0;  // Step down at this SoC temperature. The Pi throttles at 80.
+static const double   GOVERNOR_COOL_C            = 68.0;  // Stepping up needs the SoC below this.
+static const unsigned GOVERNOR_THROTTLED_FLAGS   = 0xE;   // Firmware flags: clock capped, throttled, soft temperature limit.
+static const double   GOVERNOR_THROTTLED_RATIO   = 0.9;   // CPU clock limit below this part of its maximum counts as throttled.
+static const double   GOVERNOR_LATENCY_BUDGET    = 0.8;   // Encoder latency limit as a part of the frame interval.
+static const int      GOVERNOR_DOWN_HOLD_S       = 5;     // Least time between steps down, for a step to take effect.
+static const int      GOVERNOR_UP_HOLD_S         = 30;    // Calm time needed before a step up.
+
+// Files the governor reads and writes. Tests can point these at fake files.
+struct GovernorPaths {
+    const char *temperature;     // Millidegrees Celsius.
+    const char *throttled;       // Firmware throttle flags in hex, the same as vcgencmd get_throttled.
+    const char *cpu_limit_freq;  // CPU clock limit in kHz.
+    const char *cpu_max_freq;    // Maximum CPU clock in kHz.
+    const char *metrics;         // Prometheus text file. NULL for none.
+};
+
+static const GovernorPaths GOVERNOR_PATHS = {"/sys/class/thermal/thermal_zone0/temp",
+                                             "/sys/devices/platform/soc/soc:firmware/get_throttled",
+                                             "/sys/devices/system/cpu/cpu0/cpufreq/scaling_max_freq",
+                                             "/sys/devices/system/cpu/cpu0/cpufreq/cpuinfo_max_freq",
+                                             "/var/lib/node_exporter/textfile_collector/masthead.prom"};
+
+// Quality levels, best first. Frame rate goes first since it saves the most
+// encoder time (and so heat) for the least loss in a docking or bridge view.
+// The bitrate follows the frame rate down, a little slower, so each frame
+// gets a few more bits. Size is only cut once the frame rate is at its
+// floor. Each level is named after everything it changes from the full
+// stream.
+struct GovernorLevel {
+    const char  *name;
+    ProfileLimit limit;
+};
+
+static const GovernorLevel GOVERNOR_LADDER[] = {{"full",                          {1000, 100, 100}},
+                                                {"20 fps, bitrate 75%",           {  20, 100,  75}},
+                                                {"15 fps, bitrate 60%",           {  15, 100,  60}},
+                                                {"10 fps, bitrate 50%",           {  10, 100,  50}},
+                                                {"10 fps, 75% size, bitrate 40%", {  10,  75,  40}},
+                                                {"10 fps, 50% size, bitrate 25%", {  10,  50,  25}}};
+static const int GOVERNOR_LEVELS = sizeof(GOVERNOR_LADDER) / sizeof(GOVERNOR_LADDER[0]);
+
+// One reading of the governor inputs.
+struct GovernorReading {
+    double temperature_c;    // Negative when unknown.
+    bool   throttled;        // The CPU is clocked down. false when unknown.
+    double latency_ratio;    // Worst encoder latency over its frame interval, 0 when idle.
+};
+
+// Public Function Prototypes
+
+// Read the temperature and throttling from the files of `paths`. The
+// latency is left at 0.
+GovernorReading readGovernorSensors(const GovernorPaths &paths);
+
+// Level to go to from `level` after a reading. calm_s is the time everything
+// has been calm for and since_step_s the time since the last step.
+int nextGovernorLevel(int level, const GovernorReading &reading, double calm_s, double since_step_s);
+
+// Measure the encoder latency of the cameras and start the governor.
+int startGovernor(const std::vector<CameraPipeline> &cameras, const GovernorPaths &paths);
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <camera_model.hpp>
+#include <overlay_config.hpp>
+
+// Pitch ladder geometry. Each ladder line is a line of constant elevation
+// projected through the camera model, so it follows the lens projection
+// across the whole frame. The projected points are memoized per quantized
+// attitude and overlay settings snapshot in a small LRU cache.
+static const int    LADDER_LINE_POINTS = 9;     // Points per ladder polyline.
+static const double LADDER_QUANTUM_DEG = 0.02;  // Attitude step the cache is keyed on.
+static const int    LADDER_CACHE_SIZE  = 16;    // Number of cached attitudes.
+
+// Label directions are rounded to this step. Cairo keeps a scaled font per
+// text rotation, so a small set of directions keeps the labels drawing from
+// its cache instead of building fonts every frame.
+static const double LADDER_LABEL_QUANTUM_DEG = 0.5;
+
+// Label text of every whole ladder angle, built at compile time so drawing
+// the labels needs no string formatting.
+static const int LADDER_LABEL_MAX_ANGLE = 90;
+static const int LADDER_LABEL_COUNT     = 2 * LADDER_LABEL_MAX_ANGLE + 1;
+static const int LADDER_LABEL_LENGTH    = 4;    // Longest label is "-90".
+
+struct LadderLabels {
+    char text[LADDER_LABEL_COUNT][LADDER_LABEL_LENGTH + 1];
+};
+
+constexpr LadderLabels makeLadderLabels() {
+    LadderLabels labels = {};
+    for (int i = 0; i < LADDER_LABEL_COUNT; i++) {
+        int   angle     = i - LADDER_LABEL_MAX_ANGLE;
+        int   magnitude = angle < 0 ? -angle : angle;
+        char *text      = labels.text[i];
+        int   length    = 0;
+        if (angle < 0)        text[length++] = '-';
+        if (magnitude >= 10)  text[length++] = '0' + magnitude / 10;
+        text[length++] = '0' + magnitude % 10;
+        text[length]   = '\0';
+    }
+    return labels;
+}
+
+static constexpr LadderLabels LADDER_LABELS = makeLadderLabels();
+static_assert(LADDER_LABELS.text[0][0] == '-' && LADDER_LABELS.text[0][1] == '9' && LADDER_LABELS.text[0][2] == '0');
+static_assert(LADDER_LABELS.text[LADDER_LABEL_MAX_ANGLE][0] == '0' && LADDER_LABELS.text[LADDER_LABEL_MAX_ANGLE][1] == '\0');
+
+// Index into LADDER_LABELS of a ladder angle, clamped to +/- LADDER_LABEL_MAX_ANGLE.
+constexpr int ladderLabelIndex(int angle) {
+    return (angle < -LADDER_LABEL_MAX_ANGLE ? -LADDER_LABEL_MAX_ANGLE :
+            angle >  LADDER_LABEL_MAX_ANGLE ?  LADDER_LABEL_MAX_ANGLE : angle) + LADDER_LABEL_MAX_ANGLE;
+}
+
+// One projected ladder line.
+struct LadderLine {
+    int    points;                  // Number of valid points. Below 2 the line is not visible.
+    double x[LADDER_LINE_POINTS];
+    double y[LADDER_LINE_POINTS];
+    double label_angle;             // Screen direction at the right end, for the label. Quantized.
+};
+
+// All ladder lines for one attitude, in the order of the overlay settings.
+struct LadderGeometry {
+    int        line_count;
+    LadderLine lines[OVERLAY_MAX_LINES];
+};
+
+// Public Function Prototypes
+
+// Get the ladder geometry for an attitude and overlay settings snapshot. The
+// result stays valid until the next call.
+const LadderGeometry &ladderGeometry(const CameraModel &camera, const OverlayConfig &config,
+                                     double pitch, double roll);
+
+// Project the line of constant elevation that spans +/- half_span degrees of
+// azimuth around the optical axis. Returns the number of points written.
+int elevationPolyline(const CameraModel &camera, const CameraRotation &rotation, double elevation,
+                      double half_span, double *x, double *y, int max_points);
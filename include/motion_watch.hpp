@@ -0,0 +1,48 @@
+#pragma once
+
+#include <gst/gst.h>
+#include <cstdint>
+#include <vector>
+
+// Motion watch for the downward camera. Runs ahead of the stream valve so it
+// keeps watching while nobody is connected. A heavily downscaled luma sample
+// of every Nth frame is compared to a slowly learned background. Motion start
+// and end are posted as "motion-watch" element messages on the pipeline bus,
+// which the bus loop of video.cpp logs, and sent as a datagram to
+// MOTION_WATCH_SOCKET when something listens there.
+static const bool  MOTION_WATCH_ENABLED     = false;
+static const int   MOTION_WATCH_SCALE       = 16;     // Luma is downscaled by this factor in each direction.
+static const int   MOTION_WATCH_INTERVAL    = 10;     // Check every Nth frame (3 Hz at 30 fps).
+static const int   MOTION_WATCH_THRESHOLD   = 20;     // Luma change that counts as motion.
+static const float MOTION_WATCH_MIN_AREA    = 0.01;   // Fraction of the sample that must change.
+static const int   MOTION_WATCH_CONFIRM     = 2;      // Checks in a row with motion before an event starts.
+static const int   MOTION_WATCH_HOLD_S      = 10;     // Seconds without motion before the event ends.
+static const int   MOTION_WATCH_LEARN_SHIFT = 4;      // Background learns 1/2^N of each new sample.
+static const char  MOTION_WATCH_SOCKET[]    = "/run/masthead/motion.sock";
+
+// Background model and event state of one camera, kept apart from GStreamer.
+struct MotionState {
+    std::vector<uint8_t> sample;               // Downscaled luma of the last check.
+    std::vector<int16_t> background;           // 8.7 fixed point.
+    bool                 learned       = false;
+    int                  motion_checks = 0;    // Checks in a row with motion.
+    bool                 active        = false;
+    double               last_motion_s = 0.0;
+};
+
+// Public Function Prototypes
+
+// Check one luma plane for motion. now_s is a steady time in seconds. Returns
+// 1 when an event starts, -1 when it ends and 0 otherwise, with the fraction
+// of the sample that changed. The first plane, and the first after the state
+// is cleared, only becomes the background.
+int checkMotion(MotionState *state, const uint8_t *luma, int stride, int width, int height, double now_s,
+                double *changed);
+
+// Start watching the frames arriving at the sink pad of the named element.
+// The element must carry NV12 frames. camera_name labels the events.
+int startMotionWatch(GstElement *pipeline, const char *element_name, const char *camera_name);
+
+// Log a "motion-watch" element message from a pipeline bus. Returns false for
+// any other message.
+bool handleMotionMessage(GstMessage *message);
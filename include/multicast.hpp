@@ -0,0 +1,54 @@
+#pragma once
+
+#include <gst/gst.h>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <camera_config.hpp>
+
+// RTP multicast output. Every extra SRT viewer costs the Pi its own session,
+// send buffer and retransmissions. A camera with a multicast group in its
+// configuration also sends its main encode, as RTP over UDP, to that group,
+// so any number of viewers on the boat network cost one send. The encoded
+// stream is teed after the encoder, so there is still one encode:
+//   - The multicast branch has no clients to gate on, so it holds the valves
+//     of the camera open and the camera is encoded all the time.
+//   - Viewers joining late wait for the next key frame. The encoder of a
+//     multicast camera makes one at least every MULTICAST_KEY_INTERVAL_S.
+//     Docking mode refreshes with an intra column instead (see
+//     docking_mode.hpp), which a late joiner can start from as well. Either
+//     way the payloader repeats the SPS and PPS at the same interval.
+//   - Each stream is announced on the LAN with SAP (RFC 2974), carrying the
+//     SDP a player such as VLC needs to open it, every MULTICAST_SAP_INTERVAL_S.
+//     The announcements go out with the TTL and on the interface of the
+//     stream, and are withdrawn when streaming stops.
+static const bool MULTICAST_ENABLED          = false;
+static const int  MULTICAST_PAYLOAD_TYPE     = 96;
+static const int  MULTICAST_MTU              = 1400;   // RTP packet size, below the Ethernet MTU.
+static const int  MULTICAST_KEY_INTERVAL_S   = 1;
+static const int  MULTICAST_SAP_INTERVAL_S   = 5;
+static const char MULTICAST_SAP_GROUP[]      = "224.2.127.254";
+static const int  MULTICAST_SAP_PORT         = 9875;
+
+// Public Function Prototypes
+
+// Elements of a multicast branch, to link after a tee of encoded frames (see
+// element_chain.hpp). Its udpsink is called <camera>_multicast_sink.
+std::vector<GstElement *> multicastBranch(const CameraConfig &camera);
+
+// SDP describing the multicast stream of a camera. The origin is the IPv4
+// address the stream is sent from.
+std::string multicastSdp(const CameraConfig &camera, const char *origin, uint32_t session_id);
+
+// SAP packet announcing an SDP from an origin, or withdrawing it when
+// deletion is set.
+std::vector<uint8_t> sapPacket(const std::string &sdp, const char *origin, bool deletion);
+
+// IPv4 address of the named interface, or of the first interface other than
+// loopback when the name is empty. Returns false if there is none.
+bool interfaceAddress(const std::string &iface, std::string *address);
+
+// Announce the multicast streams of the cameras with SAP until
+// stopMulticastAnnouncer, which withdraws them.
+int  startMulticastAnnouncer(const std::vector<CameraConfig> &cameras);
+void stopMulticastAnnouncer();
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <memory>
+#include <camera_model.hpp>
+#include <video.hpp>
+
+// Overlay settings that can be changed while streaming. Readers take the
+// current snapshot once per frame and keep using it for that frame. A change
+// is published as a whole new snapshot, so a frame never sees half of one.
+// Old snapshots are freed once the last reader drops them.
+static const int OVERLAY_MAX_LINES = 24;  // Most ladder lines a snapshot can hold.
+
+struct OverlayConfig {
+    unsigned          version;                    // Changes with every published snapshot.
+    int               line_count;
+    AngleLineSettings lines[OVERLAY_MAX_LINES];   // Pitch ladder, as ANGLE_LINE_SETTINGS.
+    Boresight         boresight;                  // Forward camera to IMU rotation.
+    bool              debug_text;                 // Attitude readout at the bottom left.
+};
+
+// Public Function Prototypes
+
+// Get the current snapshot. Starts out as the compiled in settings.
+std::shared_ptr<const OverlayConfig> overlayConfig();
+
+// Publish a new snapshot. Its version is assigned here.
+void publishOverlayConfig(const OverlayConfig &config);
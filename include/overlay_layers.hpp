@@ -0,0 +1,87 @@
+#pragma once
+
+#include <gst/gst.h>
+#include <cairo.h>
+#include <cstdint>
+#include <camera_model.hpp>
+
+// Overlay engine. An overlay is a stack of layers, each drawn into its own
+// transparent surface and kept there until its trigger says it is stale:
+//   ATTITUDE - The quantized attitude (LADDER_QUANTUM_DEG), the crop window
+//              or the overlay settings changed.
+//   TIMER    - Its period rolled over, or the overlay settings changed.
+//   CONFIG   - The overlay settings or the frame size changed.
+//   FRAME    - Drawn again for every frame.
+// A layer records the 16 x 16 tiles it drew into. Each frame its cached
+// pixels are composited onto the video only inside those tiles, skipping the
+// transparent ones, and a stale layer only clears the tiles of its last
+// drawing. A layer that is not stale costs a key comparison and a blend of
+// the pixels it covers, so static layers cost next to nothing per frame.
+//
+// Either kind of camera pipeline can attach an engine. On a cairooverlay
+// (BGRx, the horizon camera) the layers are painted from its draw signal.
+// On any other element the layers are blended straight into the NV12 frames
+// at its source pad, so the camera needs no format conversion.
+static const bool OVERLAY_DOCKING_ENABLED     = false;  // Overlay on the docking camera (see camera_config.hpp).
+static const int  OVERLAY_TELEMETRY_PERIOD_MS = 200;    // Refresh of the attitude readout.
+static const int  OVERLAY_BADGE_PERIOD_MS     = 1000;   // Refresh of the status badges.
+
+// Docking guides, drawn on the water plane below the docking camera. The
+// camera is taken to be on the centerline, DOCKING_CAMERA_HEIGHT_M above the
+// waterline. The fender lines mark the hull sides and the distance lines run
+// parallel to them, outboard by each of DOCKING_GUIDE_DISTANCES_M.
+static const double DOCKING_CAMERA_HEIGHT_M     = 12.0;
+static const double DOCKING_HALF_BEAM_M         = 2.1;
+static const double DOCKING_GUIDE_LENGTH_M      = 6.0;   // Fore and aft of the camera.
+static const double DOCKING_GUIDE_DISTANCES_M[] = {0.5, 1.0, 2.0};
+
+// Layers. An engine draws the layers of its mask in this order.
+enum OverlayLayer : unsigned {
+    OVERLAY_LAYER_LADDER    = 1 << 0,  // Pitch ladder. ATTITUDE.
+    OVERLAY_LAYER_DOCKING   = 1 << 1,  // Fender and distance guides. CONFIG.
+    OVERLAY_LAYER_TELEMETRY = 1 << 2,  // Attitude readout, when debug_text is set. TIMER.
+    OVERLAY_LAYER_BADGES    = 1 << 3,  // Camera name and clock. TIMER.
+    OVERLAY_LAYER_BRIDGE    = 1 << 4,  // Bridge line and go/no-go readout. FRAME.
+};
+
+static const unsigned HORIZON_OVERLAY_LAYERS = OVERLAY_LAYER_LADDER | OVERLAY_LAYER_TELEMETRY |
+                                               OVERLAY_LAYER_BADGES | OVERLAY_LAYER_BRIDGE;
+static const unsigned DOCKING_OVERLAY_LAYERS = OVERLAY_LAYER_DOCKING | OVERLAY_LAYER_BADGES;
+
+// Camera model of the frames an engine draws on, for a frame size.
+using OverlayCameraModel = CameraModel (*)(int width, int height);
+
+// What one frame is drawn for.
+struct OverlayFrame {
+    double  pitch, roll, yaw;  // IMU attitude, degrees.
+    int64_t now_ms;            // Wall clock, milliseconds since the epoch.
+    int     width, height;
+};
+
+struct OverlayEngine;
+struct BridgeDetector;
+
+// Public Function Prototypes
+
+// Make an engine for the layers of a mask. The name is shown on the badges.
+// The bridge layer draws the readout of bridge, and nothing when it is NULL.
+OverlayEngine *makeOverlayEngine(const char *name, unsigned layers, OverlayCameraModel camera,
+                                 BridgeDetector *bridge);
+
+void freeOverlayEngine(OverlayEngine *engine);
+
+// Bring the stale layers up to date and composite all of them onto a frame
+// drawn with Cairo.
+void drawOverlayLayers(OverlayEngine *engine, cairo_t *cr, const OverlayFrame &frame);
+
+// Same, blended into the planes of an NV12 frame.
+void blendOverlayLayers(OverlayEngine *engine, uint8_t *luma, int luma_stride, uint8_t *chroma, int chroma_stride,
+                        const OverlayFrame &frame);
+
+// Attach an engine to the named element, drawn with the IMU attitude of each
+// frame. A cairooverlay is drawn on, any other element must carry NV12.
+int attachOverlay(GstElement *pipeline, const char *element_name, const char *name, unsigned layers,
+                  OverlayCameraModel camera, BridgeDetector *bridge);
+
+// Camera model of the docking camera for a full field of view frame.
+CameraModel dockingCameraModel(int width, int height);
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <gst/gst.h>
+#include <cstdint>
+
+// Picture in picture composite. When enabled, the forward camera frames are
+// teed after all the forward processing into a second encode that shows the
+// docking camera at half size as well. It is served on its own SRT port, so
+// docking needs one connection and one encode instead of switching between
+// ports 5000 and 5001.
+//   CORNER       - The docking camera is inset into a corner of the forward view.
+//   SIDE_BY_SIDE - Both cameras at half size next to each other.
+enum class PipLayout { CORNER, SIDE_BY_SIDE };
+
+static const bool      PIP_ENABLED       = false;
+static const int       PIP_PORT          = 5002;
+static const PipLayout PIP_LAYOUT        = PipLayout::CORNER;
+static const int       PIP_INSET_MARGIN  = 16;   // Gap between the inset and the frame edge. Must be even.
+static const int       PIP_INSET_OPACITY = 128;  // Opacity of the inset, out of 128.
+
+// Inset camera of a composite, shared between its pipeline and the composite one.
+struct PipInset;
+
+// Public Function Prototypes
+
+// Downscale two rows of an 8 bit plane by 2 in each direction (2x2 average).
+void halveRowY(const uint8_t *row0, const uint8_t *row1, uint8_t *out, int out_width);
+
+// Same as halveRowY for an interleaved UV plane. out_width is in UV samples.
+void halveRowUV(const uint8_t *row0, const uint8_t *row1, uint8_t *out, int out_width);
+
+// Blend `count` bytes of src over dst with opacity / 128.
+void blendRow(uint8_t *dst, const uint8_t *src, int opacity, int count);
+
+// Keep a half size copy of the docking camera frames arriving at the sink pad
+// of the named element, while the composite is being watched. Returns NULL if
+// the element was not found.
+PipInset *startPipInset(GstElement *pipeline, const char *element_name);
+
+// Composite the forward camera frames leaving the source pad of the named
+// element with the latest frame of an inset camera.
+int attachPipCompositor(GstElement *pipeline, const char *element_name, PipInset *inset);
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <gst/gst.h>
+#include <string>
+#include <vector>
+#include <camera_config.hpp>
+
+// Builds one pipeline per camera of the camera list. All cameras share the
+// same chain: source, stream valve, processing stages, optional tee, encoder
+// and SRT sink, with the optional picture in picture and proxy branches.
+// Each pipeline is built element by element (see element_chain.hpp). Elements
+// are named after the camera ("<name>_encoder", "<name>_sink", ...) and the
+// ones worth tuning are kept as handles.
+//
+// The pipelines are built and started on one thread per camera, so a slow
+// sensor does not hold up the others. At startup each camera's main encode is
+// run until its first encoded frame, which is dropped, so caps negotiation and
+// encoder setup are done before the first client connects. Build time is
+// logged per camera, and so are the startup phases up to the first encoded
+// frame (see startup.hpp).
+
+// Handles of one camera pipeline. Elements the camera does not have are NULL.
+// The handles hold a reference until stopCameraPipelines.
+struct CameraPipeline {
+    CameraConfig config;
+    int          index;          // Position in the camera list.
+    GstElement  *pipeline;
+    GstElement  *source;         // libcamerasrc, or the appsrc of native capture.
+    GstElement  *capture_caps;   // Format asked of the source.
+    GstElement  *stream_valve;   // Gates all processing of the camera.
+    GstElement  *overlay;        // cairooverlay of the horizon camera.
+    GstElement  *tee;            // Splits the processed frames between encodes.
+    GstElement  *encoder_valve;  // Gates the main encode behind the tee.
+    GstElement  *encoder;
+    GstElement  *sink;
+    GstElement  *pip_sink;
+    GstElement  *proxy_sink;
+    double       build_ms;       // Time taken to build the pipeline.
+};
+
+// Public Function Prototypes
+
+// Load the plugins of all elements the pipelines use. Call after gst_init;
+// runs on its own threads so it can overlap other startup work.
+void preloadPlugins();
+
+// Element name of a camera pipeline element, "<camera name>_<element>".
+std::string cameraElement(const CameraPipeline &camera, const char *element);
+
+// Build the pipelines of all cameras in parallel. Returns 1 if any fails, in
+// which case none are kept.
+int buildCameraPipelines(const std::vector<CameraConfig> &cameras, std::vector<CameraPipeline> *pipelines);
+
+// Set all pipelines playing in parallel and preroll their main encodes. The
+// stream gates must be set up first.
+int startCameraPipelines(std::vector<CameraPipeline> &pipelines);
+
+// Stop the pipelines and drop the handles.
+void stopCameraPipelines(std::vector<CameraPipeline> &pipelines);
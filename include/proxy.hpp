@@ -0,0 +1,26 @@
+#pragma once
+
+#include <gst/gst.h>
+#include <string>
+#include <vector>
+
+// Low resolution proxy streams for weak links. When enabled, each camera is
+// teed after all its processing into a second, small encode served on its
+// own SRT port. The frames are dropped to PROXY_FPS before they are scaled,
+// so the scaler and the encoder only see the frames that are sent. The proxy
+// encoder is gated on its own clients like the full streams, and is served
+// with the proxy_srt options of the camera in cameras.conf.
+static const bool PROXY_ENABLED      = false;
+static const int  PROXY_SCALE        = 2;     // Full resolution is divided by this in each direction.
+static const int  PROXY_FPS          = 10;
+static const int  PROXY_BITRATE_KBPS = 800;
+static const int  PROXY_THREADS      = 1;     // Encoder threads. Bounds the proxy to one core.
+static const int  PROXY_PORT         = 5010;  // First camera. Each further camera is served on the next port.
+
+// Public Function Prototypes
+
+// Elements of a proxy branch, to link after a tee (see element_chain.hpp).
+// The branch starts with a valve called valve_name and ends with an srtsink
+// called sink_name listening on port with the SRT listener options srt.
+std::vector<GstElement *> proxyBranch(const std::string &valve_name, const std::string &sink_name,
+                                      int width, int height, int port, const std::string &srt);
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <gst/gst.h>
+
+// High resolution region of interest for camera 1. The sensor is read at
+// ROI_SENSOR_WIDTH x ROI_SENSOR_HEIGHT and a WIDTH x HEIGHT window centered on
+// the predicted horizon band is cropped out of it. The encoder still sees
+// WIDTH x HEIGHT, so its cost does not change, while every degree covers more
+// pixels. The window follows a slowly filtered pitch and only moves once the
+// target is more than ROI_CROP_HYSTERESIS_PX away, so it does not chase swells.
+static const bool  ROI_CROP_ENABLED         = false;
+static const int   ROI_SENSOR_WIDTH         = 2304, ROI_SENSOR_HEIGHT = 1296;  // Full sensor field of view.
+static const float ROI_CROP_TARGET_DEG      = 3.0;   // Elevation kept at the center of the window.
+static const float ROI_CROP_TIME_CONSTANT_S = 2.0;   // Time constant of the pitch filter driving the window.
+static const int   ROI_CROP_HYSTERESIS_PX   = 48;    // Target change needed before the window moves.
+
+// Public Function Prototypes
+
+// Start driving the named videocrop element from the attitude.
+int startRoiCrop(GstElement *pipeline, const char *element_name);
+
+// Get the top left corner of the current crop window in sensor pixels.
+void getRoiOrigin(int *left, int *top);
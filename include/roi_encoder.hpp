@@ -0,0 +1,59 @@
+#pragma once
+
+#include <gst/gst.h>
+#include <vector>
+#include <camera_model.hpp>
+
+// H.264 encoder element with a quality boost on the horizon band of the
+// forward camera. x264enc spends its bits evenly over the frame, sky and
+// water included. This element wraps libx264 directly and hands it a
+// quantizer offset per macroblock with every frame: ROI_BAND_QP_OFFSET in the
+// band from ROI_BAND_BELOW_DEG below the horizon to ROI_BAND_ABOVE_DEG above
+// it (the pitch ladder and the bridge underside), ROI_OUTSIDE_QP_OFFSET
+// elsewhere, with a ramp between them so there is no seam. The rate control
+// keeps the bitrate, so the band gets the bits the rest of the frame gives up.
+//
+// The band follows the attitude through the camera model. The lens model is
+// inverted once per macroblock when the frame size or the region of interest
+// crop changes. After that an attitude change costs one dot product per
+// macroblock, and the map is only remade once the attitude has moved by
+// ROI_MAP_STEP_DEG.
+//
+// Properties, as x264enc where they overlap: bitrate (kbps, can be changed
+// while playing), threads, key-int-max, plus roi (apply the map),
+// follow-attitude and pitch / roll (the attitude used when not following).
+// Upstream force key unit events start an IDR frame.
+static const bool   ROI_ENCODER_ENABLED   = false;
+static const char   ROI_ENCODER_NAME[]    = "mastheadroienc";
+static const double ROI_BAND_BELOW_DEG    = 4.0;    // Water kept sharp below the horizon.
+static const double ROI_BAND_ABOVE_DEG    = 16.0;   // Ladder and bridge underside above it.
+static const double ROI_BAND_RAMP_DEG     = 2.0;    // Blend from the band to the rest.
+static const float  ROI_BAND_QP_OFFSET    = -4.0f;
+static const float  ROI_OUTSIDE_QP_OFFSET = 3.0f;
+static const double ROI_MAP_STEP_DEG      = 0.25;   // Attitude change that remakes the map.
+static const float  ROI_AQ_STRENGTH       = 0.5f;   // x264 only takes offsets with adaptive quantization on.
+
+// Quantizer offsets per 16 x 16 macroblock, row by row, as libx264 takes them.
+struct RoiQpMap {
+    int                 mb_width  = 0;
+    int                 mb_height = 0;
+    double              cx = 0.0, cy = 0.0;   // Principal point the rays were made for.
+    std::vector<double> rays;                  // Camera frame ray through each macroblock center.
+    std::vector<float>  offsets;
+    bool                valid = false;
+    double              pitch = 0.0, roll = 0.0;
+    Boresight           boresight = {};
+};
+
+// Public Function Prototypes
+
+// Register the element. Call after gst_init, before the pipelines are built.
+int registerRoiEncoder();
+
+// Quantizer offset of a macroblock at an elevation in degrees.
+float roiQpOffset(double elevation);
+
+// Bring the map up to date for a frame of width x height through the camera
+// model at an attitude. Returns true if the offsets changed.
+bool updateRoiQpMap(RoiQpMap *map, const CameraModel &camera, int width, int height,
+                    double pitch, double roll, const Boresight &boresight);
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <gst/gst.h>
+
+// Horizon leveling. When enabled, each frame of pipeline 1 is rotated by the
+// smoothed IMU roll after the overlay has been drawn, so the picture and the
+// pitch ladder are leveled together. The frame is zoomed by a fixed amount so
+// the rotated corners are always cropped off.
+static const bool  STABILIZE_HORIZON         = false;
+static const float STABILIZE_MAX_ROLL_DEG    = 15.0;  // Largest roll that is corrected. Sets the crop zoom.
+static const float STABILIZE_TIME_CONSTANT_S = 0.15;  // Time constant of the roll smoothing filter.
+static const int   STABILIZE_THREADS         = 4;     // Threads the warp is split across.
+
+// Public Function Prototypes
+
+// Attach the horizon leveling stage to the source pad of the named element.
+// The element must carry NV12 frames.
+int attachStabilizer(GstElement *pipeline, const char *element_name);
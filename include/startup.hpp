@@ -0,0 +1,15 @@
+#pragma once
+
+#include <cstddef>
+
+// Startup phase timing. Phases are logged against the time the process was
+// started by the kernel, so the time spent before main (loading the program
+// and its libraries) is counted as well.
+
+// Public Function Prototypes
+
+// Milliseconds since the process was started.
+double processUptimeMs();
+
+// Log that a startup phase has been reached.
+void logStartupPhase(const char *phase, const char *camera = NULL);
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <gst/gst.h>
+
+// Valve gating on SRT clients. A valve is opened when the first client
+// connects to any SRT sink gating it and closed again when the last one
+// leaves, so processing upstream of the valve only runs while somebody
+// watches. One valve can be gated by several sinks and one sink can gate
+// several valves.
+
+// Public Function Prototypes
+
+// Gate the named valve on the clients of the named srtsink. `label` names the
+// stream in the log messages. Pass NULL to log nothing for this pair.
+int gateValve(GstElement *pipeline, const char *sink_name, const char *valve_name, const char *label);
+
+// Hold the named valve open for good, as one client that never leaves. For
+// outputs whose viewers cannot be counted. `label` is as for gateValve.
+int holdValve(GstElement *pipeline, const char *valve_name, const char *label);
+
+// Number of clients currently gating the named valve.
+int gateClients(GstElement *pipeline, const char *valve_name);
+
+// Open a gated valve that has no clients yet, so the stream behind it starts
+// up ahead of its first client. endValvePreroll closes it again unless a
+// client has connected in the meantime.
+int prerollValve(GstElement *pipeline, const char *valve_name);
+void endValvePreroll(GstElement *pipeline, const char *valve_name);
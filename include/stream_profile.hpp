@@ -0,0 +1,79 @@
+#pragma once
+
+#include <gst/gst.h>
+#include <string>
+#include <vector>
+
+// Stream profiles requested through the SRT streamid. A caller can ask for a
+// smaller stream with a streamid such as "res=720p,fps=15,br=2000" (the SRT
+// access control form "#!::res=720p,..." works too). An SRT listener sends
+// the same stream to all of its callers, so the profile of the first caller
+// is applied while the stream is idle, before its valve opens. Callers that
+// join a running stream share the profile it already has. Requests are
+// clamped to the camera settings, so nothing is ever upscaled.
+//   res - Height with a "p" (the width keeps the aspect ratio) or WxH.
+//   fps - Frame rate. Frames are dropped ahead of the scaler. A source
+//         slower than this is passed through at its own rate.
+//   br  - Encoder bitrate in kbps.
+// A profile change sets the caps of the rate and scale stage and the encoder
+// bitrate. The encoder itself is not restarted, so its GOP length (a READY
+// only setting of x264enc) stays as the camera settings made it.
+static const bool STREAM_PROFILES_ENABLED    = false;
+static const int  STREAM_PROFILE_MIN_SIZE    = 64;   // Smallest width or height served.
+static const int  STREAM_PROFILE_MIN_KBPS    = 100;  // Lowest bitrate served.
+
+// Stream settings.
+struct StreamProfile {
+    int width;
+    int height;
+    int fps;
+    int bitrate_kbps;
+};
+
+// Upper limit put on all profiles, relative to the full stream of each camera.
+// Used by the quality governor. A requested profile is kept and served again
+// once the limit is lifted.
+struct ProfileLimit {
+    int max_fps;
+    int size_percent;
+    int bitrate_percent;
+};
+
+static const ProfileLimit NO_PROFILE_LIMIT = {1000, 100, 100};
+
+// Public Function Prototypes
+
+// Parse a streamid into a profile, starting from and clamped to `full`.
+// Returns false if the streamid is malformed. Unknown keys are ignored.
+bool parseStreamProfile(const char *stream_id, const StreamProfile &full, StreamProfile *profile);
+
+// Elements of the rate and scale stage for a stream, to link just ahead of
+// the encoder (see element_chain.hpp), which must be named "<prefix>_encoder".
+std::vector<GstElement *> profileElements(const char *prefix, const StreamProfile &full);
+
+// Apply the streamid profiles of callers of the named srtsink to the stream
+// built with profileElements(prefix). valve_name is the valve gated by the
+// same sink, used to tell whether the stream is idle. Without
+// STREAM_PROFILES_ENABLED the stream always asks for `full` and only follows
+// the profile limit.
+int startStreamProfiles(GstElement *pipeline, const char *sink_name, const char *valve_name,
+                        const char *prefix, const StreamProfile &full);
+
+// Profile within a limit, relative to `full`.
+StreamProfile limitProfile(const StreamProfile &profile, const StreamProfile &full, const ProfileLimit &limit);
+
+// Limit the profiles of all streams. Running streams change right away,
+// starting with a key frame.
+void setProfileLimit(const ProfileLimit &limit);
+
+// Change the full bitrate of the stream built with profileElements(prefix),
+// as set from the control socket. Caller profiles and the profile limit are
+// taken from the new rate, so the quality governor keeps scaling it down.
+// A pinned stream takes it when let go. Returns 1 if there is no such stream.
+int setStreamBitrate(const char *prefix, int kbps);
+
+// Pin the stream built with profileElements(prefix) to a profile, over its
+// callers and the profile limit, or let it go back to them with NULL. Used
+// by docking mode (see docking_mode.hpp). Returns 1 if there is no such
+// stream.
+int pinStreamProfile(const char *prefix, const StreamProfile *profile);
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <gst/gst.h>
+#include <cstdint>
+#include <string>
+
+// Event tracer. Every thread records into its own ring buffer, so recording
+// takes no locks: a clock read and a few stores, with the oldest events
+// overwritten. Spans, counters and instant events are recorded all the time,
+// and a snapshot of the rings is written on SIGUSR1 or the control socket
+// "trace_dump" command, in the Chrome trace JSON format that Perfetto
+// (ui.perfetto.dev) and chrome://tracing open.
+//
+//   TRACE_SPAN("overlay draw");            // Until the end of the scope.
+//   TRACE_COUNTER("forward srt bytes", n);
+//   TRACE_INSTANT("forward client connected");
+//
+// Names must be string literals or otherwise outlive the process. Comment out
+// the define below to compile all of the tracing out.
+#define TRACE
+
+static const int  TRACE_RING_EVENTS    = 8192;  // Events kept per thread. A power of 2.
+static const int  TRACE_MAX_THREADS    = 64;    // Threads traced at once. Others record nothing.
+static const char TRACE_DUMP_PATTERN[] = "/tmp/masthead-trace-%Y%m%d-%H%M%S.json";  // strftime pattern.
+
+enum TraceType : uint8_t { TRACE_BEGIN, TRACE_END, TRACE_COMPLETE, TRACE_INSTANT, TRACE_COUNTER };
+
+// Public Function Prototypes
+
+// Trace clock, monotonic nanoseconds.
+uint64_t traceNowNs();
+
+// Record an event on the calling thread. value is the counter value, or the
+// duration in nanoseconds of a complete event, which starts at time_ns.
+// Other events are stamped now.
+void traceRecord(TraceType type, const char *name, int64_t value = 0, uint64_t time_ns = 0);
+
+// Dump the trace on SIGUSR1. Call first thing in main, before any other
+// thread is started, so SIGUSR1 is blocked on all of them.
+int startTracer();
+
+// Write a snapshot of all rings to a new file named after TRACE_DUMP_PATTERN.
+// Returns 0 on success and sets the path written.
+int dumpTrace(std::string *path);
+
+// Trace the frames of a camera pipeline: captures, encodes and SRT sends.
+int attachCameraTrace(GstElement *pipeline, const char *camera);
+
+// Span from construction to the end of the scope.
+class TraceSpan {
+public:
+    explicit TraceSpan(const char *name) : name(name) { traceRecord(TRACE_BEGIN, name); }
+    ~TraceSpan() { traceRecord(TRACE_END, name); }
+
+private:
+    const char *name;
+};
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b)  TRACE_CONCAT_(a, b)
+
+#ifdef TRACE
+#define TRACE_SPAN(name)                      TraceSpan TRACE_CONCAT(trace_span_, __LINE__)(name)
+#define TRACE_COUNTER(name, value)            traceRecord(TRACE_COUNTER, name, value)
+#define TRACE_INSTANT(name)                   traceRecord(TRACE_INSTANT, name)
+#define TRACE_COMPLETE(name, start_ns, dur_ns) traceRecord(TRACE_COMPLETE, name, dur_ns, start_ns)
+#else
+#define TRACE_SPAN(name)
+#define TRACE_COUNTER(name, value)
+#define TRACE_INSTANT(name)
+#define TRACE_COMPLETE(name, start_ns, dur_ns)
+#endif
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <gst/gst.h>
+#include <camera_model.hpp>
+#include <warp.hpp>
+
+#include <cstdint>
+#include <vector>
+
+class WorkerPool;
+
+// Lens undistortion. When enabled, each frame of pipeline 1 is remapped to an
+// ideal pinhole view with the same focal length and principal point, after
+// the overlay has been drawn through the distorted camera model. The picture
+// and the ladder are straightened together.
+//
+// The source coordinates are precomputed in 16.16 fixed point on a grid of
+// UNDISTORT_GRID_STEP pixels and interpolated across each grid cell, which
+// keeps the table small enough to stay in cache. The frame is processed in
+// tiles of one grid row by UNDISTORT_TILE_WIDTH pixels.
+static const bool UNDISTORT_ENABLED    = false;
+static const int  UNDISTORT_GRID_SHIFT = 4;    // Luma pixels between table entries, as a power of 2.
+static const int  UNDISTORT_GRID_STEP  = 1 << UNDISTORT_GRID_SHIFT;
+static const int  UNDISTORT_TILE_WIDTH = 128;  // Luma pixels per tile row. Multiple of the grid step.
+static const int  UNDISTORT_THREADS    = 4;    // Threads the remap is split across.
+
+// Remap table for one frame size and camera model.
+struct UndistortMap {
+    int                  width  = 0;
+    int                  height = 0;
+    int                  y_columns, y_rows;    // Luma grid nodes
+    int                  uv_columns, uv_rows;  // Chroma grid nodes
+    std::vector<int32_t> y_sx, y_sy;           // Luma source coordinates per node
+    std::vector<int32_t> uv_sx, uv_sy;         // Chroma source coordinates per node
+};
+
+// Public Function Prototypes
+
+// Build the remap table taking an ideal pinhole frame of width x height back
+// to the distorted frame of `camera`.
+void buildUndistortMap(const CameraModel &camera, int width, int height, UndistortMap &map);
+
+// Apply a remap table. src and dst must match the table size.
+void undistortNV12(const Nv12Frame &src, const Nv12Frame &dst, const UndistortMap &map, WorkerPool &pool);
+
+// Attach the undistortion stage to the source pad of the named element. The
+// element must carry NV12 frames.
+int attachUndistort(GstElement *pipeline, const char *element_name);
@@ -1,6 +1,8 @@
 #pragma once
 
 #include <math.h>
+#include <cairo.h>
+#include <camera_model.hpp>
 
 //#define DEBUG
 
@@ -26,9 +28,14 @@ static const AngleLineSettings ANGLE_LINE_SETTINGS[] = {{-10, .3, true},
 static const int WIDTH   = 1280, HEIGHT   = 1080;
 static const int WIDTH_2 = 1280, HEIGHT_2 = 1080;
 
+// Nominal field of view. The projection itself comes from FORWARD_CAMERA_CALIBRATION and the
+// camera tilt from FORWARD_CAMERA_BORESIGHT in camera_model.hpp.
 static const int   VERTICAL_FOV_DEG    = 41;
 static const int   HORIZONTAL_FOV_DEG  = 67;
-static const float VERTICAL_OFFSET_DEG = 10.0;  // Angle that the camera is pitched up.
 
 // Public Function Prototypes
 int startStreaming();
+
+// Get the camera model of the forward camera frame the overlay is drawing on.
+// Follows the region of interest crop.
+CameraModel forwardCameraModel();
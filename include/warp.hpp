@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstdint>
+
+class WorkerPool;
+
+// Source coordinates handed to the remap kernels are 16.16 fixed point in
+// pixels of the plane being sampled. Only the top 7 fraction bits are used
+// for the bilinear weights.
+static const int WARP_FRAC_BITS    = 16;
+static const int WARP_WEIGHT_BITS  = 7;
+static const int WARP_WEIGHT_ONE   = 1 << WARP_WEIGHT_BITS;
+
+// View of an NV12 frame. Y is a full resolution plane, UV is a half
+// resolution plane with interleaved U and V bytes.
+struct Nv12Frame {
+    uint8_t *y;
+    uint8_t *uv;
+    int      width;
+    int      height;
+    int      y_stride;
+    int      uv_stride;
+};
+
+// Public Function Prototypes
+
+// Bilinear sample `count` Y pixels at the fixed point source coordinates
+// (sx[i], sy[i]) into dst. Coordinates are clamped to the plane.
+void remapRowY(const Nv12Frame &src, uint8_t *dst, const int32_t *sx, const int32_t *sy, int count);
+
+// Same as remapRowY for the interleaved UV plane. Coordinates are in chroma
+// pixels and each sample writes one U and one V byte.
+void remapRowUV(const Nv12Frame &src, uint8_t *dst, const int32_t *sx, const int32_t *sy, int count);
+
+// Rotate src about its center by angle_rad (Cairo rotation direction) and
+// zoom in by `zoom` into dst. Rows are split across the worker pool.
+void rotateNV12(const Nv12Frame &src, const Nv12Frame &dst, double angle_rad, double zoom, WorkerPool &pool);
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Small persistent thread pool used to split per-frame pixel work into bands
+// of rows. The calling thread works on bands too, so a pool of N threads
+// only starts N-1 helper threads. Threads are created once and reused for
+// every frame so no thread is started or stopped in the video path. A job is
+// a plain function and context pointer, so running one allocates nothing.
+class WorkerPool {
+public:
+    // Band function, called with the job context.
+    using BandJob = void (*)(const void *context, int band, int bands);
+
+    explicit WorkerPool(int threads);
+    ~WorkerPool();
+
+    WorkerPool(const WorkerPool &) = delete;
+    WorkerPool &operator=(const WorkerPool &) = delete;
+
+    // Run job(context, band, bands) for every band in [0, bands) and return
+    // once all of them are finished.
+    void run(int bands, BandJob job, const void *context);
+
+    // Same for a callable, such as a lambda, called as job(band, bands). The
+    // callable is used in place, never copied.
+    template <typename Job>
+    void run(int bands, const Job &job) {
+        run(bands, [](const void *context, int band, int bands) { (*(const Job *)context)(band, bands); }, &job);
+    }
+
+    // Number of threads, including the caller, that work on a job.
+    int size() const { return m_threads; }
+
+private:
+    void workerLoop();
+    void drainBands(unsigned generation);
+
+    int                                     m_threads;
+    std::vector<std::thread>                m_workers;
+    std::mutex                              m_mutex;
+    std::condition_variable                 m_wake;
+    std::condition_variable                 m_done;
+    BandJob                                 m_job        = nullptr;
+    const void                             *m_context    = nullptr;
+    int                                     m_bands      = 0;
+    int                                     m_next_band  = 0;
+    int                                     m_remaining  = 0;
+    unsigned                                m_generation = 0;
+    bool                                    m_stop       = false;
+};
@@ -9,21 +9,30 @@
 #include <linux/i2c-dev.h>
 #include <cstdint>
 #include <cstdio> 
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <attitude_filter.hpp>
+#include <startup.hpp>
+#include <trace.hpp>
 
 // Pitch roll and yaw. There may not be an updated
-// with every call to getAttitude.
-static double m_pitch   = 0.0;
-static double m_roll    = 0.0;
-static double m_yaw = 0.0;
+// with every call to getAttitude. They are read from other
+// threads through peekAttitude.
+static std::atomic<double> m_pitch {0.0};
+static std::atomic<double> m_roll  {0.0};
+static std::atomic<double> m_yaw   {0.0};
 
 // I2C bus that is connected to the BNo085
-int i2c_bus = 0;
+int i2c_bus = -1;
+
+// Set once the sensor reports rotation vectors. Until then getAttitude does not touch the bus.
+static std::atomic<bool> m_ready {false};
 
 // BNo085 message buffer
 uint8_t buffer[128];
 
 void enableRotationVector(int fd);
-void parseAndRemap(uint8_t* data);
 
 /**
  * @brief Initialize the I2C bus and enable the rotation vector caclulations. 
@@ -42,11 +51,29 @@ int initAttitude(){
     for(int i=0; i<10; i++) { read(i2c_bus, buffer, 128); usleep(10000); }
 
     enableRotationVector(i2c_bus);
+    m_ready = true;
 
     return 0;
 
 }
 
+/**
+ * @brief Initialize the sensor on a background thread.
+ *
+ * The boot message flush takes about 100 ms, which then overlaps the camera
+ * startup instead of coming ahead of it.
+ */
+void startAttitude(){
+
+    std::thread([]() {
+        if (initAttitude() != 0) {
+            std::cerr << "Failed to initialize the attitude sensor." << std::endl;
+        } else {
+            logStartupPhase("attitude sensor ready");
+        }
+    }).detach();
+}
+
 /**
  * @brief Get the current Attitude. 
  *
@@ -57,25 +84,59 @@ int initAttitude(){
  * @return yaw   - Camera yaw angle.
  */
 void getAttitude(double *pitch, double *roll, double *yaw){
+    TRACE_SPAN("attitude read");
 
-    int bytes = read(i2c_bus, buffer, 128);
-    if (bytes > 4 && buffer[2] == 0x03) { // Channel 3: Input Reports
+    int     bytes   = m_ready ? read(i2c_bus, buffer, 128) : 0;
+    int64_t read_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+    parseAttitudeReport(buffer, bytes, read_ns);
+
+    *pitch   = m_pitch;
+    *roll    = m_roll;
+    *yaw = m_yaw;
+}
+
+/**
+ * @brief Scan an SHTP packet for a Gaming Rotation Vector report.
+ *
+ * @param packet  Packet read from the sensor, with its SHTP header.
+ * @param bytes   Number of bytes read.
+ * @param read_ns Steady clock time of the read, in nanoseconds.
+ * @return 1 if a rotation vector was found and stored, 0 otherwise.
+ */
+int parseAttitudeReport(const uint8_t *packet, int bytes, int64_t read_ns){
+
+    if (bytes > 4 && packet[2] == 0x03) { // Channel 3: Input Reports
         int i = 4; // Skip SHTP Header
         while (i < bytes - 10) {
-            if (buffer[i] == 0xFB) { // Skip Timebase Report (5 bytes)
+            if (packet[i] == 0xFB) { // Skip Timebase Report (5 bytes)
                 i += 5;
-            } else if (buffer[i] == 0x08) { // Found Gaming Rotation Vector
-                parseAndRemap(&buffer[i + 4]); // 4-byte offset: ID, Seq, Status, Delay
-                break;
+            } else if (packet[i] == 0x08) { // Found Gaming Rotation Vector
+                parseAndRemap(&packet[i + 4], packet[i + 1], read_ns); // 4-byte offset: ID, Seq, Status, Delay
+                return 1;
             } else {
                 i++;
             }
         }
     }
+    return 0;
+}
 
-    *pitch   = m_pitch;
-    *roll    = m_roll;
-    *yaw = m_yaw;
+/**
+ * @brief Get the last Attitude without reading the sensor.
+ *
+ * Returns the values stored by the last call to getAttitude. Used by stages
+ * that run after the overlay and must use the same sample it drew.
+ *
+ * @return pitch - Camera pitch angle.
+ * @return roll  - Camera roll angle.
+ * @return yaw   - Camera yaw angle.
+ */
+void peekAttitude(double *pitch, double *roll, double *yaw){
+
+    *pitch = m_pitch.load(std::memory_order_relaxed);
+    *roll  = m_roll.load(std::memory_order_relaxed);
+    *yaw   = m_yaw.load(std::memory_order_relaxed);
 }
 
 /**
@@ -104,9 +165,11 @@ void enableRotationVector(int fd) {
  * Roll and Yaw angles and remap to the orientation of
  * sensor on the camera.
  *
- * @param data Raw binary data recieved form the BNO085 sensor. Header removed.
+ * @param data     Raw binary data recieved form the BNO085 sensor. Header removed.
+ * @param sequence Sequence number of the report.
+ * @param read_ns  Time the report was read, steady clock nanoseconds.
  */
-void parseAndRemap(uint8_t* data) {
+void parseAndRemap(const uint8_t* data, uint8_t sequence, int64_t read_ns) {
     // 1. Extract raw data from SHTP packet (Q14 format)
     // Order for Gaming Rotation Vector is: i, j, k, real (x, y, z, w)
     int16_t raw_i = (int16_t)(data[1] << 8 | data[0]);
@@ -114,11 +177,13 @@ void parseAndRemap(uint8_t* data) {
     int16_t raw_k = (int16_t)(data[5] << 8 | data[4]);
     int16_t raw_r = (int16_t)(data[7] << 8 | data[6]);
 
-    // 2. Convert to float (divide by 2^14)
-    float qx = raw_i / 16384.0f;
-    float qy = raw_j / 16384.0f;
-    float qz = raw_k / 16384.0f;
-    float qw = raw_r / 16384.0f;
+    // 2. Convert to floating point (divide by 2^14) and smooth out the mast vibration
+    double q[4] = {raw_i / 16384.0, raw_j / 16384.0, raw_k / 16384.0, raw_r / 16384.0};
+    filterAttitudeSample(q, sequence, read_ns);
+    double qx = q[0];
+    double qy = q[1];
+    double qz = q[2];
+    double qw = q[3];
 
     // 3. Calculate Euler Angles (Standard Z-Y-X sequence)
     double temp_roll, temp_pitch, temp_yaw;
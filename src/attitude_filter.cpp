@@ -0,0 +1,269 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <attitude_filter.hpp>
+
+static const double FILTER_DEG_TO_RAD = M_PI / 180.0;
+
+// A rotation rate of w rad/s moves a unit quaternion by w / 2 per second, so
+// degrees map to quaternion units by this factor.
+static const double DEG_TO_QUAT = FILTER_DEG_TO_RAD / 2.0;
+
+static const char *FILTER_NAMES[] = {"none", "one_euro", "complementary", "kalman"};
+
+static std::mutex     m_filter_mutex;
+static AttitudeFilter m_filter;
+static bool           m_filter_set = false;
+static uint8_t        m_last_sequence = 0;
+static int64_t        m_last_read_ns  = 0;
+
+/**
+ * @brief Get the compiled in filter settings.
+ */
+AttitudeFilterSettings defaultAttitudeFilterSettings() {
+    AttitudeFilterSettings settings;
+    settings.type                  = ATTITUDE_FILTER_TYPE;
+    settings.min_cutoff_hz         = ONE_EURO_MIN_CUTOFF_HZ;
+    settings.beta                  = ONE_EURO_BETA;
+    settings.derivative_cutoff_hz  = ONE_EURO_DERIVATIVE_CUTOFF_HZ;
+    settings.rest_time_constant_s  = COMPLEMENTARY_REST_TIME_CONSTANT_S;
+    settings.motion_rate_dps       = COMPLEMENTARY_MOTION_RATE_DPS;
+    settings.accel_noise_dps2      = KALMAN_ACCEL_NOISE_DPS2;
+    settings.measurement_noise_deg = KALMAN_MEASUREMENT_NOISE_DEG;
+    return settings;
+}
+
+/**
+ * @brief Get the control socket name of a filter type.
+ */
+const char *attitudeFilterName(AttitudeFilterType type) {
+    return FILTER_NAMES[(int)type];
+}
+
+/**
+ * @brief Look up a filter type by its control socket name.
+ *
+ * @param name Filter name.
+ * @param type Returned type.
+ * @return false if the name is unknown.
+ */
+bool attitudeFilterType(const char *name, AttitudeFilterType *type) {
+    for (int i = 0; i < (int)(sizeof(FILTER_NAMES) / sizeof(FILTER_NAMES[0])); i++) {
+        if (strcmp(name, FILTER_NAMES[i]) == 0) {
+            *type = (AttitudeFilterType)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Restart a filter with new settings.
+ *
+ * @param filter   Filter state.
+ * @param settings Filter choice and tuning.
+ */
+void resetAttitudeFilter(AttitudeFilter *filter, const AttitudeFilterSettings &settings) {
+    memset(filter, 0, sizeof(*filter));
+    filter->settings = settings;
+}
+
+/**
+ * @brief Blend factor of a one pole low pass filter.
+ *
+ * @param cutoff_hz Cutoff frequency.
+ * @param dt        Sample interval in seconds.
+ * @return share of the new sample.
+ */
+static double lowPassAlpha(double cutoff_hz, double dt) {
+    double tau = 1.0 / (2.0 * M_PI * cutoff_hz);
+    return 1.0 / (1.0 + tau / dt);
+}
+
+/**
+ * @brief Rotation rate in degrees per second of a quaternion rate.
+ */
+static double rateDps(const double rate[4]) {
+    return sqrt(rate[0] * rate[0] + rate[1] * rate[1] + rate[2] * rate[2] + rate[3] * rate[3]) / DEG_TO_QUAT;
+}
+
+/**
+ * @brief One euro filter step.
+ */
+static void stepOneEuro(AttitudeFilter *filter, const double q[4], double dt) {
+    const AttitudeFilterSettings &settings = filter->settings;
+
+    double derivative_alpha = lowPassAlpha(settings.derivative_cutoff_hz, dt);
+    for (int i = 0; i < 4; i++) filter->rate[i] += derivative_alpha * ((q[i] - filter->q[i]) / dt - filter->rate[i]);
+
+    double alpha = lowPassAlpha(settings.min_cutoff_hz + settings.beta * rateDps(filter->rate), dt);
+    for (int i = 0; i < 4; i++) filter->q[i] += alpha * (q[i] - filter->q[i]);
+}
+
+/**
+ * @brief Adaptive complementary filter step.
+ */
+static void stepComplementary(AttitudeFilter *filter, const double q[4], double dt) {
+    const AttitudeFilterSettings &settings = filter->settings;
+
+    double ratio = rateDps(filter->rate) / settings.motion_rate_dps;
+    double tau   = settings.rest_time_constant_s / (1.0 + ratio * ratio);
+    double alpha = 1.0 - exp(-dt / tau);
+    double rate_alpha = 1.0 - exp(-dt / settings.rest_time_constant_s);
+
+    for (int i = 0; i < 4; i++) {
+        double predicted = filter->q[i] + filter->rate[i] * dt;
+        double blended   = predicted + alpha * (q[i] - predicted);
+        filter->rate[i] += rate_alpha * ((blended - filter->q[i]) / dt - filter->rate[i]);
+        filter->q[i]     = blended;
+    }
+}
+
+/**
+ * @brief Constant rate Kalman filter step, one component at a time.
+ */
+static void stepKalman(AttitudeFilter *filter, const double q[4], double dt) {
+    const double accel = filter->settings.accel_noise_dps2 * DEG_TO_QUAT;
+    const double noise = filter->settings.measurement_noise_deg * DEG_TO_QUAT;
+    const double qa    = accel * accel;
+    const double r     = noise * noise;
+
+    for (int i = 0; i < 4; i++) {
+        double *p = filter->p[i];
+
+        // Predict with white noise acceleration
+        filter->q[i] += filter->rate[i] * dt;
+        p[0] += dt * (2.0 * p[1] + dt * p[2]) + qa * dt * dt * dt / 3.0;
+        p[1] += dt * p[2] + qa * dt * dt / 2.0;
+        p[2] += qa * dt;
+
+        // Update with the sample
+        double s     = p[0] + r;
+        double k0    = p[0] / s;
+        double k1    = p[1] / s;
+        double error = q[i] - filter->q[i];
+        filter->q[i]    += k0 * error;
+        filter->rate[i] += k1 * error;
+        p[2] -= k1 * p[1];
+        p[1] -= k1 * p[0];
+        p[0] -= k0 * p[0];
+    }
+}
+
+/**
+ * @brief Filter one quaternion sample.
+ *
+ * The sample is flipped to the hemisphere of the last output first, since q
+ * and -q are the same attitude.
+ *
+ * @param filter Filter state.
+ * @param q      Unit quaternion (x, y, z, w). Replaced by the filtered one.
+ * @param dt     Seconds since the previous sample.
+ */
+void stepAttitudeFilter(AttitudeFilter *filter, double q[4], double dt) {
+    const AttitudeFilterSettings &settings = filter->settings;
+    if (settings.type == AttitudeFilterType::NONE) return;
+
+    if (!filter->primed) {
+        for (int i = 0; i < 4; i++) {
+            filter->q[i]    = q[i];
+            filter->rate[i] = 0.0;
+            // Start at the measurement noise, with a rate of up to a second of the acceleration noise
+            double noise = settings.measurement_noise_deg * DEG_TO_QUAT;
+            double rate  = settings.accel_noise_dps2 * DEG_TO_QUAT;
+            filter->p[i][0] = noise * noise;
+            filter->p[i][1] = 0.0;
+            filter->p[i][2] = rate * rate;
+        }
+        filter->primed = true;
+        return;
+    }
+
+    double dot = q[0] * filter->q[0] + q[1] * filter->q[1] + q[2] * filter->q[2] + q[3] * filter->q[3];
+    double sample[4];
+    for (int i = 0; i < 4; i++) sample[i] = dot < 0.0 ? -q[i] : q[i];
+
+    switch (settings.type) {
+        case AttitudeFilterType::ONE_EURO:      stepOneEuro(filter, sample, dt);       break;
+        case AttitudeFilterType::COMPLEMENTARY: stepComplementary(filter, sample, dt); break;
+        case AttitudeFilterType::KALMAN:        stepKalman(filter, sample, dt);        break;
+        case AttitudeFilterType::NONE:          break;
+    }
+
+    double norm = sqrt(filter->q[0] * filter->q[0] + filter->q[1] * filter->q[1] +
+                       filter->q[2] * filter->q[2] + filter->q[3] * filter->q[3]);
+    if (norm < 1e-9) {
+        filter->primed = false;
+        return;
+    }
+    for (int i = 0; i < 4; i++) q[i] = filter->q[i] / norm;
+}
+
+/**
+ * @brief Filter a sensor sample with the filter stage.
+ *
+ * The sensor numbers its reports, so the step is the number of sensor
+ * periods since the last report, whenever it was read.
+ *
+ * @param q        Unit quaternion (x, y, z, w). Replaced by the filtered one.
+ * @param sequence Sequence number of the report.
+ * @param read_ns  Time the report was read, steady clock nanoseconds.
+ */
+void filterAttitudeSample(double q[4], uint8_t sequence, int64_t read_ns) {
+    std::lock_guard<std::mutex> lock(m_filter_mutex);
+    if (!m_filter_set) {
+        resetAttitudeFilter(&m_filter, defaultAttitudeFilterSettings());
+        m_filter_set = true;
+    }
+    // The same report read again steps by one period. The number wraps after
+    // 256 reports, which the read time catches.
+    int    periods = std::max((uint8_t)(sequence - m_last_sequence), (uint8_t)1);
+    double dt      = periods * ATTITUDE_SAMPLE_PERIOD_S;
+    if (dt > ATTITUDE_FILTER_RESET_S || read_ns - m_last_read_ns > (int64_t)(ATTITUDE_FILTER_RESET_S * 1e9)) {
+        m_filter.primed = false;
+    }
+    m_last_sequence = sequence;
+    m_last_read_ns  = read_ns;
+
+    stepAttitudeFilter(&m_filter, q, dt);
+}
+
+/**
+ * @brief Change the settings of the filter stage and restart it.
+ *
+ * @param settings Filter choice and tuning.
+ */
+void setAttitudeFilter(const AttitudeFilterSettings &settings) {
+    std::lock_guard<std::mutex> lock(m_filter_mutex);
+    resetAttitudeFilter(&m_filter, settings);
+    m_filter_set = true;
+}
+
+/**
+ * @brief Get the settings of the filter stage.
+ */
+AttitudeFilterSettings attitudeFilterSettings() {
+    std::lock_guard<std::mutex> lock(m_filter_mutex);
+    return m_filter_set ? m_filter.settings : defaultAttitudeFilterSettings();
+}
+
+/**
+ * @brief Format filter settings as JSON.
+ *
+ * @param settings Filter choice and tuning.
+ * @return JSON object.
+ */
+std::string attitudeFilterJson(const AttitudeFilterSettings &settings) {
+    char json[320];
+    snprintf(json, sizeof(json),
+             "{\"type\":\"%s\",\"min_cutoff_hz\":%g,\"beta\":%g,\"derivative_cutoff_hz\":%g,"
+             "\"rest_time_constant_s\":%g,\"motion_rate_dps\":%g,\"accel_noise_dps2\":%g,"
+             "\"measurement_noise_deg\":%g}",
+             attitudeFilterName(settings.type), settings.min_cutoff_hz, settings.beta, settings.derivative_cutoff_hz,
+             settings.rest_time_constant_s, settings.motion_rate_dps, settings.accel_noise_dps2,
+             settings.measurement_noise_deg);
+    return json;
+}
@@ -0,0 +1,515 @@
+#include <gst/gst.h>
+#include <gst/video/video.h>
+#include <cairo.h>
+
+#include <iostream>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <attitude.hpp>
+#include <bridge_detect.hpp>
+#include <camera_model.hpp>
+#include <ladder.hpp>
+#include <overlay_config.hpp>
+#include <video.hpp>
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Edges lower than this elevation are water, reflections and the shore.
+static const float BRIDGE_DETECT_MIN_ELEVATION_DEG = -5.0;
+
+// A result older than this is no longer drawn.
+static const double BRIDGE_RESULT_MAX_AGE_S = 1.0;
+
+// Azimuth span of the drawn bridge line, either side of the optical axis.
+static const double BRIDGE_LINE_HALF_SPAN_DEG = 20.0;
+
+// Text size of the go/no-go readout.
+static const double BRIDGE_READOUT_FONT_SIZE = 28.0;
+
+// Hough tilts, 1 degree apart, padded to whole SIMD vectors of 4.
+static const int BRIDGE_TILTS       = 2 * (int)BRIDGE_DETECT_MAX_TILT_DEG + 1;
+static const int BRIDGE_HOUGH_TILTS = (BRIDGE_TILTS + 3) & ~3;
+
+// Downscaled luma handed from the video thread to the analysis thread, with
+// the attitude, camera model and boresight it was taken at.
+struct LumaFrame {
+    std::vector<uint8_t> pixels;
+    int                  width  = 0;
+    int                  height = 0;
+    CameraModel          camera;
+    Boresight            boresight;
+    double               pitch  = 0.0;
+    double               roll   = 0.0;
+};
+
+// Last measured bridge edge.
+struct BridgeResult {
+    bool                                  valid         = false;
+    double                                elevation_deg = 0.0;  // Elevation of the edge above the mast.
+    std::chrono::steady_clock::time_point time;
+};
+
+// Scratch space of the analysis thread, kept between frames so nothing is
+// allocated per analysis once the frame size is known.
+struct BridgeScratch {
+    std::vector<uint8_t>  mask;
+    std::vector<uint16_t> accumulator;
+    alignas(16) float     vote_ly[BRIDGE_HOUGH_TILTS];    // Ladder frame y to distance bin, per tilt.
+    alignas(16) float     vote_lx[BRIDGE_HOUGH_TILTS];    // Ladder frame x to distance bin, per tilt.
+    alignas(16) int32_t   bins[BRIDGE_HOUGH_TILTS];
+    double                tilt_cos[BRIDGE_HOUGH_TILTS];
+};
+
+// State of the bridge detector. It lives as long as the pipeline, which is
+// as long as the program, as the analysis thread never stops.
+struct BridgeDetector {
+    // Frame hand off. The video thread only ever try-locks this.
+    std::mutex              frame_mutex;
+    std::condition_variable frame_cv;
+    LumaFrame               pending;
+    bool                    pending_ready = false;
+
+    // Analysis rate, adjusted by the analysis thread to stay inside the budget
+    std::atomic<int>        interval {BRIDGE_DETECT_MIN_INTERVAL};
+    unsigned                frame_count   = 0;
+    GstVideoInfo            video_info;
+    bool                    have_info     = false;
+
+    std::mutex              result_mutex;
+    BridgeResult            result;
+};
+
+/**
+ * @brief Downscale a BGRx frame to luma.
+ *
+ * Each output pixel averages four samples spread over its scale x scale
+ * block, which is enough for edge finding at a fraction of the memory reads.
+ *
+ * @param bgrx   Source pixels.
+ * @param stride Source row stride in bytes.
+ * @param out    Output frame. Its width and height must already be set.
+ * @param scale  Downscale factor.
+ */
+static void downscaleLuma(const uint8_t *bgrx, int stride, LumaFrame &out, int scale) {
+    const int a = scale / 4;
+    const int b = (3 * scale) / 4;
+
+    for (int v = 0; v < out.height; v++) {
+        const uint8_t *row_a = bgrx + (v * scale + a) * stride;
+        const uint8_t *row_b = bgrx + (v * scale + b) * stride;
+        uint8_t       *dst   = out.pixels.data() + v * out.width;
+
+        for (int u = 0; u < out.width; u++) {
+            int x[2] = {(u * scale + a) * 4, (u * scale + b) * 4};
+            int sum  = 0;
+            for (const uint8_t *row : {row_a, row_b}) {
+                for (int i : x) {
+                    sum += 29 * row[i] + 150 * row[i + 1] + 77 * row[i + 2];  // B, G, R
+                }
+            }
+            dst[u] = (uint8_t)((sum + 512) >> 10);
+        }
+    }
+}
+
+/**
+ * @brief Mark the pixels on a dark above, bright below horizontal edge.
+ *
+ * That is the shape of a bridge underside against the sky or background. The
+ * sea horizon has the opposite sign, so it does not compete. The vertical
+ * step must exceed BRIDGE_DETECT_EDGE_MIN and be more than twice the
+ * horizontal step.
+ *
+ * @param luma   Downscaled luma.
+ * @param width  Frame width.
+ * @param height Frame height.
+ * @param mask   Output, 0xFF on an edge and 0 elsewhere. Border rows are 0.
+ */
+static void edgeMask(const uint8_t *luma, int width, int height, uint8_t *mask) {
+    std::fill(mask, mask + width, 0);
+    std::fill(mask + (height - 1) * width, mask + height * width, 0);
+
+    for (int y = 1; y < height - 1; y++) {
+        const uint8_t *above = luma + (y - 1) * width;
+        const uint8_t *row   = luma + y * width;
+        const uint8_t *below = luma + (y + 1) * width;
+        uint8_t       *out   = mask + y * width;
+
+        out[0] = out[width - 1] = 0;
+        int x = 1;
+
+#if defined(__ARM_NEON)
+        const uint8x16_t edge_min = vdupq_n_u8(BRIDGE_DETECT_EDGE_MIN);
+        for (; x + 16 <= width - 1; x += 16) {
+            uint8x16_t gy  = vqsubq_u8(vld1q_u8(below + x), vld1q_u8(above + x));
+            uint8x16_t gx  = vabdq_u8(vld1q_u8(row + x + 1), vld1q_u8(row + x - 1));
+            uint8x16_t gx2 = vqaddq_u8(gx, gx);
+            vst1q_u8(out + x, vandq_u8(vcgeq_u8(gy, edge_min), vcgtq_u8(gy, gx2)));
+        }
+#elif defined(__SSE2__)
+        const __m128i edge_min = _mm_set1_epi8((char)BRIDGE_DETECT_EDGE_MIN);
+        const __m128i zero     = _mm_setzero_si128();
+        for (; x + 16 <= width - 1; x += 16) {
+            __m128i gy    = _mm_subs_epu8(_mm_loadu_si128((const __m128i *)(below + x)),
+                                          _mm_loadu_si128((const __m128i *)(above + x)));
+            __m128i left  = _mm_loadu_si128((const __m128i *)(row + x - 1));
+            __m128i right = _mm_loadu_si128((const __m128i *)(row + x + 1));
+            __m128i gx    = _mm_or_si128(_mm_subs_epu8(left, right), _mm_subs_epu8(right, left));
+            __m128i gx2   = _mm_adds_epu8(gx, gx);
+
+            __m128i strong = _mm_cmpeq_epi8(_mm_max_epu8(gy, edge_min), gy);               // gy >= min
+            __m128i flat   = _mm_xor_si128(_mm_cmpeq_epi8(_mm_subs_epu8(gy, gx2), zero),   // gy > 2 gx
+                                           _mm_set1_epi8((char)0xFF));
+            _mm_storeu_si128((__m128i *)(out + x), _mm_and_si128(strong, flat));
+        }
+#endif
+
+        for (; x < width - 1; x++) {
+            int gy = below[x] - above[x];
+            int gx = std::abs(row[x + 1] - row[x - 1]);
+            out[x] = (gy >= BRIDGE_DETECT_EDGE_MIN && gy > 2 * gx) ? 0xFF : 0;
+        }
+    }
+}
+
+/**
+ * @brief Check whether 16 mask bytes are all clear.
+ *
+ * Most of a frame has no edge, so the vote skips it 16 pixels at a time.
+ */
+static inline bool emptyMaskBlock(const uint8_t *mask) {
+#if defined(__ARM_NEON)
+    uint64x2_t block = vreinterpretq_u64_u8(vld1q_u8(mask));
+    return (vgetq_lane_u64(block, 0) | vgetq_lane_u64(block, 1)) == 0;
+#elif defined(__SSE2__)
+    __m128i block = _mm_loadu_si128((const __m128i *)mask);
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(block, _mm_setzero_si128())) == 0xFFFF;
+#else
+    for (int i = 0; i < 16; i++) {
+        if (mask[i]) return false;
+    }
+    return true;
+#endif
+}
+
+/**
+ * @brief Distance bins of one edge pixel for every tilt.
+ *
+ * bin = round(ly * cos(tilt) / scale - lx * sin(tilt) / scale) + rho_offset,
+ * four tilts per vector. The sum is biased by rhos before the truncating
+ * conversion, so it only rounds toward zero on values that are out of range
+ * either way. The scattered increments of the accumulator stay scalar.
+ *
+ * @param scratch Tilt coefficients, and the returned bins.
+ * @param lx      Ladder frame x in full resolution pixels.
+ * @param ly      Ladder frame y in full resolution pixels.
+ * @param bias    rho_offset + rhos + 0.5.
+ * @param rhos    Number of distance bins.
+ */
+static inline void houghBins(BridgeScratch &scratch, float lx, float ly, float bias, int rhos) {
+#if defined(__ARM_NEON)
+    const float32x4_t x = vdupq_n_f32(lx), y = vdupq_n_f32(ly), b = vdupq_n_f32(bias);
+    const int32x4_t   r = vdupq_n_s32(rhos);
+    for (int t = 0; t < BRIDGE_HOUGH_TILTS; t += 4) {
+        float32x4_t rho = vmlaq_f32(vmlaq_f32(b, y, vld1q_f32(scratch.vote_ly + t)), x, vld1q_f32(scratch.vote_lx + t));
+        vst1q_s32(scratch.bins + t, vsubq_s32(vcvtq_s32_f32(rho), r));
+    }
+#elif defined(__SSE2__)
+    const __m128  x = _mm_set1_ps(lx), y = _mm_set1_ps(ly), b = _mm_set1_ps(bias);
+    const __m128i r = _mm_set1_epi32(rhos);
+    for (int t = 0; t < BRIDGE_HOUGH_TILTS; t += 4) {
+        __m128 rho = _mm_add_ps(_mm_add_ps(b, _mm_mul_ps(y, _mm_load_ps(scratch.vote_ly + t))),
+                                _mm_mul_ps(x, _mm_load_ps(scratch.vote_lx + t)));
+        _mm_store_si128((__m128i *)(scratch.bins + t), _mm_sub_epi32(_mm_cvttps_epi32(rho), r));
+    }
+#else
+    for (int t = 0; t < BRIDGE_HOUGH_TILTS; t++) {
+        scratch.bins[t] = (int32_t)(bias + ly * scratch.vote_ly[t] + lx * scratch.vote_lx[t]) - rhos;
+    }
+#endif
+}
+
+/**
+ * @brief Find the dominant bridge edge in a downscaled frame.
+ *
+ * Edge pixels are rotated into the ladder frame, where the ladder lines are
+ * horizontal, and voted into a small Hough accumulator over tilts within
+ * BRIDGE_DETECT_MAX_TILT_DEG of the ladder lines. The peak is converted to an
+ * elevation through the same camera model and boresight as the ladder,
+ * measured where the edge crosses the optical axis (over the mast).
+ *
+ * @param frame   Frame to analyse.
+ * @param scratch Scratch space for the edge mask and the Hough votes.
+ * @return the measured edge. valid is false if no edge is long enough.
+ */
+static BridgeResult analyseFrame(const LumaFrame &frame, BridgeScratch &scratch) {
+    BridgeResult result;
+
+    const int          scale    = BRIDGE_DETECT_SCALE;
+    const CameraModel &camera   = frame.camera;
+    CameraRotation     rotation = cameraRotation(frame.pitch, frame.roll, frame.boresight);
+    double             azimuth  = axisAzimuth(rotation);
+
+    // Screen direction of the ladder lines near the center
+    double u0, v0, u1, v1;
+    if (!projectDirection(camera, rotation, 0.0, azimuth - 5.0, &u0, &v0) ||
+        !projectDirection(camera, rotation, 0.0, azimuth + 5.0, &u1, &v1)) {
+        return result;
+    }
+    const double ladder_angle = atan2(v1 - v0, u1 - u0);
+    const double cos_ladder   = cos(ladder_angle);
+    const double sin_ladder   = sin(ladder_angle);
+
+    // Edges below the minimum elevation are ignored. Find how far down the ladder frame that is.
+    double limit_ly = 1e9;
+    double u, v;
+    if (projectDirection(camera, rotation, BRIDGE_DETECT_MIN_ELEVATION_DEG, azimuth, &u, &v)) {
+        limit_ly = -(u - camera.cx) * sin_ladder + (v - camera.cy) * cos_ladder;
+    }
+
+    scratch.mask.resize(frame.width * frame.height);
+    edgeMask(frame.pixels.data(), frame.width, frame.height, scratch.mask.data());
+
+    // Tilt table, 1 degree per step, folded with the bin width. The padding tilts never vote.
+    for (int t = 0; t < BRIDGE_HOUGH_TILTS; t++) {
+        double tilt = (t - (int)BRIDGE_DETECT_MAX_TILT_DEG) * DEG_TO_RAD;
+        scratch.tilt_cos[t] = cos(tilt);
+        scratch.vote_ly[t]  = (float)( cos(tilt) / scale);
+        scratch.vote_lx[t]  = (float)(-sin(tilt) / scale);
+    }
+
+    // Distance bins are one downscaled pixel wide
+    const int   rhos       = 2 * ((int)std::hypot(frame.width, frame.height) + 2);
+    const int   rho_offset = rhos / 2;
+    const float bias       = (float)(rho_offset + rhos) + 0.5f;
+    std::vector<uint16_t> &accumulator = scratch.accumulator;
+    accumulator.assign(BRIDGE_TILTS * rhos, 0);
+
+    for (int y = 1; y < frame.height - 1; y++) {
+        const uint8_t *row = scratch.mask.data() + y * frame.width;
+        double dy = (y * scale + scale / 2) - camera.cy;
+
+        for (int x = 1; x < frame.width - 1; x++) {
+            if (x + 16 <= frame.width - 1 && emptyMaskBlock(row + x)) {
+                x += 15;
+                continue;
+            }
+            if (!row[x]) continue;
+
+            // Position in the ladder frame, full resolution pixels
+            double dx = (x * scale + scale / 2) - camera.cx;
+            double lx =  dx * cos_ladder + dy * sin_ladder;
+            double ly = -dx * sin_ladder + dy * cos_ladder;
+
+            if (ly > limit_ly) continue;
+
+            houghBins(scratch, (float)lx, (float)ly, bias, rhos);
+            for (int t = 0; t < BRIDGE_TILTS; t++) {
+                if ((unsigned)scratch.bins[t] < (unsigned)rhos) accumulator[t * rhos + scratch.bins[t]]++;
+            }
+        }
+    }
+
+    int best = 0;
+    for (int i = 1; i < BRIDGE_TILTS * rhos; i++) {
+        if (accumulator[i] > accumulator[best]) best = i;
+    }
+    if (accumulator[best] < BRIDGE_DETECT_MIN_LENGTH * frame.width) return result;
+
+    // Point where the edge crosses lx = 0, back on screen
+    int    t  = best / rhos;
+    double ly = (double)(best % rhos - rho_offset) * scale / scratch.tilt_cos[t];
+    u = camera.cx - ly * sin_ladder;
+    v = camera.cy + ly * cos_ladder;
+
+    result.valid         = true;
+    result.elevation_deg = pixelElevation(camera, rotation, u, v);
+    result.time          = std::chrono::steady_clock::now();
+    return result;
+}
+
+/**
+ * @brief Analysis thread body.
+ *
+ * Waits for a sampled frame, analyses it and publishes the result. The time
+ * each analysis takes sets how many frames are skipped before the next one,
+ * so the average cost per video frame stays inside BRIDGE_DETECT_BUDGET_MS.
+ *
+ * @param detector Detector of the camera.
+ */
+static void analysisLoop(BridgeDetector *detector) {
+    LumaFrame     work;
+    BridgeScratch scratch;
+
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(detector->frame_mutex);
+            detector->frame_cv.wait(lock, [detector] { return detector->pending_ready; });
+            std::swap(work, detector->pending);
+            detector->pending_ready = false;
+        }
+
+        auto         start  = std::chrono::steady_clock::now();
+        BridgeResult result = analyseFrame(work, scratch);
+        double       ms     = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        // Self throttle
+        int interval = (int)ceil(ms / BRIDGE_DETECT_BUDGET_MS);
+        detector->interval.store(std::clamp(interval, BRIDGE_DETECT_MIN_INTERVAL, BRIDGE_DETECT_MAX_INTERVAL));
+
+        if (result.valid) {
+            std::lock_guard<std::mutex> lock(detector->result_mutex);
+            detector->result = result;
+        }
+    }
+}
+
+/**
+ * @brief Buffer probe that samples frames for the analysis thread.
+ *
+ * Runs in the video thread, so it never waits. If the analysis thread has not
+ * taken the previous sample yet, this frame is simply skipped.
+ *
+ * @param pad       Pad the probe is attached to.
+ * @param info      Probe info holding the buffer.
+ * @param user_data Detector of the camera.
+ * @return GST_PAD_PROBE_OK to keep the data flowing.
+ */
+static GstPadProbeReturn on_sample_frame(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    BridgeDetector *detector = (BridgeDetector *)user_data;
+    if (++detector->frame_count % detector->interval.load(std::memory_order_relaxed) != 0) return GST_PAD_PROBE_OK;
+
+    if (!detector->have_info) {
+        GstCaps *caps = gst_pad_get_current_caps(pad);
+        if (!caps) return GST_PAD_PROBE_OK;
+        detector->have_info = gst_video_info_from_caps(&detector->video_info, caps) &&
+                              GST_VIDEO_INFO_FORMAT(&detector->video_info) == GST_VIDEO_FORMAT_BGRx;
+        gst_caps_unref(caps);
+        if (!detector->have_info) return GST_PAD_PROBE_OK;
+    }
+
+    std::unique_lock<std::mutex> lock(detector->frame_mutex, std::try_to_lock);
+    if (!lock.owns_lock() || detector->pending_ready) return GST_PAD_PROBE_OK;
+
+    GstVideoFrame frame;
+    if (!gst_video_frame_map(&frame, &detector->video_info, GST_PAD_PROBE_INFO_BUFFER(info), GST_MAP_READ)) {
+        return GST_PAD_PROBE_OK;
+    }
+
+    LumaFrame &pending = detector->pending;
+    pending.width  = GST_VIDEO_FRAME_WIDTH(&frame)  / BRIDGE_DETECT_SCALE;
+    pending.height = GST_VIDEO_FRAME_HEIGHT(&frame) / BRIDGE_DETECT_SCALE;
+    pending.pixels.resize(pending.width * pending.height);
+
+    double yaw;
+    peekAttitude(&pending.pitch, &pending.roll, &yaw);
+    pending.camera    = forwardCameraModel();
+    pending.boresight = overlayConfig()->boresight;
+
+    downscaleLuma((const uint8_t *)GST_VIDEO_FRAME_PLANE_DATA(&frame, 0),
+                  GST_VIDEO_FRAME_PLANE_STRIDE(&frame, 0), pending, BRIDGE_DETECT_SCALE);
+    gst_video_frame_unmap(&frame);
+
+    detector->pending_ready = true;
+    lock.unlock();
+    detector->frame_cv.notify_one();
+
+    return GST_PAD_PROBE_OK;
+}
+
+/**
+ * @brief Draw the measured bridge edge and the clearance readout.
+ *
+ * The edge is drawn as the line of its measured elevation through the camera
+ * model, in green when it is at least BRIDGE_CLEARANCE_MARGIN_DEG above the 0
+ * line and red otherwise. Nothing is drawn if there is no recent measurement.
+ *
+ * @param detector Detector of the camera.
+ * @param cr       Cairo context of the overlay, without a transform.
+ * @param face     Font face of the readout, made once by the overlay.
+ * @param camera   Camera model of the frame.
+ * @param rotation Rotation used for the ladder of this frame.
+ * @param area     Returned line and text box drawn, so a cached overlay layer
+ *                 only covers those.
+ */
+void drawBridgeReadout(BridgeDetector *detector, cairo_t *cr, cairo_font_face_t *face, const CameraModel &camera,
+                       const CameraRotation &rotation, BridgeReadoutArea *area) {
+    area->points       = 0;
+    area->line_width   = 2.0;
+    area->text         = {0.0, 0.0, 0.0, 0.0};
+
+    BridgeResult result;
+    {
+        std::lock_guard<std::mutex> lock(detector->result_mutex);
+        result = detector->result;
+    }
+
+    double age = std::chrono::duration<double>(std::chrono::steady_clock::now() - result.time).count();
+    if (!result.valid || age > BRIDGE_RESULT_MAX_AGE_S) return;
+
+    bool go = result.elevation_deg >= BRIDGE_CLEARANCE_MARGIN_DEG;
+
+    cairo_save(cr);
+    if (go) cairo_set_source_rgb(cr, 0.0, 1.0, 0.0);
+    else    cairo_set_source_rgb(cr, 1.0, 0.0, 0.0);
+
+    // Measured edge, projected like the ladder lines
+    int points = elevationPolyline(camera, rotation, result.elevation_deg, BRIDGE_LINE_HALF_SPAN_DEG,
+                                   area->x, area->y, LADDER_LINE_POINTS);
+    if (points >= 2) {
+        cairo_set_line_width(cr, area->line_width);
+        cairo_move_to(cr, area->x[0], area->y[0]);
+        for (int i = 1; i < points; i++) cairo_line_to(cr, area->x[i], area->y[i]);
+        cairo_stroke(cr);
+        area->points = points;
+    }
+
+    // Fixed readout (non-rotating)
+    char text[48];
+    snprintf(text, sizeof(text), "Bridge %+.1f\xC2\xB0 %s", result.elevation_deg, go ? "GO" : "NO GO");
+    cairo_set_font_face(cr, face);
+    cairo_set_font_size(cr, BRIDGE_READOUT_FONT_SIZE);
+    cairo_text_extents_t extents;
+    cairo_text_extents(cr, text, &extents);
+    cairo_move_to(cr, 20, 40);
+    cairo_show_text(cr, text);
+    area->text = {20 + extents.x_bearing, 40 + extents.y_bearing, extents.width, extents.height};
+    cairo_restore(cr);
+}
+
+/**
+ * @brief Start the bridge detector.
+ *
+ * Starts the analysis thread and adds the sampling probe to the sink pad of
+ * the named element. The element is normally the cairo overlay, so the
+ * sampled frames do not contain the ladder.
+ *
+ * @param pipeline     Pipeline containing the element.
+ * @param element_name Name of the element to sample frames from.
+ * @return the detector, or NULL if the element was not found.
+ */
+BridgeDetector *startBridgeDetector(GstElement *pipeline, const char *element_name) {
+    GstElement *element = gst_bin_get_by_name(GST_BIN(pipeline), element_name);
+    if (!element) return NULL;
+
+    BridgeDetector *detector = new BridgeDetector();
+    std::thread(analysisLoop, detector).detach();
+
+    GstPad *pad = gst_element_get_static_pad(element, "sink");
+    gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, on_sample_frame, detector, NULL);
+
+    gst_object_unref(pad);
+    gst_object_unref(element);
+    return detector;
+}
@@ -0,0 +1,345 @@
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include <calibration.hpp>
+
+// Layout of the fitted parameters: fx, fy, cx, cy in pixels, the distortion
+// terms, then a rotation vector and a translation per view.
+static const int CALIBRATION_INTRINSICS = 4;
+static const int CALIBRATION_POSE       = 6;
+
+// Residual of a corner that lands behind the camera, in pixels.
+static const double BEHIND_CAMERA_PX = 1e4;
+
+/**
+ * @brief Number of distortion terms fitted for a lens model.
+ */
+static int distortionTerms(LensModel model) {
+    return model == LensModel::PINHOLE ? 2 : 4;
+}
+
+/**
+ * @brief Rotation matrix of a rotation vector (Rodrigues).
+ */
+static void rotationMatrix(const double r[3], double m[3][3]) {
+    double angle = sqrt(r[0] * r[0] + r[1] * r[1] + r[2] * r[2]);
+    if (angle < 1e-12) {
+        for (int i = 0; i < 3; i++) {
+            for (int j = 0; j < 3; j++) m[i][j] = (i == j) ? 1.0 : 0.0;
+        }
+        return;
+    }
+    double x = r[0] / angle, y = r[1] / angle, z = r[2] / angle;
+    double c = cos(angle), s = sin(angle), t = 1.0 - c;
+    m[0][0] = t * x * x + c;     m[0][1] = t * x * y - s * z; m[0][2] = t * x * z + s * y;
+    m[1][0] = t * x * y + s * z; m[1][1] = t * y * y + c;     m[1][2] = t * y * z - s * x;
+    m[2][0] = t * x * z - s * y; m[2][1] = t * y * z + s * x; m[2][2] = t * z * z + c;
+}
+
+/**
+ * @brief Rotation vector of a rotation matrix.
+ */
+static void rotationVector(const double m[3][3], double r[3]) {
+    double c     = std::clamp((m[0][0] + m[1][1] + m[2][2] - 1.0) / 2.0, -1.0, 1.0);
+    double angle = acos(c);
+    double axis[3] = {m[2][1] - m[1][2], m[0][2] - m[2][0], m[1][0] - m[0][1]};
+    double length  = sqrt(axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2]);
+
+    if (length < 1e-9) {
+        // No rotation, or half a turn: take the axis from the diagonal
+        if (angle < 1e-6) {
+            r[0] = r[1] = r[2] = 0.0;
+            return;
+        }
+        for (int i = 0; i < 3; i++) axis[i] = sqrt(std::max(0.0, (m[i][i] + 1.0) / 2.0));
+        if (m[0][1] < 0) axis[1] = -axis[1];
+        if (m[0][2] < 0) axis[2] = -axis[2];
+        length = sqrt(axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2]);
+    }
+    for (int i = 0; i < 3; i++) r[i] = axis[i] / length * angle;
+}
+
+/**
+ * @brief Solve a x = b in place by Gaussian elimination with partial pivoting.
+ *
+ * @param a n x n matrix, row major. Destroyed.
+ * @param b Right hand side, replaced by the solution.
+ * @param n Size.
+ * @return false if the matrix is singular.
+ */
+static bool solveLinear(std::vector<double> &a, std::vector<double> &b, int n) {
+    for (int col = 0; col < n; col++) {
+        int pivot = col;
+        for (int row = col + 1; row < n; row++) {
+            if (std::abs(a[row * n + col]) > std::abs(a[pivot * n + col])) pivot = row;
+        }
+        if (std::abs(a[pivot * n + col]) < 1e-300) return false;
+        if (pivot != col) {
+            for (int k = 0; k < n; k++) std::swap(a[col * n + k], a[pivot * n + k]);
+            std::swap(b[col], b[pivot]);
+        }
+        for (int row = col + 1; row < n; row++) {
+            double f = a[row * n + col] / a[col * n + col];
+            if (f == 0.0) continue;
+            for (int k = col; k < n; k++) a[row * n + k] -= f * a[col * n + k];
+            b[row] -= f * b[col];
+        }
+    }
+    for (int row = n - 1; row >= 0; row--) {
+        double sum = b[row];
+        for (int k = row + 1; k < n; k++) sum -= a[row * n + k] * b[k];
+        b[row] = sum / a[row * n + row];
+    }
+    return true;
+}
+
+/**
+ * @brief Pose of a view from the homography of its corners.
+ *
+ * The corners are taken back to the ideal image plane with the initial
+ * intrinsics, ignoring the distortion, and the plane to plane homography is
+ * found by least squares. Its first two columns are the target axes in the
+ * camera frame and the third the target origin, up to scale.
+ *
+ * @param view   Corners of the view.
+ * @param camera Initial camera model.
+ * @param pose   Returned rotation vector and translation.
+ * @return false if the homography cannot be solved.
+ */
+static bool initialPose(const TargetView &view, const CameraModel &camera, double pose[CALIBRATION_POSE]) {
+    // h33 = 1, the other eight from the normal equations
+    std::vector<double> ata(64, 0.0), atb(8, 0.0);
+    for (const TargetPoint &p : view.points) {
+        double xn = (p.u - camera.cx) / camera.fx;
+        double yn = (p.v - camera.cy) / camera.fy;
+        double rows[2][8] = {{p.x, p.y, 1.0, 0.0, 0.0, 0.0, -xn * p.x, -xn * p.y},
+                             {0.0, 0.0, 0.0, p.x, p.y, 1.0, -yn * p.x, -yn * p.y}};
+        double rhs[2]     = {xn, yn};
+        for (int r = 0; r < 2; r++) {
+            for (int i = 0; i < 8; i++) {
+                for (int j = 0; j < 8; j++) ata[i * 8 + j] += rows[r][i] * rows[r][j];
+                atb[i] += rows[r][i] * rhs[r];
+            }
+        }
+    }
+    if (!solveLinear(ata, atb, 8)) return false;
+
+    double h1[3] = {atb[0], atb[3], atb[6]};
+    double h2[3] = {atb[1], atb[4], atb[7]};
+    double h3[3] = {atb[2], atb[5], 1.0};
+    double scale = (sqrt(h1[0] * h1[0] + h1[1] * h1[1] + h1[2] * h1[2]) +
+                    sqrt(h2[0] * h2[0] + h2[1] * h2[1] + h2[2] * h2[2])) / 2.0;
+    if (scale < 1e-12) return false;
+    if (h3[2] < 0) scale = -scale;  // The target is in front of the camera
+
+    // Orthonormal axes from the first two columns
+    double r1[3], r2[3], r3[3];
+    for (int i = 0; i < 3; i++) r1[i] = h1[i] / scale;
+    double n1 = sqrt(r1[0] * r1[0] + r1[1] * r1[1] + r1[2] * r1[2]);
+    for (int i = 0; i < 3; i++) r1[i] /= n1;
+    double d = 0.0;
+    for (int i = 0; i < 3; i++) d += r1[i] * h2[i] / scale;
+    for (int i = 0; i < 3; i++) r2[i] = h2[i] / scale - d * r1[i];
+    double n2 = sqrt(r2[0] * r2[0] + r2[1] * r2[1] + r2[2] * r2[2]);
+    for (int i = 0; i < 3; i++) r2[i] /= n2;
+    r3[0] = r1[1] * r2[2] - r1[2] * r2[1];
+    r3[1] = r1[2] * r2[0] - r1[0] * r2[2];
+    r3[2] = r1[0] * r2[1] - r1[1] * r2[0];
+
+    double m[3][3] = {{r1[0], r2[0], r3[0]}, {r1[1], r2[1], r3[1]}, {r1[2], r2[2], r3[2]}};
+    rotationVector(m, pose);
+    for (int i = 0; i < 3; i++) pose[3 + i] = h3[i] / scale;
+    return true;
+}
+
+/**
+ * @brief Camera model of a parameter vector.
+ */
+static CameraModel fittedCamera(const std::vector<double> &p, LensModel model, int width, int height) {
+    CameraModel camera;
+    camera.model  = model;
+    camera.fx     = p[0];
+    camera.fy     = p[1];
+    camera.cx     = p[2];
+    camera.cy     = p[3];
+    camera.width  = width;
+    camera.height = height;
+    const int terms = distortionTerms(model);
+    for (int i = 0; i < 4; i++) camera.k[i] = i < terms ? p[CALIBRATION_INTRINSICS + i] : 0.0;
+    return camera;
+}
+
+/**
+ * @brief Reprojection residuals of one view.
+ *
+ * @param camera Camera model.
+ * @param pose   Rotation vector and translation of the view.
+ * @param view   Corners of the view.
+ * @param out    Returned u and v error of every corner.
+ */
+static void viewResiduals(const CameraModel &camera, const double *pose, const TargetView &view, double *out) {
+    double m[3][3];
+    rotationMatrix(pose, m);
+
+    for (size_t i = 0; i < view.points.size(); i++) {
+        const TargetPoint &p = view.points[i];
+        double x = m[0][0] * p.x + m[0][1] * p.y + pose[3];
+        double y = m[1][0] * p.x + m[1][1] * p.y + pose[4];
+        double z = m[2][0] * p.x + m[2][1] * p.y + pose[5];
+        if (z <= 1e-9) {
+            out[2 * i]     = BEHIND_CAMERA_PX;
+            out[2 * i + 1] = BEHIND_CAMERA_PX;
+            continue;
+        }
+        double u, v;
+        lensPixel(camera, x, y, z, &u, &v);
+        out[2 * i]     = u - p.u;
+        out[2 * i + 1] = v - p.v;
+    }
+}
+
+/**
+ * @brief Reprojection residuals of all views.
+ *
+ * @param offsets First residual of each view.
+ * @return sum of the squared residuals.
+ */
+static double allResiduals(const std::vector<double> &p, const std::vector<TargetView> &views,
+                           const std::vector<int> &offsets, LensModel model, int width, int height,
+                           std::vector<double> &out) {
+    const CameraModel camera = fittedCamera(p, model, width, height);
+    const int         first  = CALIBRATION_INTRINSICS + distortionTerms(model);
+    for (size_t v = 0; v < views.size(); v++) {
+        viewResiduals(camera, &p[first + CALIBRATION_POSE * v], views[v], &out[offsets[v]]);
+    }
+    double sum = 0.0;
+    for (double r : out) sum += r * r;
+    return sum;
+}
+
+/**
+ * @brief Fit a calibration to views of a flat target.
+ *
+ * The Jacobian is taken by central differences. The intrinsics touch every
+ * residual, a pose only those of its own view, so only those are evaluated.
+ *
+ * @param views   Corners of each view.
+ * @param width   Frame width.
+ * @param height  Frame height.
+ * @param initial Nominal calibration to start from. Sets the lens model.
+ * @param result  Returned calibration and fit.
+ * @return error - 0 for no error, 1 if there are too few corners or the fit cannot be solved.
+ */
+int calibrateCamera(const std::vector<TargetView> &views, int width, int height, const CameraCalibration &initial,
+                    CalibrationResult *result) {
+    if ((int)views.size() < CALIBRATION_MIN_VIEWS) return 1;
+    for (const TargetView &view : views) {
+        if ((int)view.points.size() < CALIBRATION_MIN_POINTS) return 1;
+    }
+
+    const LensModel model  = initial.model;
+    const int       terms  = distortionTerms(model);
+    const int       first  = CALIBRATION_INTRINSICS + terms;
+    const int       n      = first + CALIBRATION_POSE * (int)views.size();
+
+    std::vector<int> offsets(views.size());
+    int residual_count = 0;
+    for (size_t v = 0; v < views.size(); v++) {
+        offsets[v]      = residual_count;
+        residual_count += 2 * (int)views[v].points.size();
+    }
+
+    // Start from the nominal intrinsics and the homography poses
+    const CameraModel nominal = makeCameraModel(initial, width, height, width, height, 0, 0);
+    std::vector<double> p(n, 0.0);
+    p[0] = nominal.fx;
+    p[1] = nominal.fy;
+    p[2] = nominal.cx;
+    p[3] = nominal.cy;
+    for (int i = 0; i < terms; i++) p[CALIBRATION_INTRINSICS + i] = initial.k[i];
+    for (size_t v = 0; v < views.size(); v++) {
+        if (!initialPose(views[v], nominal, &p[first + CALIBRATION_POSE * v])) return 1;
+    }
+
+    std::vector<double> residuals(residual_count), trial_residuals(residual_count);
+    std::vector<double> plus(residual_count), minus(residual_count);
+    std::vector<double> jacobian((size_t)residual_count * n);
+    std::vector<double> normal((size_t)n * n), gradient(n), step(n), trial(n);
+
+    double error     = allResiduals(p, views, offsets, model, width, height, residuals);
+    double lambda    = 1e-3;
+    bool   converged = false;
+    int    iteration = 0;
+
+    for (; iteration < CALIBRATION_ITERATIONS && !converged; iteration++) {
+        // Jacobian, one column per parameter
+        std::fill(jacobian.begin(), jacobian.end(), 0.0);
+        for (int j = 0; j < n; j++) {
+            const double h     = 1e-6 * std::max(std::abs(p[j]), 1.0);
+            const double saved = p[j];
+            int begin = 0, end = residual_count;
+            if (j >= first) {
+                int v = (j - first) / CALIBRATION_POSE;
+                begin = offsets[v];
+                end   = begin + 2 * (int)views[v].points.size();
+            }
+
+            p[j] = saved + h;
+            allResiduals(p, views, offsets, model, width, height, plus);
+            p[j] = saved - h;
+            allResiduals(p, views, offsets, model, width, height, minus);
+            p[j] = saved;
+            for (int r = begin; r < end; r++) jacobian[(size_t)r * n + j] = (plus[r] - minus[r]) / (2.0 * h);
+        }
+
+        // Normal equations
+        std::fill(normal.begin(), normal.end(), 0.0);
+        std::fill(gradient.begin(), gradient.end(), 0.0);
+        for (int r = 0; r < residual_count; r++) {
+            const double *row = &jacobian[(size_t)r * n];
+            for (int i = 0; i < n; i++) {
+                if (row[i] == 0.0) continue;
+                gradient[i] -= row[i] * residuals[r];
+                for (int k = i; k < n; k++) normal[(size_t)i * n + k] += row[i] * row[k];
+            }
+        }
+        for (int i = 0; i < n; i++) {
+            for (int k = 0; k < i; k++) normal[(size_t)i * n + k] = normal[(size_t)k * n + i];
+        }
+
+        // Damped step, raising the damping until the error falls
+        bool improved = false;
+        while (!improved && lambda < 1e12) {
+            std::vector<double> a = normal;
+            for (int i = 0; i < n; i++) a[(size_t)i * n + i] += lambda * std::max(normal[(size_t)i * n + i], 1e-12);
+            step = gradient;
+            if (!solveLinear(a, step, n)) return 1;
+
+            for (int i = 0; i < n; i++) trial[i] = p[i] + step[i];
+            double trial_error = allResiduals(trial, views, offsets, model, width, height, trial_residuals);
+            if (trial_error < error) {
+                converged = (error - trial_error) <= CALIBRATION_TOLERANCE * error;
+                p.swap(trial);
+                residuals.swap(trial_residuals);
+                error    = trial_error;
+                lambda   = std::max(lambda / 10.0, 1e-12);
+                improved = true;
+            } else {
+                lambda *= 10.0;
+            }
+        }
+        // No step lowers the error any more: it is at the minimum
+        if (!improved) converged = true;
+    }
+
+    result->calibration.model = model;
+    result->calibration.fx    = p[0] / width;
+    result->calibration.fy    = p[1] / height;
+    result->calibration.cx    = p[2] / width;
+    result->calibration.cy    = p[3] / height;
+    for (int i = 0; i < 4; i++) result->calibration.k[i] = i < terms ? p[CALIBRATION_INTRINSICS + i] : 0.0;
+    result->rms_px     = sqrt(error / (residual_count / 2));
+    result->iterations = iteration;
+    result->converged  = converged;
+    return 0;
+}
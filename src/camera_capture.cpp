@@ -0,0 +1,417 @@
+#include <gst/gst.h>
+#include <gst/app/gstappsrc.h>
+#include <gst/video/video.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <sys/mman.h>
+#include <camera_capture.hpp>
+#include <trace.hpp>
+
+// One mapping of a sensor dmabuf, kept for the life of the source.
+struct CaptureMapping {
+    int      fd;
+    uint8_t *data;
+    size_t   length;
+};
+
+struct CaptureSource;
+
+// One sensor buffer. Its request goes back to the sensor when the last of
+// its memories is freed.
+struct CaptureSlot {
+    CaptureSource         *source;
+    int                    index;
+    std::vector<uint8_t *> planes;
+    std::vector<unsigned>  lengths;
+    std::atomic<int>       outstanding{0};  // Memories still held downstream.
+};
+
+// Capture state of one camera.
+struct CaptureSource {
+    std::string                               name;
+    const char                               *trace_name;   // Queue depth counter, interned.
+    GstElement                               *appsrc;
+    std::unique_ptr<CaptureBackend>           backend;
+    CaptureFormat                             format;
+    GstVideoFormat                            video_format;
+    std::vector<CaptureMapping>               mappings;
+    std::vector<std::unique_ptr<CaptureSlot>> slots;
+    std::atomic<long>                         frames{0};
+    std::atomic<long>                         dropped{0};
+    std::atomic<int>                          queued{0};
+    std::atomic<int>                          releasing{0};  // on_plane_released calls still using the source.
+    std::mutex                                mutex;        // Guards last and have_last.
+    CaptureFrameInfo                          last = {};
+    bool                                      have_last = false;
+};
+
+static std::mutex                   m_sources_mutex;
+static std::vector<CaptureSource *> m_sources;
+static std::vector<CaptureSource *> m_retired;        // Stopped by switchCapture, buffers still downstream.
+static GstCaps                     *m_timestamp_caps = NULL;
+
+/**
+ * @brief Map every dmabuf of the sensor buffers once.
+ *
+ * @param source  Capture source, gets the mappings and slots.
+ * @param buffers Planes of each buffer.
+ * @return error - 0 for no error, 1 if a buffer could not be mapped.
+ */
+static int mapBuffers(CaptureSource *source, const std::vector<std::vector<CapturePlane>> &buffers) {
+    for (size_t index = 0; index < buffers.size(); index++) {
+        auto slot    = std::make_unique<CaptureSlot>();
+        slot->source = source;
+        slot->index  = (int)index;
+        for (const CapturePlane &plane : buffers[index]) {
+            // A dmabuf is mapped whole, over all the planes in it
+            CaptureMapping *mapping = NULL;
+            for (CaptureMapping &known : source->mappings) {
+                if (known.fd == plane.fd) mapping = &known;
+            }
+            if (!mapping) {
+                size_t length = 0;
+                for (const std::vector<CapturePlane> &other : buffers) {
+                    for (const CapturePlane &p : other) {
+                        if (p.fd == plane.fd) length = std::max(length, (size_t)p.offset + p.length);
+                    }
+                }
+                void *data = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, plane.fd, 0);
+                if (data == MAP_FAILED) return 1;
+                source->mappings.push_back({plane.fd, (uint8_t *)data, length});
+                mapping = &source->mappings.back();
+            }
+            slot->planes.push_back(mapping->data + plane.offset);
+            slot->lengths.push_back(plane.length);
+        }
+        source->slots.push_back(std::move(slot));
+    }
+    return 0;
+}
+
+/**
+ * @brief Hand a buffer back to the sensor.
+ */
+static void requeue(CaptureSource *source, int index) {
+    if (source->backend->queue(index) == 0) source->queued++;
+    TRACE_COUNTER(source->trace_name, source->queued.load());
+}
+
+/**
+ * @brief A memory wrapping a sensor plane was freed.
+ *
+ * Called on whichever thread dropped the last reference. The source stays
+ * counted as in use until the requeue returns, so freeRetired cannot free a
+ * retired source between the last plane coming back and its requeue.
+ */
+static void on_plane_released(gpointer user_data) {
+    CaptureSlot   *slot   = (CaptureSlot *)user_data;
+    CaptureSource *source = slot->source;
+    source->releasing++;
+    if (--slot->outstanding == 0) requeue(source, slot->index);
+    source->releasing--;
+}
+
+/**
+ * @brief Convert a sensor timestamp to running time.
+ *
+ * As libcamerasrc: the monotonic clock and the pipeline clock advance
+ * together, so the sensor time is moved over by the difference of the two now.
+ *
+ * @param appsrc    Source element.
+ * @param sensor_ns Sensor timestamp, CLOCK_MONOTONIC.
+ * @param pts       Running time, set.
+ * @return false if the pipeline is not playing yet.
+ */
+static bool runningTime(GstElement *appsrc, int64_t sensor_ns, GstClockTime *pts) {
+    GstClock *clock = gst_element_get_clock(appsrc);
+    if (!clock) return false;
+    const GstClockTime base_time = gst_element_get_base_time(appsrc);
+    const GstClockTime gst_now   = gst_clock_get_time(clock);
+    gst_object_unref(clock);
+
+    const int64_t sys_now       = g_get_monotonic_time() * 1000;
+    const int64_t sys_base_time = sys_now - (int64_t)(gst_now - base_time);
+    if (sensor_ns < sys_base_time) return false;
+    *pts = (GstClockTime)(sensor_ns - sys_base_time);
+    return true;
+}
+
+/**
+ * @brief Push a completed sensor buffer into the pipeline, without a copy.
+ *
+ * @param source Capture source.
+ * @param index  Buffer index.
+ * @param info   Sensor metadata of the frame.
+ */
+static void on_capture_complete(CaptureSource *source, int index, const CaptureFrameInfo &info) {
+    source->queued--;
+    if (!info.ok) {
+        source->dropped++;
+        requeue(source, index);
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(source->mutex);
+        if (source->have_last && info.sequence > source->last.sequence + 1) {
+            source->dropped += (long)(info.sequence - source->last.sequence - 1);
+        }
+        source->last      = info;
+        source->have_last = true;
+    }
+
+    // Frames before the pipeline plays have no running time
+    GstClockTime pts;
+    if (!runningTime(source->appsrc, info.sensor_ns, &pts)) {
+        requeue(source, index);
+        return;
+    }
+
+    CaptureSlot *slot   = source->slots[index].get();
+    GstBuffer   *buffer = gst_buffer_new();
+    gsize        offsets[GST_VIDEO_MAX_PLANES] = {};
+    gint         strides[GST_VIDEO_MAX_PLANES] = {};
+    gsize        offset = 0;
+    slot->outstanding   = (int)slot->planes.size();
+    for (size_t plane = 0; plane < slot->planes.size(); plane++) {
+        gst_buffer_append_memory(buffer, gst_memory_new_wrapped((GstMemoryFlags)0, slot->planes[plane],
+                                                                slot->lengths[plane], 0, slot->lengths[plane],
+                                                                slot, on_plane_released));
+        offsets[plane] = offset;
+        strides[plane] = source->format.stride;
+        offset        += slot->lengths[plane];
+    }
+    // NV12 in one plane of the sensor, the chroma after the luma lines
+    if (source->video_format == GST_VIDEO_FORMAT_NV12 && slot->planes.size() == 1) {
+        offsets[1] = (gsize)source->format.stride * source->format.height;
+        strides[1] = source->format.stride;
+    }
+    gst_buffer_add_video_meta_full(buffer, GST_VIDEO_FRAME_FLAG_NONE, source->video_format, source->format.width,
+                                   source->format.height, source->video_format == GST_VIDEO_FORMAT_NV12 ? 2 : 1,
+                                   offsets, strides);
+    gst_buffer_add_reference_timestamp_meta(buffer, m_timestamp_caps, (GstClockTime)info.sensor_ns,
+                                            GST_CLOCK_TIME_NONE);
+    GST_BUFFER_PTS(buffer)      = pts;
+    GST_BUFFER_DURATION(buffer) = info.frame_duration_us > 0 ? (GstClockTime)info.frame_duration_us * 1000 :
+                                                               GST_SECOND / source->format.fps;
+    GST_BUFFER_OFFSET(buffer)   = info.sequence;
+
+    // The appsrc takes the buffer, and frees it when it is dropped
+    source->frames++;
+    gst_app_src_push_buffer(GST_APP_SRC(source->appsrc), buffer);
+}
+
+/**
+ * @brief Start capturing into an appsrc.
+ *
+ * @param source  appsrc of the pipeline. Its caps are set from the format.
+ * @param backend Camera to capture from.
+ * @param format  Pixel format, size and frame rate.
+ * @param depth   Sensor buffers.
+ * @param name    Camera name for the status.
+ * @return error - 0 for no error, 1 if the camera could not be started.
+ */
+int startCaptureSource(GstElement *source, std::unique_ptr<CaptureBackend> backend, const CaptureFormat &format,
+                       int depth, const char *name) {
+    if (!source || !backend) return 1;
+    GstVideoFormat video_format = gst_video_format_from_string(format.pixel_format.c_str());
+    if (video_format != GST_VIDEO_FORMAT_NV12 && video_format != GST_VIDEO_FORMAT_BGRx) return 1;
+
+    CaptureSource *capture = new CaptureSource;
+    capture->name          = name;
+    capture->trace_name    = g_intern_string((std::string(name) + " capture queued").c_str());
+    capture->appsrc        = source;
+    capture->backend       = std::move(backend);
+    capture->format        = format;
+    capture->video_format  = video_format;
+
+    std::vector<std::vector<CapturePlane>> buffers;
+    if (capture->backend->configure(&capture->format, depth, &buffers) != 0 || buffers.empty() ||
+        mapBuffers(capture, buffers) != 0) {
+        for (CaptureMapping &mapping : capture->mappings) munmap(mapping.data, mapping.length);
+        delete capture;
+        return 1;
+    }
+
+    GstCaps *caps = gst_caps_new_simple("video/x-raw",
+                                        "format",    G_TYPE_STRING,     format.pixel_format.c_str(),
+                                        "width",     G_TYPE_INT,        format.width,
+                                        "height",    G_TYPE_INT,        format.height,
+                                        "framerate", GST_TYPE_FRACTION, format.fps, 1,
+                                        NULL);
+    gst_app_src_set_caps(GST_APP_SRC(source), caps);
+    gst_caps_unref(caps);
+
+    {
+        std::lock_guard<std::mutex> lock(m_sources_mutex);
+        if (!m_timestamp_caps) m_timestamp_caps = gst_caps_new_empty_simple(CAPTURE_TIMESTAMP_CAPS);
+        m_sources.push_back(capture);
+    }
+
+    capture->queued = (int)capture->slots.size();
+    if (capture->backend->start([capture](int index, const CaptureFrameInfo &info) {
+            on_capture_complete(capture, index, info);
+        }) != 0) {
+        std::lock_guard<std::mutex> lock(m_sources_mutex);
+        m_sources.pop_back();
+        for (CaptureMapping &mapping : capture->mappings) munmap(mapping.data, mapping.length);
+        delete capture;
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Start capturing into the source of a camera pipeline.
+ *
+ * @param pipeline Camera pipeline, with an appsrc named "<name>_source".
+ * @param camera   Camera settings.
+ * @return error - 0 for no error, 1 if the camera could not be started.
+ */
+int startCapture(GstElement *pipeline, const CameraConfig &camera) {
+    GstElement *source = gst_bin_get_by_name(GST_BIN(pipeline), (camera.name + "_source").c_str());
+    if (!source) return 1;
+
+    // The horizon overlay is drawn on BGRx, the other cameras stay in NV12 (see pipeline_builder.cpp)
+    const CaptureFormat format = {camera.horizon ? "BGRx" : "NV12", camera.width, camera.height, camera.fps, 0};
+    std::unique_ptr<CaptureBackend> backend =
+        camera.sensor == CAPTURE_FAKE_SENSOR ? makeFakeBackend() : makeLibcameraBackend(camera.sensor);
+    int error = startCaptureSource(source, std::move(backend), format, camera.capture_depth, camera.name.c_str());
+    gst_object_unref(source);
+    return error;
+}
+
+/**
+ * @brief Unmap and free the retired sources whose buffers are all back.
+ *
+ * Called with the sources mutex held. The planes are checked before the
+ * releases in progress: a release that took the last plane back has already
+ * counted itself by then.
+ */
+static void freeRetired() {
+    std::erase_if(m_retired, [](CaptureSource *source) {
+        for (const std::unique_ptr<CaptureSlot> &slot : source->slots) {
+            if (slot->outstanding > 0) return false;
+        }
+        if (source->releasing > 0) return false;
+        for (CaptureMapping &mapping : source->mappings) munmap(mapping.data, mapping.length);
+        delete source;
+        return true;
+    });
+}
+
+/**
+ * @brief Restart the capture of a camera pipeline at another size and frame rate.
+ *
+ * The pipeline keeps playing. The sensor is stopped and started again with
+ * new buffers in the new format, and the appsrc caps follow, so downstream
+ * renegotiates with the first new frame. Frames of the old format still held
+ * downstream keep their buffers: the old source is retired, and unmapped by a
+ * later switch or by stopCaptures once all of them are back.
+ *
+ * @param pipeline Camera pipeline, with an appsrc named "<name>_source".
+ * @param camera   Camera settings.
+ * @param width    New frame width.
+ * @param height   New frame height.
+ * @param fps      New frame rate.
+ * @return error - 0 for no error, 1 if the camera has no capture source or could not be restarted.
+ */
+int switchCapture(GstElement *pipeline, const CameraConfig &camera, int width, int height, int fps) {
+    GstElement *source = gst_bin_get_by_name(GST_BIN(pipeline), (camera.name + "_source").c_str());
+    if (!source) return 1;
+
+    CaptureSource *old = NULL;
+    {
+        std::lock_guard<std::mutex> lock(m_sources_mutex);
+        freeRetired();
+        auto found = std::find_if(m_sources.begin(), m_sources.end(),
+                                  [&camera](CaptureSource *source) { return source->name == camera.name; });
+        if (found == m_sources.end()) {
+            gst_object_unref(source);
+            return 1;
+        }
+        old = *found;
+        m_sources.erase(found);
+        m_retired.push_back(old);
+    }
+
+    // The sensor is released before it is configured again. Buffers let go of from here on are not requeued.
+    old->backend->stop();
+
+    const CaptureFormat format = {old->format.pixel_format, width, height, fps, 0};
+    std::unique_ptr<CaptureBackend> backend =
+        camera.sensor == CAPTURE_FAKE_SENSOR ? makeFakeBackend() : makeLibcameraBackend(camera.sensor);
+    int error = startCaptureSource(source, std::move(backend), format, camera.capture_depth, camera.name.c_str());
+    gst_object_unref(source);
+    return error;
+}
+
+/**
+ * @brief Get the counters of a capture source.
+ *
+ * @param name   Camera name.
+ * @param status Counters, set.
+ * @return error - 0 for no error, 1 if the camera has no capture source.
+ */
+int captureStatus(const char *name, CaptureStatus *status) {
+    std::lock_guard<std::mutex> lock(m_sources_mutex);
+    for (CaptureSource *source : m_sources) {
+        if (source->name != name) continue;
+        status->frames  = source->frames;
+        status->dropped = source->dropped;
+        status->queued  = source->queued;
+        status->depth   = (int)source->slots.size();
+        std::lock_guard<std::mutex> last_lock(source->mutex);
+        status->last    = source->last;
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * @brief Get all capture sources as JSON.
+ *
+ * @return array with the counters and latest frame metadata of each source.
+ */
+std::string captureStatusJson() {
+    std::vector<std::string> names;
+    {
+        std::lock_guard<std::mutex> lock(m_sources_mutex);
+        for (CaptureSource *source : m_sources) names.push_back(source->name);
+    }
+
+    std::string json = "[";
+    for (const std::string &name : names) {
+        CaptureStatus status;
+        if (captureStatus(name.c_str(), &status) != 0) continue;
+        char entry[512];
+        snprintf(entry, sizeof(entry),
+                 "%s{\"camera\":\"%s\",\"frames\":%ld,\"dropped\":%ld,\"queued\":%d,\"depth\":%d,"
+                 "\"sequence\":%llu,\"sensor_ns\":%lld,\"exposure_us\":%d,\"analogue_gain\":%.3f,"
+                 "\"digital_gain\":%.3f,\"colour_temperature\":%d,\"frame_duration_us\":%lld}",
+                 json.size() > 1 ? "," : "", name.c_str(), status.frames, status.dropped, status.queued, status.depth,
+                 (unsigned long long)status.last.sequence, (long long)status.last.sensor_ns, status.last.exposure_us,
+                 status.last.analogue_gain, status.last.digital_gain, status.last.colour_temperature,
+                 (long long)status.last.frame_duration_us);
+        json += entry;
+    }
+    return json + "]";
+}
+
+/**
+ * @brief Stop all sensors and unmap their buffers.
+ */
+void stopCaptures() {
+    std::lock_guard<std::mutex> lock(m_sources_mutex);
+    for (CaptureSource *source : m_sources) {
+        source->backend->stop();
+        for (CaptureMapping &mapping : source->mappings) munmap(mapping.data, mapping.length);
+        delete source;
+    }
+    m_sources.clear();
+    freeRetired();
+}
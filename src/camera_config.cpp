@@ -0,0 +1,231 @@
+#include <iostream>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <camera_config.hpp>
+#include <video.hpp>
+
+/**
+ * @brief Get the two cameras of the mast.
+ *
+ * @return forward camera with the horizon overlay, then the docking camera.
+ */
+std::vector<CameraConfig> defaultCameraConfig() {
+    CameraConfig forward = {};
+    forward.name          = "forward";
+    forward.sensor        = "/base/axi/pcie@1000120000/rp1/i2c@88000/imx708@1a";
+    forward.width         = WIDTH;
+    forward.height        = HEIGHT;
+    forward.fps           = 30;
+    forward.port          = 5000;
+    forward.srt           = SRT_DEFAULT_OPTIONS;
+    forward.proxy_srt     = SRT_DEFAULT_OPTIONS;
+    forward.capture_depth = CAPTURE_DEFAULT_DEPTH;
+    forward.horizon       = true;
+    forward.encoder       = {8000, 4, 30};
+    forward.multicast_ttl = MULTICAST_DEFAULT_TTL;
+
+    CameraConfig docking = {};
+    docking.name          = "docking";
+    docking.sensor        = "/base/axi/pcie@1000120000/rp1/i2c@80000/imx477@1a";
+    docking.width         = WIDTH_2;
+    docking.height        = HEIGHT_2;
+    docking.fps           = 30;
+    docking.port          = 5001;
+    docking.srt           = SRT_DEFAULT_OPTIONS;
+    docking.proxy_srt     = SRT_DEFAULT_OPTIONS;
+    docking.capture_depth = CAPTURE_DEFAULT_DEPTH;
+    docking.docking       = true;
+    docking.denoise       = true;
+    docking.motion_watch  = true;
+    docking.pip_inset     = true;
+    docking.encoder       = {8000, 4, 30};
+    docking.multicast_ttl = MULTICAST_DEFAULT_TTL;
+
+    return {forward, docking};
+}
+
+/**
+ * @brief Parse an integer setting.
+ *
+ * @param text  Setting value.
+ * @param min   Smallest allowed value.
+ * @param max   Largest allowed value.
+ * @param value Returned value.
+ * @return false if the text is not a number in range.
+ */
+static bool parseSetting(const std::string &text, int min, int max, int *value) {
+    char *end;
+    long  number = strtol(text.c_str(), &end, 10);
+    if (text.empty() || *end != '\0' || number < min || number > max) return false;
+    *value = (int)number;
+    return true;
+}
+
+/**
+ * @brief Parse a space separated list of layer or stage names.
+ *
+ * @param text   Setting value.
+ * @param camera Camera receiving the flags.
+ * @return false if a name is unknown.
+ */
+static bool parseNames(const std::string &text, CameraConfig *camera) {
+    std::istringstream words(text);
+    std::string        word;
+    while (words >> word) {
+        if      (word == "horizon")      camera->horizon      = true;
+        else if (word == "docking")      camera->docking      = true;
+        else if (word == "denoise")      camera->denoise      = true;
+        else if (word == "motion_watch") camera->motion_watch = true;
+        else if (word == "pip_inset")    camera->pip_inset    = true;
+        else return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Parse a multicast group and port.
+ *
+ * @param text   Setting value, GROUP:PORT with an IPv4 multicast group.
+ * @param camera Camera receiving the group and port.
+ * @return false if the text is not a multicast group and port.
+ */
+static bool parseMulticast(const std::string &text, CameraConfig *camera) {
+    size_t colon = text.rfind(':');
+    if (colon == std::string::npos) return false;
+
+    std::string group = text.substr(0, colon);
+    in_addr     address;
+    if (inet_pton(AF_INET, group.c_str(), &address) != 1 || !IN_MULTICAST(ntohl(address.s_addr))) return false;
+    if (!parseSetting(text.substr(colon + 1), 1, 65535, &camera->multicast_port)) return false;
+    camera->multicast_group = group;
+    return true;
+}
+
+/**
+ * @brief Check a camera list for settings that cannot be built.
+ *
+ * @param cameras Camera list.
+ * @return error text, empty if the list is usable.
+ */
+static std::string checkCameras(const std::vector<CameraConfig> &cameras) {
+    if (cameras.empty()) return "no cameras";
+
+    int horizon = 0, docking = 0, pip_inset = 0;
+    for (size_t i = 0; i < cameras.size(); i++) {
+        const CameraConfig &camera = cameras[i];
+        if (camera.name.empty() || camera.name.find_first_not_of("abcdefghijklmnopqrstuvwxyz0123456789") != std::string::npos) {
+            return "camera names must be lower case letters and digits";
+        }
+        if (camera.sensor.empty()) return camera.name + " has no sensor";
+        if (camera.width == 0 || camera.height == 0 || camera.port == 0) {
+            return camera.name + " needs a width, height and port";
+        }
+        if ((camera.width | camera.height) & 1) return camera.name + " must have an even size";
+        if (camera.horizon && (camera.width != WIDTH || camera.height != HEIGHT)) {
+            return camera.name + " must be " + std::to_string(WIDTH) + "x" + std::to_string(HEIGHT) + " for the horizon overlay";
+        }
+        for (size_t j = 0; j < i; j++) {
+            if (cameras[j].name == camera.name) return "camera name " + camera.name + " is used twice";
+            if (cameras[j].port == camera.port) return "port " + std::to_string(camera.port) + " is used twice";
+            if (!camera.multicast_group.empty() && cameras[j].multicast_group == camera.multicast_group &&
+                cameras[j].multicast_port == camera.multicast_port) {
+                return "multicast " + camera.multicast_group + ":" + std::to_string(camera.multicast_port) + " is used twice";
+            }
+        }
+        horizon   += camera.horizon;
+        docking   += camera.docking;
+        pip_inset += camera.pip_inset;
+    }
+    if (horizon > 1 || docking > 1 || pip_inset > 1) {
+        return "horizon, docking and pip_inset can be given to one camera only";
+    }
+    return "";
+}
+
+/**
+ * @brief Read the camera list from a file.
+ *
+ * @param path Camera configuration file.
+ * @return camera list, the default cameras if the file is missing or bad.
+ */
+std::vector<CameraConfig> loadCameraConfig(const char *path) {
+    std::ifstream file(path);
+    if (!file) return defaultCameraConfig();
+
+    std::vector<CameraConfig> cameras;
+    std::string               line;
+    std::string               error;
+    int                       line_number = 0;
+
+    while (error.empty() && std::getline(file, line)) {
+        line_number++;
+        line = line.substr(0, line.find('#'));
+        size_t first = line.find_first_not_of(" \t\r");
+        if (first == std::string::npos) continue;
+        line = line.substr(first, line.find_last_not_of(" \t\r") - first + 1);
+
+        if (line == "[camera]") {
+            CameraConfig camera = {};
+            camera.fps           = 30;
+            camera.srt           = SRT_DEFAULT_OPTIONS;
+            camera.capture_depth = CAPTURE_DEFAULT_DEPTH;
+            camera.encoder       = {8000, 4, 30};
+            camera.multicast_ttl = MULTICAST_DEFAULT_TTL;
+            cameras.push_back(camera);
+            continue;
+        }
+
+        size_t equals = line.find('=');
+        if (cameras.empty() || equals == std::string::npos) {
+            error = "expected [camera] or key = value";
+            break;
+        }
+        std::string key   = line.substr(0, equals);
+        std::string value = line.substr(equals + 1);
+        key.erase(key.find_last_not_of(" \t") + 1);
+        value.erase(0, value.find_first_not_of(" \t"));
+
+        CameraConfig &camera = cameras.back();
+        bool ok = true;
+        if      (key == "name")          camera.name   = value;
+        else if (key == "sensor")        camera.sensor = value;
+        else if (key == "width")         ok = parseSetting(value, 64, 8192, &camera.width);
+        else if (key == "height")        ok = parseSetting(value, 64, 8192, &camera.height);
+        else if (key == "fps")           ok = parseSetting(value, 1, 120, &camera.fps);
+        else if (key == "port")          ok = parseSetting(value, 1, 65535, &camera.port);
+        else if (key == "srt")           camera.srt = value;
+        else if (key == "proxy_srt")     camera.proxy_srt = value;
+        else if (key == "capture_depth") ok = parseSetting(value, 2, 16, &camera.capture_depth);
+        else if (key == "overlay")       ok = parseNames(value, &camera);
+        else if (key == "stages")        ok = parseNames(value, &camera);
+        else if (key == "bitrate")       ok = parseSetting(value, 100, 100000, &camera.encoder.bitrate_kbps);
+        else if (key == "threads")       ok = parseSetting(value, 1, 16, &camera.encoder.threads);
+        else if (key == "key_int_max")   ok = parseSetting(value, 1, 1000, &camera.encoder.key_int_max);
+        else if (key == "multicast")     ok = parseMulticast(value, &camera);
+        else if (key == "multicast_ttl") ok = parseSetting(value, 1, 255, &camera.multicast_ttl);
+        else if (key == "multicast_iface") camera.multicast_iface = value;
+        else error = "unknown setting " + key;
+
+        if (!ok) error = "bad value for " + key;
+    }
+
+    // The proxy is served like the full stream unless it has its own options
+    for (CameraConfig &camera : cameras) {
+        if (camera.proxy_srt.empty()) camera.proxy_srt = camera.srt;
+    }
+
+    if (error.empty()) {
+        error = checkCameras(cameras);
+        line_number = 0;
+    }
+    if (!error.empty()) {
+        std::cerr << path;
+        if (line_number > 0) std::cerr << ":" << line_number;
+        std::cerr << ": " << error << ". Using the default cameras." << std::endl;
+        return defaultCameraConfig();
+    }
+    return cameras;
+}
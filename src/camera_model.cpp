@@ -0,0 +1,251 @@
+#include <camera_model.hpp>
+#include <cmath>
+
+static const double DEG = M_PI / 180.0;
+
+// Iterations used to invert the lens distortion.
+static const int UNDISTORT_ITERATIONS = 8;
+
+/**
+ * @brief 3x3 matrix product out = a * b.
+ */
+static void multiply(const double a[3][3], const double b[3][3], double out[3][3]) {
+    for (int r = 0; r < 3; r++) {
+        for (int c = 0; c < 3; c++) {
+            out[r][c] = a[r][0] * b[0][c] + a[r][1] * b[1][c] + a[r][2] * b[2][c];
+        }
+    }
+}
+
+/**
+ * @brief Rotation of the view up by `angle` (about the x axis).
+ *
+ * A camera pitched up sees a level direction lower in the frame.
+ */
+static void pitchMatrix(double angle, double m[3][3]) {
+    double c = cos(angle), s = sin(angle);
+    double r[3][3] = {{1, 0, 0}, {0, c, s}, {0, -s, c}};
+    for (int i = 0; i < 3; i++) for (int j = 0; j < 3; j++) m[i][j] = r[i][j];
+}
+
+/**
+ * @brief Rotation of the picture by `angle` about the optical axis.
+ *
+ * Uses the Cairo rotation direction, so the same angle that rotates the
+ * ladder in the overlay rotates the projection.
+ */
+static void screenMatrix(double angle, double m[3][3]) {
+    double c = cos(angle), s = sin(angle);
+    double r[3][3] = {{c, -s, 0}, {s, c, 0}, {0, 0, 1}};
+    for (int i = 0; i < 3; i++) for (int j = 0; j < 3; j++) m[i][j] = r[i][j];
+}
+
+/**
+ * @brief Rotation of the view to the right by `angle` (about the y axis).
+ */
+static void yawMatrix(double angle, double m[3][3]) {
+    double c = cos(angle), s = sin(angle);
+    double r[3][3] = {{c, 0, -s}, {0, 1, 0}, {s, 0, c}};
+    for (int i = 0; i < 3; i++) for (int j = 0; j < 3; j++) m[i][j] = r[i][j];
+}
+
+/**
+ * @brief Scale a calibration to a frame.
+ *
+ * @param calibration Lens calibration.
+ * @param full_width  Width of the full field of view frame.
+ * @param full_height Height of the full field of view frame.
+ * @param width       Width of the frame drawn on (the crop window).
+ * @param height      Height of the frame drawn on (the crop window).
+ * @param left        Left edge of the crop window in the full frame.
+ * @param top         Top edge of the crop window in the full frame.
+ * @return the camera model in pixels of the frame drawn on.
+ */
+CameraModel makeCameraModel(const CameraCalibration &calibration, int full_width, int full_height,
+                            int width, int height, int left, int top) {
+    CameraModel camera;
+    camera.model  = calibration.model;
+    camera.fx     = calibration.fx * full_width;
+    camera.fy     = calibration.fy * full_height;
+    camera.cx     = calibration.cx * full_width  - left;
+    camera.cy     = calibration.cy * full_height - top;
+    camera.width  = width;
+    camera.height = height;
+    for (int i = 0; i < 4; i++) camera.k[i] = calibration.k[i];
+    return camera;
+}
+
+/**
+ * @brief Build the level frame to camera frame rotation.
+ *
+ * The IMU pitch is applied first and the roll second, the same order the
+ * ladder has always been drawn in. The boresight then takes the IMU frame to
+ * the camera frame, which replaces the old cos(roll) scaled vertical offset.
+ *
+ * @param pitch     IMU pitch in degrees.
+ * @param roll      IMU roll in degrees.
+ * @param boresight Camera to IMU rotation.
+ * @return rotation from the level frame to the camera frame.
+ */
+CameraRotation cameraRotation(double pitch, double roll, const Boresight &boresight) {
+    double p[3][3], r[3][3], body[3][3];
+    pitchMatrix(pitch * DEG, p);
+    screenMatrix(-roll * DEG, r);
+    multiply(r, p, body);
+
+    double bp[3][3], br[3][3], by[3][3], tmp[3][3], mount[3][3];
+    pitchMatrix(boresight.pitch_deg * DEG, bp);
+    screenMatrix(-boresight.roll_deg * DEG, br);
+    yawMatrix(boresight.yaw_deg * DEG, by);
+    multiply(bp, by, tmp);
+    multiply(br, tmp, mount);
+
+    CameraRotation rotation;
+    multiply(mount, body, rotation.m);
+    return rotation;
+}
+
+/**
+ * @brief Apply the lens model to a camera frame ray.
+ *
+ * @param camera Camera model.
+ * @param x      Ray x (right).
+ * @param y      Ray y (down).
+ * @param z      Ray z (along the optical axis). Must be positive.
+ * @return u - Pixel column.
+ * @return v - Pixel row.
+ */
+void lensPixel(const CameraModel &camera, double x, double y, double z, double *u, double *v) {
+    const double *k = camera.k;
+    double xn, yn;
+
+    if (camera.model == LensModel::PINHOLE) {
+        xn = x / z;
+        yn = y / z;
+        double r2     = xn * xn + yn * yn;
+        double radial = 1.0 + r2 * (k[0] + r2 * (k[1] + r2 * k[2]));
+        xn *= radial;
+        yn *= radial;
+    } else {
+        double r      = sqrt(x * x + y * y);
+        double theta  = atan2(r, z);
+        double t2     = theta * theta;
+        double theta_d = theta * (1.0 + t2 * (k[0] + t2 * (k[1] + t2 * (k[2] + t2 * k[3]))));
+        double scale  = (r > 1e-9) ? theta_d / r : 1.0 / z;
+        xn = x * scale;
+        yn = y * scale;
+    }
+
+    *u = camera.fx * xn + camera.cx;
+    *v = camera.fy * yn + camera.cy;
+}
+
+/**
+ * @brief Project a level frame direction to a pixel.
+ *
+ * @param camera    Camera model.
+ * @param rotation  Level frame to camera frame rotation.
+ * @param elevation Elevation above the horizon in degrees.
+ * @param azimuth   Azimuth right of the bow in degrees.
+ * @return u - Pixel column.
+ * @return v - Pixel row.
+ * @return false if the direction is behind the camera.
+ */
+bool projectDirection(const CameraModel &camera, const CameraRotation &rotation,
+                      double elevation, double azimuth, double *u, double *v) {
+    double ce = cos(elevation * DEG);
+    double d[3] = {ce * sin(azimuth * DEG), -sin(elevation * DEG), ce * cos(azimuth * DEG)};
+
+    const double (*m)[3] = rotation.m;
+    double x = m[0][0] * d[0] + m[0][1] * d[1] + m[0][2] * d[2];
+    double y = m[1][0] * d[0] + m[1][1] * d[1] + m[1][2] * d[2];
+    double z = m[2][0] * d[0] + m[2][1] * d[1] + m[2][2] * d[2];
+    if (z <= 1e-6) return false;
+
+    lensPixel(camera, x, y, z, u, v);
+    return true;
+}
+
+/**
+ * @brief Camera frame ray through a pixel.
+ *
+ * The lens distortion is inverted by fixed point iteration (pinhole) or
+ * Newton's method (fisheye). Both converge in a few steps for real lenses.
+ *
+ * @param camera Camera model.
+ * @param u      Pixel column.
+ * @param v      Pixel row.
+ * @param ray    Returned ray (x, y, z), not normalized.
+ */
+void pixelRay(const CameraModel &camera, double u, double v, double ray[3]) {
+    const double *k  = camera.k;
+    double        xd = (u - camera.cx) / camera.fx;
+    double        yd = (v - camera.cy) / camera.fy;
+
+    if (camera.model == LensModel::PINHOLE) {
+        double x = xd, y = yd;
+        for (int i = 0; i < UNDISTORT_ITERATIONS; i++) {
+            double r2     = x * x + y * y;
+            double radial = 1.0 + r2 * (k[0] + r2 * (k[1] + r2 * k[2]));
+            x = xd / radial;
+            y = yd / radial;
+        }
+        ray[0] = x;
+        ray[1] = y;
+        ray[2] = 1.0;
+    } else {
+        double theta_d = sqrt(xd * xd + yd * yd);
+        double theta   = theta_d;
+        for (int i = 0; i < UNDISTORT_ITERATIONS; i++) {
+            double t2 = theta * theta;
+            double f  = theta * (1.0 + t2 * (k[0] + t2 * (k[1] + t2 * (k[2] + t2 * k[3])))) - theta_d;
+            double df = 1.0 + t2 * (3 * k[0] + t2 * (5 * k[1] + t2 * (7 * k[2] + t2 * 9 * k[3])));
+            theta -= f / df;
+        }
+        double s = (theta_d > 1e-9) ? sin(theta) / theta_d : 1.0;
+        ray[0] = xd * s;
+        ray[1] = yd * s;
+        ray[2] = cos(theta);
+    }
+}
+
+/**
+ * @brief Elevation of a camera frame ray.
+ *
+ * @param rotation Level frame to camera frame rotation.
+ * @param ray      Camera frame ray, as from pixelRay.
+ * @return elevation above the horizon in degrees.
+ */
+double rayElevation(const CameraRotation &rotation, const double ray[3]) {
+    // Back to the level frame (transpose of the rotation)
+    const double (*m)[3] = rotation.m;
+    double up   = -(m[0][1] * ray[0] + m[1][1] * ray[1] + m[2][1] * ray[2]);
+    double norm = sqrt(ray[0] * ray[0] + ray[1] * ray[1] + ray[2] * ray[2]);
+    return asin(up / norm) / DEG;
+}
+
+/**
+ * @brief Elevation of the ray through a pixel.
+ *
+ * @param camera   Camera model.
+ * @param rotation Level frame to camera frame rotation.
+ * @param u        Pixel column.
+ * @param v        Pixel row.
+ * @return elevation above the horizon in degrees.
+ */
+double pixelElevation(const CameraModel &camera, const CameraRotation &rotation, double u, double v) {
+    double ray[3];
+    pixelRay(camera, u, v, ray);
+    return rayElevation(rotation, ray);
+}
+
+/**
+ * @brief Azimuth the optical axis points at.
+ *
+ * @param rotation Level frame to camera frame rotation.
+ * @return azimuth right of the bow in degrees.
+ */
+double axisAzimuth(const CameraRotation &rotation) {
+    // Optical axis in the level frame is the third row of the rotation
+    return atan2(rotation.m[2][0], rotation.m[2][2]) / DEG;
+}
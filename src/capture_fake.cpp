@@ -0,0 +1,180 @@
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <ctime>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <camera_capture.hpp>
+
+static const int FAKE_STRIDE_ALIGN = 64;  // Lines padded as a sensor would, so strides are exercised.
+
+// Fake camera. One memfd per buffer, drawn by a frame thread at the frame
+// rate. A frame with no buffer queued is dropped, and its sequence number
+// skipped, as the sensor does.
+class FakeBackend : public CaptureBackend {
+public:
+    ~FakeBackend() override { stop(); }
+
+    int  configure(CaptureFormat *format, int depth, std::vector<std::vector<CapturePlane>> *buffers) override;
+    int  start(Completion completion) override;
+    int  queue(int buffer) override;
+    void stop() override;
+
+private:
+    void frameLoop();
+    void draw(uint8_t *data, uint64_t sequence);
+
+    CaptureFormat           format = {};
+    size_t                  size   = 0;
+    std::vector<int>        fds;
+    std::vector<uint8_t *>  maps;
+    std::mutex              mutex;    // Guards queued.
+    std::deque<int>         queued;
+    Completion              completion;
+    std::thread             thread;
+    std::atomic<bool>       running{false};
+};
+
+/**
+ * @brief Allocate the buffers.
+ *
+ * @param format  Format to capture. The stride is set.
+ * @param depth   Buffers to allocate.
+ * @param buffers Planes of each buffer, set.
+ * @return error - 0 for no error, 1 if the memory could not be allocated.
+ */
+int FakeBackend::configure(CaptureFormat *format, int depth, std::vector<std::vector<CapturePlane>> *buffers) {
+    const bool nv12 = format->pixel_format == "NV12";
+    format->stride  = ((nv12 ? format->width : format->width * 4) + FAKE_STRIDE_ALIGN - 1) & ~(FAKE_STRIDE_ALIGN - 1);
+    this->format    = *format;
+
+    const size_t luma = (size_t)format->stride * format->height;
+    size              = nv12 ? luma + luma / 2 : luma;
+    for (int index = 0; index < depth; index++) {
+        int fd = memfd_create("masthead-fake-camera", MFD_CLOEXEC);
+        if (fd < 0 || ftruncate(fd, size) != 0) {
+            if (fd >= 0) close(fd);
+            return 1;
+        }
+        void *data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (data == MAP_FAILED) {
+            close(fd);
+            return 1;
+        }
+        fds.push_back(fd);
+        maps.push_back((uint8_t *)data);
+
+        // NV12 as two planes of one buffer, as libcamera gives it
+        if (nv12) buffers->push_back({{fd, 0, (unsigned)luma}, {fd, (unsigned)luma, (unsigned)(luma / 2)}});
+        else      buffers->push_back({{fd, 0, (unsigned)luma}});
+    }
+    return 0;
+}
+
+/**
+ * @brief Draw a frame: a luma ramp moving down two lines a frame, grey chroma.
+ *
+ * @param data     Buffer.
+ * @param sequence Frame number.
+ */
+void FakeBackend::draw(uint8_t *data, uint64_t sequence) {
+    const int line = format.pixel_format == "NV12" ? format.width : format.width * 4;
+    for (int y = 0; y < format.height; y++) {
+        memset(data + (size_t)y * format.stride, (int)((y + 2 * sequence) & 0xff), line);
+    }
+    if (format.pixel_format == "NV12") {
+        memset(data + (size_t)format.stride * format.height, 128, (size_t)format.stride * format.height / 2);
+    }
+}
+
+/**
+ * @brief Frame thread body. Completes one queued buffer per frame interval.
+ */
+void FakeBackend::frameLoop() {
+    const auto period   = std::chrono::nanoseconds(1000000000 / format.fps);
+    auto       next     = std::chrono::steady_clock::now() + period;
+    uint64_t   sequence = 0;
+
+    while (running) {
+        std::this_thread::sleep_until(next);
+        next += period;
+        sequence++;
+
+        int buffer = -1;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!queued.empty()) {
+                buffer = queued.front();
+                queued.pop_front();
+            }
+        }
+        if (buffer < 0) continue;
+
+        // Exposure ends as the frame is read out, now
+        draw(maps[buffer], sequence);
+        timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        CaptureFrameInfo info   = {};
+        info.ok                 = true;
+        info.sequence           = sequence;
+        info.frame_duration_us  = period.count() / 1000;
+        info.exposure_us        = (int32_t)(info.frame_duration_us / 2);
+        info.sensor_ns          = (int64_t)now.tv_sec * 1000000000 + now.tv_nsec - info.exposure_us * 1000;
+        info.analogue_gain      = 1.0f;
+        info.digital_gain       = 1.0f;
+        info.colour_temperature = 5000;
+        completion(buffer, info);
+    }
+}
+
+/**
+ * @brief Start the frame thread with every buffer queued.
+ */
+int FakeBackend::start(Completion completion) {
+    if (maps.empty() || format.fps <= 0) return 1;
+    this->completion = completion;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (int index = 0; index < (int)maps.size(); index++) queued.push_back(index);
+    }
+    running = true;
+    thread  = std::thread(&FakeBackend::frameLoop, this);
+    return 0;
+}
+
+/**
+ * @brief Queue a buffer for a coming frame.
+ */
+int FakeBackend::queue(int buffer) {
+    if (!running || buffer < 0 || buffer >= (int)maps.size()) return 1;
+    std::lock_guard<std::mutex> lock(mutex);
+    queued.push_back(buffer);
+    return 0;
+}
+
+/**
+ * @brief Stop the frame thread and free the buffers.
+ */
+void FakeBackend::stop() {
+    running = false;
+    if (thread.joinable()) thread.join();
+    for (size_t index = 0; index < maps.size(); index++) {
+        munmap(maps[index], size);
+        close(fds[index]);
+    }
+    maps.clear();
+    fds.clear();
+}
+
+/**
+ * @brief Make a fake capture backend.
+ *
+ * @return backend.
+ */
+std::unique_ptr<CaptureBackend> makeFakeBackend() {
+    return std::make_unique<FakeBackend>();
+}
@@ -0,0 +1,222 @@
+#include <libcamera/libcamera.h>
+
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <camera_capture.hpp>
+
+using namespace libcamera;
+
+// libcamera allows one camera manager per process. It is shared by all
+// cameras and started with the first.
+static std::mutex                     m_manager_mutex;
+static std::unique_ptr<CameraManager> m_manager;
+
+// libcamera camera. One request per buffer, each made once and reused.
+class LibcameraBackend : public CaptureBackend {
+public:
+    explicit LibcameraBackend(const std::string &camera_name) : camera_name(camera_name) {}
+    ~LibcameraBackend() override { stop(); }
+
+    int  configure(CaptureFormat *format, int depth, std::vector<std::vector<CapturePlane>> *buffers) override;
+    int  start(Completion completion) override;
+    int  queue(int buffer) override;
+    void stop() override;
+
+private:
+    void onRequestCompleted(Request *request);
+
+    std::string                           camera_name;
+    std::shared_ptr<Camera>               camera;
+    std::unique_ptr<CameraConfiguration>  config;
+    std::unique_ptr<FrameBufferAllocator> allocator;
+    std::vector<std::unique_ptr<Request>> requests;
+    Stream                               *stream = NULL;
+    int                                   fps    = 30;
+    Completion                            completion;
+    std::mutex                            queue_mutex;       // Guards running and requests.
+    bool                                  running = false;
+};
+
+/**
+ * @brief Acquire and configure the camera, and allocate its buffers.
+ *
+ * @param format  Format to capture. The stride is set.
+ * @param depth   Buffers to allocate. The pipeline handler may give more.
+ * @param buffers Planes of each buffer, set.
+ * @return error - 0 for no error, 1 if the camera could not be set up.
+ */
+int LibcameraBackend::configure(CaptureFormat *format, int depth, std::vector<std::vector<CapturePlane>> *buffers) {
+    {
+        std::lock_guard<std::mutex> lock(m_manager_mutex);
+        if (!m_manager) {
+            m_manager = std::make_unique<CameraManager>();
+            if (m_manager->start() != 0) {
+                m_manager.reset();
+                return 1;
+            }
+        }
+        camera = m_manager->get(camera_name);
+    }
+    if (!camera || camera->acquire() != 0) {
+        std::cerr << "Camera " << camera_name << " is not available." << std::endl;
+        camera.reset();
+        return 1;
+    }
+
+    // XRGB8888 is B, G, R, X in memory, which is BGRx
+    const PixelFormat pixel_format = format->pixel_format == "BGRx" ? formats::XRGB8888 : formats::NV12;
+    config = camera->generateConfiguration({StreamRole::VideoRecording});
+    if (!config) return 1;
+    StreamConfiguration &stream_config = config->at(0);
+    stream_config.pixelFormat = pixel_format;
+    stream_config.size        = Size(format->width, format->height);
+    stream_config.bufferCount = depth;
+    if (config->validate() == CameraConfiguration::Invalid || stream_config.pixelFormat != pixel_format ||
+        stream_config.size != Size(format->width, format->height)) {
+        std::cerr << "Camera " << camera_name << " cannot capture " << format->pixel_format << " "
+                  << format->width << "x" << format->height << "." << std::endl;
+        return 1;
+    }
+    if (camera->configure(config.get()) != 0) return 1;
+
+    stream         = stream_config.stream();
+    format->stride = (int)stream_config.stride;
+    fps            = format->fps;
+    allocator      = std::make_unique<FrameBufferAllocator>(camera);
+    if (allocator->allocate(stream) < 0) return 1;
+
+    const std::vector<std::unique_ptr<FrameBuffer>> &frame_buffers = allocator->buffers(stream);
+    for (size_t index = 0; index < frame_buffers.size(); index++) {
+        std::unique_ptr<Request> request = camera->createRequest(index);
+        if (!request || request->addBuffer(stream, frame_buffers[index].get()) != 0) return 1;
+        requests.push_back(std::move(request));
+
+        std::vector<CapturePlane> planes;
+        for (const FrameBuffer::Plane &plane : frame_buffers[index]->planes()) {
+            planes.push_back({plane.fd.get(), plane.offset, plane.length});
+        }
+        buffers->push_back(planes);
+    }
+    return 0;
+}
+
+/**
+ * @brief Start the sensor at the frame rate, with every request queued.
+ *
+ * @param completion Called with each completed request.
+ * @return error - 0 for no error, 1 if the camera did not start.
+ */
+int LibcameraBackend::start(Completion completion) {
+    if (!camera || requests.empty()) return 1;
+    this->completion = completion;
+
+    // Fixed frame duration, so the exposure cannot stretch the frame interval
+    const int64_t frame_us = 1000000 / fps;
+    ControlList   controls(camera->controls());
+    controls.set(controls::FrameDurationLimits, Span<const int64_t, 2>({frame_us, frame_us}));
+    if (camera->start(&controls) != 0) return 1;
+    camera->requestCompleted.connect(this, &LibcameraBackend::onRequestCompleted);
+
+    bool queued = true;
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        running = true;
+        for (std::unique_ptr<Request> &request : requests) {
+            if (camera->queueRequest(request.get()) != 0) {
+                queued = false;
+                break;
+            }
+        }
+        running = queued;
+    }
+    // Left as stop would leave it, so stop does not stop it again
+    if (!queued) {
+        camera->stop();
+        camera->requestCompleted.disconnect(this);
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Queue a request again once its buffer is free.
+ *
+ * Called from whichever thread let go of the buffer last, so it can race
+ * stop. Once stop has begun no request is touched.
+ *
+ * @param buffer Buffer index, the request cookie.
+ * @return error - 0 for no error, 1 if the camera is stopped.
+ */
+int LibcameraBackend::queue(int buffer) {
+    std::lock_guard<std::mutex> lock(queue_mutex);
+    if (!running || buffer < 0 || buffer >= (int)requests.size()) return 1;
+    Request *request = requests[buffer].get();
+    request->reuse(Request::ReuseBuffers);
+    return camera->queueRequest(request) == 0 ? 0 : 1;
+}
+
+/**
+ * @brief Report a completed request with its sensor metadata.
+ *
+ * Runs on the libcamera thread.
+ */
+void LibcameraBackend::onRequestCompleted(Request *request) {
+    if (request->status() == Request::RequestCancelled) return;
+
+    const FrameBuffer  *buffer   = request->buffers().begin()->second;
+    const ControlList  &metadata = request->metadata();
+    CaptureFrameInfo    info     = {};
+    info.ok                 = request->status() == Request::RequestComplete &&
+                              buffer->metadata().status == FrameMetadata::FrameSuccess;
+    info.sequence           = buffer->metadata().sequence;
+    info.sensor_ns          = metadata.get(controls::SensorTimestamp).value_or((int64_t)buffer->metadata().timestamp);
+    info.exposure_us        = metadata.get(controls::ExposureTime).value_or(0);
+    info.analogue_gain      = metadata.get(controls::AnalogueGain).value_or(0.0f);
+    info.digital_gain       = metadata.get(controls::DigitalGain).value_or(0.0f);
+    info.colour_temperature = metadata.get(controls::ColourTemperature).value_or(0);
+    info.frame_duration_us  = metadata.get(controls::FrameDuration).value_or(0);
+    completion((int)request->cookie(), info);
+}
+
+/**
+ * @brief Stop the sensor and free its buffers.
+ *
+ * Requeues from buffers released during or after the stop are refused. The
+ * lock is not held while the camera stops, as the last completions can
+ * requeue. The mappings of the capture source keep the buffer memory valid
+ * for frames still downstream after the allocator frees it.
+ */
+void LibcameraBackend::stop() {
+    if (!camera) return;
+    bool was_running;
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        was_running = running;
+        running     = false;
+    }
+    if (was_running) {
+        camera->stop();
+        camera->requestCompleted.disconnect(this);
+    }
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        requests.clear();
+    }
+    if (allocator && stream) allocator->free(stream);
+    allocator.reset();
+    camera->release();
+    camera.reset();
+}
+
+/**
+ * @brief Make a libcamera capture backend.
+ *
+ * @param camera_name libcamera camera name, as libcamerasrc camera-name.
+ * @return backend. The camera is acquired by configure.
+ */
+std::unique_ptr<CaptureBackend> makeLibcameraBackend(const std::string &camera_name) {
+    return std::make_unique<LibcameraBackend>(camera_name);
+}
@@ -0,0 +1,495 @@
+#include <gst/gst.h>
+
+#include <chrono>
+#include <cstring>
+#include <ctime>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <capture_stamp.hpp>
+
+static const int STAMP_SLOTS        = 16;  // Frames that can be inside the encoder at once.
+static const int STAMP_PAYLOAD_SIZE = 16 + 3 * 8;
+
+// Stamping state of one encoder.
+struct StampedEncoder {
+    std::string      name;
+    GstElement      *encoder;
+    std::mutex       mutex;
+    GstClockTime     pts[STAMP_SLOTS];
+    CaptureStamp     stamps[STAMP_SLOTS];
+    int              next = 0;
+    LatencyHistogram processing = {};
+    LatencyHistogram encode     = {};
+};
+
+static std::mutex                     m_encoders_mutex;
+static std::vector<StampedEncoder *>  m_encoders;
+static bool                           m_metrics_started = false;
+
+/**
+ * @brief Get CLOCK_REALTIME in nanoseconds.
+ */
+int64_t realtimeNs() {
+    timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/**
+ * @brief Add a sample to a histogram.
+ *
+ * @param histogram Histogram to add to.
+ * @param ms        Latency in milliseconds.
+ */
+void addLatency(LatencyHistogram *histogram, double ms) {
+    int bucket = 0;
+    while (bucket < LATENCY_BUCKETS && ms > LATENCY_BUCKETS_MS[bucket]) bucket++;
+    histogram->counts[bucket]++;
+    histogram->count++;
+    histogram->sum_ms += ms;
+}
+
+/**
+ * @brief Write a histogram in the Prometheus text format.
+ *
+ * @param file      File to write to.
+ * @param name      Metric name.
+ * @param labels    Labels of the series, without braces.
+ * @param histogram Histogram to write.
+ */
+void writeLatencyHistogram(FILE *file, const char *name, const char *labels, const LatencyHistogram &histogram) {
+    long cumulative = 0;
+    for (int i = 0; i < LATENCY_BUCKETS; i++) {
+        cumulative += histogram.counts[i];
+        fprintf(file, "%s_bucket{%s,le=\"%g\"} %ld\n", name, labels, LATENCY_BUCKETS_MS[i], cumulative);
+    }
+    fprintf(file, "%s_bucket{%s,le=\"+Inf\"} %ld\n", name, labels, histogram.count);
+    fprintf(file, "%s_sum{%s} %.3f\n", name, labels, histogram.sum_ms);
+    fprintf(file, "%s_count{%s} %ld\n", name, labels, histogram.count);
+}
+
+/**
+ * @brief Estimate a quantile of a histogram, interpolating within its bucket.
+ *
+ * @param histogram Histogram to read.
+ * @param part      Quantile, 0 to 1.
+ * @return latency in milliseconds, -1 without samples. Samples over the last
+ *         bucket are reported as its bound.
+ */
+double latencyQuantile(const LatencyHistogram &histogram, double part) {
+    if (histogram.count == 0) return -1.0;
+    double rank  = part * histogram.count;
+    long   below = 0;
+    for (int i = 0; i < LATENCY_BUCKETS; i++) {
+        if (below + histogram.counts[i] >= rank && histogram.counts[i] > 0) {
+            double lower = i == 0 ? 0.0 : LATENCY_BUCKETS_MS[i - 1];
+            return lower + (LATENCY_BUCKETS_MS[i] - lower) * (rank - below) / histogram.counts[i];
+        }
+        below += histogram.counts[i];
+    }
+    return LATENCY_BUCKETS_MS[LATENCY_BUCKETS - 1];
+}
+
+/**
+ * @brief Build the SEI NAL unit carrying a stamp, with its start code.
+ *
+ * @param stamp Stamp to carry.
+ * @param nal   Output of CAPTURE_STAMP_NAL_MAX bytes.
+ * @return size of the NAL unit.
+ */
+size_t stampNal(const CaptureStamp &stamp, uint8_t *nal) {
+    uint8_t rbsp[2 + STAMP_PAYLOAD_SIZE + 1];
+    rbsp[0] = 5;                   // user_data_unregistered
+    rbsp[1] = STAMP_PAYLOAD_SIZE;
+    memcpy(rbsp + 2, CAPTURE_STAMP_UUID, sizeof(CAPTURE_STAMP_UUID));
+    const int64_t times[3] = {stamp.capture_ns, stamp.encoder_in_ns, stamp.encoder_out_ns};
+    for (int t = 0; t < 3; t++) {
+        for (int i = 0; i < 8; i++) rbsp[2 + 16 + t * 8 + i] = (uint8_t)((uint64_t)times[t] >> (56 - 8 * i));
+    }
+    rbsp[sizeof(rbsp) - 1] = 0x80;  // rbsp_trailing_bits
+
+    // Start code and NAL header, then the payload with emulation prevention
+    size_t size = 0;
+    nal[size++] = 0;
+    nal[size++] = 0;
+    nal[size++] = 0;
+    nal[size++] = 1;
+    nal[size++] = 6;
+    int zeros = 0;
+    for (uint8_t byte : rbsp) {
+        if (zeros >= 2 && byte <= 3) {
+            nal[size++] = 3;
+            zeros = 0;
+        }
+        nal[size++] = byte;
+        zeros = byte == 0 ? zeros + 1 : 0;
+    }
+    return size;
+}
+
+/**
+ * @brief Find the next start code.
+ *
+ * @return offset of the 00 00 01 start code, or size if there is none.
+ */
+static size_t nextStartCode(const uint8_t *data, size_t size, size_t from) {
+    for (size_t i = from; i + 3 <= size; i++) {
+        if (data[i] == 0 && data[i + 1] == 0 && data[i + 2] == 1) return i;
+    }
+    return size;
+}
+
+/**
+ * @brief Reader of the RBSP of a NAL unit, dropping the emulation prevention
+ *        bytes on the way.
+ */
+struct RbspReader {
+    const uint8_t *data;
+    size_t         at;     // Next byte of the escaped NAL unit.
+    size_t         end;
+    int            zeros = 0;
+
+    // Read the next RBSP byte. Returns false at the end of the NAL unit.
+    bool next(uint8_t *byte) {
+        if (at < end && zeros >= 2 && data[at] == 3) {
+            at++;
+            zeros = 0;
+        }
+        if (at >= end) return false;
+        *byte = data[at++];
+        zeros = *byte == 0 ? zeros + 1 : 0;
+        return true;
+    }
+
+    // The rest is the rbsp_trailing_bits, or nothing.
+    bool done() const {
+        RbspReader rest = *this;
+        uint8_t    byte;
+        return !rest.next(&byte) || byte == 0x80;
+    }
+};
+
+/**
+ * @brief Read an SEI message type or size, coded as ff bytes and a last byte.
+ *
+ * @return false if the NAL unit ends first.
+ */
+static bool readSeiValue(RbspReader *reader, size_t *value) {
+    uint8_t byte;
+    *value = 0;
+    do {
+        if (!reader->next(&byte)) return false;
+        *value += byte;
+    } while (byte == 0xff);
+    return true;
+}
+
+/**
+ * @brief Walk the messages of an SEI NAL unit for a capture stamp.
+ *
+ * Messages of any size are skipped, only the start of each is kept.
+ *
+ * @param reader Reader at the first message.
+ * @param stamp  Output stamp.
+ * @return 0 if a stamp was found, 1 otherwise.
+ */
+static int findStampMessage(RbspReader reader, CaptureStamp *stamp) {
+    size_t type, payload;
+    while (!reader.done() && readSeiValue(&reader, &type) && readSeiValue(&reader, &payload)) {
+        uint8_t start[STAMP_PAYLOAD_SIZE];
+        for (size_t i = 0; i < payload; i++) {
+            uint8_t byte;
+            if (!reader.next(&byte)) return 1;
+            if (i < sizeof(start)) start[i] = byte;
+        }
+        if (type != 5 || payload < STAMP_PAYLOAD_SIZE ||
+            memcmp(start, CAPTURE_STAMP_UUID, sizeof(CAPTURE_STAMP_UUID)) != 0) {
+            continue;
+        }
+
+        int64_t times[3];
+        for (int t = 0; t < 3; t++) {
+            uint64_t value = 0;
+            for (int i = 0; i < 8; i++) value = (value << 8) | start[16 + t * 8 + i];
+            times[t] = (int64_t)value;
+        }
+        *stamp = {times[0], times[1], times[2]};
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * @brief Find the capture stamp in an H.264 byte stream access unit.
+ *
+ * @param data  Access unit.
+ * @param size  Size of the access unit.
+ * @param stamp Output stamp.
+ * @return 0 if a stamp was found, 1 otherwise.
+ */
+int findCaptureStamp(const uint8_t *data, size_t size, CaptureStamp *stamp) {
+    for (size_t start = nextStartCode(data, size, 0); start < size;) {
+        size_t header = start + 3;
+        size_t end    = nextStartCode(data, size, header);
+        if (header < end && (data[header] & 0x1f) == 6 && findStampMessage({data, header + 1, end}, stamp) == 0) {
+            return 0;
+        }
+        start = end;
+    }
+    return 1;
+}
+
+/**
+ * @brief Buffer probe on the encoder sink pad. Notes when the frame was captured
+ *        and when it went in.
+ */
+static GstPadProbeReturn on_stamp_input(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    StampedEncoder *encoder = (StampedEncoder *)user_data;
+    GstClockTime    pts     = GST_BUFFER_PTS(GST_PAD_PROBE_INFO_BUFFER(info));
+    int64_t         now     = realtimeNs();
+
+    // The timestamp is the running time of the capture. Its age on the pipeline clock
+    // carries it over to the realtime clock.
+    int64_t   capture = now;
+    GstClock *clock   = gst_element_get_clock(encoder->encoder);
+    if (clock) {
+        GstClockTime captured = gst_element_get_base_time(encoder->encoder) + pts;
+        GstClockTime current  = gst_clock_get_time(clock);
+        if (GST_CLOCK_TIME_IS_VALID(pts) && current > captured) capture = now - (int64_t)(current - captured);
+        gst_object_unref(clock);
+    }
+
+    std::lock_guard<std::mutex> lock(encoder->mutex);
+    encoder->pts[encoder->next]    = pts;
+    encoder->stamps[encoder->next] = {capture, now, 0};
+    encoder->next = (encoder->next + 1) % STAMP_SLOTS;
+    addLatency(&encoder->processing, (now - capture) / 1e6);
+    return GST_PAD_PROBE_OK;
+}
+
+/**
+ * @brief Buffer probe on the encoder source pad. Puts the stamp of the frame
+ *        ahead of its first slice.
+ */
+static GstPadProbeReturn on_stamp_output(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    StampedEncoder *encoder = (StampedEncoder *)user_data;
+    GstBuffer      *buffer  = GST_PAD_PROBE_INFO_BUFFER(info);
+    GstClockTime    pts     = GST_BUFFER_PTS(buffer);
+    int64_t         now     = realtimeNs();
+
+    CaptureStamp stamp;
+    bool         found = false;
+    {
+        std::lock_guard<std::mutex> lock(encoder->mutex);
+        for (int i = 0; i < STAMP_SLOTS && GST_CLOCK_TIME_IS_VALID(pts); i++) {
+            if (encoder->pts[i] != pts) continue;
+            stamp = encoder->stamps[i];
+            stamp.encoder_out_ns = now;
+            encoder->pts[i]      = GST_CLOCK_TIME_NONE;
+            addLatency(&encoder->encode, (now - stamp.encoder_in_ns) / 1e6);
+            found = true;
+            break;
+        }
+    }
+    if (!found) return GST_PAD_PROBE_OK;
+
+    GstMapInfo map;
+    if (!gst_buffer_map(buffer, &map, GST_MAP_READ)) return GST_PAD_PROBE_OK;
+    size_t at = 0;
+    for (size_t start = nextStartCode(map.data, map.size, 0); start < map.size;
+         start = nextStartCode(map.data, map.size, start + 3)) {
+        int type = map.data[start + 3] & 0x1f;
+        if (type >= 1 && type <= 5) {
+            at = start > 0 && map.data[start - 1] == 0 ? start - 1 : start;
+            break;
+        }
+    }
+
+    uint8_t     nal[CAPTURE_STAMP_NAL_MAX];
+    size_t      nal_size = stampNal(stamp, nal);
+    GstBuffer  *stamped  = gst_buffer_new_allocate(NULL, map.size + nal_size, NULL);
+    gst_buffer_fill(stamped, 0,             map.data,      at);
+    gst_buffer_fill(stamped, at,            nal,           nal_size);
+    gst_buffer_fill(stamped, at + nal_size, map.data + at, map.size - at);
+    gst_buffer_unmap(buffer, &map);
+
+    gst_buffer_copy_into(stamped, buffer,
+                         (GstBufferCopyFlags)(GST_BUFFER_COPY_FLAGS | GST_BUFFER_COPY_TIMESTAMPS | GST_BUFFER_COPY_META),
+                         0, -1);
+    gst_buffer_unref(buffer);
+    GST_PAD_PROBE_INFO_DATA(info) = stamped;
+    return GST_PAD_PROBE_OK;
+}
+
+/**
+ * @brief Buffer probe on the receiver parser source pad. Reads the stamp of
+ *        each access unit as it arrives.
+ */
+static GstPadProbeReturn on_stamp_received(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    StampReceiver *receiver = (StampReceiver *)user_data;
+    GstBuffer     *buffer   = GST_PAD_PROBE_INFO_BUFFER(info);
+    int64_t        now      = realtimeNs();
+
+    GstMapInfo map;
+    if (!gst_buffer_map(buffer, &map, GST_MAP_READ)) return GST_PAD_PROBE_OK;
+    CaptureStamp stamp;
+    bool         found = findCaptureStamp(map.data, map.size, &stamp) == 0;
+    gst_buffer_unmap(buffer, &map);
+
+    std::lock_guard<std::mutex> lock(receiver->mutex);
+    if (!found) {
+        receiver->unstamped++;
+        return GST_PAD_PROBE_OK;
+    }
+    receiver->pts[receiver->next]         = GST_BUFFER_PTS(buffer);
+    receiver->stamps[receiver->next]      = stamp;
+    receiver->received_ns[receiver->next] = now;
+    receiver->next = (receiver->next + 1) % STAMP_RECEIVER_SLOTS;
+    addLatency(&receiver->hops[HOP_PROCESSING], (stamp.encoder_in_ns - stamp.capture_ns) / 1e6);
+    addLatency(&receiver->hops[HOP_ENCODE],     (stamp.encoder_out_ns - stamp.encoder_in_ns) / 1e6);
+    addLatency(&receiver->hops[HOP_NETWORK],    (now - stamp.encoder_out_ns) / 1e6);
+    return GST_PAD_PROBE_OK;
+}
+
+/**
+ * @brief Buffer probe on the receiver sink. Completes the hops of each decoded frame.
+ */
+static GstPadProbeReturn on_stamp_decoded(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    StampReceiver *receiver = (StampReceiver *)user_data;
+    GstClockTime   pts      = GST_BUFFER_PTS(GST_PAD_PROBE_INFO_BUFFER(info));
+    int64_t        now      = realtimeNs();
+
+    std::lock_guard<std::mutex> lock(receiver->mutex);
+    for (int i = 0; i < STAMP_RECEIVER_SLOTS && GST_CLOCK_TIME_IS_VALID(pts); i++) {
+        if (receiver->pts[i] != pts) continue;
+        addLatency(&receiver->hops[HOP_DECODE],     (now - receiver->received_ns[i]) / 1e6);
+        addLatency(&receiver->hops[HOP_END_TO_END], (now - receiver->stamps[i].capture_ns) / 1e6);
+        receiver->pts[i] = GST_CLOCK_TIME_NONE;
+        break;
+    }
+    return GST_PAD_PROBE_OK;
+}
+
+/**
+ * @brief Read the stamps of a receiving pipeline.
+ *
+ * @param pipeline    Receiving pipeline.
+ * @param parser_name Name of the h264parse.
+ * @param sink_name   Name of the sink of the decoded frames.
+ * @param receiver    Receiver state, kept by the caller.
+ * @return 0 on success, 1 on error.
+ */
+int attachStampReceiver(GstElement *pipeline, const char *parser_name, const char *sink_name, StampReceiver *receiver) {
+    GstElement *parser = gst_bin_get_by_name(GST_BIN(pipeline), parser_name);
+    GstElement *sink   = gst_bin_get_by_name(GST_BIN(pipeline), sink_name);
+    GstPad     *parsed  = parser ? gst_element_get_static_pad(parser, "src")  : NULL;
+    GstPad     *decoded = sink   ? gst_element_get_static_pad(sink,   "sink") : NULL;
+    if (parser) gst_object_unref(parser);
+    if (sink)   gst_object_unref(sink);
+    if (!parsed || !decoded) {
+        if (parsed)  gst_object_unref(parsed);
+        if (decoded) gst_object_unref(decoded);
+        return 1;
+    }
+
+    for (GstClockTime &pts : receiver->pts) pts = GST_CLOCK_TIME_NONE;
+    gst_pad_add_probe(parsed,  GST_PAD_PROBE_TYPE_BUFFER, on_stamp_received, receiver, NULL);
+    gst_pad_add_probe(decoded, GST_PAD_PROBE_TYPE_BUFFER, on_stamp_decoded,  receiver, NULL);
+    gst_object_unref(parsed);
+    gst_object_unref(decoded);
+    return 0;
+}
+
+/**
+ * @brief Write the sender hop histograms once a second.
+ *
+ * The file is replaced in one rename so the collector never reads half of it.
+ */
+static void metricsLoop() {
+    const std::string temp_path = std::string(CAPTURE_STAMP_METRICS) + ".tmp";
+    while (true) {
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+
+        FILE *file = fopen(temp_path.c_str(), "w");
+        if (!file) continue;
+        fprintf(file, "# HELP masthead_latency_ms Latency of each frame through the sender hops.\n"
+                      "# TYPE masthead_latency_ms histogram\n");
+        std::lock_guard<std::mutex> encoders_lock(m_encoders_mutex);
+        for (StampedEncoder *encoder : m_encoders) {
+            LatencyHistogram processing, encode;
+            {
+                std::lock_guard<std::mutex> lock(encoder->mutex);
+                processing = encoder->processing;
+                encode     = encoder->encode;
+            }
+            std::string labels = "camera=\"" + encoder->name + "\",hop=\"";
+            writeLatencyHistogram(file, "masthead_latency_ms", (labels + LATENCY_HOP_NAMES[HOP_PROCESSING] + "\"").c_str(),
+                                  processing);
+            writeLatencyHistogram(file, "masthead_latency_ms", (labels + LATENCY_HOP_NAMES[HOP_ENCODE] + "\"").c_str(),
+                                  encode);
+        }
+        fclose(file);
+        rename(temp_path.c_str(), CAPTURE_STAMP_METRICS);
+    }
+}
+
+/**
+ * @brief Stamp the access units of an encoder with the capture times.
+ *
+ * @param pipeline     Pipeline holding the encoder.
+ * @param encoder_name Name of the x264enc.
+ * @param camera       Camera name for the metrics.
+ * @return 0 on success, 1 on error.
+ */
+int startCaptureStamps(GstElement *pipeline, const char *encoder_name, const char *camera) {
+    GstElement *element = gst_bin_get_by_name(GST_BIN(pipeline), encoder_name);
+    if (!element) return 1;
+    GstPad *sink = gst_element_get_static_pad(element, "sink");
+    GstPad *src  = gst_element_get_static_pad(element, "src");
+    if (!sink || !src) {
+        if (sink) gst_object_unref(sink);
+        if (src)  gst_object_unref(src);
+        gst_object_unref(element);
+        return 1;
+    }
+
+    // Kept for the life of the process, like the pipeline
+    StampedEncoder *encoder = new StampedEncoder;
+    encoder->name    = camera;
+    encoder->encoder = element;
+    for (GstClockTime &pts : encoder->pts) pts = GST_CLOCK_TIME_NONE;
+    gst_pad_add_probe(sink, GST_PAD_PROBE_TYPE_BUFFER, on_stamp_input,  encoder, NULL);
+    gst_pad_add_probe(src,  GST_PAD_PROBE_TYPE_BUFFER, on_stamp_output, encoder, NULL);
+    gst_object_unref(sink);
+    gst_object_unref(src);
+
+    std::lock_guard<std::mutex> lock(m_encoders_mutex);
+    m_encoders.push_back(encoder);
+    if (!m_metrics_started) {
+        m_metrics_started = true;
+        std::thread(metricsLoop).detach();
+    }
+    return 0;
+}
+
+/**
+ * @brief Copy the sender hop histograms of a camera.
+ *
+ * @param camera     Camera name given to startCaptureStamps.
+ * @param processing Capture to encoder input, set.
+ * @param encode     Encoder input to output, set.
+ * @return error - 0 for no error, 1 if the camera is not stamped.
+ */
+int senderLatency(const char *camera, LatencyHistogram *processing, LatencyHistogram *encode) {
+    std::lock_guard<std::mutex> encoders_lock(m_encoders_mutex);
+    for (StampedEncoder *encoder : m_encoders) {
+        if (encoder->name != camera) continue;
+        std::lock_guard<std::mutex> lock(encoder->mutex);
+        *processing = encoder->processing;
+        *encode     = encoder->encode;
+        return 0;
+    }
+    return 1;
+}
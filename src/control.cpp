@@ -0,0 +1,472 @@
+#include <gst/gst.h>
+#include <gst/video/video.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <attitude_filter.hpp>
+#include <camera_capture.hpp>
+#include <control.hpp>
+#include <docking_mode.hpp>
+#include <overlay_config.hpp>
+#include <stream_profile.hpp>
+#include <trace.hpp>
+
+// Parsed JSON value. Only what the commands need: no unicode escapes, and
+// numbers are doubles.
+struct JsonValue {
+    enum Type { NUL, BOOLEAN, NUMBER, STRING, ARRAY, OBJECT };
+    Type                                           type    = NUL;
+    bool                                           boolean = false;
+    double                                         number  = 0.0;
+    std::string                                    text;
+    std::vector<JsonValue>                         items;
+    std::vector<std::pair<std::string, JsonValue>> members;
+};
+
+// Encoders whose bitrate can be changed and their camera names, in camera list order.
+static std::vector<GstElement *> m_encoders;
+static std::vector<std::string>  m_camera_names;
+
+// Commands run one at a time, whichever client sent them.
+static std::mutex       m_command_mutex;
+static std::atomic<int> m_clients{0};
+
+/**
+ * @brief Skip white space.
+ */
+static const char *skipSpace(const char *p) {
+    while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n') p++;
+    return p;
+}
+
+/**
+ * @brief Parse a JSON string.
+ *
+ * @param p    Text, at the opening quote.
+ * @param text Returned string.
+ * @return first character after the closing quote, NULL if malformed.
+ */
+static const char *parseString(const char *p, std::string *text) {
+    p++;
+    text->clear();
+    while (*p != '"') {
+        if (*p == '\0') return NULL;
+        if (*p == '\\') {
+            p++;
+            switch (*p) {
+                case '"':  case '\\': case '/': text->push_back(*p); break;
+                case 'n':  text->push_back('\n'); break;
+                case 't':  text->push_back('\t'); break;
+                default:   return NULL;
+            }
+        } else {
+            text->push_back(*p);
+        }
+        p++;
+    }
+    return p + 1;
+}
+
+/**
+ * @brief Parse a JSON value.
+ *
+ * @param p     Text.
+ * @param value Returned value.
+ * @param depth Nesting depth, limited so a hostile line cannot exhaust the stack.
+ * @return first character after the value, NULL if malformed.
+ */
+static const char *parseValue(const char *p, JsonValue *value, int depth = 0) {
+    if (depth > 8) return NULL;
+    p = skipSpace(p);
+
+    if (*p == '{' || *p == '[') {
+        bool object = *p == '{';
+        char close  = object ? '}' : ']';
+        value->type = object ? JsonValue::OBJECT : JsonValue::ARRAY;
+        p = skipSpace(p + 1);
+        if (*p == close) return p + 1;
+        while (true) {
+            JsonValue item;
+            if (object) {
+                std::string key;
+                if (*p != '"' || !(p = parseString(p, &key))) return NULL;
+                p = skipSpace(p);
+                if (*p != ':' || !(p = parseValue(p + 1, &item, depth + 1))) return NULL;
+                value->members.emplace_back(std::move(key), std::move(item));
+            } else {
+                if (!(p = parseValue(p, &item, depth + 1))) return NULL;
+                value->items.push_back(std::move(item));
+            }
+            p = skipSpace(p);
+            if (*p == close) return p + 1;
+            if (*p != ',') return NULL;
+            p = skipSpace(p + 1);
+        }
+    }
+    if (*p == '"') {
+        value->type = JsonValue::STRING;
+        return parseString(p, &value->text);
+    }
+    if (strncmp(p, "true", 4) == 0 || strncmp(p, "false", 5) == 0) {
+        value->type    = JsonValue::BOOLEAN;
+        value->boolean = *p == 't';
+        return p + (value->boolean ? 4 : 5);
+    }
+    if (strncmp(p, "null", 4) == 0) {
+        value->type = JsonValue::NUL;
+        return p + 4;
+    }
+
+    char *end;
+    value->type   = JsonValue::NUMBER;
+    value->number = strtod(p, &end);
+    if (end == p || !std::isfinite(value->number)) return NULL;
+    return end;
+}
+
+/**
+ * @brief Read an integer bitrate field.
+ *
+ * @param value Field value.
+ * @param kbps  Returned bitrate.
+ * @return false if the value is not a number in the allowed range.
+ */
+static bool bitrateField(const JsonValue &value, int *kbps) {
+    if (value.type != JsonValue::NUMBER) return false;
+    if (value.number < CONTROL_MIN_KBPS || value.number > CONTROL_MAX_KBPS) return false;
+    *kbps = (int)value.number;
+    return true;
+}
+
+/**
+ * @brief Read the ladder field into a settings snapshot.
+ *
+ * @param value  Field value, an array of [angle, width_ratio, display_text].
+ * @param config Settings receiving the lines.
+ * @return error text, NULL if the ladder is valid.
+ */
+static const char *ladderField(const JsonValue &value, OverlayConfig *config) {
+    if (value.type != JsonValue::ARRAY) return "ladder must be an array";
+    if ((int)value.items.size() > OVERLAY_MAX_LINES) return "too many ladder lines";
+
+    for (size_t i = 0; i < value.items.size(); i++) {
+        const JsonValue &line = value.items[i];
+        if (line.type != JsonValue::ARRAY || line.items.size() != 3 ||
+            line.items[0].type != JsonValue::NUMBER || line.items[1].type != JsonValue::NUMBER ||
+            line.items[2].type != JsonValue::BOOLEAN) {
+            return "ladder lines must be [angle, width_ratio, display_text]";
+        }
+        if (fabs(line.items[0].number) > 90.0) return "ladder angle out of range";
+        if (line.items[1].number <= 0.0 || line.items[1].number > 1.0) return "ladder width_ratio out of range";
+        config->lines[i].angle        = (int)lround(line.items[0].number);
+        config->lines[i].width_ratio  = (float)line.items[1].number;
+        config->lines[i].display_text = line.items[2].boolean;
+    }
+    config->line_count = (int)value.items.size();
+    return NULL;
+}
+
+/**
+ * @brief Read an attitude filter field into filter settings.
+ *
+ * @param key      Field name.
+ * @param value    Field value.
+ * @param settings Settings receiving the value.
+ * @return error text, NULL if the value is valid.
+ */
+static const char *attitudeFilterField(const std::string &key, const JsonValue &value,
+                                       AttitudeFilterSettings *settings) {
+    if (key == "attitude_filter") {
+        if (value.type != JsonValue::STRING || !attitudeFilterType(value.text.c_str(), &settings->type)) {
+            return "attitude_filter must be none, one_euro, complementary or kalman";
+        }
+        return NULL;
+    }
+
+    // Name, setting and range of the tuning fields
+    struct Tuning {
+        const char *key;
+        double     *setting;
+        double      min, max;
+    };
+    const Tuning tunings[] = {
+        {"attitude_min_cutoff_hz",         &settings->min_cutoff_hz,         0.01, 10.0},
+        {"attitude_beta",                  &settings->beta,                  0.0,  10.0},
+        {"attitude_derivative_cutoff_hz",  &settings->derivative_cutoff_hz,  0.01, 10.0},
+        {"attitude_rest_time_constant_s",  &settings->rest_time_constant_s,  0.01, 5.0},
+        {"attitude_motion_rate_dps",       &settings->motion_rate_dps,       0.1,  180.0},
+        {"attitude_accel_noise_dps2",      &settings->accel_noise_dps2,      0.1,  1000.0},
+        {"attitude_measurement_noise_deg", &settings->measurement_noise_deg, 0.01, 10.0},
+    };
+    for (const Tuning &tuning : tunings) {
+        if (key != tuning.key) continue;
+        if (value.type != JsonValue::NUMBER || value.number < tuning.min || value.number > tuning.max) {
+            return "attitude filter setting out of range";
+        }
+        *tuning.setting = value.number;
+        return NULL;
+    }
+    return "unknown field";
+}
+
+/**
+ * @brief Change the bitrate of a playing encoder.
+ *
+ * x264enc reconfigures on its next frame. Forcing a key unit makes the new
+ * rate start on a clean key frame instead of partway through a GOP.
+ *
+ * @param encoder Encoder.
+ * @param kbps    New bitrate.
+ */
+void setEncoderBitrate(GstElement *encoder, int kbps) {
+    g_object_set(G_OBJECT(encoder), "bitrate", (guint)kbps, NULL);
+    gst_element_send_event(encoder, gst_video_event_new_upstream_force_key_unit(GST_CLOCK_TIME_NONE, TRUE, 0));
+}
+
+/**
+ * @brief Run one command line.
+ *
+ * Every field is checked first. The overlay settings are then published as
+ * one snapshot, picked up by the next frame drawn, and the encoder bitrates
+ * are set. The pipelines keep running throughout.
+ *
+ * @param line Command text.
+ * @return reply line.
+ */
+static std::string runCommand(const char *line) {
+    auto start = std::chrono::steady_clock::now();
+
+    JsonValue   command;
+    const char *end = parseValue(line, &command);
+    if (!end || *skipSpace(end) != '\0' || command.type != JsonValue::OBJECT) {
+        return "{\"ok\":false,\"error\":\"expected one JSON object\"}";
+    }
+
+    OverlayConfig          config   = *overlayConfig();
+    bool                   overlay  = false;
+    std::vector<int>       bitrates(m_encoders.size(), 0);
+    bool                   trace    = false;
+    bool                   capture  = false;
+    int                    docking  = -1;      // Docking mode wanted, -1 to leave it.
+    AttitudeFilterSettings filter   = attitudeFilterSettings();
+    bool                   filters  = false;   // Filter settings changed.
+    const char            *error    = NULL;
+
+    for (const auto &[key, value] : command.members) {
+        int camera, length = 0;
+        if (sscanf(key.c_str(), "camera%d_bitrate%n", &camera, &length) == 1 && length == (int)key.size()) {
+            if (camera < 1 || camera > (int)m_encoders.size()) {
+                error = "no such camera";
+            } else if (!bitrateField(value, &bitrates[camera - 1])) {
+                error = "bitrate out of range";
+            }
+        } else if (key == "boresight_pitch" || key == "boresight_roll" || key == "boresight_yaw") {
+            if (value.type != JsonValue::NUMBER || fabs(value.number) > 45.0) {
+                error = "boresight angles must be numbers within 45 degrees";
+            } else {
+                double &angle = key == "boresight_pitch" ? config.boresight.pitch_deg :
+                                key == "boresight_roll"  ? config.boresight.roll_deg  : config.boresight.yaw_deg;
+                angle   = value.number;
+                overlay = true;
+            }
+        } else if (key == "debug_text") {
+            if (value.type != JsonValue::BOOLEAN) {
+                error = "debug_text must be true or false";
+            } else {
+                config.debug_text = value.boolean;
+                overlay           = true;
+            }
+        } else if (key == "ladder") {
+            error   = ladderField(value, &config);
+            overlay = true;
+        } else if (key == "trace_dump") {
+            if (value.type != JsonValue::BOOLEAN) error = "trace_dump must be true or false";
+            else                                  trace = value.boolean;
+        } else if (key == "capture_status") {
+            if (value.type != JsonValue::BOOLEAN) error = "capture_status must be true or false";
+            else                                  capture = value.boolean;
+        } else if (key == "docking_mode") {
+            if (value.type != JsonValue::BOOLEAN) error = "docking_mode must be true or false";
+            else if (!DOCKING_MODE_ENABLED)       error = "docking mode is not enabled";
+            else                                  docking = value.boolean;
+        } else if (key.starts_with("attitude_")) {
+            error   = attitudeFilterField(key, value, &filter);
+            filters = true;
+        } else {
+            error = "unknown field";
+        }
+        if (error) return std::string("{\"ok\":false,\"error\":\"") + error + " (" + key + ")\"}";
+    }
+
+    if (overlay) publishOverlayConfig(config);
+    if (filters) setAttitudeFilter(filter);
+
+    // With the stream profile stage the bitrate goes through it, so the quality governor and
+    // docking mode scale the new rate instead of overwriting it or being overwritten
+    for (size_t camera = 0; camera < m_encoders.size(); camera++) {
+        if (bitrates[camera] == 0 || setStreamBitrate(m_camera_names[camera].c_str(), bitrates[camera]) == 0) continue;
+        setEncoderBitrate(m_encoders[camera], bitrates[camera]);
+    }
+
+    // Switching waits for the docking camera, so it goes after the quick settings
+    double switch_ms;
+    if (docking >= 0 && setDockingMode(docking == 1, &switch_ms) != 0) {
+        return "{\"ok\":false,\"error\":\"settings applied, docking mode not switched\"}";
+    }
+
+    // The snapshot is taken last so it holds the command above
+    std::string trace_path;
+    if (trace && dumpTrace(&trace_path) != 0) return "{\"ok\":false,\"error\":\"settings applied, trace not written\"}";
+
+    long apply_us = std::chrono::duration_cast<std::chrono::microseconds>(
+                        std::chrono::steady_clock::now() - start).count();
+    return "{\"ok\":true,\"version\":" + std::to_string(overlayConfig()->version) +
+           ",\"apply_us\":" + std::to_string(apply_us) +
+           (trace ? ",\"trace\":\"" + trace_path + "\"" : "") +
+           (capture ? ",\"capture\":" + captureStatusJson() : "") +
+           (filters ? ",\"attitude_filter\":" + attitudeFilterJson(filter) : "") +
+           (docking >= 0 ? ",\"docking\":" + dockingStatusJson() : "") + "}";
+}
+
+/**
+ * @brief Send a whole reply to a client.
+ *
+ * A client that went away must not take the process down with SIGPIPE, and
+ * one that stopped reading is given up on after CONTROL_CLIENT_TIMEOUT_S.
+ *
+ * @param client Connected socket.
+ * @param reply  Reply text.
+ * @param size   Reply length.
+ * @return error - 0 for no error, 1 if the client is gone or stalled.
+ */
+static int sendReply(int client, const char *reply, size_t size) {
+    while (size > 0) {
+        ssize_t sent = send(client, reply, size, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR) continue;
+        if (sent <= 0) return 1;
+        reply += sent;
+        size  -= sent;
+    }
+    return 0;
+}
+
+/**
+ * @brief Serve one client until it disconnects or goes quiet for
+ *        CONTROL_CLIENT_TIMEOUT_S.
+ *
+ * @param client Connected socket. Closed on return.
+ */
+static void serveClient(int client) {
+    timeval timeout = {CONTROL_CLIENT_TIMEOUT_S, 0};
+    setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    std::string pending;
+    char        buffer[512];
+    ssize_t     count;
+
+    while ((count = read(client, buffer, sizeof(buffer))) > 0) {
+        pending.append(buffer, count);
+
+        size_t newline;
+        bool   gone = false;
+        while (!gone && (newline = pending.find('\n')) != std::string::npos) {
+            std::string line  = pending.substr(0, newline);
+            pending.erase(0, newline + 1);
+            if (line.find_first_not_of(" \t\r") == std::string::npos) continue;
+
+            std::string reply;
+            {
+                std::lock_guard<std::mutex> lock(m_command_mutex);
+                reply = runCommand(line.c_str()) + "\n";
+            }
+            gone = sendReply(client, reply.data(), reply.size()) != 0;
+        }
+        if (gone) break;
+
+        if ((int)pending.size() > CONTROL_MAX_LINE) {
+            const char reply[] = "{\"ok\":false,\"error\":\"line too long\"}\n";
+            sendReply(client, reply, sizeof(reply) - 1);
+            break;
+        }
+    }
+    close(client);
+    m_clients--;
+}
+
+/**
+ * @brief Control socket thread body. Serves each client on its own thread, up
+ *        to CONTROL_MAX_CLIENTS at a time, so a slow client does not lock the
+ *        others out.
+ *
+ * @param listener Listening socket.
+ */
+static void controlLoop(int listener) {
+    int retry_ms = CONTROL_ACCEPT_RETRY_MS;
+    while (true) {
+        int client = accept4(listener, NULL, NULL, SOCK_CLOEXEC);
+        if (client < 0) {
+            // A client that went away is retried at once. Anything else, such
+            // as running out of file descriptors, lasts, so wait for it to clear.
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            std::this_thread::sleep_for(std::chrono::milliseconds(retry_ms));
+            retry_ms = std::min(retry_ms * 2, CONTROL_ACCEPT_RETRY_MAX_MS);
+            continue;
+        }
+        retry_ms = CONTROL_ACCEPT_RETRY_MS;
+        if (m_clients.fetch_add(1) >= CONTROL_MAX_CLIENTS) {
+            const char reply[] = "{\"ok\":false,\"error\":\"too many clients\"}\n";
+            sendReply(client, reply, sizeof(reply) - 1);
+            close(client);
+            m_clients--;
+            continue;
+        }
+        std::thread(serveClient, client).detach();
+    }
+}
+
+/**
+ * @brief Start serving the control socket.
+ *
+ * @param cameras Camera pipelines. Their encoder handles must outlive the socket.
+ * @return error - 0 for no error, 1 if the socket could not be opened.
+ */
+int startControlSocket(const std::vector<CameraPipeline> &cameras) {
+    for (const CameraPipeline &camera : cameras) {
+        m_encoders.push_back(camera.encoder);
+        m_camera_names.push_back(camera.config.name);
+    }
+
+    int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listener < 0) return 1;
+
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, CONTROL_SOCKET, sizeof(address.sun_path) - 1);
+
+    // A socket file left over from an earlier run would make bind fail
+    unlink(CONTROL_SOCKET);
+    if (bind(listener, (sockaddr *)&address, sizeof(address)) != 0 || listen(listener, CONTROL_MAX_CLIENTS) != 0) {
+        close(listener);
+        return 1;
+    }
+
+    std::thread(controlLoop, listener).detach();
+    return 0;
+}
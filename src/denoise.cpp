@@ -0,0 +1,222 @@
+#include <gst/gst.h>
+#include <gst/video/video.h>
+
+#include <cstdlib>
+#include <cstring>
+#include <denoise.hpp>
+#include <frame_stage.hpp>
+#include <worker_pool.hpp>
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Rise of the new frame weight per level of difference
+static const int DENOISE_SLOPE = (128 - DENOISE_STILL_WEIGHT + DENOISE_MOTION_DIFF - 1) / DENOISE_MOTION_DIFF;
+
+// State of the denoise stage of one camera. It lives as long as the probes on
+// the pad.
+struct Denoiser {
+    WorkerPool     pool {DENOISE_THREADS};
+    FrameStage     stage       = {"Temporal denoise"};
+    GstBuffer     *reference   = NULL;  // Private copy of the last output frame.
+    bool           primed      = false; // The reference holds a frame.
+    GstClockTime   last_pts    = GST_CLOCK_TIME_NONE;
+};
+
+/**
+ * @brief Motion adaptive blend of one row.
+ *
+ * out = ref + ((cur - ref) * w + 64) >> 7 with
+ * w = min(128, DENOISE_STILL_WEIGHT + |cur - ref| * DENOISE_SLOPE).
+ * Every intermediate fits in an int16_t, so the SIMD paths give exactly the
+ * same result as the scalar tail.
+ *
+ * @param current   Bytes of the new frame.
+ * @param reference Bytes of the previous output frame.
+ * @param out       Output bytes.
+ * @param count     Number of bytes.
+ */
+void temporalBlendRow(const uint8_t *current, const uint8_t *reference, uint8_t *out, int count) {
+    int i = 0;
+
+#if defined(__ARM_NEON)
+    const int16x8_t still = vdupq_n_s16(DENOISE_STILL_WEIGHT);
+    const int16x8_t full  = vdupq_n_s16(128);
+
+    auto blend = [&](uint8x8_t cur, uint8x8_t ref) {
+        int16x8_t diff   = vreinterpretq_s16_u16(vsubl_u8(cur, ref));
+        int16x8_t weight = vminq_s16(vmlaq_n_s16(still, vabsq_s16(diff), DENOISE_SLOPE), full);
+        int16x8_t step   = vrshrq_n_s16(vmulq_s16(diff, weight), 7);
+        return vqmovun_s16(vaddq_s16(vreinterpretq_s16_u16(vmovl_u8(ref)), step));
+    };
+
+    for (; i + 16 <= count; i += 16) {
+        uint8x16_t cur = vld1q_u8(current + i);
+        uint8x16_t ref = vld1q_u8(reference + i);
+        vst1q_u8(out + i, vcombine_u8(blend(vget_low_u8(cur), vget_low_u8(ref)),
+                                      blend(vget_high_u8(cur), vget_high_u8(ref))));
+    }
+#elif defined(__SSE2__)
+    const __m128i zero  = _mm_setzero_si128();
+    const __m128i still = _mm_set1_epi16(DENOISE_STILL_WEIGHT);
+    const __m128i full  = _mm_set1_epi16(128);
+    const __m128i slope = _mm_set1_epi16(DENOISE_SLOPE);
+    const __m128i round = _mm_set1_epi16(64);
+
+    auto blend = [&](__m128i cur, __m128i ref) {
+        __m128i diff     = _mm_sub_epi16(cur, ref);
+        __m128i abs_diff = _mm_max_epi16(diff, _mm_sub_epi16(zero, diff));
+        __m128i weight   = _mm_min_epi16(_mm_add_epi16(still, _mm_mullo_epi16(abs_diff, slope)), full);
+        __m128i step     = _mm_srai_epi16(_mm_add_epi16(_mm_mullo_epi16(diff, weight), round), 7);
+        return _mm_add_epi16(ref, step);
+    };
+
+    for (; i + 16 <= count; i += 16) {
+        __m128i cur = _mm_loadu_si128((const __m128i *)(current + i));
+        __m128i ref = _mm_loadu_si128((const __m128i *)(reference + i));
+        __m128i lo  = blend(_mm_unpacklo_epi8(cur, zero), _mm_unpacklo_epi8(ref, zero));
+        __m128i hi  = blend(_mm_unpackhi_epi8(cur, zero), _mm_unpackhi_epi8(ref, zero));
+        _mm_storeu_si128((__m128i *)(out + i), _mm_packus_epi16(lo, hi));
+    }
+#endif
+
+    for (; i < count; i++) {
+        int diff   = current[i] - reference[i];
+        int weight = DENOISE_STILL_WEIGHT + std::abs(diff) * DENOISE_SLOPE;
+        if (weight > 128) weight = 128;
+        out[i] = (uint8_t)(reference[i] + ((diff * weight + 64) >> 7));
+    }
+}
+
+/**
+ * @brief Blend the planes of two frames, split across the pool.
+ *
+ * Each output row is copied to the reference while it is still in the cache.
+ *
+ * @param den       Denoiser state.
+ * @param current   New frame.
+ * @param reference Previous output frame, replaced by the new one.
+ * @param out       Output frame.
+ */
+static void blendFrames(Denoiser *den, const Nv12Frame &current, const Nv12Frame &reference, const Nv12Frame &out) {
+    auto band_job = [&](int band, int bands) {
+        for (int plane = 0; plane < 2; plane++) {
+            int rows  = plane == 0 ? out.height : (out.height + 1) / 2;
+            int bytes = out.width;  // Y is one byte per pixel, UV two per half width sample
+            int cur_stride = plane == 0 ? current.y_stride   : current.uv_stride;
+            int ref_stride = plane == 0 ? reference.y_stride : reference.uv_stride;
+            int out_stride = plane == 0 ? out.y_stride       : out.uv_stride;
+            const uint8_t *cur = plane == 0 ? current.y   : current.uv;
+            uint8_t       *ref = plane == 0 ? reference.y : reference.uv;
+            uint8_t       *dst = plane == 0 ? out.y       : out.uv;
+
+            for (int row = rows * band / bands; row < rows * (band + 1) / bands; row++) {
+                temporalBlendRow(cur + row * cur_stride, ref + row * ref_stride, dst + row * out_stride, bytes);
+                memcpy(ref + row * ref_stride, dst + row * out_stride, bytes);
+            }
+        }
+    };
+
+    den->pool.run(den->pool.size() * 4, band_job);
+}
+
+/**
+ * @brief Denoise one frame into an output frame.
+ *
+ * The first frame, and the first frame after a gap (the valve was closed),
+ * is copied through to start a new reference.
+ *
+ * @param src     New frame.
+ * @param dst     Output frame.
+ * @param context Denoiser state.
+ */
+static void denoiseFrame(const Nv12Frame &src, const Nv12Frame &dst, void *context) {
+    Denoiser     *den = (Denoiser *)context;
+    GstVideoFrame ref_frame;
+    if (!gst_video_frame_map(&ref_frame, &den->stage.info, den->reference, GST_MAP_READWRITE)) {
+        copyNv12Frame(src, dst);
+        return;
+    }
+
+    Nv12Frame reference = nv12View(&ref_frame);
+    if (den->primed) {
+        blendFrames(den, src, reference, dst);
+    } else {
+        copyNv12Frame(src, dst);
+        copyNv12Frame(src, reference);
+        den->primed = true;
+    }
+    gst_video_frame_unmap(&ref_frame);
+}
+
+/**
+ * @brief Buffer probe that denoises each frame.
+ *
+ * Blends the incoming frame with the previous output into a buffer from the
+ * stage pool and hands that buffer downstream instead. The output is also
+ * copied to the private reference for the next frame.
+ *
+ * @param pad       Pad the probe is attached to.
+ * @param info      Probe info holding the buffer.
+ * @param user_data Denoiser state.
+ * @return GST_PAD_PROBE_OK to keep the data flowing.
+ */
+static GstPadProbeReturn on_denoise_frame(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    Denoiser *den = (Denoiser *)user_data;
+
+    // The pool is set up again after each caps change, so the reference starts over at the new size.
+    // It is a buffer of its own, so the output frames are not shared and the stages downstream can
+    // draw into them without a copy.
+    if (!den->stage.buffer_pool) {
+        if (!setupFrameStage(&den->stage, pad)) return GST_PAD_PROBE_OK;
+        if (den->reference) gst_buffer_unref(den->reference);
+        den->reference = gst_buffer_new_allocate(NULL, GST_VIDEO_INFO_SIZE(&den->stage.info), NULL);
+        den->primed    = false;
+    }
+
+    // Drop a stale reference
+    GstClockTime pts = GST_BUFFER_PTS(GST_PAD_PROBE_INFO_BUFFER(info));
+    if (den->primed && (!GST_CLOCK_TIME_IS_VALID(pts) || !GST_CLOCK_TIME_IS_VALID(den->last_pts) ||
+                        pts < den->last_pts || pts - den->last_pts > DENOISE_RESET_MS * GST_MSECOND)) {
+        den->primed = false;
+    }
+    den->last_pts = pts;
+
+    runFrameStage(&den->stage, info, denoiseFrame, den);
+    return GST_PAD_PROBE_OK;
+}
+
+/**
+ * @brief Free the denoise state of a camera once its frame probe is removed.
+ *
+ * The caps probe is removed along with it when the pad goes away.
+ */
+static void free_denoiser(gpointer user_data) {
+    Denoiser *den = (Denoiser *)user_data;
+    releaseFrameStage(&den->stage);
+    if (den->reference) gst_buffer_unref(den->reference);
+    delete den;
+}
+
+/**
+ * @brief Attach the temporal denoise stage to a pipeline.
+ *
+ * Adds a buffer probe to the source pad of the named element. The element
+ * is normally an identity placed after the stream valve, so the filter only
+ * runs while someone is watching.
+ *
+ * @param pipeline     Pipeline containing the element.
+ * @param element_name Name of the element to attach to.
+ * @return error - 0 for no error, 1 if the element was not found.
+ */
+int attachDenoise(GstElement *pipeline, const char *element_name) {
+    Denoiser *den = new Denoiser();
+    if (attachFrameStage(pipeline, element_name, &den->stage, on_denoise_frame, den, free_denoiser) != 0) {
+        delete den;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,374 @@
+#include <gst/gst.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <camera_capture.hpp>
+#include <capture_stamp.hpp>
+#include <docking_mode.hpp>
+#include <stream_profile.hpp>
+
+// Profile of the other cameras in docking mode, relative to their full stream.
+static const ProfileLimit DOCKING_STARVE_LIMIT = {DOCKING_STARVE_FPS, DOCKING_STARVE_SIZE_PERCENT,
+                                                  DOCKING_STARVE_BITRATE_PERCENT};
+
+// One camera as docking mode sees it.
+struct DockingCamera {
+    GstElement  *pipeline;
+    CameraConfig config;
+    GstElement  *source;
+    GstElement  *encoder;
+    GstElement  *capture_filter;  // Capture caps filter, the format asked of the source.
+};
+
+// Encoder settings docking mode changes, kept to go back to.
+struct EncoderSettings {
+    guint    vbv_buf_capacity;
+    gboolean intra_refresh;
+};
+
+// Docking mode state. It lives for the life of the pipelines.
+struct DockingState {
+    std::vector<DockingCamera>            cameras;
+    int                                   docking = -1;      // Index of the docking camera.
+    bool                                  on      = false;
+    EncoderSettings                       saved   = {};
+    std::mutex                            switch_mutex;       // One switch at a time.
+
+    // Switch in progress, shared with the streaming thread of the docking camera source
+    std::atomic<bool>                     waiting{false};
+    std::mutex                            mutex;              // Guards the fields below.
+    std::condition_variable               switched;
+    bool                                  arrived = false;    // The new caps went by, the next frame ends the switch.
+    int                                   width = 0, height = 0, fps = 0;
+    std::chrono::steady_clock::time_point start;
+    double                                switch_ms = -1.0;   // Time taken by the last switch.
+    double                                encoder_ms = -1.0;  // Time the encoder restart took in it.
+
+    // Docking camera hops, processing and encode: as counted at the last switch, and per mode since
+    LatencyHistogram                      mark[2]     = {};
+    LatencyHistogram                      modes[2][2] = {};   // [docking][hop].
+};
+
+static DockingState *m_docking = NULL;
+
+/**
+ * @brief Add the samples a histogram gained since a copy of it was taken.
+ *
+ * @param sum  Histogram receiving the samples.
+ * @param now  Histogram now.
+ * @param mark Earlier copy of it.
+ */
+static void addSince(LatencyHistogram *sum, const LatencyHistogram &now, const LatencyHistogram &mark) {
+    for (int i = 0; i <= LATENCY_BUCKETS; i++) sum->counts[i] += now.counts[i] - mark.counts[i];
+    sum->count  += now.count  - mark.count;
+    sum->sum_ms += now.sum_ms - mark.sum_ms;
+}
+
+/**
+ * @brief Count the docking camera hops since the last switch to the mode it was in.
+ *
+ * Called with the switch mutex held. Does nothing without capture stamps.
+ */
+static void settleLatency(DockingState *state) {
+    LatencyHistogram processing, encode;
+    if (senderLatency(state->cameras[state->docking].config.name.c_str(), &processing, &encode) != 0) return;
+    addSince(&state->modes[state->on][0], processing, state->mark[0]);
+    addSince(&state->modes[state->on][1], encode,     state->mark[1]);
+    state->mark[0] = processing;
+    state->mark[1] = encode;
+}
+
+/**
+ * @brief Probe on the docking camera source filter. Ends a switch at the first
+ *        frame in the new format.
+ */
+static GstPadProbeReturn on_docking_capture(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    DockingState *state = (DockingState *)user_data;
+    if (!state->waiting.load(std::memory_order_relaxed)) return GST_PAD_PROBE_OK;
+
+    std::lock_guard<std::mutex> lock(state->mutex);
+    if (GST_PAD_PROBE_INFO_TYPE(info) & GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM) {
+        GstEvent *event = GST_PAD_PROBE_INFO_EVENT(info);
+        if (GST_EVENT_TYPE(event) != GST_EVENT_CAPS) return GST_PAD_PROBE_OK;
+
+        GstCaps *caps;
+        gst_event_parse_caps(event, &caps);
+        const GstStructure *structure = gst_caps_get_structure(caps, 0);
+        int width = 0, height = 0, fps_n = 0, fps_d = 0;
+        gst_structure_get_int(structure, "width", &width);
+        gst_structure_get_int(structure, "height", &height);
+        gst_structure_get_fraction(structure, "framerate", &fps_n, &fps_d);
+        state->arrived = width == state->width && height == state->height && fps_d > 0 && fps_n == state->fps * fps_d;
+        return GST_PAD_PROBE_OK;
+    }
+
+    if (state->arrived) {
+        state->switch_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() -
+                                                                     state->start).count();
+        state->arrived   = false;
+        state->waiting   = false;
+        state->switched.notify_all();
+    }
+    return GST_PAD_PROBE_OK;
+}
+
+/**
+ * @brief Find the docking camera and get ready to switch.
+ *
+ * @param cameras Camera pipelines. Their handles must outlive docking mode.
+ * @return error - 0 for no error, 1 if there is no docking camera or an element was not found.
+ */
+int startDockingMode(const std::vector<CameraPipeline> &cameras) {
+    DockingState *state = new DockingState();
+    for (const CameraPipeline &camera : cameras) {
+        if (!camera.capture_caps || !camera.source || !camera.encoder) {
+            delete state;
+            return 1;
+        }
+        if (camera.config.docking) state->docking = (int)state->cameras.size();
+        state->cameras.push_back({camera.pipeline, camera.config, camera.source, camera.encoder, camera.capture_caps});
+    }
+    if (state->docking < 0) {
+        delete state;
+        return 1;
+    }
+
+    GstPad *pad = gst_element_get_static_pad(state->cameras[state->docking].capture_filter, "src");
+    gst_pad_add_probe(pad, (GstPadProbeType)(GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM),
+                      on_docking_capture, state, NULL);
+    gst_object_unref(pad);
+
+    m_docking = state;
+    return 0;
+}
+
+/**
+ * @brief Check whether an element has a property.
+ */
+static bool hasProperty(GstElement *element, const char *name) {
+    return g_object_class_find_property(G_OBJECT_GET_CLASS(element), name) != NULL;
+}
+
+/**
+ * @brief Copy a sticky event of the pad feeding the encoder to its sink pad.
+ */
+static gboolean resendStickyEvent(GstPad *pad, GstEvent **event, gpointer user_data) {
+    gst_pad_send_event((GstPad *)user_data, gst_event_ref(*event));
+    return TRUE;
+}
+
+/**
+ * @brief Blocking probe holding the frames back while the encoder restarts.
+ */
+static GstPadProbeReturn on_encoder_blocked(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    return GST_PAD_PROBE_OK;
+}
+
+/**
+ * @brief Set the docking camera encoder up for latency, or back as it was.
+ *
+ * x264enc only takes these in the READY state, so the encoder alone is taken
+ * down to READY and back while the pad feeding it is blocked. The sticky
+ * events (stream start, caps and segment) it lost on the way down are sent to
+ * it again before the block is lifted. The rest of the pipeline keeps playing.
+ * Encoders without the settings are left alone.
+ *
+ * @param state   Docking mode state, keeps the settings to go back to and
+ *                the time of the restart.
+ * @param encoder Docking camera encoder.
+ * @param on      Entering docking mode.
+ * @return error - 0 for no error, 1 if the encoder could not be restarted.
+ */
+static int setLatencyEncoder(DockingState *state, GstElement *encoder, bool on) {
+    if (!hasProperty(encoder, "vbv-buf-capacity") || !hasProperty(encoder, "intra-refresh")) return 0;
+    auto start = std::chrono::steady_clock::now();
+
+    GstPad *sink = gst_element_get_static_pad(encoder, "sink");
+    GstPad *feed = gst_pad_get_peer(sink);
+    if (!feed) {
+        gst_object_unref(sink);
+        return 1;
+    }
+    gulong block = gst_pad_add_probe(feed, GST_PAD_PROBE_TYPE_BLOCK_DOWNSTREAM, on_encoder_blocked, NULL, NULL);
+
+    int error = gst_element_set_state(encoder, GST_STATE_READY) == GST_STATE_CHANGE_FAILURE ? 1 : 0;
+    if (on) {
+        g_object_get(G_OBJECT(encoder), "vbv-buf-capacity", &state->saved.vbv_buf_capacity,
+                                        "intra-refresh",    &state->saved.intra_refresh, NULL);
+        g_object_set(G_OBJECT(encoder), "vbv-buf-capacity", (guint)DOCKING_MODE_VBV_MS, "intra-refresh", TRUE, NULL);
+    } else {
+        g_object_set(G_OBJECT(encoder), "vbv-buf-capacity", state->saved.vbv_buf_capacity,
+                                        "intra-refresh",    state->saved.intra_refresh, NULL);
+    }
+    if (!gst_element_sync_state_with_parent(encoder)) error = 1;
+    gst_pad_sticky_events_foreach(feed, resendStickyEvent, sink);
+
+    gst_pad_remove_probe(feed, block);
+    gst_object_unref(feed);
+    gst_object_unref(sink);
+
+    state->encoder_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    return error;
+}
+
+/**
+ * @brief Restart the source of a camera in another frame size and rate.
+ *
+ * The pixel format stays, and so does the size where width and height are 0.
+ * Frames of the old format can still be on their way to the source filter,
+ * so the filter lets both through, the new one first so it is the one a
+ * restarted source picks.
+ *
+ * @param camera Camera to switch.
+ * @param width  New frame width, 0 to keep it.
+ * @param height New frame height, 0 to keep it.
+ * @param fps    New frame rate.
+ * @return error - 0 for no error, 1 if the source could not be restarted.
+ */
+static int switchSource(const DockingCamera &camera, int width, int height, int fps) {
+    GstCaps *current = NULL;
+    g_object_get(G_OBJECT(camera.capture_filter), "caps", &current, NULL);
+    if (!current || gst_caps_is_empty(current) || gst_caps_is_any(current)) {
+        if (current) gst_caps_unref(current);
+        return 1;
+    }
+
+    GstCaps      *target    = gst_caps_copy_nth(current, 0);
+    GstStructure *structure = gst_caps_get_structure(target, 0);
+    if (width  > 0) gst_structure_set(structure, "width",  G_TYPE_INT, width,  NULL);
+    if (height > 0) gst_structure_set(structure, "height", G_TYPE_INT, height, NULL);
+    gst_structure_set(structure, "framerate", GST_TYPE_FRACTION, fps, 1, NULL);
+    gst_structure_get_int(structure, "width",  &width);
+    gst_structure_get_int(structure, "height", &height);
+
+    GstCaps *both = gst_caps_merge(target, gst_caps_copy_nth(current, 0));
+    g_object_set(G_OBJECT(camera.capture_filter), "caps", both, NULL);
+    gst_caps_unref(both);
+    gst_caps_unref(current);
+
+    // Native capture restarts the sensor itself. libcamerasrc and videotestsrc negotiate the new
+    // format as they start again. Everything downstream keeps playing.
+    if (CAMERA_CAPTURE_ENABLED && camera.config.sensor != TEST_SENSOR) {
+        return switchCapture(camera.pipeline, camera.config, width, height, fps);
+    }
+    if (gst_element_set_state(camera.source, GST_STATE_NULL) == GST_STATE_CHANGE_FAILURE) return 1;
+    return gst_element_sync_state_with_parent(camera.source) ? 0 : 1;
+}
+
+/**
+ * @brief Switch docking mode on or off.
+ *
+ * The docking camera encoder is set up first, then each camera is pinned to
+ * its docking mode profile (or let go) and its source restarted. The SRT
+ * sinks are not touched.
+ *
+ * @param on        Docking mode wanted.
+ * @param switch_ms Time until the docking camera delivered the new format, set.
+ *                  0 if the mode was already set, -1 if it timed out.
+ * @return error - 0 for no error, 1 if a camera could not be switched.
+ */
+int setDockingMode(bool on, double *switch_ms) {
+    *switch_ms = -1.0;
+    if (!m_docking) return 1;
+    DockingState *state = m_docking;
+
+    std::lock_guard<std::mutex> switch_lock(state->switch_mutex);
+    if (on == state->on) {
+        *switch_ms = 0.0;
+        return 0;
+    }
+    settleLatency(state);
+
+    const CameraConfig &docking = state->cameras[state->docking].config;
+    const int           width   = on ? (docking.width  * DOCKING_MODE_SIZE_PERCENT / 100) & ~1 : docking.width;
+    const int           height  = on ? (docking.height * DOCKING_MODE_SIZE_PERCENT / 100) & ~1 : docking.height;
+    const int           fps     = on ? DOCKING_MODE_FPS : docking.fps;
+    {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        state->width   = width;
+        state->height  = height;
+        state->fps     = fps;
+        state->arrived = false;
+        state->start   = std::chrono::steady_clock::now();
+        state->waiting = true;
+    }
+
+    int error = 0;
+    for (int index = 0; index < (int)state->cameras.size(); index++) {
+        const DockingCamera &camera = state->cameras[index];
+        const CameraConfig  &config = camera.config;
+        const StreamProfile  full   = {config.width, config.height, config.fps, config.encoder.bitrate_kbps};
+        if (index == state->docking) {
+            const StreamProfile pinned = {width, height, fps, config.encoder.bitrate_kbps};
+            if (setLatencyEncoder(state, camera.encoder, on) != 0 ||
+                pinStreamProfile(config.name.c_str(), on ? &pinned : NULL) != 0 ||
+                switchSource(camera, width, height, fps) != 0) {
+                fprintf(stderr, "Docking mode could not switch the %s camera.\n", config.name.c_str());
+                error = 1;
+            }
+        } else {
+            const StreamProfile starved = limitProfile(full, full, DOCKING_STARVE_LIMIT);
+            if (pinStreamProfile(config.name.c_str(), on ? &starved : NULL) != 0 ||
+                switchSource(camera, 0, 0, on ? DOCKING_STARVE_FPS : config.fps) != 0) {
+                fprintf(stderr, "Docking mode could not switch the %s camera.\n", config.name.c_str());
+                error = 1;
+            }
+        }
+    }
+    state->on = on;
+
+    std::unique_lock<std::mutex> lock(state->mutex);
+    if (state->switched.wait_for(lock, std::chrono::milliseconds(DOCKING_SWITCH_TIMEOUT_MS),
+                                 [state]() { return !state->waiting; })) {
+        *switch_ms = state->switch_ms;
+        g_print("Docking mode %s. The %s camera switched to %dx%d at %d fps in %.1f ms.\n", on ? "on" : "off",
+                docking.name.c_str(), width, height, fps, *switch_ms);
+    } else {
+        state->waiting = false;
+        g_print("Docking mode %s. The %s camera did not deliver %dx%d at %d fps within %d ms.\n", on ? "on" : "off",
+                docking.name.c_str(), width, height, fps, DOCKING_SWITCH_TIMEOUT_MS);
+    }
+    return error;
+}
+
+/**
+ * @brief Get docking mode as JSON.
+ *
+ * @return object with the mode, the time of the last switch and, with
+ *         capture stamps, the median hops of the docking camera per mode.
+ */
+std::string dockingStatusJson() {
+    if (!m_docking) return "{\"docking_mode\":false}";
+    DockingState *state = m_docking;
+
+    std::lock_guard<std::mutex> switch_lock(state->switch_mutex);
+    LatencyHistogram modes[2][2];
+    memcpy(modes, state->modes, sizeof(modes));
+    LatencyHistogram processing, encode;
+    if (senderLatency(state->cameras[state->docking].config.name.c_str(), &processing, &encode) == 0) {
+        addSince(&modes[state->on][0], processing, state->mark[0]);
+        addSince(&modes[state->on][1], encode,     state->mark[1]);
+    }
+    double switch_ms;
+    {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        switch_ms = state->switch_ms;
+    }
+    double encoder_ms = state->encoder_ms;
+
+    char json[512];
+    snprintf(json, sizeof(json),
+             "{\"docking_mode\":%s,\"switch_ms\":%.1f,\"encoder_restart_ms\":%.1f,\"latency_ms\":{"
+             "\"normal\":{\"frames\":%ld,\"processing_p50\":%.1f,\"encode_p50\":%.1f},"
+             "\"docking\":{\"frames\":%ld,\"processing_p50\":%.1f,\"encode_p50\":%.1f}}}",
+             state->on ? "true" : "false", switch_ms, encoder_ms,
+             modes[0][0].count, latencyQuantile(modes[0][0], 0.5), latencyQuantile(modes[0][1], 0.5),
+             modes[1][0].count, latencyQuantile(modes[1][0], 0.5), latencyQuantile(modes[1][1], 0.5));
+    return json;
+}
@@ -0,0 +1,140 @@
+#include <gst/gst.h>
+
+#include <iostream>
+#include <element_chain.hpp>
+
+/**
+ * @brief Make an element.
+ *
+ * @param factory Element factory, such as "queue".
+ * @param name    Element name, empty to let GStreamer name it.
+ * @return element, NULL if the factory is not installed.
+ */
+GstElement *makeElement(const char *factory, const std::string &name) {
+    GstElement *element = gst_element_factory_make(factory, name.empty() ? NULL : name.c_str());
+    if (!element) std::cerr << "Missing element " << factory << "." << std::endl;
+    return element;
+}
+
+/**
+ * @brief Make a capsfilter.
+ *
+ * @param name Element name, empty to let GStreamer name it.
+ * @param caps Caps in their string form.
+ * @return element, NULL if capsfilter is missing or the caps do not parse.
+ */
+GstElement *makeCapsFilter(const std::string &name, const std::string &caps) {
+    GstCaps *filter_caps = gst_caps_from_string(caps.c_str());
+    if (!filter_caps) {
+        std::cerr << "Bad caps " << caps << "." << std::endl;
+        return NULL;
+    }
+    GstElement *filter = makeElement("capsfilter", name);
+    if (filter) g_object_set(G_OBJECT(filter), "caps", filter_caps, NULL);
+    gst_caps_unref(filter_caps);
+    return filter;
+}
+
+/**
+ * @brief Make a closed valve.
+ *
+ * @param name Element name.
+ * @return element, NULL if valve is missing.
+ */
+GstElement *makeValve(const std::string &name) {
+    GstElement *valve = makeElement("valve", name);
+    if (valve) g_object_set(G_OBJECT(valve), "drop", TRUE, NULL);
+    return valve;
+}
+
+/**
+ * @brief Make a one buffer queue that drops the oldest buffer when full.
+ *
+ * @return element, NULL if queue is missing.
+ */
+GstElement *makeQueue() {
+    GstElement *queue = makeElement("queue", "");
+    if (!queue) return NULL;
+    g_object_set(G_OBJECT(queue), "max-size-buffers", 1, NULL);
+    gst_util_set_object_arg(G_OBJECT(queue), "leaky", "downstream");
+    return queue;
+}
+
+/**
+ * @brief Make a low latency x264 encoder.
+ *
+ * @param name         Element name, empty to let GStreamer name it.
+ * @param bitrate_kbps Bitrate.
+ * @param threads      Encoder threads.
+ * @param key_int_max  Most frames between key frames.
+ * @return element, NULL if x264enc is missing.
+ */
+GstElement *makeX264Encoder(const std::string &name, int bitrate_kbps, int threads, int key_int_max) {
+    GstElement *encoder = makeElement("x264enc", name);
+    if (!encoder) return NULL;
+    gst_util_set_object_arg(G_OBJECT(encoder), "tune", "zerolatency");
+    gst_util_set_object_arg(G_OBJECT(encoder), "speed-preset", "ultrafast");
+    g_object_set(G_OBJECT(encoder), "bitrate", (guint)bitrate_kbps, "threads", (guint)threads,
+                 "key-int-max", (guint)key_int_max, NULL);
+    return encoder;
+}
+
+/**
+ * @brief Make the MPEG-TS muxer of a stream.
+ *
+ * Whole packets, no added latency and a PCR every 20 ms.
+ *
+ * @return element, NULL if mpegtsmux is missing.
+ */
+GstElement *makeTsMux() {
+    GstElement *mux = makeElement("mpegtsmux", "");
+    if (!mux) return NULL;
+    g_object_set(G_OBJECT(mux), "alignment", 7, "latency", (guint64)0, "pcr-interval", (guint)20,
+                 "scte-35-null-interval", (guint)0, NULL);
+    return mux;
+}
+
+/**
+ * @brief Make the SRT listener of a stream.
+ *
+ * @param name Element name.
+ * @param port Listener port.
+ * @param srt  SRT listener options, as in cameras.conf.
+ * @return element, NULL if srtsink is missing.
+ */
+GstElement *makeSrtSink(const std::string &name, int port, const std::string &srt) {
+    GstElement *sink = makeElement("srtsink", name);
+    if (!sink) return NULL;
+    const std::string uri = "srt://:" + std::to_string(port) + "?mode=listener&" + srt;
+    g_object_set(G_OBJECT(sink), "uri", uri.c_str(), "wait-for-connection", TRUE, "sync", FALSE, NULL);
+    return sink;
+}
+
+/**
+ * @brief Add a chain of elements to a bin and link it.
+ *
+ * @param bin      Bin receiving the elements.
+ * @param upstream Element already in the bin the chain is linked after, or NULL.
+ * @param chain    Elements in stream order. NULL entries are elements that could not be made.
+ * @return true if every element was made and linked.
+ */
+bool addChain(GstBin *bin, GstElement *upstream, const std::vector<GstElement *> &chain) {
+    // The elements made go into the bin either way, so they are freed with it
+    bool made = true;
+    for (GstElement *element : chain) {
+        if (element) gst_bin_add(bin, element);
+        else         made = false;
+    }
+    if (!made) return false;
+
+    GstElement *previous = upstream;
+    for (GstElement *element : chain) {
+        if (previous && !gst_element_link(previous, element)) {
+            std::cerr << "Could not link " << GST_ELEMENT_NAME(previous) << " to " << GST_ELEMENT_NAME(element) << "."
+                      << std::endl;
+            return false;
+        }
+        previous = element;
+    }
+    return true;
+}
@@ -0,0 +1,151 @@
+#include <gst/gst.h>
+#include <gst/video/video.h>
+
+#include <cstring>
+#include <iostream>
+#include <frame_stage.hpp>
+
+/**
+ * @brief Fill an Nv12Frame view from a mapped video frame.
+ */
+Nv12Frame nv12View(GstVideoFrame *frame) {
+    Nv12Frame view;
+    view.y         = (uint8_t *)GST_VIDEO_FRAME_PLANE_DATA(frame, 0);
+    view.uv        = (uint8_t *)GST_VIDEO_FRAME_PLANE_DATA(frame, 1);
+    view.width     = GST_VIDEO_FRAME_WIDTH(frame);
+    view.height    = GST_VIDEO_FRAME_HEIGHT(frame);
+    view.y_stride  = GST_VIDEO_FRAME_PLANE_STRIDE(frame, 0);
+    view.uv_stride = GST_VIDEO_FRAME_PLANE_STRIDE(frame, 1);
+    return view;
+}
+
+/**
+ * @brief Copy the planes of one frame into another of the same size.
+ */
+void copyNv12Frame(const Nv12Frame &src, const Nv12Frame &dst) {
+    for (int row = 0; row < src.height; row++) {
+        memcpy(dst.y + row * dst.y_stride, src.y + row * src.y_stride, src.width);
+    }
+    for (int row = 0; row < (src.height + 1) / 2; row++) {
+        memcpy(dst.uv + row * dst.uv_stride, src.uv + row * src.uv_stride, src.width);
+    }
+}
+
+/**
+ * @brief Set up the output buffer pool from the negotiated caps.
+ *
+ * @param stage Stage of one camera.
+ * @param pad   Pad the frames are flowing through.
+ * @return true once the stage is ready to process frames.
+ */
+bool setupFrameStage(FrameStage *stage, GstPad *pad) {
+    GstCaps *caps = gst_pad_get_current_caps(pad);
+    if (!caps) return false;
+
+    if (!gst_video_info_from_caps(&stage->info, caps) ||
+        GST_VIDEO_INFO_FORMAT(&stage->info) != GST_VIDEO_FORMAT_NV12) {
+        std::cerr << stage->name << " needs NV12 frames. The stage is disabled." << std::endl;
+        gst_caps_unref(caps);
+        return false;
+    }
+
+    // The output frames come from a preallocated pool so nothing is allocated per frame
+    stage->buffer_pool = gst_video_buffer_pool_new();
+    GstStructure *config = gst_buffer_pool_get_config(stage->buffer_pool);
+    gst_buffer_pool_config_set_params(config, caps, GST_VIDEO_INFO_SIZE(&stage->info), FRAME_STAGE_POOL_SIZE, 0);
+    gst_buffer_pool_set_config(stage->buffer_pool, config);
+    gst_buffer_pool_set_active(stage->buffer_pool, TRUE);
+    gst_caps_unref(caps);
+    return true;
+}
+
+/**
+ * @brief Drop the output buffer pool.
+ *
+ * Frames still downstream go back to the inactive pool and are freed there.
+ */
+void releaseFrameStage(FrameStage *stage) {
+    if (!stage->buffer_pool) return;
+    gst_buffer_pool_set_active(stage->buffer_pool, FALSE);
+    gst_object_unref(stage->buffer_pool);
+    stage->buffer_pool = NULL;
+}
+
+/**
+ * @brief Process one probed frame into a buffer from the pool.
+ *
+ * The output buffer takes the flags and timestamps of the input and replaces
+ * it in the probe. If anything fails the frame is passed on unchanged.
+ *
+ * @param stage   Stage of one camera, set up.
+ * @param info    Probe info holding the buffer.
+ * @param work    Pixel work of the stage.
+ * @param context Stage state passed to work.
+ */
+void runFrameStage(FrameStage *stage, GstPadProbeInfo *info, FrameStageWork work, void *context) {
+    GstBuffer *in  = GST_PAD_PROBE_INFO_BUFFER(info);
+    GstBuffer *out = NULL;
+    if (!stage->buffer_pool || gst_buffer_pool_acquire_buffer(stage->buffer_pool, &out, NULL) != GST_FLOW_OK) return;
+
+    GstVideoFrame src_frame, dst_frame;
+    if (!gst_video_frame_map(&src_frame, &stage->info, in, GST_MAP_READ)) {
+        gst_buffer_unref(out);
+        return;
+    }
+    if (!gst_video_frame_map(&dst_frame, &stage->info, out, GST_MAP_WRITE)) {
+        gst_video_frame_unmap(&src_frame);
+        gst_buffer_unref(out);
+        return;
+    }
+
+    work(nv12View(&src_frame), nv12View(&dst_frame), context);
+
+    gst_video_frame_unmap(&dst_frame);
+    gst_video_frame_unmap(&src_frame);
+
+    gst_buffer_copy_into(out, in, (GstBufferCopyFlags)(GST_BUFFER_COPY_FLAGS | GST_BUFFER_COPY_TIMESTAMPS), 0, -1);
+    gst_buffer_unref(in);
+    GST_PAD_PROBE_INFO_DATA(info) = out;
+}
+
+/**
+ * @brief Event probe that drops the pool when the caps change.
+ *
+ * @param pad       Pad the probe is attached to.
+ * @param info      Probe info holding the event.
+ * @param user_data Stage of one camera.
+ * @return GST_PAD_PROBE_OK to keep the events flowing.
+ */
+static GstPadProbeReturn on_frame_stage_caps(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    if (GST_EVENT_TYPE(GST_PAD_PROBE_INFO_EVENT(info)) == GST_EVENT_CAPS) releaseFrameStage((FrameStage *)user_data);
+    return GST_PAD_PROBE_OK;
+}
+
+/**
+ * @brief Attach a frame stage to a pipeline.
+ *
+ * The caps probe goes on first so it sees the caps ahead of any frame. It is
+ * removed along with the frame probe when the pad goes away, so only the
+ * frame probe carries the destroy notify.
+ *
+ * @param pipeline     Pipeline containing the element.
+ * @param element_name Name of the element to attach to.
+ * @param stage        Stage of one camera, inside user_data.
+ * @param on_frame     Buffer probe of the stage.
+ * @param user_data    Stage state.
+ * @param destroy      Frees user_data once the frame probe is removed.
+ * @return error - 0 for no error, 1 if the element was not found.
+ */
+int attachFrameStage(GstElement *pipeline, const char *element_name, FrameStage *stage,
+                     GstPadProbeCallback on_frame, gpointer user_data, GDestroyNotify destroy) {
+    GstElement *element = gst_bin_get_by_name(GST_BIN(pipeline), element_name);
+    if (!element) return 1;
+
+    GstPad *pad = gst_element_get_static_pad(element, "src");
+    gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM, on_frame_stage_caps, stage, NULL);
+    gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, on_frame, user_data, destroy);
+
+    gst_object_unref(pad);
+    gst_object_unref(element);
+    return 0;
+}
@@ -0,0 +1,303 @@
+#include <gst/gst.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <governor.hpp>
+
+// Frames in flight in an encoder that can be matched up.
+static const int LATENCY_SLOTS = 16;
+
+// Encoder latency of one camera, measured between the sink and source pad of
+// its encoder by matching timestamps.
+struct EncoderLatency {
+    std::string          name;
+    int                  fps;
+    std::mutex           mutex;
+    GstClockTime         pts[LATENCY_SLOTS];
+    int64_t              in_us[LATENCY_SLOTS];
+    int                  next = 0;
+    std::atomic<double>  latency_ms {0.0};  // Smoothed latency.
+    std::atomic<int64_t> last_us    {0};    // Time of the last measured frame.
+};
+
+// Governor state, for the life of the program.
+struct Governor {
+    GovernorPaths                  paths;
+    std::vector<EncoderLatency *>  encoders;
+    int                            level       = 0;
+    int                            transitions = 0;
+};
+
+/**
+ * @brief Get the monotonic time in microseconds.
+ */
+static int64_t nowUs() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * @brief Buffer probe on the encoder sink pad. Notes when each frame went in.
+ */
+static GstPadProbeReturn on_encoder_input(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    EncoderLatency *encoder = (EncoderLatency *)user_data;
+    std::lock_guard<std::mutex> lock(encoder->mutex);
+
+    encoder->pts[encoder->next]   = GST_BUFFER_PTS(GST_PAD_PROBE_INFO_BUFFER(info));
+    encoder->in_us[encoder->next] = nowUs();
+    encoder->next = (encoder->next + 1) % LATENCY_SLOTS;
+    return GST_PAD_PROBE_OK;
+}
+
+/**
+ * @brief Buffer probe on the encoder source pad. Measures how long the frame took.
+ */
+static GstPadProbeReturn on_encoder_output(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    EncoderLatency *encoder = (EncoderLatency *)user_data;
+    GstClockTime    pts     = GST_BUFFER_PTS(GST_PAD_PROBE_INFO_BUFFER(info));
+    int64_t         now     = nowUs();
+    std::lock_guard<std::mutex> lock(encoder->mutex);
+
+    for (int i = 0; i < LATENCY_SLOTS; i++) {
+        if (encoder->pts[i] != pts || pts == GST_CLOCK_TIME_NONE) continue;
+        double ms = (now - encoder->in_us[i]) / 1000.0;
+        encoder->latency_ms = encoder->latency_ms + 0.1 * (ms - encoder->latency_ms);
+        encoder->last_us    = now;
+        encoder->pts[i]     = GST_CLOCK_TIME_NONE;
+        break;
+    }
+    return GST_PAD_PROBE_OK;
+}
+
+/**
+ * @brief Read a number from a sysfs style file.
+ *
+ * @param path  File to read.
+ * @param value Returned value.
+ * @return false if the file cannot be read.
+ */
+static bool readNumber(const char *path, double *value) {
+    FILE *file = fopen(path, "r");
+    if (!file) return false;
+    bool ok = fscanf(file, "%lf", value) == 1;
+    fclose(file);
+    return ok;
+}
+
+/**
+ * @brief Read a hexadecimal number, with or without 0x, from a sysfs style file.
+ *
+ * @param path  File to read.
+ * @param value Returned value.
+ * @return false if the file cannot be read.
+ */
+static bool readHex(const char *path, unsigned *value) {
+    FILE *file = fopen(path, "r");
+    if (!file) return false;
+    bool ok = fscanf(file, "%x", value) == 1;
+    fclose(file);
+    return ok;
+}
+
+/**
+ * @brief Read the temperature and throttling.
+ *
+ * The firmware flags are used where they can be read. Otherwise the CPU
+ * counts as throttled when its clock limit is below GOVERNOR_THROTTLED_RATIO
+ * of the maximum.
+ *
+ * @param paths Files to read.
+ * @return reading, with no encoder latency.
+ */
+GovernorReading readGovernorSensors(const GovernorPaths &paths) {
+    GovernorReading reading = {-1.0, false, 0.0};
+
+    double millidegrees, limit_freq, max_freq;
+    if (readNumber(paths.temperature, &millidegrees)) reading.temperature_c = millidegrees / 1000.0;
+
+    unsigned flags;
+    if (paths.throttled && readHex(paths.throttled, &flags)) {
+        reading.throttled = (flags & GOVERNOR_THROTTLED_FLAGS) != 0;
+    } else if (readNumber(paths.cpu_limit_freq, &limit_freq) && readNumber(paths.cpu_max_freq, &max_freq) &&
+               max_freq > 0) {
+        reading.throttled = limit_freq / max_freq < GOVERNOR_THROTTLED_RATIO;
+    }
+    return reading;
+}
+
+/**
+ * @brief Check whether a reading calls for a step down.
+ */
+static bool stressed(const GovernorReading &reading) {
+    return reading.temperature_c >= GOVERNOR_HOT_C ||
+           reading.throttled ||
+           reading.latency_ratio > GOVERNOR_LATENCY_BUDGET;
+}
+
+/**
+ * @brief Check whether a reading leaves room for a step up.
+ */
+static bool calm(const GovernorReading &reading) {
+    return reading.temperature_c < GOVERNOR_COOL_C &&
+           !reading.throttled &&
+           reading.latency_ratio <= GOVERNOR_LATENCY_BUDGET / 2;
+}
+
+/**
+ * @brief Get the level to go to after a reading.
+ *
+ * Steps down right away when stressed, but no faster than one level per
+ * GOVERNOR_DOWN_HOLD_S so each step can take effect. Steps up one level
+ * after GOVERNOR_UP_HOLD_S of calm, and again no sooner than that after any
+ * step. The gap between GOVERNOR_HOT_C and GOVERNOR_COOL_C keeps it from
+ * going up and down on a steady temperature.
+ *
+ * @param level        Current level.
+ * @param reading      Latest reading.
+ * @param calm_s       Time all readings have been calm for.
+ * @param since_step_s Time since the last step.
+ * @return new level.
+ */
+int nextGovernorLevel(int level, const GovernorReading &reading, double calm_s, double since_step_s) {
+    if (stressed(reading)) {
+        if (level < GOVERNOR_LEVELS - 1 && since_step_s >= GOVERNOR_DOWN_HOLD_S) return level + 1;
+    } else if (level > 0 && calm_s >= GOVERNOR_UP_HOLD_S && since_step_s >= GOVERNOR_UP_HOLD_S) {
+        return level - 1;
+    }
+    return level;
+}
+
+/**
+ * @brief Take a reading of the governor inputs.
+ *
+ * An encoder that has not output a frame for a second is idle.
+ *
+ * @param governor Governor state.
+ * @return reading.
+ */
+static GovernorReading takeReading(Governor *governor) {
+    GovernorReading reading = readGovernorSensors(governor->paths);
+    int64_t         now     = nowUs();
+
+    for (EncoderLatency *encoder : governor->encoders) {
+        if (now - encoder->last_us > 1000000) continue;
+        int    fps      = std::min(encoder->fps, GOVERNOR_LADDER[governor->level].limit.max_fps);
+        double interval = 1000.0 / fps;
+        reading.latency_ratio = std::max(reading.latency_ratio, encoder->latency_ms / interval);
+    }
+    return reading;
+}
+
+/**
+ * @brief Write the governor state in the Prometheus text format.
+ *
+ * The file is replaced in one rename so the collector never reads half of it.
+ *
+ * @param governor Governor state.
+ * @param reading  Latest reading.
+ */
+static void writeMetrics(Governor *governor, const GovernorReading &reading) {
+    if (!governor->paths.metrics) return;
+
+    std::string temp_path = std::string(governor->paths.metrics) + ".tmp";
+    FILE *file = fopen(temp_path.c_str(), "w");
+    if (!file) return;
+
+    fprintf(file, "# HELP masthead_governor_level Quality level, 0 is full quality.\n"
+                  "# TYPE masthead_governor_level gauge\n"
+                  "masthead_governor_level{name=\"%s\"} %d\n", GOVERNOR_LADDER[governor->level].name, governor->level);
+    fprintf(file, "# HELP masthead_governor_transitions_total Quality level changes.\n"
+                  "# TYPE masthead_governor_transitions_total counter\n"
+                  "masthead_governor_transitions_total %d\n", governor->transitions);
+    if (reading.temperature_c >= 0) {
+        fprintf(file, "# HELP masthead_soc_temperature_celsius SoC temperature.\n"
+                      "# TYPE masthead_soc_temperature_celsius gauge\n"
+                      "masthead_soc_temperature_celsius %.1f\n", reading.temperature_c);
+    }
+    fprintf(file, "# HELP masthead_cpu_throttled 1 while the CPU is throttled.\n"
+                  "# TYPE masthead_cpu_throttled gauge\n"
+                  "masthead_cpu_throttled %d\n", reading.throttled ? 1 : 0);
+    fprintf(file, "# HELP masthead_encoder_latency_ms Smoothed encoder latency.\n"
+                  "# TYPE masthead_encoder_latency_ms gauge\n");
+    for (EncoderLatency *encoder : governor->encoders) {
+        fprintf(file, "masthead_encoder_latency_ms{camera=\"%s\"} %.2f\n", encoder->name.c_str(), encoder->latency_ms.load());
+    }
+
+    fclose(file);
+    rename(temp_path.c_str(), governor->paths.metrics);
+}
+
+/**
+ * @brief Governor thread body.
+ *
+ * @param governor Governor state.
+ */
+static void governorLoop(Governor *governor) {
+    double calm_s       = 0.0;
+    double since_step_s = GOVERNOR_UP_HOLD_S;
+
+    while (true) {
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+        calm_s       += 1.0;
+        since_step_s += 1.0;
+
+        GovernorReading reading = takeReading(governor);
+        if (!calm(reading)) calm_s = 0.0;
+
+        int level = nextGovernorLevel(governor->level, reading, calm_s, since_step_s);
+        if (level != governor->level) {
+            g_print("Quality governor: %s -> %s (%.1f C, %s, encoder latency %.0f%% of frame time)\n",
+                    GOVERNOR_LADDER[governor->level].name, GOVERNOR_LADDER[level].name, reading.temperature_c,
+                    reading.throttled ? "throttled" : "not throttled", reading.latency_ratio * 100);
+            governor->level = level;
+            governor->transitions++;
+            since_step_s = 0.0;
+            setProfileLimit(GOVERNOR_LADDER[level].limit);
+        }
+
+        writeMetrics(governor, reading);
+    }
+}
+
+/**
+ * @brief Measure the encoder latency of the cameras and start the governor.
+ *
+ * The cameras must have the stream profile stage, which applies the levels.
+ *
+ * @param cameras Camera pipelines.
+ * @param paths   Files to read and write.
+ * @return error - 0 for no error, 1 if an encoder has no pads to measure.
+ */
+int startGovernor(const std::vector<CameraPipeline> &cameras, const GovernorPaths &paths) {
+    Governor *governor = new Governor();
+    governor->paths = paths;
+
+    for (const CameraPipeline &camera : cameras) {
+        GstPad *sink = gst_element_get_static_pad(camera.encoder, "sink");
+        GstPad *src  = gst_element_get_static_pad(camera.encoder, "src");
+        if (!sink || !src) {
+            if (sink) gst_object_unref(sink);
+            if (src)  gst_object_unref(src);
+            return 1;
+        }
+
+        EncoderLatency *encoder = new EncoderLatency();
+        encoder->name = camera.config.name;
+        encoder->fps  = camera.config.fps;
+        std::fill(std::begin(encoder->pts), std::end(encoder->pts), GST_CLOCK_TIME_NONE);
+        governor->encoders.push_back(encoder);
+
+        gst_pad_add_probe(sink, GST_PAD_PROBE_TYPE_BUFFER, on_encoder_input,  encoder, NULL);
+        gst_pad_add_probe(src,  GST_PAD_PROBE_TYPE_BUFFER, on_encoder_output, encoder, NULL);
+        gst_object_unref(sink);
+        gst_object_unref(src);
+    }
+
+    std::thread(governorLoop, governor).detach();
+    return 0;
+}
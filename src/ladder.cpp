@@ -0,0 +1,121 @@
+#include <ladder.hpp>
+#include <cmath>
+
+// One cached attitude. The crop window origin is part of the key because it
+// moves the principal point, and so is the overlay settings version.
+struct LadderCacheEntry {
+    bool           used      = false;
+    unsigned       version   = 0;
+    long           pitch_q   = 0;
+    long           roll_q    = 0;
+    long           cx        = 0;
+    long           cy        = 0;
+    unsigned       last_used = 0;
+    LadderGeometry geometry;
+};
+
+static LadderCacheEntry m_cache[LADDER_CACHE_SIZE];
+static unsigned         m_tick = 0;
+
+/**
+ * @brief Project a line of constant elevation.
+ *
+ * Points that fall behind the camera are left out.
+ *
+ * @param camera     Camera model.
+ * @param rotation   Level frame to camera frame rotation.
+ * @param elevation  Elevation of the line in degrees.
+ * @param half_span  Half the azimuth span in degrees, around the optical axis.
+ * @param x          Returned point columns.
+ * @param y          Returned point rows.
+ * @param max_points Number of points to sample.
+ * @return number of points written.
+ */
+int elevationPolyline(const CameraModel &camera, const CameraRotation &rotation, double elevation,
+                      double half_span, double *x, double *y, int max_points) {
+    double center = axisAzimuth(rotation);
+    int    points = 0;
+
+    for (int i = 0; i < max_points; i++) {
+        double azimuth = center - half_span + (2.0 * half_span * i) / (max_points - 1);
+        if (projectDirection(camera, rotation, elevation, azimuth, &x[points], &y[points])) points++;
+    }
+    return points;
+}
+
+/**
+ * @brief Compute the ladder geometry for an attitude.
+ *
+ * Each line spans the same fraction of the frame width as its width_ratio,
+ * measured at the center of the frame.
+ *
+ * @param camera   Camera model.
+ * @param config   Overlay settings.
+ * @param pitch    IMU pitch in degrees.
+ * @param roll     IMU roll in degrees.
+ * @param geometry Returned geometry.
+ */
+static void computeLadder(const CameraModel &camera, const OverlayConfig &config, double pitch, double roll,
+                          LadderGeometry &geometry) {
+    CameraRotation rotation = cameraRotation(pitch, roll, config.boresight);
+
+    geometry.line_count = config.line_count;
+    for (int i = 0; i < config.line_count; i++) {
+        const AngleLineSettings &settings = config.lines[i];
+        LadderLine              &line     = geometry.lines[i];
+
+        double half_span = atan((camera.width * settings.width_ratio / 2.0) / camera.fx) / DEG_TO_RAD;
+        line.points = elevationPolyline(camera, rotation, settings.angle, half_span,
+                                        line.x, line.y, LADDER_LINE_POINTS);
+
+        line.label_angle = 0.0;
+        if (line.points >= 2) {
+            int last = line.points - 1;
+            double angle = atan2(line.y[last] - line.y[last - 1], line.x[last] - line.x[last - 1]);
+            double step  = LADDER_LABEL_QUANTUM_DEG * DEG_TO_RAD;
+            line.label_angle = round(angle / step) * step;
+        }
+    }
+}
+
+/**
+ * @brief Get the memoized ladder geometry for an attitude.
+ *
+ * The attitude is quantized to LADDER_QUANTUM_DEG. On a miss the least
+ * recently used entry is recomputed. Only the overlay thread calls this.
+ *
+ * @param camera Camera model of the frame drawn on.
+ * @param config Overlay settings snapshot.
+ * @param pitch  IMU pitch in degrees.
+ * @param roll   IMU roll in degrees.
+ * @return ladder geometry, valid until the next call.
+ */
+const LadderGeometry &ladderGeometry(const CameraModel &camera, const OverlayConfig &config,
+                                     double pitch, double roll) {
+    long pitch_q = lround(pitch / LADDER_QUANTUM_DEG);
+    long roll_q  = lround(roll  / LADDER_QUANTUM_DEG);
+    long cx      = lround(camera.cx);
+    long cy      = lround(camera.cy);
+
+    m_tick++;
+
+    LadderCacheEntry *victim = &m_cache[0];
+    for (LadderCacheEntry &entry : m_cache) {
+        if (entry.used && entry.version == config.version && entry.pitch_q == pitch_q && entry.roll_q == roll_q &&
+            entry.cx == cx && entry.cy == cy) {
+            entry.last_used = m_tick;
+            return entry.geometry;
+        }
+        if (!entry.used || (victim->used && entry.last_used < victim->last_used)) victim = &entry;
+    }
+
+    computeLadder(camera, config, pitch_q * LADDER_QUANTUM_DEG, roll_q * LADDER_QUANTUM_DEG, victim->geometry);
+    victim->used      = true;
+    victim->version   = config.version;
+    victim->pitch_q   = pitch_q;
+    victim->roll_q    = roll_q;
+    victim->cx        = cx;
+    victim->cy        = cy;
+    victim->last_used = m_tick;
+    return victim->geometry;
+}
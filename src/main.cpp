@@ -1,9 +1,14 @@
 #include <video.hpp>
 #include <attitude.hpp>
+#include <trace.hpp>
 
 int main(int argc, char *argv[]){
 
-    initAttitude();
+    // Before any thread starts, so they all leave the dump signal to the tracer
+    startTracer();
+
+    // The attitude sensor starts up in the background while the cameras do
+    startAttitude();
     startStreaming();
     
     return 0;
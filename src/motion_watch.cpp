@@ -0,0 +1,339 @@
+#include <gst/gst.h>
+#include <gst/video/video.h>
+
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <motion_watch.hpp>
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Background pixels are 8.7 fixed point so a slow learn rate still moves them
+// and every value fits in an int16_t.
+static const int BACKGROUND_FRAC_BITS = 7;
+
+// State of the motion watch of one camera. It lives as long as the probes on
+// the pad.
+struct MotionWatch {
+    GstElement                           *pipeline      = NULL;
+    std::string                           camera_name;
+    GstVideoInfo                          info;
+    bool                                  have_info     = false;
+    MotionState                           state;
+    unsigned                              frame_count   = 0;
+    int                                   socket_fd     = -1;
+    sockaddr_un                           address;
+    double                                busy_ms       = 0.0;  // Time spent checking, for the DEBUG report.
+    std::chrono::steady_clock::time_point report_start;
+};
+
+/**
+ * @brief Point sample a downscaled luma plane from NV12.
+ *
+ * Each output pixel averages four Y samples spread over its block.
+ *
+ * @param y      Y plane.
+ * @param stride Y plane stride in bytes.
+ * @param width  Output width.
+ * @param height Output height.
+ * @param scale  Downscale factor.
+ * @param out    Output pixels.
+ */
+static void sampleLuma(const uint8_t *y, int stride, int width, int height, int scale, uint8_t *out) {
+    const int a = scale / 4;
+    const int b = (3 * scale) / 4;
+
+    for (int v = 0; v < height; v++) {
+        const uint8_t *row_a = y + (v * scale + a) * stride;
+        const uint8_t *row_b = y + (v * scale + b) * stride;
+        for (int u = 0; u < width; u++) {
+            int x0 = u * scale + a;
+            int x1 = u * scale + b;
+            out[v * width + u] = (uint8_t)((row_a[x0] + row_a[x1] + row_b[x0] + row_b[x1] + 2) >> 2);
+        }
+    }
+}
+
+/**
+ * @brief Compare a sample to the background and learn it.
+ *
+ * Counts the pixels that differ from the background by more than
+ * MOTION_WATCH_THRESHOLD, then moves the background 1/2^MOTION_WATCH_LEARN_SHIFT
+ * of the way towards the sample.
+ *
+ * @param sample     Downscaled luma.
+ * @param background Background in 8.7 fixed point. Updated in place.
+ * @param count      Number of pixels.
+ * @return number of changed pixels.
+ */
+static int subtractBackground(const uint8_t *sample, int16_t *background, int count) {
+    int changed = 0;
+    int i       = 0;
+
+#if defined(__ARM_NEON)
+    const int16x8_t threshold = vdupq_n_s16(MOTION_WATCH_THRESHOLD);
+    int16x8_t       hits      = vdupq_n_s16(0);
+
+    for (; i + 8 <= count; i += 8) {
+        int16x8_t cur = vreinterpretq_s16_u16(vmovl_u8(vld1_u8(sample + i)));
+        int16x8_t bg  = vld1q_s16(background + i);
+
+        int16x8_t diff = vabdq_s16(cur, vshrq_n_s16(bg, BACKGROUND_FRAC_BITS));
+        hits = vsubq_s16(hits, vreinterpretq_s16_u16(vcgtq_s16(diff, threshold)));  // -1 per hit
+
+        int16x8_t delta = vsubq_s16(vshlq_n_s16(cur, BACKGROUND_FRAC_BITS), bg);
+        vst1q_s16(background + i, vsraq_n_s16(bg, delta, MOTION_WATCH_LEARN_SHIFT));
+    }
+    int32x4_t sums = vpaddlq_s16(hits);
+    changed = vgetq_lane_s32(sums, 0) + vgetq_lane_s32(sums, 1) + vgetq_lane_s32(sums, 2) + vgetq_lane_s32(sums, 3);
+#elif defined(__SSE2__)
+    const __m128i zero      = _mm_setzero_si128();
+    const __m128i threshold = _mm_set1_epi16(MOTION_WATCH_THRESHOLD);
+    __m128i       hits      = zero;
+
+    for (; i + 8 <= count; i += 8) {
+        __m128i cur = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(sample + i)), zero);
+        __m128i bg  = _mm_loadu_si128((const __m128i *)(background + i));
+
+        __m128i diff = _mm_sub_epi16(cur, _mm_srai_epi16(bg, BACKGROUND_FRAC_BITS));
+        diff = _mm_max_epi16(diff, _mm_sub_epi16(zero, diff));
+        hits = _mm_sub_epi16(hits, _mm_cmpgt_epi16(diff, threshold));
+
+        __m128i delta = _mm_sub_epi16(_mm_slli_epi16(cur, BACKGROUND_FRAC_BITS), bg);
+        _mm_storeu_si128((__m128i *)(background + i), _mm_add_epi16(bg, _mm_srai_epi16(delta, MOTION_WATCH_LEARN_SHIFT)));
+    }
+
+    int16_t lanes[8];
+    _mm_storeu_si128((__m128i *)lanes, hits);
+    for (int16_t lane : lanes) changed += lane;
+#endif
+
+    for (; i < count; i++) {
+        int cur = sample[i];
+        if (std::abs(cur - (background[i] >> BACKGROUND_FRAC_BITS)) > MOTION_WATCH_THRESHOLD) changed++;
+        background[i] += (int16_t)(((cur << BACKGROUND_FRAC_BITS) - background[i]) >> MOTION_WATCH_LEARN_SHIFT);
+    }
+
+    return changed;
+}
+
+/**
+ * @brief Check one luma plane for motion and update the event state.
+ *
+ * @param state   Background and event state.
+ * @param luma    Y plane.
+ * @param stride  Y plane stride in bytes.
+ * @param width   Frame width.
+ * @param height  Frame height.
+ * @param now_s   Steady time in seconds.
+ * @param changed Returned fraction of the sample that changed.
+ * @return 1 when an event starts, -1 when it ends, 0 otherwise.
+ */
+int checkMotion(MotionState *state, const uint8_t *luma, int stride, int width, int height, double now_s,
+                double *changed) {
+    const int sample_width  = width  / MOTION_WATCH_SCALE;
+    const int sample_height = height / MOTION_WATCH_SCALE;
+    const int count         = sample_width * sample_height;
+
+    *changed = 0.0;
+    state->sample.resize(count);
+    sampleLuma(luma, stride, sample_width, sample_height, MOTION_WATCH_SCALE, state->sample.data());
+
+    // The first sample becomes the background
+    if (!state->learned) {
+        state->background.resize(count);
+        for (int i = 0; i < count; i++) state->background[i] = (int16_t)(state->sample[i] << BACKGROUND_FRAC_BITS);
+        state->learned       = true;
+        state->motion_checks = 0;
+        return 0;
+    }
+
+    *changed = (double)subtractBackground(state->sample.data(), state->background.data(), count) / count;
+
+    if (*changed >= MOTION_WATCH_MIN_AREA) {
+        state->motion_checks++;
+        state->last_motion_s = now_s;
+        if (!state->active && state->motion_checks >= MOTION_WATCH_CONFIRM) {
+            state->active = true;
+            return 1;
+        }
+    } else {
+        state->motion_checks = 0;
+        if (state->active && now_s - state->last_motion_s > MOTION_WATCH_HOLD_S) {
+            state->active = false;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Announce the start or end of a motion event.
+ *
+ * Posts a "motion-watch" element message on the pipeline bus and sends a one
+ * line datagram to MOTION_WATCH_SOCKET. Nobody listening on the socket is not
+ * an error. The message is logged by the bus loop, off the streaming thread.
+ *
+ * @param watch   Motion watch state.
+ * @param active  true when motion starts, false when it ends.
+ * @param changed Fraction of the sample that changed.
+ */
+static void raiseMotionEvent(MotionWatch *watch, bool active, double changed) {
+    GstStructure *s = gst_structure_new("motion-watch",
+                                        "camera",  G_TYPE_STRING,  watch->camera_name.c_str(),
+                                        "active",  G_TYPE_BOOLEAN, active,
+                                        "changed", G_TYPE_DOUBLE,  changed, NULL);
+    gst_element_post_message(watch->pipeline, gst_message_new_element(GST_OBJECT(watch->pipeline), s));
+
+    if (watch->socket_fd >= 0) {
+        char text[96];
+        int  length = snprintf(text, sizeof(text), "camera=%s motion=%d changed=%.4f\n", watch->camera_name.c_str(),
+                               active ? 1 : 0, changed);
+        sendto(watch->socket_fd, text, std::min(length, (int)sizeof(text) - 1), MSG_DONTWAIT,
+               (sockaddr *)&watch->address, sizeof(watch->address));
+    }
+}
+
+/**
+ * @brief Buffer probe that feeds every Nth frame to the motion check.
+ *
+ * @param pad       Pad the probe is attached to.
+ * @param info      Probe info holding the buffer.
+ * @param user_data Motion watch state.
+ * @return GST_PAD_PROBE_OK to keep the data flowing.
+ */
+static GstPadProbeReturn on_watch_frame(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    MotionWatch *watch = (MotionWatch *)user_data;
+
+    if (++watch->frame_count % MOTION_WATCH_INTERVAL != 0) return GST_PAD_PROBE_OK;
+
+    if (!watch->have_info) {
+        GstCaps *caps = gst_pad_get_current_caps(pad);
+        if (!caps) return GST_PAD_PROBE_OK;
+        watch->have_info = gst_video_info_from_caps(&watch->info, caps) &&
+                           GST_VIDEO_INFO_FORMAT(&watch->info) == GST_VIDEO_FORMAT_NV12;
+        gst_caps_unref(caps);
+        if (!watch->have_info) return GST_PAD_PROBE_OK;
+        watch->report_start = std::chrono::steady_clock::now();
+    }
+
+    auto start = std::chrono::steady_clock::now();
+
+    GstVideoFrame frame;
+    if (!gst_video_frame_map(&frame, &watch->info, GST_PAD_PROBE_INFO_BUFFER(info), GST_MAP_READ)) {
+        return GST_PAD_PROBE_OK;
+    }
+    double changed;
+    int    event = checkMotion(&watch->state, (const uint8_t *)GST_VIDEO_FRAME_PLANE_DATA(&frame, 0),
+                               GST_VIDEO_FRAME_PLANE_STRIDE(&frame, 0), GST_VIDEO_FRAME_WIDTH(&frame),
+                               GST_VIDEO_FRAME_HEIGHT(&frame),
+                               std::chrono::duration<double>(start.time_since_epoch()).count(), &changed);
+    gst_video_frame_unmap(&frame);
+    if (event != 0) raiseMotionEvent(watch, event > 0, changed);
+
+    auto end = std::chrono::steady_clock::now();
+    watch->busy_ms += std::chrono::duration<double, std::milli>(end - start).count();
+
+// When defined, report the share of one core the motion watch uses once a minute.
+#ifdef DEBUG
+    double elapsed_ms = std::chrono::duration<double, std::milli>(end - watch->report_start).count();
+    if (elapsed_ms >= 60000.0) {
+        g_print("Motion watch CPU: %.2f%% of one core\n", 100.0 * watch->busy_ms / elapsed_ms);
+        watch->busy_ms      = 0.0;
+        watch->report_start = end;
+    }
+#endif
+
+    return GST_PAD_PROBE_OK;
+}
+
+/**
+ * @brief Event probe that starts the background over when the caps change.
+ *
+ * The frame size can change while playing (see docking_mode.hpp).
+ */
+static GstPadProbeReturn on_watch_caps(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    MotionWatch *watch = (MotionWatch *)user_data;
+    if (GST_EVENT_TYPE(GST_PAD_PROBE_INFO_EVENT(info)) != GST_EVENT_CAPS) return GST_PAD_PROBE_OK;
+
+    watch->have_info     = false;
+    watch->state.learned = false;
+    return GST_PAD_PROBE_OK;
+}
+
+/**
+ * @brief Free the motion watch of a camera once its frame probe is removed.
+ */
+static void free_motion_watch(gpointer user_data) {
+    MotionWatch *watch = (MotionWatch *)user_data;
+    if (watch->socket_fd >= 0) close(watch->socket_fd);
+    delete watch;
+}
+
+/**
+ * @brief Start the motion watch.
+ *
+ * Adds the watch probe to the sink pad of the named element. Attach it ahead
+ * of the stream valve so it runs while no client is connected.
+ *
+ * @param pipeline     Pipeline containing the element. Events are posted on its bus.
+ * @param element_name Name of the element to watch frames at.
+ * @param camera_name  Camera name the events are labelled with.
+ * @return error - 0 for no error, 1 if the element was not found.
+ */
+int startMotionWatch(GstElement *pipeline, const char *element_name, const char *camera_name) {
+    GstElement *element = gst_bin_get_by_name(GST_BIN(pipeline), element_name);
+    if (!element) return 1;
+
+    MotionWatch *watch = new MotionWatch();
+    watch->pipeline    = pipeline;
+    watch->camera_name = camera_name;
+
+    // Local event socket. Datagrams are dropped when nobody is listening.
+    watch->socket_fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    memset(&watch->address, 0, sizeof(watch->address));
+    watch->address.sun_family = AF_UNIX;
+    strncpy(watch->address.sun_path, MOTION_WATCH_SOCKET, sizeof(watch->address.sun_path) - 1);
+
+    GstPad *pad = gst_element_get_static_pad(element, "sink");
+    gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM, on_watch_caps, watch, NULL);
+    gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, on_watch_frame, watch, free_motion_watch);
+
+    gst_object_unref(pad);
+    gst_object_unref(element);
+    return 0;
+}
+
+/**
+ * @brief Log a motion event posted on a pipeline bus.
+ *
+ * @param message Message popped from the bus.
+ * @return true if it was a "motion-watch" message.
+ */
+bool handleMotionMessage(GstMessage *message) {
+    const GstStructure *s = gst_message_get_structure(message);
+    if (GST_MESSAGE_TYPE(message) != GST_MESSAGE_ELEMENT || !s || !gst_structure_has_name(s, "motion-watch")) {
+        return false;
+    }
+
+    const char *camera  = gst_structure_get_string(s, "camera");
+    gboolean    active  = FALSE;
+    double      changed = 0.0;
+    gst_structure_get_boolean(s, "active", &active);
+    gst_structure_get_double(s, "changed", &changed);
+    g_print("%s motion %s (%.1f%% changed)\n", camera ? camera : "Camera", active ? "started" : "ended",
+            changed * 100.0);
+    return true;
+}
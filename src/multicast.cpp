@@ -0,0 +1,240 @@
+#include <arpa/inet.h>
+#include <chrono>
+#include <condition_variable>
+#include <ctime>
+#include <ifaddrs.h>
+#include <iostream>
+#include <mutex>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <multicast.hpp>
+#include <element_chain.hpp>
+
+// Announcement of one multicast stream.
+struct Announcement {
+    int                  socket;
+    sockaddr_in          group;     // SAP group and port.
+    std::vector<uint8_t> announce;
+    std::vector<uint8_t> withdraw;
+};
+
+static std::mutex                m_announcer_mutex;
+static std::condition_variable   m_announcer_cv;
+static bool                      m_announcer_stop = false;
+static std::thread               m_announcer;
+static std::vector<Announcement> m_announcements;
+
+/**
+ * @brief Make the elements of a multicast branch.
+ *
+ * @param camera Camera with a multicast group.
+ * @return chain to link after the tee of encoded frames.
+ */
+std::vector<GstElement *> multicastBranch(const CameraConfig &camera) {
+    const std::string name = camera.name;
+
+    // Packetize for RTP, repeating the SPS and PPS for viewers joining late
+    GstElement *pay = makeElement("rtph264pay", name + "_rtp_pay");
+    if (pay) {
+        g_object_set(G_OBJECT(pay), "pt", (guint)MULTICAST_PAYLOAD_TYPE, "mtu", (guint)MULTICAST_MTU,
+                     "config-interval", MULTICAST_KEY_INTERVAL_S, NULL);
+        gst_util_set_object_arg(G_OBJECT(pay), "aggregate-mode", "zero-latency");
+    }
+    // One send for any number of viewers. The sink never waits, a slow network drops packets instead.
+    GstElement *sink = makeElement("udpsink", name + "_multicast_sink");
+    if (sink) {
+        g_object_set(G_OBJECT(sink), "host", camera.multicast_group.c_str(), "port", camera.multicast_port,
+                     "auto-multicast", TRUE, "ttl-mc", camera.multicast_ttl, "sync", FALSE, "async", FALSE, NULL);
+        if (!camera.multicast_iface.empty()) {
+            g_object_set(G_OBJECT(sink), "multicast-iface", camera.multicast_iface.c_str(), NULL);
+        }
+    }
+    return {makeQueue(), pay, sink};
+}
+
+/**
+ * @brief Build the SDP of a multicast stream.
+ *
+ * @param camera     Camera with a multicast group.
+ * @param origin     IPv4 address the stream is sent from.
+ * @param session_id SDP session id, also used as its version.
+ * @return SDP text with CRLF line ends.
+ */
+std::string multicastSdp(const CameraConfig &camera, const char *origin, uint32_t session_id) {
+    const std::string pt = std::to_string(MULTICAST_PAYLOAD_TYPE);
+
+    return "v=0\r\n"
+        "o=- " + std::to_string(session_id) + " " + std::to_string(session_id) + " IN IP4 " + origin + "\r\n"
+        "s=Masthead " + camera.name + "\r\n"
+        "c=IN IP4 " + camera.multicast_group + "/" + std::to_string(camera.multicast_ttl) + "\r\n"
+        "t=0 0\r\n"
+        "a=recvonly\r\n"
+        "m=video " + std::to_string(camera.multicast_port) + " RTP/AVP " + pt + "\r\n"
+        "a=rtpmap:" + pt + " H264/90000\r\n"
+        "a=fmtp:" + pt + " packetization-mode=1\r\n"
+        "a=framerate:" + std::to_string(camera.fps) + "\r\n";
+}
+
+/**
+ * @brief Build a SAP packet.
+ *
+ * Version 1, IPv4 origin, no authentication or encryption. The message id
+ * hash is taken from the SDP, so it changes with the announced session.
+ *
+ * @param sdp      Session description.
+ * @param origin   IPv4 address of the announcer.
+ * @param deletion Withdraw the session instead of announcing it.
+ * @return packet, empty if the origin is not an IPv4 address.
+ */
+std::vector<uint8_t> sapPacket(const std::string &sdp, const char *origin, bool deletion) {
+    in_addr address;
+    if (inet_pton(AF_INET, origin, &address) != 1) return {};
+
+    // FNV-1a, folded to 16 bits
+    uint32_t hash = 2166136261u;
+    for (unsigned char c : sdp) hash = (hash ^ c) * 16777619u;
+    hash = (hash >> 16) ^ (hash & 0xffff);
+
+    static const char payload_type[] = "application/sdp";
+    std::vector<uint8_t> packet = {(uint8_t)(0x20 | (deletion ? 0x04 : 0x00)), 0,
+                                   (uint8_t)(hash >> 8), (uint8_t)hash};
+    const uint8_t *origin_bytes = (const uint8_t *)&address.s_addr;
+    packet.insert(packet.end(), origin_bytes, origin_bytes + 4);
+    packet.insert(packet.end(), payload_type, payload_type + sizeof(payload_type));
+    packet.insert(packet.end(), sdp.begin(), sdp.end());
+    return packet;
+}
+
+/**
+ * @brief Find the IPv4 address of an interface.
+ *
+ * @param iface   Interface name, empty for the first one other than loopback.
+ * @param address Returned address.
+ * @return true if the interface has an IPv4 address.
+ */
+bool interfaceAddress(const std::string &iface, std::string *address) {
+    ifaddrs *interfaces;
+    if (getifaddrs(&interfaces) != 0) return false;
+
+    bool found = false;
+    for (ifaddrs *entry = interfaces; entry != NULL && !found; entry = entry->ifa_next) {
+        if (entry->ifa_addr == NULL || entry->ifa_addr->sa_family != AF_INET) continue;
+        if (iface.empty() ? (entry->ifa_flags & IFF_LOOPBACK) != 0 : iface != entry->ifa_name) continue;
+
+        char text[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &((sockaddr_in *)entry->ifa_addr)->sin_addr, text, sizeof(text));
+        *address = text;
+        found    = true;
+    }
+
+    freeifaddrs(interfaces);
+    return found;
+}
+
+/**
+ * @brief Open the socket announcing one multicast stream.
+ *
+ * @param camera     Camera with a multicast group.
+ * @param origin     IPv4 address of the interface the stream is sent on.
+ * @param descriptor Returned socket.
+ * @return error - 0 for no error, 1 if the socket could not be set up.
+ */
+static int openAnnouncer(const CameraConfig &camera, const std::string &origin, int *descriptor) {
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd < 0) return 1;
+
+    unsigned char ttl = (unsigned char)camera.multicast_ttl;
+    in_addr       iface;
+    inet_pton(AF_INET, origin.c_str(), &iface);
+    if (setsockopt(fd, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl)) != 0 ||
+        setsockopt(fd, IPPROTO_IP, IP_MULTICAST_IF, &iface, sizeof(iface)) != 0) {
+        close(fd);
+        return 1;
+    }
+    *descriptor = fd;
+    return 0;
+}
+
+/**
+ * @brief Send one packet of every announcement.
+ *
+ * @param withdraw Send the withdrawals instead of the announcements.
+ */
+static void sendAnnouncements(bool withdraw) {
+    for (const Announcement &announcement : m_announcements) {
+        const std::vector<uint8_t> &packet = withdraw ? announcement.withdraw : announcement.announce;
+        sendto(announcement.socket, packet.data(), packet.size(), 0, (const sockaddr *)&announcement.group,
+               sizeof(announcement.group));
+    }
+}
+
+/**
+ * @brief Announcer thread. Announces until stopped, then withdraws.
+ */
+static void runAnnouncer() {
+    std::unique_lock<std::mutex> lock(m_announcer_mutex);
+    while (!m_announcer_stop) {
+        sendAnnouncements(false);
+        m_announcer_cv.wait_for(lock, std::chrono::seconds(MULTICAST_SAP_INTERVAL_S), []() { return m_announcer_stop; });
+    }
+    sendAnnouncements(true);
+}
+
+/**
+ * @brief Start announcing the multicast streams of the cameras.
+ *
+ * A stream whose interface has no IPv4 address is not announced, but still
+ * sent.
+ *
+ * @param cameras Camera list.
+ * @return error - 0 for no error, 1 if a stream could not be announced.
+ */
+int startMulticastAnnouncer(const std::vector<CameraConfig> &cameras) {
+    int      error      = 0;
+    uint32_t session_id = (uint32_t)time(NULL);
+
+    for (const CameraConfig &camera : cameras) {
+        if (camera.multicast_group.empty()) continue;
+
+        std::string  origin;
+        Announcement announcement = {};
+        if (!interfaceAddress(camera.multicast_iface, &origin) || openAnnouncer(camera, origin, &announcement.socket) != 0) {
+            std::cerr << "No multicast announcement for " << camera.name << "." << std::endl;
+            error = 1;
+            continue;
+        }
+
+        const std::string sdp = multicastSdp(camera, origin.c_str(), session_id++);
+        announcement.group.sin_family = AF_INET;
+        announcement.group.sin_port   = htons(MULTICAST_SAP_PORT);
+        inet_pton(AF_INET, MULTICAST_SAP_GROUP, &announcement.group.sin_addr);
+        announcement.announce = sapPacket(sdp, origin.c_str(), false);
+        announcement.withdraw = sapPacket(sdp, origin.c_str(), true);
+        m_announcements.push_back(announcement);
+    }
+
+    if (!m_announcements.empty()) {
+        m_announcer_stop = false;
+        m_announcer      = std::thread(runAnnouncer);
+    }
+    return error;
+}
+
+/**
+ * @brief Withdraw the multicast announcements and close their sockets.
+ */
+void stopMulticastAnnouncer() {
+    if (m_announcer.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(m_announcer_mutex);
+            m_announcer_stop = true;
+        }
+        m_announcer_cv.notify_all();
+        m_announcer.join();
+    }
+    for (const Announcement &announcement : m_announcements) close(announcement.socket);
+    m_announcements.clear();
+}
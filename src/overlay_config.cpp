@@ -0,0 +1,46 @@
+#include <atomic>
+#include <overlay_config.hpp>
+
+/**
+ * @brief Build the snapshot of the compiled in settings.
+ */
+static std::shared_ptr<const OverlayConfig> defaultConfig() {
+    auto config = std::make_shared<OverlayConfig>();
+    config->version    = 0;
+    config->line_count = 0;
+    for (const AngleLineSettings &line : ANGLE_LINE_SETTINGS) {
+        if (config->line_count < OVERLAY_MAX_LINES) config->lines[config->line_count++] = line;
+    }
+    config->boresight = FORWARD_CAMERA_BORESIGHT;
+#ifdef DEBUG
+    config->debug_text = true;
+#else
+    config->debug_text = false;
+#endif
+    return config;
+}
+
+static std::atomic<std::shared_ptr<const OverlayConfig>> m_config {defaultConfig()};
+static std::atomic<unsigned>                             m_version {0};
+
+/**
+ * @brief Get the current overlay settings snapshot.
+ *
+ * @return snapshot, valid for as long as the caller holds it.
+ */
+std::shared_ptr<const OverlayConfig> overlayConfig() {
+    return m_config.load(std::memory_order_acquire);
+}
+
+/**
+ * @brief Publish new overlay settings.
+ *
+ * The snapshot is copied, so the caller can reuse its config.
+ *
+ * @param config New settings.
+ */
+void publishOverlayConfig(const OverlayConfig &config) {
+    auto snapshot = std::make_shared<OverlayConfig>(config);
+    snapshot->version = ++m_version;
+    m_config.store(snapshot, std::memory_order_release);
+}
@@ -0,0 +1,888 @@
+#include <gst/gst.h>
+#include <gst/video/video.h>
+#include <cairo.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <attitude.hpp>
+#include <bridge_detect.hpp>
+#include <ladder.hpp>
+#include <overlay_config.hpp>
+#include <overlay_layers.hpp>
+#include <trace.hpp>
+
+// Overlay text size in points.
+static const double OVERLAY_FONT_SIZE = 20.0;
+
+// Side of the tiles a layer records its drawing in, in pixels. Even, so the
+// tiles line up with the NV12 chroma samples.
+static const int OVERLAY_TILE = 16;
+
+// Points per docking guide polyline, so the guides follow the lens projection.
+static const int DOCKING_GUIDE_POINTS = 9;
+
+// When a layer goes stale.
+enum class OverlayTrigger { ATTITUDE, TIMER, CONFIG, FRAME };
+
+// Overlay fonts and the glyphs of the ladder labels, made on the first frame and kept for the
+// life of the program, so drawing a frame does not look up fonts or lay out text.
+struct OverlayFonts {
+    cairo_font_face_t    *face;
+    cairo_scaled_font_t  *upright;   // Unrotated text, for the readouts.
+    cairo_glyph_t         label_glyphs[LADDER_LABEL_COUNT][LADDER_LABEL_LENGTH];
+    int                   label_glyph_count[LADDER_LABEL_COUNT];
+    cairo_text_extents_t  label_extents[LADDER_LABEL_COUNT];
+};
+
+static OverlayFonts  *m_fonts = NULL;
+static std::once_flag m_fonts_once;
+
+// Tiles a layer drew into, one byte per tile, and the same as runs of
+// consecutive tiles along each tile row, which is what gets composited.
+struct LayerTiles {
+    int                                columns = 0;
+    int                                rows    = 0;
+    int                                width   = 0;
+    int                                height  = 0;
+    std::vector<uint8_t>               drawn;
+    std::vector<cairo_rectangle_int_t> runs;
+};
+
+// What a layer is drawn for.
+struct LayerContext {
+    const OverlayFrame  &frame;
+    const CameraModel   &camera;
+    const OverlayConfig &config;
+    const char          *name;
+    BridgeDetector      *bridge;   // NULL without a bridge detector.
+};
+
+// Cache key of a layer. The trigger decides which fields are used.
+struct LayerKey {
+    int64_t  a       = 0;   // Quantized pitch, timer tick or frame count.
+    int64_t  b       = 0;   // Quantized roll.
+    long     cx      = 0;   // Principal point, which moves with the crop window.
+    long     cy      = 0;
+    unsigned version = 0;
+    int      width   = 0;
+    int      height  = 0;
+
+    bool operator==(const LayerKey &) const = default;
+};
+
+// One layer and its cached drawing.
+struct LayerCache {
+    bool             drawn   = false;
+    LayerKey         key;
+    cairo_surface_t *surface = NULL;   // ARGB32, transparent where the layer has not drawn.
+    LayerTiles       tiles;
+};
+
+// How to draw one layer.
+struct LayerSpec {
+    OverlayLayer   layer;
+    OverlayTrigger trigger;
+    int            period_ms;   // TIMER only.
+    void         (*draw)(cairo_t *cr, const LayerContext &context, LayerTiles *tiles);
+};
+
+static void drawLadderLayer(cairo_t *cr, const LayerContext &context, LayerTiles *tiles);
+static void drawDockingLayer(cairo_t *cr, const LayerContext &context, LayerTiles *tiles);
+static void drawTelemetryLayer(cairo_t *cr, const LayerContext &context, LayerTiles *tiles);
+static void drawBadgesLayer(cairo_t *cr, const LayerContext &context, LayerTiles *tiles);
+static void drawBridgeLayer(cairo_t *cr, const LayerContext &context, LayerTiles *tiles);
+
+// All layers, bottom to top.
+static const LayerSpec LAYER_SPECS[] = {
+    {OVERLAY_LAYER_LADDER,    OverlayTrigger::ATTITUDE, 0,                           drawLadderLayer},
+    {OVERLAY_LAYER_DOCKING,   OverlayTrigger::CONFIG,   0,                           drawDockingLayer},
+    {OVERLAY_LAYER_TELEMETRY, OverlayTrigger::TIMER,    OVERLAY_TELEMETRY_PERIOD_MS, drawTelemetryLayer},
+    {OVERLAY_LAYER_BADGES,    OverlayTrigger::TIMER,    OVERLAY_BADGE_PERIOD_MS,     drawBadgesLayer},
+    {OVERLAY_LAYER_BRIDGE,    OverlayTrigger::FRAME,    0,                           drawBridgeLayer},
+};
+static const int LAYER_COUNT = sizeof(LAYER_SPECS) / sizeof(LAYER_SPECS[0]);
+
+struct OverlayEngine {
+    std::string        name;
+    unsigned           layers;
+    OverlayCameraModel camera;
+    BridgeDetector    *bridge = NULL;
+    int64_t            frames = 0;
+    LayerCache         caches[LAYER_COUNT];
+};
+
+// Engine attached to a pipeline element, and the frame format of an NV12 element.
+struct OverlayAttachment {
+    OverlayEngine *engine;
+    GstVideoInfo   info;
+    bool           ready = false;
+};
+
+/**
+ * @brief Get the overlay fonts, making them on the first call.
+ *
+ * @return overlay fonts.
+ */
+static const OverlayFonts &overlayFonts() {
+    std::call_once(m_fonts_once, []() {
+        m_fonts = new OverlayFonts();
+        m_fonts->face = cairo_toy_font_face_create("Sans", CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_BOLD);
+
+        cairo_matrix_t font_matrix, identity;
+        cairo_matrix_init_scale(&font_matrix, OVERLAY_FONT_SIZE, OVERLAY_FONT_SIZE);
+        cairo_matrix_init_identity(&identity);
+        cairo_font_options_t *options = cairo_font_options_create();
+        m_fonts->upright = cairo_scaled_font_create(m_fonts->face, &font_matrix, &identity, options);
+        cairo_font_options_destroy(options);
+
+        // Glyph positions do not depend on the rotation the labels are drawn at
+        for (int i = 0; i < LADDER_LABEL_COUNT; i++) {
+            cairo_glyph_t *glyphs = NULL;
+            int            count  = 0;
+            cairo_scaled_font_text_to_glyphs(m_fonts->upright, 0, 0, LADDER_LABELS.text[i], -1,
+                                             &glyphs, &count, NULL, NULL, NULL);
+            count = std::min(count, LADDER_LABEL_LENGTH);
+            std::copy(glyphs, glyphs + count, m_fonts->label_glyphs[i]);
+            m_fonts->label_glyph_count[i] = count;
+            cairo_scaled_font_glyph_extents(m_fonts->upright, m_fonts->label_glyphs[i], count,
+                                            &m_fonts->label_extents[i]);
+            cairo_glyph_free(glyphs);
+        }
+    });
+    return *m_fonts;
+}
+
+/**
+ * @brief Size the tiles of a layer to a frame, with none drawn.
+ */
+static void resizeTiles(LayerTiles *tiles, int width, int height) {
+    tiles->width   = width;
+    tiles->height  = height;
+    tiles->columns = (width  + OVERLAY_TILE - 1) / OVERLAY_TILE;
+    tiles->rows    = (height + OVERLAY_TILE - 1) / OVERLAY_TILE;
+    tiles->drawn.assign((size_t)tiles->columns * tiles->rows, 0);
+    tiles->runs.clear();
+    // At most every other tile of a row starts a run
+    tiles->runs.reserve((size_t)tiles->rows * (tiles->columns / 2 + 1));
+}
+
+/**
+ * @brief Mark the tiles under a box of device pixels as drawn.
+ *
+ * @param tiles  Layer tiles.
+ * @param left   Box left edge.
+ * @param top    Box top edge.
+ * @param right  Box right edge.
+ * @param bottom Box bottom edge.
+ */
+static void markTiles(LayerTiles *tiles, double left, double top, double right, double bottom) {
+    if (!(right > 0.0 && bottom > 0.0 && left < tiles->width && top < tiles->height)) return;
+    int c0 = std::max((int)floor(left) / OVERLAY_TILE, 0);
+    int r0 = std::max((int)floor(top)  / OVERLAY_TILE, 0);
+    int c1 = std::min((int)ceil(right)  / OVERLAY_TILE, tiles->columns - 1);
+    int r1 = std::min((int)ceil(bottom) / OVERLAY_TILE, tiles->rows - 1);
+    for (int r = r0; r <= r1; r++) {
+        std::fill(tiles->drawn.begin() + (size_t)r * tiles->columns + c0,
+                  tiles->drawn.begin() + (size_t)r * tiles->columns + c1 + 1, 1);
+    }
+}
+
+/**
+ * @brief Mark the tiles under a stroked segment as drawn.
+ *
+ * Samples the segment every half tile, so a long diagonal marks the tiles it
+ * crosses rather than its whole bounding box.
+ *
+ * @param tiles Layer tiles.
+ * @param x0,y0 Segment start.
+ * @param x1,y1 Segment end.
+ * @param width Line width.
+ */
+static void markSegment(LayerTiles *tiles, double x0, double y0, double x1, double y1, double width) {
+    const double reach = width / 2.0 + 1.0 + OVERLAY_TILE / 4.0;  // Antialiasing and the sample spacing.
+    const int    steps = std::max((int)ceil(hypot(x1 - x0, y1 - y0) / (OVERLAY_TILE / 2.0)), 1);
+    for (int i = 0; i <= steps; i++) {
+        double x = x0 + (x1 - x0) * i / steps;
+        double y = y0 + (y1 - y0) * i / steps;
+        markTiles(tiles, x - reach, y - reach, x + reach, y + reach);
+    }
+}
+
+/**
+ * @brief Mark the tiles under a box in user space, such as a text box, as drawn.
+ *
+ * @param cr     Cairo context with the transform the box is drawn with.
+ * @param tiles  Layer tiles.
+ * @param x, y   Box corner in user space.
+ * @param width  Box width in user space.
+ * @param height Box height in user space.
+ */
+static void markUserBox(cairo_t *cr, LayerTiles *tiles, double x, double y, double width, double height) {
+    double left = INFINITY, top = INFINITY, right = -INFINITY, bottom = -INFINITY;
+    for (int corner = 0; corner < 4; corner++) {
+        double u = x + (corner & 1 ? width : 0.0);
+        double v = y + (corner & 2 ? height : 0.0);
+        cairo_user_to_device(cr, &u, &v);
+        left   = std::min(left, u);
+        top    = std::min(top, v);
+        right  = std::max(right, u);
+        bottom = std::max(bottom, v);
+    }
+    markTiles(tiles, left - 2.0, top - 2.0, right + 2.0, bottom + 2.0);
+}
+
+/**
+ * @brief Rebuild the runs of a layer from its drawn tiles.
+ */
+static void buildRuns(LayerTiles *tiles) {
+    tiles->runs.clear();
+    for (int r = 0; r < tiles->rows; r++) {
+        const uint8_t *row = &tiles->drawn[(size_t)r * tiles->columns];
+        for (int c = 0; c < tiles->columns; c++) {
+            if (!row[c]) continue;
+            int start = c;
+            while (c + 1 < tiles->columns && row[c + 1]) c++;
+            cairo_rectangle_int_t run;
+            run.x      = start * OVERLAY_TILE;
+            run.y      = r * OVERLAY_TILE;
+            run.width  = std::min((c + 1) * OVERLAY_TILE, tiles->width)  - run.x;
+            run.height = std::min((r + 1) * OVERLAY_TILE, tiles->height) - run.y;
+            tiles->runs.push_back(run);
+        }
+    }
+}
+
+/**
+ * @brief Draw one line of upright text without formatting into a heap string.
+ *
+ * @param cr     Cairo context, with the upright font set.
+ * @param tiles  Layer tiles, the text box is marked.
+ * @param x      Text origin column.
+ * @param y      Text origin row.
+ * @param format printf format.
+ */
+static void drawText(cairo_t *cr, LayerTiles *tiles, double x, double y, const char *format, ...) {
+    char    text[64];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(text, sizeof(text), format, args);
+    va_end(args);
+
+    cairo_text_extents_t extents;
+    cairo_text_extents(cr, text, &extents);
+    markUserBox(cr, tiles, x + extents.x_bearing, y + extents.y_bearing, extents.width, extents.height);
+
+    cairo_move_to(cr, x, y);
+    cairo_show_text(cr, text);
+}
+
+/**
+ * @brief Draw the pitch ladder.
+ *
+ * Each line is the line of constant elevation projected through the camera
+ * model, so it lands at the right elevation across the whole frame. The
+ * projected points are cached per quantized attitude.
+ */
+static void drawLadderLayer(cairo_t *cr, const LayerContext &context, LayerTiles *tiles) {
+    const OverlayConfig  &config = context.config;
+    const LadderGeometry &ladder = ladderGeometry(context.camera, config, context.frame.pitch, context.frame.roll);
+    const OverlayFonts   &fonts  = overlayFonts();
+    const double          width  = 3.0;
+
+    cairo_set_source_rgb(cr, 1.0, 1.0, 1.0);
+    cairo_set_line_width(cr, width);
+    cairo_set_font_face(cr, fonts.face);
+    cairo_set_font_size(cr, OVERLAY_FONT_SIZE);
+
+    // Add each of the pitch lines based on their definitions in the settings (ANGLE_LINE_SETTINGS by default)
+    for (int i = 0; i < ladder.line_count; i++) {
+        const LadderLine &line = ladder.lines[i];
+        if (line.points < 2) continue;
+
+        // 1. Draw the projected line
+        cairo_move_to(cr, line.x[0], line.y[0]);
+        for (int p = 1; p < line.points; p++) {
+            cairo_line_to(cr, line.x[p], line.y[p]);
+            markSegment(tiles, line.x[p - 1], line.y[p - 1], line.x[p], line.y[p], width);
+        }
+        cairo_stroke(cr);
+
+        // 2. Draw text next to the right end of the line if enabled, along the line direction.
+        //    The label glyphs are laid out once, ahead of time.
+        if (config.lines[i].display_text) {
+            int                         label   = ladderLabelIndex(config.lines[i].angle);
+            const cairo_text_extents_t &extents = fonts.label_extents[label];
+            cairo_save(cr);
+            cairo_translate(cr, line.x[line.points - 1], line.y[line.points - 1]);
+            cairo_rotate(cr, line.label_angle);
+            cairo_translate(cr, 10, 7); // Offset to the right of the line
+            cairo_show_glyphs(cr, fonts.label_glyphs[label], fonts.label_glyph_count[label]);
+            markUserBox(cr, tiles, extents.x_bearing, extents.y_bearing, extents.width, extents.height);
+            cairo_restore(cr);
+        }
+    }
+}
+
+/**
+ * @brief Project a point of the water plane below the docking camera.
+ *
+ * @param camera   Camera model.
+ * @param rotation Boat frame to camera frame rotation.
+ * @param x        Distance to starboard of the camera, meters.
+ * @param z        Distance forward of the camera, meters.
+ * @return u, v - Pixel. False when the point is behind the camera.
+ */
+static bool projectWaterPoint(const CameraModel &camera, const CameraRotation &rotation, double x, double z,
+                              double *u, double *v) {
+    const double point[3] = {x, DOCKING_CAMERA_HEIGHT_M, z};
+    double       ray[3];
+    for (int r = 0; r < 3; r++) {
+        ray[r] = rotation.m[r][0] * point[0] + rotation.m[r][1] * point[1] + rotation.m[r][2] * point[2];
+    }
+    if (ray[2] <= 1e-6) return false;
+    lensPixel(camera, ray[0], ray[1], ray[2], u, v);
+    return true;
+}
+
+/**
+ * @brief Draw the fender lines and the distance lines outboard of them.
+ *
+ * The guides are fixed to the boat, so they do not follow the attitude and
+ * are only drawn again when the settings change.
+ */
+static void drawDockingLayer(cairo_t *cr, const LayerContext &context, LayerTiles *tiles) {
+    const CameraRotation rotation = cameraRotation(0.0, 0.0, DOCKING_CAMERA_BORESIGHT);
+    const OverlayFonts  &fonts    = overlayFonts();
+    const double         width    = 3.0;
+
+    // Fender line, then the distance lines from near (red) to far (green)
+    const int distances = sizeof(DOCKING_GUIDE_DISTANCES_M) / sizeof(DOCKING_GUIDE_DISTANCES_M[0]);
+    cairo_set_line_width(cr, width);
+    cairo_set_scaled_font(cr, fonts.upright);
+    for (int guide = 0; guide <= distances; guide++) {
+        const double offset = guide == 0 ? 0.0 : DOCKING_GUIDE_DISTANCES_M[guide - 1];
+        const double mix    = distances > 1 && guide > 0 ? (guide - 1.0) / (distances - 1) : 0.0;
+        if (guide == 0) cairo_set_source_rgb(cr, 1.0, 1.0, 1.0);
+        else            cairo_set_source_rgb(cr, 1.0 - mix, mix < 0.5 ? 2.0 * mix : 1.0, 0.0);
+
+        for (int side = -1; side <= 1; side += 2) {
+            const double x = side * (DOCKING_HALF_BEAM_M + offset);
+            double       u[DOCKING_GUIDE_POINTS], v[DOCKING_GUIDE_POINTS];
+            int          points = 0;
+            for (int i = 0; i < DOCKING_GUIDE_POINTS; i++) {
+                double z = DOCKING_GUIDE_LENGTH_M - 2.0 * DOCKING_GUIDE_LENGTH_M * i / (DOCKING_GUIDE_POINTS - 1);
+                if (projectWaterPoint(context.camera, rotation, x, z, &u[points], &v[points])) points++;
+            }
+            if (points < 2) continue;
+
+            cairo_move_to(cr, u[0], v[0]);
+            for (int p = 1; p < points; p++) {
+                cairo_line_to(cr, u[p], v[p]);
+                markSegment(tiles, u[p - 1], v[p - 1], u[p], v[p], width);
+            }
+            cairo_stroke(cr);
+
+            // Distance at the forward end, outboard of the line
+            if (guide > 0) {
+                cairo_text_extents_t extents;
+                char                 text[16];
+                snprintf(text, sizeof(text), "%.1f m", offset);
+                cairo_text_extents(cr, text, &extents);
+                drawText(cr, tiles, side > 0 ? u[0] + 8 : u[0] - 8 - extents.x_advance, v[0] + 20, "%s", text);
+            }
+        }
+    }
+}
+
+/**
+ * @brief Draw the pitch, roll and yaw readout at the bottom left, when
+ *        debug_text is set. On by default when DEBUG is defined, and can be
+ *        switched through the control socket.
+ */
+static void drawTelemetryLayer(cairo_t *cr, const LayerContext &context, LayerTiles *tiles) {
+    if (!context.config.debug_text) return;
+
+    const int height = context.frame.height;
+    cairo_set_source_rgb(cr, 1.0, 1.0, 0.0); // Yellow for debug
+    cairo_set_scaled_font(cr, overlayFonts().upright);
+
+    drawText(cr, tiles, 20, height - 70, "Pitch: %f", context.frame.pitch);
+    drawText(cr, tiles, 20, height - 45, "Roll:  %f", context.frame.roll);
+    drawText(cr, tiles, 20, height - 20, "Yaw:   %f", context.frame.yaw);
+}
+
+/**
+ * @brief Draw the camera name and the UTC time on a dark badge at the top right.
+ */
+static void drawBadgesLayer(cairo_t *cr, const LayerContext &context, LayerTiles *tiles) {
+    const time_t seconds = (time_t)(context.frame.now_ms / 1000);
+    struct tm    utc;
+    gmtime_r(&seconds, &utc);
+
+    char text[64];
+    snprintf(text, sizeof(text), "%s  %02d:%02d:%02d UTC", context.name, utc.tm_hour, utc.tm_min, utc.tm_sec);
+
+    cairo_set_scaled_font(cr, overlayFonts().upright);
+    cairo_text_extents_t extents;
+    cairo_text_extents(cr, text, &extents);
+
+    const double pad = 8.0;
+    const double x   = context.frame.width - 20.0 - extents.x_advance;
+    const double y   = 40.0;
+    cairo_set_source_rgba(cr, 0.0, 0.0, 0.0, 0.5);
+    cairo_rectangle(cr, x - pad, y + extents.y_bearing - pad, extents.x_advance + 2 * pad, extents.height + 2 * pad);
+    cairo_fill(cr);
+
+    cairo_set_source_rgb(cr, 1.0, 1.0, 1.0);
+    drawText(cr, tiles, x, y, "%s", text);
+    markUserBox(cr, tiles, x - pad, y + extents.y_bearing - pad, extents.x_advance + 2 * pad, extents.height + 2 * pad);
+}
+
+/**
+ * @brief Draw the measured bridge underside and the go/no-go readout.
+ *
+ * Drawn every frame, so only the tiles under the line and the text are
+ * cleared and blended.
+ */
+static void drawBridgeLayer(cairo_t *cr, const LayerContext &context, LayerTiles *tiles) {
+    if (!context.bridge) return;
+    BridgeReadoutArea area;
+    drawBridgeReadout(context.bridge, cr, overlayFonts().face, context.camera,
+                      cameraRotation(context.frame.pitch, context.frame.roll, context.config.boresight), &area);
+    if (!tiles) return;
+    for (int p = 1; p < area.points; p++) {
+        markSegment(tiles, area.x[p - 1], area.y[p - 1], area.x[p], area.y[p], area.line_width);
+    }
+    if (area.text.width > 0) markUserBox(cr, tiles, area.text.x, area.text.y, area.text.width, area.text.height);
+}
+
+/**
+ * @brief Get the cache key of a layer for a frame.
+ */
+static LayerKey layerKey(const LayerSpec &spec, const OverlayEngine *engine, const LayerContext &context) {
+    LayerKey key;
+    key.version = context.config.version;
+    key.width   = context.frame.width;
+    key.height  = context.frame.height;
+    switch (spec.trigger) {
+    case OverlayTrigger::ATTITUDE:
+        key.a  = lround(context.frame.pitch / LADDER_QUANTUM_DEG);
+        key.b  = lround(context.frame.roll  / LADDER_QUANTUM_DEG);
+        key.cx = lround(context.camera.cx);
+        key.cy = lround(context.camera.cy);
+        break;
+    case OverlayTrigger::TIMER:
+        key.a = context.frame.now_ms / spec.period_ms;
+        break;
+    case OverlayTrigger::CONFIG:
+        break;
+    case OverlayTrigger::FRAME:
+        key.a = engine->frames;
+        break;
+    }
+    return key;
+}
+
+/**
+ * @brief Draw a layer again if it is stale.
+ *
+ * Only the tiles the last drawing covered are cleared, then the layer is
+ * drawn and the tiles it covers now are recorded.
+ *
+ * @param engine  Overlay engine.
+ * @param index   Layer to bring up to date.
+ * @param context What the frame is drawn for.
+ */
+static void updateLayer(OverlayEngine *engine, int index, const LayerContext &context) {
+    const LayerSpec &spec  = LAYER_SPECS[index];
+    LayerCache      &cache = engine->caches[index];
+    const LayerKey   key   = layerKey(spec, engine, context);
+    if (cache.drawn && key == cache.key) return;
+
+    TRACE_SPAN("overlay layer");
+    const int width  = context.frame.width;
+    const int height = context.frame.height;
+    if (!cache.surface || cache.tiles.width != width || cache.tiles.height != height) {
+        if (cache.surface) cairo_surface_destroy(cache.surface);
+        cache.surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, width, height);
+        resizeTiles(&cache.tiles, width, height);
+    } else {
+        cairo_surface_flush(cache.surface);
+        uint8_t *data   = cairo_image_surface_get_data(cache.surface);
+        int      stride = cairo_image_surface_get_stride(cache.surface);
+        for (const cairo_rectangle_int_t &run : cache.tiles.runs) {
+            for (int y = run.y; y < run.y + run.height; y++) {
+                std::fill_n(data + (size_t)y * stride + run.x * 4, run.width * 4, 0);
+            }
+        }
+        cairo_surface_mark_dirty(cache.surface);
+        std::fill(cache.tiles.drawn.begin(), cache.tiles.drawn.end(), 0);
+    }
+
+    cairo_t *cr = cairo_create(cache.surface);
+    spec.draw(cr, context, &cache.tiles);
+    cairo_destroy(cr);
+    cairo_surface_flush(cache.surface);
+
+    buildRuns(&cache.tiles);
+    cache.key   = key;
+    cache.drawn = true;
+}
+
+/**
+ * @brief Divide by 255, rounded, for products of two bytes.
+ */
+static inline unsigned div255(unsigned value) {
+    value += 128;
+    return (value + (value >> 8)) >> 8;
+}
+
+/**
+ * @brief Composite premultiplied ARGB32 pixels over BGRx or BGRA pixels.
+ *
+ * Every byte, the X or alpha byte too, is src + dst * (255 - alpha) / 255.
+ * Transparent pixels, most of a layer, are skipped.
+ *
+ * @param src   Layer pixels.
+ * @param dst   Frame pixels.
+ * @param count Number of pixels.
+ */
+static void blendRowBgrx(const uint32_t *src, uint32_t *dst, int count) {
+    for (int i = 0; i < count; i++) {
+        const uint32_t s = src[i];
+        if (!s) continue;
+        const unsigned inverse = 255 - (s >> 24);
+        if (!inverse) {
+            dst[i] = s;
+            continue;
+        }
+        const uint32_t d   = dst[i];
+        uint32_t       out = 0;
+        for (int shift = 0; shift < 32; shift += 8) {
+            out |= (((s >> shift) & 0xff) + div255(((d >> shift) & 0xff) * inverse)) << shift;
+        }
+        dst[i] = out;
+    }
+}
+
+/**
+ * @brief Composite one run of a layer into NV12 planes.
+ *
+ * BT.601 limited range. The layer colour is premultiplied, so the offsets of
+ * Y, U and V are scaled by its alpha. Chroma takes the top left pixel of each
+ * 2 x 2 block.
+ */
+static void blendRunNv12(const uint8_t *layer, int layer_stride, const cairo_rectangle_int_t &run,
+                         uint8_t *luma, int luma_stride, uint8_t *chroma, int chroma_stride) {
+    for (int y = run.y; y < run.y + run.height; y++) {
+        const uint32_t *src = (const uint32_t *)(layer + (size_t)y * layer_stride) + run.x;
+        uint8_t        *Y   = luma + (size_t)y * luma_stride + run.x;
+        uint8_t        *UV  = (y & 1) ? NULL : chroma + (size_t)(y / 2) * chroma_stride + run.x;
+
+        for (int x = 0; x < run.width; x++) {
+            const uint32_t s = src[x];
+            if (!s) continue;
+            const int a = s >> 24, r = (s >> 16) & 0xff, g = (s >> 8) & 0xff, b = s & 0xff;
+            const unsigned inverse = 255 - a;
+
+            Y[x] = (uint8_t)(div255(Y[x] * inverse) + ((66 * r + 129 * g + 25 * b + 128) >> 8) + div255(16 * a));
+            if (UV && !(x & 1)) {
+                int u = ((-38 * r - 74 * g + 112 * b + 128) >> 8) + (int)div255(128 * a);
+                int v = ((112 * r - 94 * g - 18 * b + 128) >> 8) + (int)div255(128 * a);
+                UV[x]     = (uint8_t)std::clamp((int)div255(UV[x]     * inverse) + u, 0, 255);
+                UV[x + 1] = (uint8_t)std::clamp((int)div255(UV[x + 1] * inverse) + v, 0, 255);
+            }
+        }
+    }
+}
+
+/**
+ * @brief Make an overlay engine.
+ *
+ * @param name   Camera name, shown on the badges.
+ * @param layers Mask of OverlayLayer.
+ * @param camera Camera model of the frames drawn on.
+ * @param bridge Bridge detector read by the bridge layer, or NULL.
+ * @return engine, freed with freeOverlayEngine.
+ */
+OverlayEngine *makeOverlayEngine(const char *name, unsigned layers, OverlayCameraModel camera,
+                                 BridgeDetector *bridge) {
+    OverlayEngine *engine = new OverlayEngine();
+    engine->name   = name;
+    engine->layers = layers;
+    engine->camera = camera;
+    engine->bridge = bridge;
+    return engine;
+}
+
+/**
+ * @brief Free an overlay engine and its layer surfaces.
+ */
+void freeOverlayEngine(OverlayEngine *engine) {
+    if (!engine) return;
+    for (LayerCache &cache : engine->caches) {
+        if (cache.surface) cairo_surface_destroy(cache.surface);
+    }
+    delete engine;
+}
+
+/**
+ * @brief Draw the layers onto a frame drawn with Cairo.
+ *
+ * Image surfaces are composited into directly, run by run. FRAME layers are
+ * drawn straight onto the frame, on top.
+ *
+ * @param engine Overlay engine.
+ * @param cr     Cairo context of the frame, without a transform.
+ * @param frame  What the frame is drawn for.
+ */
+void drawOverlayLayers(OverlayEngine *engine, cairo_t *cr, const OverlayFrame &frame) {
+    // Settings snapshot for this frame. It can be replaced through the control socket at any time.
+    std::shared_ptr<const OverlayConfig> config = overlayConfig();
+    const CameraModel                    camera = engine->camera(frame.width, frame.height);
+    const LayerContext                   context = {frame, camera, *config, engine->name.c_str(), engine->bridge};
+    engine->frames++;
+
+    cairo_surface_t *target = cairo_get_target(cr);
+    const bool       image  = cairo_surface_get_type(target) == CAIRO_SURFACE_TYPE_IMAGE &&
+                              (cairo_image_surface_get_format(target) == CAIRO_FORMAT_RGB24 ||
+                               cairo_image_surface_get_format(target) == CAIRO_FORMAT_ARGB32);
+    if (image) cairo_surface_flush(target);
+
+    for (int index = 0; index < LAYER_COUNT; index++) {
+        const LayerSpec &spec = LAYER_SPECS[index];
+        if (!(engine->layers & spec.layer) || spec.trigger == OverlayTrigger::FRAME) continue;
+        updateLayer(engine, index, context);
+
+        const LayerCache &cache = engine->caches[index];
+        if (image) {
+            const uint8_t *src        = cairo_image_surface_get_data(cache.surface);
+            const int      src_stride = cairo_image_surface_get_stride(cache.surface);
+            uint8_t       *dst        = cairo_image_surface_get_data(target);
+            const int      dst_stride = cairo_image_surface_get_stride(target);
+            const int      width      = cairo_image_surface_get_width(target);
+            const int      height     = cairo_image_surface_get_height(target);
+            for (const cairo_rectangle_int_t &run : cache.tiles.runs) {
+                const int count = std::min(run.x + run.width, width) - run.x;
+                for (int y = run.y; y < std::min(run.y + run.height, height) && count > 0; y++) {
+                    blendRowBgrx((const uint32_t *)(src + (size_t)y * src_stride) + run.x,
+                                 (uint32_t *)(dst + (size_t)y * dst_stride) + run.x, count);
+                }
+            }
+        } else {
+            cairo_save(cr);
+            cairo_set_source_surface(cr, cache.surface, 0, 0);
+            for (const cairo_rectangle_int_t &run : cache.tiles.runs) {
+                cairo_rectangle(cr, run.x, run.y, run.width, run.height);
+                cairo_fill(cr);
+            }
+            cairo_restore(cr);
+        }
+    }
+    if (image) cairo_surface_mark_dirty(target);
+
+    for (int index = 0; index < LAYER_COUNT; index++) {
+        const LayerSpec &spec = LAYER_SPECS[index];
+        if (!(engine->layers & spec.layer) || spec.trigger != OverlayTrigger::FRAME) continue;
+        cairo_save(cr);
+        spec.draw(cr, context, NULL);
+        cairo_restore(cr);
+    }
+}
+
+/**
+ * @brief Blend the layers into NV12 planes.
+ *
+ * FRAME layers are drawn into their cache every frame, after the others.
+ *
+ * @param engine        Overlay engine.
+ * @param luma          Y plane.
+ * @param luma_stride   Bytes per Y row.
+ * @param chroma        Interleaved UV plane.
+ * @param chroma_stride Bytes per UV row.
+ * @param frame         What the frame is drawn for.
+ */
+void blendOverlayLayers(OverlayEngine *engine, uint8_t *luma, int luma_stride, uint8_t *chroma, int chroma_stride,
+                        const OverlayFrame &frame) {
+    std::shared_ptr<const OverlayConfig> config = overlayConfig();
+    const CameraModel                    camera = engine->camera(frame.width, frame.height);
+    const LayerContext                   context = {frame, camera, *config, engine->name.c_str(), engine->bridge};
+    engine->frames++;
+
+    for (int index = 0; index < LAYER_COUNT; index++) {
+        if (!(engine->layers & LAYER_SPECS[index].layer)) continue;
+        updateLayer(engine, index, context);
+
+        const LayerCache &cache  = engine->caches[index];
+        const uint8_t    *layer  = cairo_image_surface_get_data(cache.surface);
+        const int         stride = cairo_image_surface_get_stride(cache.surface);
+        for (const cairo_rectangle_int_t &run : cache.tiles.runs) {
+            blendRunNv12(layer, stride, run, luma, luma_stride, chroma, chroma_stride);
+        }
+    }
+}
+
+/**
+ * @brief Get the frame of this moment: IMU attitude and wall clock.
+ *
+ * The sensor is read from one thread only, by the engine of the pitch ladder
+ * (the horizon camera) once per frame. The other engines take the attitude it
+ * read last.
+ *
+ * @param engine Overlay engine the frame is for.
+ * @param width  Frame width.
+ * @param height Frame height.
+ */
+static OverlayFrame currentFrame(const OverlayEngine *engine, int width, int height) {
+    OverlayFrame frame = {};
+    if (engine->layers & OVERLAY_LAYER_LADDER) getAttitude(&frame.pitch, &frame.roll, &frame.yaw);
+    else                                       peekAttitude(&frame.pitch, &frame.roll, &frame.yaw);
+    frame.now_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    frame.width  = width;
+    frame.height = height;
+    return frame;
+}
+
+/**
+ * @brief cairooverlay draw callback. Draws the layers for the current attitude.
+ *
+ * @param overlay   cairooverlay element.
+ * @param cr        Cairo context of the frame.
+ * @param timestamp Timestamp for the current video frame.
+ * @param duration  Length of the media stream.
+ * @param user_data Overlay attachment.
+ */
+static void on_draw_layers(GstElement *overlay, cairo_t *cr, guint64 timestamp, guint64 duration,
+                           gpointer user_data) {
+    TRACE_SPAN("overlay draw");
+    OverlayAttachment *attachment = (OverlayAttachment *)user_data;
+    cairo_surface_t   *target     = cairo_get_target(cr);
+    drawOverlayLayers(attachment->engine, cr, currentFrame(attachment->engine, cairo_image_surface_get_width(target),
+                                                           cairo_image_surface_get_height(target)));
+}
+
+/**
+ * @brief Buffer probe that blends the layers into each NV12 frame in place.
+ *
+ * @param pad       Pad the probe is attached to.
+ * @param info      Probe info holding the buffer.
+ * @param user_data Overlay attachment.
+ * @return GST_PAD_PROBE_OK to keep the data flowing.
+ */
+static GstPadProbeReturn on_blend_layers(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    OverlayAttachment *attachment = (OverlayAttachment *)user_data;
+
+    if (!attachment->ready) {
+        GstCaps *caps = gst_pad_get_current_caps(pad);
+        if (!caps) return GST_PAD_PROBE_OK;
+        attachment->ready = gst_video_info_from_caps(&attachment->info, caps) &&
+                            GST_VIDEO_INFO_FORMAT(&attachment->info) == GST_VIDEO_FORMAT_NV12;
+        gst_caps_unref(caps);
+        if (!attachment->ready) {
+            std::cerr << "The overlay needs NV12 frames. Overlay disabled." << std::endl;
+            return GST_PAD_PROBE_REMOVE;
+        }
+    }
+
+    TRACE_SPAN("overlay blend");
+    // Drawn in place. Only the pixels under the layers are touched, so copying the frame would cost more.
+    // The frames are not shared upstream (denoise keeps a copy of its own), so this does not copy.
+    GstBuffer *buffer = gst_buffer_make_writable(GST_PAD_PROBE_INFO_BUFFER(info));
+    GST_PAD_PROBE_INFO_DATA(info) = buffer;
+
+    GstVideoFrame video;
+    if (!gst_video_frame_map(&video, &attachment->info, buffer, GST_MAP_READWRITE)) return GST_PAD_PROBE_OK;
+    blendOverlayLayers(attachment->engine,
+                       (uint8_t *)GST_VIDEO_FRAME_PLANE_DATA(&video, 0), GST_VIDEO_FRAME_PLANE_STRIDE(&video, 0),
+                       (uint8_t *)GST_VIDEO_FRAME_PLANE_DATA(&video, 1), GST_VIDEO_FRAME_PLANE_STRIDE(&video, 1),
+                       currentFrame(attachment->engine, GST_VIDEO_FRAME_WIDTH(&video), GST_VIDEO_FRAME_HEIGHT(&video)));
+    gst_video_frame_unmap(&video);
+    return GST_PAD_PROBE_OK;
+}
+
+/**
+ * @brief Event probe that reads the frame layout again when the caps change.
+ *
+ * The frame size can change while playing (see docking_mode.hpp). The engine
+ * redraws its layers for the new size by itself.
+ */
+static GstPadProbeReturn on_blend_caps(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    OverlayAttachment *attachment = (OverlayAttachment *)user_data;
+    if (GST_EVENT_TYPE(GST_PAD_PROBE_INFO_EVENT(info)) == GST_EVENT_CAPS) attachment->ready = false;
+    return GST_PAD_PROBE_OK;
+}
+
+/**
+ * @brief Free an overlay attachment with its engine.
+ */
+static void freeAttachment(gpointer data) {
+    OverlayAttachment *attachment = (OverlayAttachment *)data;
+    freeOverlayEngine(attachment->engine);
+    delete attachment;
+}
+
+/**
+ * @brief Free an overlay attachment once its draw signal handler is gone.
+ */
+static void on_draw_layers_disconnected(gpointer data, GClosure *closure) {
+    freeAttachment(data);
+}
+
+/**
+ * @brief Attach an overlay engine to a pipeline element.
+ *
+ * A cairooverlay draws the layers from its draw signal. Any other element
+ * gets a probe on its source pad that blends them into the NV12 frames.
+ *
+ * @param pipeline     Pipeline holding the element.
+ * @param element_name Element to draw at.
+ * @param name         Camera name, shown on the badges.
+ * @param layers       Mask of OverlayLayer.
+ * @param camera       Camera model of the frames.
+ * @param bridge       Bridge detector read by the bridge layer, or NULL.
+ * @return error - 0 for no error, 1 if the element was not found.
+ */
+int attachOverlay(GstElement *pipeline, const char *element_name, const char *name, unsigned layers,
+                  OverlayCameraModel camera, BridgeDetector *bridge) {
+    GstElement *element = gst_bin_get_by_name(GST_BIN(pipeline), element_name);
+    if (!element) return 1;
+
+    OverlayAttachment *attachment = new OverlayAttachment();
+    attachment->engine = makeOverlayEngine(name, layers, camera, bridge);
+
+    GstElementFactory *factory = gst_element_get_factory(element);
+    if (factory && strcmp(GST_OBJECT_NAME(factory), "cairooverlay") == 0) {
+        g_signal_connect_data(element, "draw", G_CALLBACK(on_draw_layers), attachment,
+                              on_draw_layers_disconnected, (GConnectFlags)0);
+    } else {
+        GstPad *pad = gst_element_get_static_pad(element, "src");
+        // The event probe stays when the blend probe removes itself, so it owns the attachment
+        gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, on_blend_layers, attachment, NULL);
+        gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM, on_blend_caps, attachment, freeAttachment);
+        gst_object_unref(pad);
+    }
+    gst_object_unref(element);
+    return 0;
+}
+
+/**
+ * @brief Get the docking camera model for a full field of view frame.
+ *
+ * @param width  Frame width.
+ * @param height Frame height.
+ * @return camera model in pixels of the frame.
+ */
+CameraModel dockingCameraModel(int width, int height) {
+    return makeCameraModel(DOCKING_CAMERA_CALIBRATION, width, height, width, height, 0, 0);
+}
@@ -0,0 +1,412 @@
+#include <gst/gst.h>
+#include <gst/video/video.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <mutex>
+#include <vector>
+#include <frame_stage.hpp>
+#include <pip.hpp>
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// The docking camera is only downscaled while the composite has been drawn
+// within this long.
+static const int PIP_IDLE_MS = 1000;
+
+// Half size copy of a docking camera frame in NV12.
+struct InsetFrame {
+    std::vector<uint8_t> y;
+    std::vector<uint8_t> uv;
+    int                  width  = 0;
+    int                  height = 0;
+    bool                 valid  = false;
+};
+
+// State of the inset camera side of one composite. Written by the inset camera, read by the
+// composite camera. It lives for the life of the pipelines.
+struct PipInset {
+    GstVideoInfo         info;
+    bool                 have_info = false;
+    InsetFrame           frames[2];
+    int                  front     = 0;  // Frame the compositor reads. Guarded by mutex.
+    std::mutex           mutex;
+    std::atomic<int64_t> last_composite {0};  // Steady clock ms of the last composite
+};
+
+// State of the compositor of one camera. It lives as long as the probe on the pad.
+struct PipCompositor {
+    PipInset      *inset       = NULL;
+    FrameStage     stage       = {"Picture in picture"};
+};
+
+/**
+ * @brief Milliseconds on the steady clock.
+ */
+static int64_t nowMs() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * @brief Downscale two rows of a plane by 2 in each direction.
+ *
+ * Each output pixel is the rounded average of a 2x2 block. The SIMD paths
+ * give exactly the same result as the scalar tail.
+ *
+ * @param row0      First source row.
+ * @param row1      Second source row.
+ * @param out       Output pixels.
+ * @param out_width Number of output pixels.
+ */
+void halveRowY(const uint8_t *row0, const uint8_t *row1, uint8_t *out, int out_width) {
+    int i = 0;
+
+#if defined(__ARM_NEON)
+    for (; i + 8 <= out_width; i += 8) {
+        uint16x8_t sum = vaddq_u16(vpaddlq_u8(vld1q_u8(row0 + 2 * i)), vpaddlq_u8(vld1q_u8(row1 + 2 * i)));
+        vst1_u8(out + i, vrshrn_n_u16(sum, 2));
+    }
+#elif defined(__SSE2__)
+    const __m128i low   = _mm_set1_epi16(0x00FF);
+    const __m128i round = _mm_set1_epi16(2);
+
+    for (; i + 8 <= out_width; i += 8) {
+        __m128i a   = _mm_loadu_si128((const __m128i *)(row0 + 2 * i));
+        __m128i b   = _mm_loadu_si128((const __m128i *)(row1 + 2 * i));
+        __m128i sum = _mm_add_epi16(_mm_add_epi16(_mm_and_si128(a, low), _mm_srli_epi16(a, 8)),
+                                    _mm_add_epi16(_mm_and_si128(b, low), _mm_srli_epi16(b, 8)));
+        sum = _mm_srli_epi16(_mm_add_epi16(sum, round), 2);
+        _mm_storel_epi64((__m128i *)(out + i), _mm_packus_epi16(sum, sum));
+    }
+#endif
+
+    for (; i < out_width; i++) {
+        out[i] = (uint8_t)((row0[2 * i] + row0[2 * i + 1] + row1[2 * i] + row1[2 * i + 1] + 2) >> 2);
+    }
+}
+
+/**
+ * @brief Downscale two rows of an interleaved UV plane by 2 in each direction.
+ *
+ * @param row0      First source row.
+ * @param row1      Second source row.
+ * @param out       Output bytes (2 per sample).
+ * @param out_width Number of output UV samples.
+ */
+void halveRowUV(const uint8_t *row0, const uint8_t *row1, uint8_t *out, int out_width) {
+    int i = 0;
+
+#if defined(__ARM_NEON)
+    for (; i + 8 <= out_width; i += 8) {
+        uint8x16x2_t a = vld2q_u8(row0 + 4 * i);
+        uint8x16x2_t b = vld2q_u8(row1 + 4 * i);
+        uint8x8x2_t  result;
+        result.val[0] = vrshrn_n_u16(vaddq_u16(vpaddlq_u8(a.val[0]), vpaddlq_u8(b.val[0])), 2);
+        result.val[1] = vrshrn_n_u16(vaddq_u16(vpaddlq_u8(a.val[1]), vpaddlq_u8(b.val[1])), 2);
+        vst2_u8(out + 2 * i, result);
+    }
+#elif defined(__SSE2__)
+    const __m128i low   = _mm_set1_epi16(0x00FF);
+    const __m128i ones  = _mm_set1_epi16(1);
+    const __m128i round = _mm_set1_epi32(2);
+
+    for (; i + 4 <= out_width; i += 4) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(row0 + 4 * i));
+        __m128i b = _mm_loadu_si128((const __m128i *)(row1 + 4 * i));
+
+        // Sums of neighbouring U and of neighbouring V samples, in 32 bit lanes
+        __m128i u = _mm_add_epi32(_mm_madd_epi16(_mm_and_si128(a, low), ones),
+                                  _mm_madd_epi16(_mm_and_si128(b, low), ones));
+        __m128i v = _mm_add_epi32(_mm_madd_epi16(_mm_srli_epi16(a, 8), ones),
+                                  _mm_madd_epi16(_mm_srli_epi16(b, 8), ones));
+        u = _mm_srli_epi32(_mm_add_epi32(u, round), 2);
+        v = _mm_srli_epi32(_mm_add_epi32(v, round), 2);
+
+        // U in the low and V in the high half of each lane is U, V order in 16 bit lanes
+        __m128i uv = _mm_or_si128(u, _mm_slli_epi32(v, 16));
+        _mm_storel_epi64((__m128i *)(out + 2 * i), _mm_packus_epi16(uv, uv));
+    }
+#endif
+
+    for (; i < out_width; i++) {
+        for (int c = 0; c < 2; c++) {
+            out[2 * i + c] = (uint8_t)((row0[4 * i + c] + row0[4 * i + 2 + c] +
+                                        row1[4 * i + c] + row1[4 * i + 2 + c] + 2) >> 2);
+        }
+    }
+}
+
+/**
+ * @brief Blend src over dst.
+ *
+ * dst = (dst * (128 - opacity) + src * opacity + 64) >> 7. A fully opaque
+ * blend is a plain copy.
+ *
+ * @param dst     Background bytes, updated in place.
+ * @param src     Foreground bytes.
+ * @param opacity Opacity of src, out of 128.
+ * @param count   Number of bytes.
+ */
+void blendRow(uint8_t *dst, const uint8_t *src, int opacity, int count) {
+    if (opacity >= 128) {
+        memcpy(dst, src, count);
+        return;
+    }
+
+    int i = 0;
+
+#if defined(__ARM_NEON)
+    const uint8x8_t w1 = vdup_n_u8(opacity);
+    const uint8x8_t w0 = vdup_n_u8(128 - opacity);
+
+    for (; i + 16 <= count; i += 16) {
+        uint8x16_t d  = vld1q_u8(dst + i);
+        uint8x16_t s  = vld1q_u8(src + i);
+        uint16x8_t lo = vmlal_u8(vmull_u8(vget_low_u8(d),  w0), vget_low_u8(s),  w1);
+        uint16x8_t hi = vmlal_u8(vmull_u8(vget_high_u8(d), w0), vget_high_u8(s), w1);
+        vst1q_u8(dst + i, vcombine_u8(vrshrn_n_u16(lo, 7), vrshrn_n_u16(hi, 7)));
+    }
+#elif defined(__SSE2__)
+    const __m128i zero  = _mm_setzero_si128();
+    const __m128i w1    = _mm_set1_epi16(opacity);
+    const __m128i w0    = _mm_set1_epi16(128 - opacity);
+    const __m128i round = _mm_set1_epi16(64);
+
+    auto lerp = [&](__m128i d, __m128i s) {
+        __m128i sum = _mm_add_epi16(_mm_mullo_epi16(d, w0), _mm_mullo_epi16(s, w1));
+        return _mm_srli_epi16(_mm_add_epi16(sum, round), 7);
+    };
+
+    for (; i + 16 <= count; i += 16) {
+        __m128i d  = _mm_loadu_si128((const __m128i *)(dst + i));
+        __m128i s  = _mm_loadu_si128((const __m128i *)(src + i));
+        __m128i lo = lerp(_mm_unpacklo_epi8(d, zero), _mm_unpacklo_epi8(s, zero));
+        __m128i hi = lerp(_mm_unpackhi_epi8(d, zero), _mm_unpackhi_epi8(s, zero));
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_packus_epi16(lo, hi));
+    }
+#endif
+
+    for (; i < count; i++) {
+        dst[i] = (uint8_t)((dst[i] * (128 - opacity) + src[i] * opacity + 64) >> 7);
+    }
+}
+
+/**
+ * @brief Downscale an NV12 frame to half size.
+ *
+ * @param frame     Source frame. Width and height must be multiples of 4.
+ * @param y         Output Y plane.
+ * @param uv        Output UV plane.
+ * @param y_stride  Output Y stride.
+ * @param uv_stride Output UV stride.
+ */
+static void halveFrame(const Nv12Frame &frame, uint8_t *y, uint8_t *uv, int y_stride, int uv_stride) {
+    for (int row = 0; row < frame.height / 2; row++) {
+        halveRowY(frame.y + 2 * row * frame.y_stride, frame.y + (2 * row + 1) * frame.y_stride,
+                  y + row * y_stride, frame.width / 2);
+    }
+    for (int row = 0; row < frame.height / 4; row++) {
+        halveRowUV(frame.uv + 2 * row * frame.uv_stride, frame.uv + (2 * row + 1) * frame.uv_stride,
+                   uv + row * uv_stride, frame.width / 4);
+    }
+}
+
+/**
+ * @brief Buffer probe that keeps a half size copy of the docking camera.
+ *
+ * Does nothing unless the composite has been drawn recently, so the docking
+ * camera costs nothing while only the normal streams are watched.
+ *
+ * @param pad       Pad the probe is attached to.
+ * @param info      Probe info holding the buffer.
+ * @param user_data Inset state.
+ * @return GST_PAD_PROBE_OK to keep the data flowing.
+ */
+static GstPadProbeReturn on_inset_frame(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    PipInset *inset = (PipInset *)user_data;
+
+    if (nowMs() - inset->last_composite.load(std::memory_order_relaxed) > PIP_IDLE_MS) return GST_PAD_PROBE_OK;
+
+    if (!inset->have_info) {
+        GstCaps *caps = gst_pad_get_current_caps(pad);
+        if (!caps) return GST_PAD_PROBE_OK;
+        inset->have_info = gst_video_info_from_caps(&inset->info, caps) &&
+                           GST_VIDEO_INFO_FORMAT(&inset->info) == GST_VIDEO_FORMAT_NV12;
+        gst_caps_unref(caps);
+        if (!inset->have_info) return GST_PAD_PROBE_OK;
+    }
+
+    GstVideoFrame frame;
+    if (!gst_video_frame_map(&frame, &inset->info, GST_PAD_PROBE_INFO_BUFFER(info), GST_MAP_READ)) {
+        return GST_PAD_PROBE_OK;
+    }
+
+    // Only this thread writes the back frame
+    InsetFrame &back = inset->frames[1 - inset->front];
+    back.width  = GST_VIDEO_FRAME_WIDTH(&frame)  / 2;
+    back.height = GST_VIDEO_FRAME_HEIGHT(&frame) / 2;
+    back.y.resize(back.width * back.height);
+    back.uv.resize(back.width * back.height / 2);
+    halveFrame(nv12View(&frame), back.y.data(), back.uv.data(), back.width, back.width);
+    back.valid = true;
+    gst_video_frame_unmap(&frame);
+
+    std::lock_guard<std::mutex> lock(inset->mutex);
+    inset->front = 1 - inset->front;
+
+    return GST_PAD_PROBE_OK;
+}
+
+/**
+ * @brief Event probe that reads the inset caps again when they change.
+ *
+ * The docking camera can change size while playing (see docking_mode.hpp).
+ */
+static GstPadProbeReturn on_inset_caps(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    PipInset *inset = (PipInset *)user_data;
+    if (GST_EVENT_TYPE(GST_PAD_PROBE_INFO_EVENT(info)) == GST_EVENT_CAPS) inset->have_info = false;
+    return GST_PAD_PROBE_OK;
+}
+
+/**
+ * @brief Start keeping the docking camera inset.
+ *
+ * Adds a buffer probe to the sink pad of the named element. The element is
+ * normally the stream valve of the docking camera, so the inset is taken
+ * whether or not the docking stream itself is watched.
+ *
+ * @param pipeline     Pipeline containing the element.
+ * @param element_name Name of the element to attach to.
+ * @return inset for attachPipCompositor, NULL if the element was not found.
+ */
+PipInset *startPipInset(GstElement *pipeline, const char *element_name) {
+    GstElement *element = gst_bin_get_by_name(GST_BIN(pipeline), element_name);
+    if (!element) return NULL;
+
+    PipInset *inset = new PipInset();
+    GstPad   *pad   = gst_element_get_static_pad(element, "sink");
+    gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, on_inset_frame, inset, NULL);
+    gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM, on_inset_caps, inset, NULL);
+
+    gst_object_unref(pad);
+    gst_object_unref(element);
+    return inset;
+}
+
+/**
+ * @brief Place the latest inset into an output frame.
+ *
+ * @param pip  Inset camera state.
+ * @param out  Output frame.
+ * @param left Left edge of the inset in the output. Must be even.
+ * @param top  Top edge of the inset in the output. Must be even.
+ */
+static void drawInset(PipInset *pip, const Nv12Frame &out, int left, int top) {
+    std::lock_guard<std::mutex> lock(pip->mutex);
+    const InsetFrame &inset = pip->frames[pip->front];
+    if (!inset.valid) return;
+
+    int width  = std::min(inset.width,  out.width  - left);
+    int height = std::min(inset.height, out.height - top);
+    if (width <= 0 || height <= 0) return;
+
+    for (int row = 0; row < height; row++) {
+        blendRow(out.y + (top + row) * out.y_stride + left, inset.y.data() + row * inset.width, PIP_INSET_OPACITY,
+                 width);
+    }
+    for (int row = 0; row < height / 2; row++) {
+        blendRow(out.uv + (top / 2 + row) * out.uv_stride + left, inset.uv.data() + row * inset.width,
+                 PIP_INSET_OPACITY, width);
+    }
+}
+
+/**
+ * @brief Composite one forward camera frame into an output frame.
+ *
+ * @param src     Forward camera frame.
+ * @param dst     Output frame.
+ * @param context Compositor state.
+ */
+static void compositeFrame(const Nv12Frame &src, const Nv12Frame &dst, void *context) {
+    PipCompositor *comp = (PipCompositor *)context;
+
+    if (PIP_LAYOUT == PipLayout::CORNER) {
+        copyNv12Frame(src, dst);
+
+        // Bottom right, where the forward view only shows water
+        int inset_width  = dst.width  / 2 & ~1;
+        int inset_height = dst.height / 2 & ~1;
+        drawInset(comp->inset, dst, dst.width - inset_width - PIP_INSET_MARGIN,
+                  dst.height - inset_height - PIP_INSET_MARGIN);
+    } else {
+        // Black background, forward camera on the left, docking camera on the right
+        memset(dst.y,  16,  dst.y_stride  * dst.height);
+        memset(dst.uv, 128, dst.uv_stride * dst.height / 2);
+
+        int top = (dst.height / 4) & ~1;
+        halveFrame(src, dst.y + top * dst.y_stride, dst.uv + top / 2 * dst.uv_stride, dst.y_stride, dst.uv_stride);
+        drawInset(comp->inset, dst, dst.width / 2 & ~1, top);
+    }
+}
+
+/**
+ * @brief Buffer probe that composites each forward camera frame.
+ *
+ * The forward frame is shared with the normal camera 1 encode through the
+ * tee, so the composite is drawn into a buffer from the stage pool and that
+ * buffer is handed downstream instead.
+ *
+ * @param pad       Pad the probe is attached to.
+ * @param info      Probe info holding the buffer.
+ * @param user_data Compositor state.
+ * @return GST_PAD_PROBE_OK to keep the data flowing.
+ */
+static GstPadProbeReturn on_composite_frame(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    PipCompositor *comp = (PipCompositor *)user_data;
+
+    if (!comp->stage.buffer_pool && !setupFrameStage(&comp->stage, pad)) return GST_PAD_PROBE_OK;
+
+    comp->inset->last_composite.store(nowMs(), std::memory_order_relaxed);
+    runFrameStage(&comp->stage, info, compositeFrame, comp);
+    return GST_PAD_PROBE_OK;
+}
+
+/**
+ * @brief Free the compositor of a camera once its frame probe is removed.
+ *
+ * The caps probe is removed along with it when the pad goes away.
+ */
+static void free_compositor(gpointer user_data) {
+    PipCompositor *comp = (PipCompositor *)user_data;
+    releaseFrameStage(&comp->stage);
+    delete comp;
+}
+
+/**
+ * @brief Attach the picture in picture compositor to a pipeline.
+ *
+ * Adds a buffer probe to the source pad of the named element. The element
+ * is normally an identity behind the composite branch valve of the horizon
+ * camera.
+ *
+ * @param pipeline     Pipeline containing the element.
+ * @param element_name Name of the element to attach to.
+ * @param inset        Inset camera, from startPipInset.
+ * @return error - 0 for no error, 1 if the element was not found.
+ */
+int attachPipCompositor(GstElement *pipeline, const char *element_name, PipInset *inset) {
+    PipCompositor *comp = new PipCompositor();
+    comp->inset = inset;
+    if (attachFrameStage(pipeline, element_name, &comp->stage, on_composite_frame, comp, free_compositor) != 0) {
+        delete comp;
+        return 1;
+    }
+    return 0;
+}
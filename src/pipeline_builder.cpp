@@ -0,0 +1,408 @@
+#include <gst/gst.h>
+
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <pipeline_builder.hpp>
+#include <camera_capture.hpp>
+#include <denoise.hpp>
+#include <docking_mode.hpp>
+#include <element_chain.hpp>
+#include <governor.hpp>
+#include <motion_watch.hpp>
+#include <multicast.hpp>
+#include <overlay_layers.hpp>
+#include <pip.hpp>
+#include <proxy.hpp>
+#include <roi_crop.hpp>
+#include <roi_encoder.hpp>
+#include <stabilize.hpp>
+#include <startup.hpp>
+#include <stream_gate.hpp>
+#include <stream_profile.hpp>
+#include <undistort.hpp>
+
+// Elements used by the camera pipelines, for preloading their plugins.
+static const char *PIPELINE_ELEMENTS[] = {"libcamerasrc", "videotestsrc", "appsrc", "queue", "valve", "videocrop",
+                                          "cairooverlay", "videoconvert", "identity", "tee", "videorate", "videoscale",
+                                          "capsfilter", "x264enc", "mpegtsmux", "srtsink", "rtph264pay",
+                                          "udpsink"};
+
+// Startup preroll of one camera's main encode.
+struct PrerollProbe {
+    GstElement *pipeline;
+    std::string name;
+    std::string stream_valve;
+    std::string valve;          // Same as stream_valve without a tee.
+};
+
+/**
+ * @brief Get the element name of a camera pipeline element.
+ *
+ * @param camera  Camera pipeline.
+ * @param element Element role, such as "encoder".
+ * @return "<camera name>_<element>".
+ */
+std::string cameraElement(const CameraPipeline &camera, const char *element) {
+    return camera.config.name + "_" + element;
+}
+
+/**
+ * @brief Load the plugins of all elements the pipelines use.
+ *
+ * Each is loaded on its own thread. Elements not installed are skipped here
+ * and reported when the pipelines are built.
+ */
+void preloadPlugins() {
+    std::vector<std::thread> threads;
+    for (const char *element : PIPELINE_ELEMENTS) {
+        threads.emplace_back([element]() {
+            GstElementFactory *factory = gst_element_factory_find(element);
+            if (!factory) return;
+            GstPluginFeature *loaded = gst_plugin_feature_load(GST_PLUGIN_FEATURE(factory));
+            if (loaded) gst_object_unref(loaded);
+            gst_object_unref(factory);
+        });
+    }
+    for (std::thread &thread : threads) thread.join();
+}
+
+/**
+ * @brief Check whether the picture in picture composite can be built.
+ *
+ * @param cameras Camera list.
+ * @return true if one camera has the horizon overlay and one the inset.
+ */
+static bool pipAvailable(const std::vector<CameraConfig> &cameras) {
+    bool horizon = false, inset = false;
+    for (const CameraConfig &camera : cameras) {
+        horizon |= camera.horizon;
+        inset   |= camera.pip_inset;
+    }
+    return PIP_ENABLED && horizon && inset;
+}
+
+/**
+ * @brief Make the source of a camera.
+ *
+ * A test pattern stands in for the sensor when testing off the boat. With
+ * native capture the sensor buffers are pushed into an appsrc (see
+ * camera_capture.hpp), which keeps only the newest.
+ *
+ * @param camera Camera settings.
+ * @return element named "<name>_source", NULL if it is not installed.
+ */
+static GstElement *makeSource(const CameraConfig &camera) {
+    const std::string name = camera.name + "_source";
+    GstElement       *source;
+    if (camera.sensor == TEST_SENSOR) {
+        source = makeElement("videotestsrc", name);
+        if (!source) return NULL;
+        g_object_set(G_OBJECT(source), "is-live", TRUE, NULL);
+        gst_util_set_object_arg(G_OBJECT(source), "pattern", "ball");
+    } else if (CAMERA_CAPTURE_ENABLED) {
+        source = makeElement("appsrc", name);
+        if (!source) return NULL;
+        g_object_set(G_OBJECT(source), "is-live", TRUE, "max-buffers", (guint64)1, NULL);
+        gst_util_set_object_arg(G_OBJECT(source), "format", "time");
+        gst_util_set_object_arg(G_OBJECT(source), "leaky-type", "downstream");
+    } else {
+        source = makeElement("libcamerasrc", name);
+        if (!source) return NULL;
+        g_object_set(G_OBJECT(source), "camera-name", camera.sensor.c_str(), NULL);
+    }
+    return source;
+}
+
+/**
+ * @brief Take a reference for a pipeline handle.
+ */
+static GstElement *keepHandle(GstElement *element) {
+    return element ? (GstElement *)gst_object_ref(element) : NULL;
+}
+
+/**
+ * @brief Build the pipeline of one camera and keep its handles.
+ *
+ * Runs on its own thread for each camera.
+ *
+ * @param cameras Camera list.
+ * @param camera  Camera pipeline receiving the pipeline and handles. Its
+ *                pipeline is left NULL if an element is missing or a link fails.
+ */
+static void buildCamera(const std::vector<CameraConfig> &cameras, CameraPipeline *camera) {
+    auto start = std::chrono::steady_clock::now();
+
+    const CameraConfig &config = camera->config;
+    const std::string   name   = config.name;
+    const bool          pip    = config.horizon && pipAvailable(cameras);
+    const bool          tee    = pip || PROXY_ENABLED;
+
+    // The horizon overlay is drawn with Cairo, which needs BGRx. The other cameras stay in the
+    // NV12 format used by the x264 encoder. In region of interest mode the full sensor field of
+    // view is read at a higher resolution.
+    const bool roi    = config.horizon && ROI_CROP_ENABLED;
+    const int  width  = roi ? ROI_SENSOR_WIDTH  : config.width;
+    const int  height = roi ? ROI_SENSOR_HEIGHT : config.height;
+
+    // Multicast viewers can join at any time, so they get a key frame at least every MULTICAST_KEY_INTERVAL_S
+    const bool multicast   = MULTICAST_ENABLED && !config.multicast_group.empty();
+    const int  key_int_max = multicast ? std::min(config.encoder.key_int_max, config.fps * MULTICAST_KEY_INTERVAL_S) :
+                                         config.encoder.key_int_max;
+    const StreamProfile full = {config.width, config.height, config.fps, config.encoder.bitrate_kbps};
+
+    GstElement *pipeline = gst_pipeline_new(name.c_str());
+    GstBin     *bin      = GST_BIN(pipeline);
+
+    // Select the camera to stream from
+    GstElement *source = makeSource(config);
+    // Set the desired format, resolution and frame rate. Docking mode changes them while playing.
+    GstElement *capture_caps = makeCapsFilter(name + "_capture_caps",
+        std::string("video/x-raw,format=") + (config.horizon ? "BGRx" : "NV12") + ",width=" + std::to_string(width) +
+        ",height=" + std::to_string(height) + ",framerate=" + std::to_string(config.fps) + "/1");
+    // Valve - The valve passes on data to the next step when the stream is active and throws out the
+    //         data when it is not. This disables all of the down stream processing when this stream
+    //         is not in use. This is valuable, because there are several camera streams, but only one
+    //         is used at a time and allows the active one to use all of the computing power of the Pi.
+    GstElement *stream_valve = makeValve(name + "_stream_valve");
+    // Add a queue to separate the camera hardware reading from the software image processing
+    std::vector<GstElement *> chain = {source, capture_caps, makeQueue(), stream_valve};
+
+    // Cut a WIDTH x HEIGHT window around the horizon band out of the sensor image
+    if (roi) chain.push_back(makeElement("videocrop", name + "_roi_crop"));
+    // Generate the pitch ladder overlay and add it to the video signal, then convert back to the
+    // NV12 format used by the x264 encoder
+    GstElement *overlay = NULL;
+    if (config.horizon) {
+        overlay = makeElement("cairooverlay", name + "_horizon_overlay");
+        chain.insert(chain.end(), {overlay, makeElement("videoconvert", ""), makeCapsFilter("", "video/x-raw,format=NV12")});
+    }
+    // Optionally remap the frame (and the ladder drawn through the lens model) to an ideal pinhole view.
+    if (config.horizon && UNDISTORT_ENABLED) chain.push_back(makeElement("identity", name + "_undistort"));
+    // Optionally rotate the frame (and the ladder drawn on it) by the smoothed roll so the horizon stays level.
+    if (config.horizon && STABILIZE_HORIZON) chain.push_back(makeElement("identity", name + "_leveler"));
+    // Optionally average the sensor noise over frames so the encoder does not spend its bitrate on it
+    if (config.denoise && DENOISE_ENABLED) chain.push_back(makeElement("identity", name + "_denoise"));
+    // Optionally blend the docking guides into the denoised NV12 frames, so no conversion is needed
+    if (config.docking && OVERLAY_DOCKING_ENABLED) chain.push_back(makeElement("identity", name + "_overlay"));
+
+    // With picture in picture or the proxy the processed frames are split between this encode and the
+    // encodes below. Each branch has its own valve so only the watched encodes run.
+    GstElement *frames        = NULL;
+    GstElement *encoder_valve = NULL;
+    if (tee) {
+        frames        = makeElement("tee", name + "_tee");
+        encoder_valve = makeValve(name + "_valve");
+        chain.insert(chain.end(), {frames, encoder_valve});
+    }
+    // Add a queue to seperate the processing from the encoding.
+    chain.push_back(makeQueue());
+    // Optionally scale the stream to the profile requested by the first caller, the quality governor
+    // or docking mode
+    if (STREAM_PROFILES_ENABLED || GOVERNOR_ENABLED || DOCKING_MODE_ENABLED) {
+        std::vector<GstElement *> profile = profileElements(name.c_str(), full);
+        chain.insert(chain.end(), profile.begin(), profile.end());
+    }
+
+    // Encode the video using x264enc. This is software encoding. A future improvemnet would be to
+    // update this to use the graphics chip to encode the video. The horizon camera can favor the
+    // horizon band with the ROI encoder, which takes the same rate settings.
+    GstElement *encoder;
+    if (config.horizon && ROI_ENCODER_ENABLED) {
+        encoder = makeElement(ROI_ENCODER_NAME, name + "_encoder");
+        if (encoder) {
+            g_object_set(G_OBJECT(encoder), "bitrate", (guint)config.encoder.bitrate_kbps,
+                         "threads", (guint)config.encoder.threads, "key-int-max", (guint)key_int_max, NULL);
+        }
+    } else {
+        encoder = makeX264Encoder(name + "_encoder", config.encoder.bitrate_kbps, config.encoder.threads, key_int_max);
+    }
+    chain.push_back(encoder);
+    // With multicast the encoded frames are also split off to the RTP branch below
+    GstElement *encoded = NULL;
+    if (multicast) chain.push_back(encoded = makeElement("tee", name + "_encoded"));
+    // Add a queue to seperate the encoding from parsing and streaming, wrap the encoded video in
+    // mpegtsmux for use with the ipad video players and stream it in SRT UDP SRT format. Do no start
+    // the stream until a connection is requested.
+    GstElement *sink = makeSrtSink(name + "_sink", config.port, config.srt);
+    chain.insert(chain.end(), {makeQueue(), makeTsMux(), sink});
+    bool built = addChain(bin, NULL, chain);
+
+    // Picture in picture branch: the inset camera is drawn into a copy of the horizon camera frame,
+    // which is encoded once and streamed on its own port. The queue ahead of the compositor puts
+    // the composite on its own thread, so it does not hold up the tee and the main encode.
+    GstElement *pip_sink = NULL;
+    if (built && pip) {
+        pip_sink = makeSrtSink(name + "_pip_sink", PIP_PORT, config.srt);
+        built = addChain(bin, frames, {makeValve(name + "_pip_valve"), makeQueue(),
+                                       makeElement("identity", name + "_pip_compositor"), makeQueue(),
+                                       makeX264Encoder("", config.encoder.bitrate_kbps, config.encoder.threads,
+                                                       key_int_max),
+                                       makeQueue(), makeTsMux(), pip_sink});
+    }
+    // Low resolution proxy branch
+    GstElement *proxy_sink = NULL;
+    if (built && PROXY_ENABLED) {
+        std::vector<GstElement *> proxy = proxyBranch(name + "_proxy_valve", name + "_proxy_sink", config.width,
+                                                      config.height, PROXY_PORT + camera->index, config.proxy_srt);
+        proxy_sink = proxy.back();
+        built = addChain(bin, frames, proxy);
+    }
+    // RTP multicast branch, one send for all the viewers on the LAN
+    if (built && multicast) built = addChain(bin, encoded, multicastBranch(config));
+
+    if (!built) {
+        std::cerr << "Camera " << name << ": could not build the pipeline." << std::endl;
+        gst_object_unref(pipeline);
+        return;
+    }
+
+    camera->pipeline      = pipeline;
+    camera->source        = keepHandle(source);
+    camera->capture_caps  = keepHandle(capture_caps);
+    camera->stream_valve  = keepHandle(stream_valve);
+    camera->overlay       = keepHandle(overlay);
+    camera->tee           = keepHandle(frames);
+    camera->encoder_valve = keepHandle(encoder_valve);
+    camera->encoder       = keepHandle(encoder);
+    camera->sink          = keepHandle(sink);
+    camera->pip_sink      = keepHandle(pip_sink);
+    camera->proxy_sink    = keepHandle(proxy_sink);
+
+    camera->build_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+/**
+ * @brief Build the pipelines of all cameras.
+ *
+ * @param cameras   Camera list.
+ * @param pipelines Returned camera pipelines, in camera list order.
+ * @return error - 0 for no error, 1 if a pipeline could not be built.
+ */
+int buildCameraPipelines(const std::vector<CameraConfig> &cameras, std::vector<CameraPipeline> *pipelines) {
+    pipelines->assign(cameras.size(), CameraPipeline {});
+
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < cameras.size(); i++) {
+        (*pipelines)[i].config = cameras[i];
+        (*pipelines)[i].index  = (int)i;
+    }
+    for (size_t i = 0; i < cameras.size(); i++) {
+        threads.emplace_back(buildCamera, std::cref(cameras), &(*pipelines)[i]);
+    }
+    for (std::thread &thread : threads) thread.join();
+
+    for (const CameraPipeline &camera : *pipelines) {
+        if (!camera.pipeline) {
+            stopCameraPipelines(*pipelines);
+            return 1;
+        }
+        g_print("Camera %s built in %.1f ms.\n", camera.config.name.c_str(), camera.build_ms);
+    }
+    return 0;
+}
+
+/**
+ * @brief Buffer probe logging the first frame of a camera, then removing itself.
+ */
+static GstPadProbeReturn on_first_frame(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    logStartupPhase("first frame", (const char *)user_data);
+    return GST_PAD_PROBE_REMOVE;
+}
+
+/**
+ * @brief Buffer probe ending the preroll of a camera at its first encoded frame.
+ *
+ * The frame is dropped unless a client has connected already, then the
+ * valves go back to their gate and the probe removes itself.
+ */
+static GstPadProbeReturn on_first_encoded_frame(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    PrerollProbe *probe = (PrerollProbe *)user_data;
+    logStartupPhase("first encoded frame", probe->name.c_str());
+
+    bool watched = gateClients(probe->pipeline, probe->valve.c_str()) > 0;
+    endValvePreroll(probe->pipeline, probe->valve.c_str());
+    endValvePreroll(probe->pipeline, probe->stream_valve.c_str());
+
+    if (watched) return GST_PAD_PROBE_REMOVE;
+    gst_pad_remove_probe(pad, GST_PAD_PROBE_INFO_ID(info));
+    return GST_PAD_PROBE_DROP;
+}
+
+/**
+ * @brief Free the preroll probe data.
+ */
+static void free_preroll_probe(gpointer user_data) {
+    delete (PrerollProbe *)user_data;
+}
+
+/**
+ * @brief Set all camera pipelines playing and preroll their main encodes.
+ *
+ * Opening a sensor takes a while, so each pipeline changes state on its own
+ * thread.
+ *
+ * @param pipelines Camera pipelines.
+ * @return error - 0 for no error, 1 if a pipeline failed to start.
+ */
+int startCameraPipelines(std::vector<CameraPipeline> &pipelines) {
+    for (CameraPipeline &camera : pipelines) {
+        GstPad *pad = gst_element_get_static_pad(camera.source, "src");
+        if (pad) {
+            gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, on_first_frame, g_strdup(camera.config.name.c_str()), g_free);
+            gst_object_unref(pad);
+        }
+
+        PrerollProbe *probe = new PrerollProbe {camera.pipeline, camera.config.name, cameraElement(camera, "stream_valve"),
+                                                cameraElement(camera, camera.tee ? "valve" : "stream_valve")};
+        pad = gst_element_get_static_pad(camera.encoder, "src");
+        if (!pad || prerollValve(camera.pipeline, probe->stream_valve.c_str()) != 0 ||
+            prerollValve(camera.pipeline, probe->valve.c_str()) != 0) {
+            if (pad) gst_object_unref(pad);
+            delete probe;
+            continue;
+        }
+        gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, on_first_encoded_frame, probe, free_preroll_probe);
+        gst_object_unref(pad);
+    }
+
+    std::vector<std::thread>          threads;
+    std::vector<GstStateChangeReturn> results(pipelines.size());
+    for (size_t i = 0; i < pipelines.size(); i++) {
+        threads.emplace_back([&pipelines, &results, i]() {
+            results[i] = gst_element_set_state(pipelines[i].pipeline, GST_STATE_PLAYING);
+            logStartupPhase("playing", pipelines[i].config.name.c_str());
+        });
+    }
+    for (std::thread &thread : threads) thread.join();
+
+    int error = 0;
+    for (size_t i = 0; i < pipelines.size(); i++) {
+        if (results[i] == GST_STATE_CHANGE_FAILURE) {
+            std::cerr << "Camera " << pipelines[i].config.name << " failed to start." << std::endl;
+            error = 1;
+        }
+    }
+    return error;
+}
+
+/**
+ * @brief Stop the camera pipelines and drop all handles.
+ *
+ * @param pipelines Camera pipelines. Emptied.
+ */
+void stopCameraPipelines(std::vector<CameraPipeline> &pipelines) {
+    for (CameraPipeline &camera : pipelines) {
+        GstElement *handles[] = {camera.source, camera.capture_caps, camera.stream_valve, camera.overlay, camera.tee,
+                                 camera.encoder_valve, camera.encoder, camera.sink, camera.pip_sink, camera.proxy_sink};
+        for (GstElement *handle : handles) {
+            if (handle) gst_object_unref(handle);
+        }
+        if (camera.pipeline) {
+            gst_element_set_state(camera.pipeline, GST_STATE_NULL);
+            gst_object_unref(camera.pipeline);
+        }
+    }
+    pipelines.clear();
+}
@@ -0,0 +1,39 @@
+#include <proxy.hpp>
+#include <element_chain.hpp>
+
+/**
+ * @brief Make the elements of a proxy branch.
+ *
+ * @param valve_name Name given to the valve gating the branch.
+ * @param sink_name  Name given to the srtsink of the branch.
+ * @param width      Full resolution width of the camera.
+ * @param height     Full resolution height of the camera.
+ * @param port       SRT listener port.
+ * @param srt        SRT listener options, as in cameras.conf.
+ * @return chain to link after the tee of the camera pipeline.
+ */
+std::vector<GstElement *> proxyBranch(const std::string &valve_name, const std::string &sink_name,
+                                      int width, int height, int port, const std::string &srt) {
+    // Even sizes for the 4:2:0 chroma planes
+    int proxy_width  = (width  / PROXY_SCALE) & ~1;
+    int proxy_height = (height / PROXY_SCALE) & ~1;
+
+    GstElement *rate  = makeElement("videorate", "");
+    GstElement *scale = makeElement("videoscale", "");
+    if (rate)  g_object_set(G_OBJECT(rate), "drop-only", TRUE, NULL);
+    if (scale) gst_util_set_object_arg(G_OBJECT(scale), "method", "bilinear");
+
+    return {
+        // Gate the proxy on its own clients
+        makeValve(valve_name),
+        // Drop frames first so nothing downstream works on frames that are not sent
+        rate, makeCapsFilter("", "video/x-raw,framerate=" + std::to_string(PROXY_FPS) + "/1"),
+        scale, makeCapsFilter("", "video/x-raw,width=" + std::to_string(proxy_width) +
+                                  ",height=" + std::to_string(proxy_height)),
+        makeQueue(),
+        // Same low latency settings as the full stream, one thread, one key frame per second
+        makeX264Encoder("", PROXY_BITRATE_KBPS, PROXY_THREADS, PROXY_FPS),
+        makeQueue(),
+        makeTsMux(),
+        makeSrtSink(sink_name, port, srt)};
+}
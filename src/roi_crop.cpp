@@ -0,0 +1,116 @@
+#include <gst/gst.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <attitude.hpp>
+#include <camera_model.hpp>
+#include <overlay_config.hpp>
+#include <roi_crop.hpp>
+#include <video.hpp>
+
+// Current crop window origin. Written by the video thread, read by the overlay.
+static std::atomic<int> m_left {(ROI_SENSOR_WIDTH  - WIDTH)  / 2};
+static std::atomic<int> m_top  {(ROI_SENSOR_HEIGHT - HEIGHT) / 2};
+
+// Filter state
+static double       m_filtered_pitch = 0.0;
+static GstClockTime m_last_pts       = GST_CLOCK_TIME_NONE;
+
+/**
+ * @brief Top edge of the window that centers the target elevation.
+ *
+ * Projects the target elevation through the camera model at full sensor
+ * resolution, the same model the ladder is drawn with.
+ *
+ * @param pitch Camera pitch angle.
+ * @param roll  Camera roll angle.
+ * @return window top in sensor pixels, clamped to the sensor.
+ */
+static int targetTop(double pitch, double roll) {
+    CameraModel    camera   = makeCameraModel(FORWARD_CAMERA_CALIBRATION, ROI_SENSOR_WIDTH, ROI_SENSOR_HEIGHT,
+                                              ROI_SENSOR_WIDTH, ROI_SENSOR_HEIGHT, 0, 0);
+    CameraRotation rotation = cameraRotation(pitch, roll, overlayConfig()->boresight);
+
+    double u, v;
+    if (!projectDirection(camera, rotation, ROI_CROP_TARGET_DEG, axisAzimuth(rotation), &u, &v)) {
+        return (ROI_SENSOR_HEIGHT - HEIGHT) / 2;
+    }
+
+    int top = (int)lround(v - HEIGHT / 2.0);
+    return std::clamp(top, 0, ROI_SENSOR_HEIGHT - HEIGHT);
+}
+
+/**
+ * @brief Buffer probe that moves the crop window.
+ *
+ * Runs on the sink pad of the videocrop element, so a new window applies to
+ * the frame that triggered it.
+ *
+ * @param pad       Pad the probe is attached to.
+ * @param info      Probe info holding the buffer.
+ * @param user_data The videocrop element.
+ * @return GST_PAD_PROBE_OK to keep the data flowing.
+ */
+static GstPadProbeReturn on_crop_frame(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    GstElement  *crop = (GstElement *)user_data;
+    GstClockTime pts  = GST_BUFFER_PTS(GST_PAD_PROBE_INFO_BUFFER(info));
+
+    double pitch, roll, yaw;
+    peekAttitude(&pitch, &roll, &yaw);
+
+    // Slow filter on the pitch so the window follows the trim of the boat, not the swell
+    double dt = 1.0 / 30.0;
+    if (GST_CLOCK_TIME_IS_VALID(pts) && GST_CLOCK_TIME_IS_VALID(m_last_pts) && pts > m_last_pts) {
+        dt = (double)(pts - m_last_pts) / GST_SECOND;
+    }
+    m_last_pts = pts;
+    m_filtered_pitch += (1.0 - exp(-dt / ROI_CROP_TIME_CONSTANT_S)) * (pitch - m_filtered_pitch);
+
+    int top = targetTop(m_filtered_pitch, roll);
+    if (std::abs(top - m_top.load()) <= ROI_CROP_HYSTERESIS_PX) return GST_PAD_PROBE_OK;
+
+    g_object_set(G_OBJECT(crop), "top", top, "bottom", ROI_SENSOR_HEIGHT - HEIGHT - top, NULL);
+    m_top.store(top);
+
+    return GST_PAD_PROBE_OK;
+}
+
+/**
+ * @brief Start the region of interest crop.
+ *
+ * Sets the initial centered window on the named videocrop element and adds
+ * the probe that moves it with the attitude.
+ *
+ * @param pipeline     Pipeline containing the element.
+ * @param element_name Name of the videocrop element.
+ * @return error - 0 for no error, 1 if the element was not found.
+ */
+int startRoiCrop(GstElement *pipeline, const char *element_name) {
+    GstElement *crop = gst_bin_get_by_name(GST_BIN(pipeline), element_name);
+    if (!crop) return 1;
+
+    int left = m_left.load();
+    int top  = m_top.load();
+    g_object_set(G_OBJECT(crop),
+                 "left",   left, "right",  ROI_SENSOR_WIDTH  - WIDTH  - left,
+                 "top",    top,  "bottom", ROI_SENSOR_HEIGHT - HEIGHT - top, NULL);
+
+    // The probe keeps the reference to the element
+    GstPad *pad = gst_element_get_static_pad(crop, "sink");
+    gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, on_crop_frame, crop, (GDestroyNotify)gst_object_unref);
+    gst_object_unref(pad);
+
+    return 0;
+}
+
+/**
+ * @brief Get the current crop window origin.
+ *
+ * @return left - Left edge of the window in sensor pixels.
+ * @return top  - Top edge of the window in sensor pixels.
+ */
+void getRoiOrigin(int *left, int *top) {
+    *left = m_left.load(std::memory_order_relaxed);
+    *top  = m_top.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,403 @@
+#include <gst/gst.h>
+#include <gst/video/video.h>
+#include <x264.h>
+
+#include <algorithm>
+#include <cmath>
+#include <attitude.hpp>
+#include <overlay_config.hpp>
+#include <roi_encoder.hpp>
+#include <video.hpp>
+
+enum {
+    PROP_0,
+    PROP_BITRATE,
+    PROP_THREADS,
+    PROP_KEY_INT_MAX,
+    PROP_ROI,
+    PROP_FOLLOW_ATTITUDE,
+    PROP_PITCH,
+    PROP_ROLL,
+};
+
+struct MastheadRoiEnc {
+    GstVideoEncoder     parent;
+
+    // Properties, under the object lock
+    guint               bitrate;
+    guint               threads;
+    guint               key_int_max;
+    gboolean            roi;
+    gboolean            follow_attitude;
+    gdouble             pitch;
+    gdouble             roll;
+    gboolean            bitrate_changed;
+
+    // Streaming thread state
+    x264_t             *x264;
+    x264_param_t        param;
+    GstVideoCodecState *input_state;
+    RoiQpMap           *map;
+};
+
+struct MastheadRoiEncClass {
+    GstVideoEncoderClass parent_class;
+};
+
+G_DEFINE_TYPE(MastheadRoiEnc, masthead_roi_enc, GST_TYPE_VIDEO_ENCODER)
+
+#define MASTHEAD_ROI_ENC(obj) ((MastheadRoiEnc *)(obj))
+
+static GstStaticPadTemplate sink_template = GST_STATIC_PAD_TEMPLATE(
+    "sink", GST_PAD_SINK, GST_PAD_ALWAYS, GST_STATIC_CAPS(GST_VIDEO_CAPS_MAKE("NV12")));
+
+static GstStaticPadTemplate src_template = GST_STATIC_PAD_TEMPLATE(
+    "src", GST_PAD_SRC, GST_PAD_ALWAYS,
+    GST_STATIC_CAPS("video/x-h264, stream-format=(string)byte-stream, alignment=(string)au, "
+                    "profile=(string)constrained-baseline"));
+
+/**
+ * @brief Quantizer offset of a macroblock at an elevation.
+ *
+ * @param elevation Elevation above the horizon in degrees.
+ * @return offset, ROI_BAND_QP_OFFSET in the band, ROI_OUTSIDE_QP_OFFSET
+ *         past the ramp and blended on it.
+ */
+float roiQpOffset(double elevation) {
+    double outside = std::max(-ROI_BAND_BELOW_DEG - elevation, elevation - ROI_BAND_ABOVE_DEG);
+    if (outside <= 0.0)               return ROI_BAND_QP_OFFSET;
+    if (outside >= ROI_BAND_RAMP_DEG) return ROI_OUTSIDE_QP_OFFSET;
+    return ROI_BAND_QP_OFFSET + (float)(outside / ROI_BAND_RAMP_DEG) * (ROI_OUTSIDE_QP_OFFSET - ROI_BAND_QP_OFFSET);
+}
+
+/**
+ * @brief Bring a quantizer offset map up to date.
+ *
+ * The rays are made again only for a new frame size or principal point (the
+ * region of interest crop moves it). The offsets are made again once the
+ * attitude or boresight has moved by ROI_MAP_STEP_DEG.
+ *
+ * @param map       Map to update.
+ * @param camera    Camera model of the frames.
+ * @param width     Frame width.
+ * @param height    Frame height.
+ * @param pitch     IMU pitch in degrees.
+ * @param roll      IMU roll in degrees.
+ * @param boresight Camera mounting angles.
+ * @return true if the offsets changed.
+ */
+bool updateRoiQpMap(RoiQpMap *map, const CameraModel &camera, int width, int height,
+                    double pitch, double roll, const Boresight &boresight) {
+    const int mb_width  = (width + 15) / 16;
+    const int mb_height = (height + 15) / 16;
+
+    if (mb_width != map->mb_width || mb_height != map->mb_height || camera.cx != map->cx || camera.cy != map->cy) {
+        map->mb_width  = mb_width;
+        map->mb_height = mb_height;
+        map->cx        = camera.cx;
+        map->cy        = camera.cy;
+        map->rays.resize(3 * mb_width * mb_height);
+        map->offsets.resize(mb_width * mb_height);
+        for (int y = 0; y < mb_height; y++) {
+            for (int x = 0; x < mb_width; x++) {
+                pixelRay(camera, x * 16 + 8.0, y * 16 + 8.0, &map->rays[3 * (y * mb_width + x)]);
+            }
+        }
+        map->valid = false;
+    }
+
+    if (map->valid && fabs(pitch - map->pitch) < ROI_MAP_STEP_DEG && fabs(roll - map->roll) < ROI_MAP_STEP_DEG &&
+        fabs(boresight.pitch_deg - map->boresight.pitch_deg) < ROI_MAP_STEP_DEG &&
+        fabs(boresight.roll_deg - map->boresight.roll_deg) < ROI_MAP_STEP_DEG &&
+        fabs(boresight.yaw_deg - map->boresight.yaw_deg) < ROI_MAP_STEP_DEG) {
+        return false;
+    }
+
+    const CameraRotation rotation = cameraRotation(pitch, roll, boresight);
+    for (size_t mb = 0; mb < map->offsets.size(); mb++) {
+        map->offsets[mb] = roiQpOffset(rayElevation(rotation, &map->rays[3 * mb]));
+    }
+    map->valid     = true;
+    map->pitch     = pitch;
+    map->roll      = roll;
+    map->boresight = boresight;
+    return true;
+}
+
+/**
+ * @brief Set the rate control of the encoder parameters from the bitrate.
+ */
+static void setRateControl(x264_param_t *param, guint bitrate) {
+    param->rc.i_rc_method       = X264_RC_ABR;
+    param->rc.i_bitrate         = (int)bitrate;
+    param->rc.i_vbv_max_bitrate = (int)bitrate;
+    param->rc.i_vbv_buffer_size = (int)bitrate * 600 / 1000;  // 600 ms, as x264enc
+}
+
+static void masthead_roi_enc_set_property(GObject *object, guint prop_id, const GValue *value, GParamSpec *pspec) {
+    MastheadRoiEnc *self = MASTHEAD_ROI_ENC(object);
+    GST_OBJECT_LOCK(self);
+    switch (prop_id) {
+    case PROP_BITRATE:
+        self->bitrate         = g_value_get_uint(value);
+        self->bitrate_changed = TRUE;
+        break;
+    case PROP_THREADS:         self->threads         = g_value_get_uint(value);    break;
+    case PROP_KEY_INT_MAX:     self->key_int_max     = g_value_get_uint(value);    break;
+    case PROP_ROI:             self->roi             = g_value_get_boolean(value); break;
+    case PROP_FOLLOW_ATTITUDE: self->follow_attitude = g_value_get_boolean(value); break;
+    case PROP_PITCH:           self->pitch           = g_value_get_double(value);  break;
+    case PROP_ROLL:            self->roll            = g_value_get_double(value);  break;
+    default:                   G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec); break;
+    }
+    GST_OBJECT_UNLOCK(self);
+}
+
+static void masthead_roi_enc_get_property(GObject *object, guint prop_id, GValue *value, GParamSpec *pspec) {
+    MastheadRoiEnc *self = MASTHEAD_ROI_ENC(object);
+    GST_OBJECT_LOCK(self);
+    switch (prop_id) {
+    case PROP_BITRATE:         g_value_set_uint(value, self->bitrate);            break;
+    case PROP_THREADS:         g_value_set_uint(value, self->threads);            break;
+    case PROP_KEY_INT_MAX:     g_value_set_uint(value, self->key_int_max);        break;
+    case PROP_ROI:             g_value_set_boolean(value, self->roi);             break;
+    case PROP_FOLLOW_ATTITUDE: g_value_set_boolean(value, self->follow_attitude); break;
+    case PROP_PITCH:           g_value_set_double(value, self->pitch);            break;
+    case PROP_ROLL:            g_value_set_double(value, self->roll);             break;
+    default:                   G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec); break;
+    }
+    GST_OBJECT_UNLOCK(self);
+}
+
+static void closeEncoder(MastheadRoiEnc *self) {
+    if (self->x264) x264_encoder_close(self->x264);
+    self->x264 = NULL;
+}
+
+static gboolean masthead_roi_enc_start(GstVideoEncoder *encoder) {
+    MastheadRoiEnc *self = MASTHEAD_ROI_ENC(encoder);
+    self->map = new RoiQpMap;
+    return TRUE;
+}
+
+static gboolean masthead_roi_enc_stop(GstVideoEncoder *encoder) {
+    MastheadRoiEnc *self = MASTHEAD_ROI_ENC(encoder);
+    closeEncoder(self);
+    if (self->input_state) gst_video_codec_state_unref(self->input_state);
+    self->input_state = NULL;
+    delete self->map;
+    self->map = NULL;
+    return TRUE;
+}
+
+/**
+ * @brief Open libx264 for the negotiated input.
+ */
+static gboolean masthead_roi_enc_set_format(GstVideoEncoder *encoder, GstVideoCodecState *state) {
+    MastheadRoiEnc *self = MASTHEAD_ROI_ENC(encoder);
+    const GstVideoInfo *info = &state->info;
+
+    closeEncoder(self);
+    if (self->input_state) gst_video_codec_state_unref(self->input_state);
+    self->input_state = gst_video_codec_state_ref(state);
+
+    // The same settings as the x264enc the element replaces
+    x264_param_t *param = &self->param;
+    x264_param_default_preset(param, "ultrafast", "zerolatency");
+    GST_OBJECT_LOCK(self);
+    param->i_threads       = (int)self->threads;
+    param->i_keyint_max    = (int)self->key_int_max;
+    setRateControl(param, self->bitrate);
+    self->bitrate_changed  = FALSE;
+    GST_OBJECT_UNLOCK(self);
+    param->i_width         = GST_VIDEO_INFO_WIDTH(info);
+    param->i_height        = GST_VIDEO_INFO_HEIGHT(info);
+    param->i_csp           = X264_CSP_NV12;
+    param->i_fps_num       = GST_VIDEO_INFO_FPS_N(info) > 0 ? GST_VIDEO_INFO_FPS_N(info) : 30;
+    param->i_fps_den       = GST_VIDEO_INFO_FPS_D(info) > 0 ? GST_VIDEO_INFO_FPS_D(info) : 1;
+    param->b_vfr_input     = 0;
+    param->b_repeat_headers = 1;
+    param->b_annexb        = 1;
+    param->i_log_level     = X264_LOG_WARNING;
+    param->rc.i_aq_mode    = X264_AQ_VARIANCE;
+    param->rc.f_aq_strength = ROI_AQ_STRENGTH;
+    x264_param_apply_profile(param, "baseline");
+
+    self->x264 = x264_encoder_open(param);
+    if (!self->x264) {
+        GST_ELEMENT_ERROR(self, STREAM, ENCODE, ("Could not open libx264"), (NULL));
+        return FALSE;
+    }
+
+    GstCaps *caps = gst_caps_from_string("video/x-h264, stream-format=(string)byte-stream, "
+                                         "alignment=(string)au, profile=(string)constrained-baseline");
+    GstVideoCodecState *output = gst_video_encoder_set_output_state(encoder, caps, state);
+    gst_video_codec_state_unref(output);
+    gst_video_encoder_set_latency(encoder, 0, 0);
+    return gst_video_encoder_negotiate(encoder);
+}
+
+/**
+ * @brief Hand the encoded access unit to its frame and push it.
+ */
+static GstFlowReturn finishEncodedFrame(MastheadRoiEnc *self, x264_nal_t *nals, int size, x264_picture_t *out) {
+    GstVideoEncoder    *encoder = GST_VIDEO_ENCODER(self);
+    GstVideoCodecFrame *frame   = gst_video_encoder_get_frame(encoder, GPOINTER_TO_INT(out->opaque));
+    if (!frame) return GST_FLOW_OK;
+
+    // The payloads of one call follow each other in memory
+    GstFlowReturn ret = gst_video_encoder_allocate_output_frame(encoder, frame, size);
+    if (ret != GST_FLOW_OK) {
+        gst_video_codec_frame_unref(frame);
+        return ret;
+    }
+    gst_buffer_fill(frame->output_buffer, 0, nals[0].p_payload, size);
+    if (out->b_keyframe) GST_VIDEO_CODEC_FRAME_SET_SYNC_POINT(frame);
+    return gst_video_encoder_finish_frame(encoder, frame);
+}
+
+/**
+ * @brief Encode one frame with the quantizer offsets of the current attitude.
+ */
+static GstFlowReturn masthead_roi_enc_handle_frame(GstVideoEncoder *encoder, GstVideoCodecFrame *frame) {
+    MastheadRoiEnc *self = MASTHEAD_ROI_ENC(encoder);
+    if (!self->x264) {
+        gst_video_codec_frame_unref(frame);
+        return GST_FLOW_NOT_NEGOTIATED;
+    }
+
+    GST_OBJECT_LOCK(self);
+    const bool     roi             = self->roi;
+    const bool     follow_attitude = self->follow_attitude;
+    double         pitch           = self->pitch;
+    double         roll            = self->roll;
+    const bool     reconfigure     = self->bitrate_changed;
+    const guint    bitrate         = self->bitrate;
+    self->bitrate_changed = FALSE;
+    GST_OBJECT_UNLOCK(self);
+
+    // A new bitrate takes effect on this frame, without reopening the encoder
+    if (reconfigure) {
+        setRateControl(&self->param, bitrate);
+        x264_encoder_reconfig(self->x264, &self->param);
+    }
+
+    GstVideoFrame video;
+    if (!gst_video_frame_map(&video, &self->input_state->info, frame->input_buffer, GST_MAP_READ)) {
+        gst_video_codec_frame_unref(frame);
+        return GST_FLOW_ERROR;
+    }
+
+    x264_picture_t picture;
+    x264_picture_init(&picture);
+    picture.img.i_csp       = X264_CSP_NV12;
+    picture.img.i_plane     = 2;
+    picture.img.plane[0]    = (uint8_t *)GST_VIDEO_FRAME_PLANE_DATA(&video, 0);
+    picture.img.plane[1]    = (uint8_t *)GST_VIDEO_FRAME_PLANE_DATA(&video, 1);
+    picture.img.i_stride[0] = GST_VIDEO_FRAME_PLANE_STRIDE(&video, 0);
+    picture.img.i_stride[1] = GST_VIDEO_FRAME_PLANE_STRIDE(&video, 1);
+    picture.i_pts           = frame->system_frame_number;
+    picture.opaque          = GINT_TO_POINTER(frame->system_frame_number);
+    picture.i_type          = GST_VIDEO_CODEC_FRAME_IS_FORCE_KEYFRAME(frame) ? X264_TYPE_IDR : X264_TYPE_AUTO;
+
+    if (roi) {
+        if (follow_attitude) {
+            double yaw;
+            peekAttitude(&pitch, &roll, &yaw);
+        }
+        const int   width  = GST_VIDEO_INFO_WIDTH(&self->input_state->info);
+        const int   height = GST_VIDEO_INFO_HEIGHT(&self->input_state->info);
+        CameraModel camera = forwardCameraModel();
+        if (camera.width != width || camera.height != height) {
+            camera = makeCameraModel(FORWARD_CAMERA_CALIBRATION, width, height, width, height, 0, 0);
+        }
+        updateRoiQpMap(self->map, camera, width, height, pitch, roll, overlayConfig()->boresight);
+        // libx264 copies the offsets into the frame before x264_encoder_encode returns
+        picture.prop.quant_offsets = self->map->offsets.data();
+    }
+
+    x264_nal_t    *nals;
+    int            nal_count;
+    x264_picture_t out;
+    int            size = x264_encoder_encode(self->x264, &nals, &nal_count, &picture, &out);
+    gst_video_frame_unmap(&video);
+    gst_video_codec_frame_unref(frame);
+
+    if (size < 0) {
+        GST_ELEMENT_ERROR(self, STREAM, ENCODE, ("libx264 failed to encode a frame"), (NULL));
+        return GST_FLOW_ERROR;
+    }
+    return size > 0 ? finishEncodedFrame(self, nals, size, &out) : GST_FLOW_OK;
+}
+
+/**
+ * @brief Push the frames libx264 still holds, at the end of the stream.
+ */
+static GstFlowReturn masthead_roi_enc_finish(GstVideoEncoder *encoder) {
+    MastheadRoiEnc *self = MASTHEAD_ROI_ENC(encoder);
+    GstFlowReturn   ret  = GST_FLOW_OK;
+    while (self->x264 && ret == GST_FLOW_OK && x264_encoder_delayed_frames(self->x264) > 0) {
+        x264_nal_t    *nals;
+        int            nal_count;
+        x264_picture_t out;
+        int            size = x264_encoder_encode(self->x264, &nals, &nal_count, NULL, &out);
+        if (size < 0) return GST_FLOW_ERROR;
+        if (size > 0) ret = finishEncodedFrame(self, nals, size, &out);
+    }
+    return ret;
+}
+
+static void masthead_roi_enc_class_init(MastheadRoiEncClass *klass) {
+    GObjectClass         *object_class  = G_OBJECT_CLASS(klass);
+    GstElementClass      *element_class = GST_ELEMENT_CLASS(klass);
+    GstVideoEncoderClass *encoder_class = GST_VIDEO_ENCODER_CLASS(klass);
+
+    object_class->set_property = masthead_roi_enc_set_property;
+    object_class->get_property = masthead_roi_enc_get_property;
+
+    const GParamFlags flags = (GParamFlags)(G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+    g_object_class_install_property(object_class, PROP_BITRATE,
+        g_param_spec_uint("bitrate", "Bitrate", "Bitrate in kbit/sec", 1, 2048000, 2048, flags));
+    g_object_class_install_property(object_class, PROP_THREADS,
+        g_param_spec_uint("threads", "Threads", "Encoder threads, 0 for automatic", 0, 64, 0, flags));
+    g_object_class_install_property(object_class, PROP_KEY_INT_MAX,
+        g_param_spec_uint("key-int-max", "Key frame interval", "Most frames between key frames", 1, 1000, 30, flags));
+    g_object_class_install_property(object_class, PROP_ROI,
+        g_param_spec_boolean("roi", "Region of interest", "Favor the horizon band", TRUE, flags));
+    g_object_class_install_property(object_class, PROP_FOLLOW_ATTITUDE,
+        g_param_spec_boolean("follow-attitude", "Follow attitude", "Place the band from the attitude sensor", TRUE,
+                             flags));
+    g_object_class_install_property(object_class, PROP_PITCH,
+        g_param_spec_double("pitch", "Pitch", "Pitch in degrees when not following the attitude", -90, 90, 0, flags));
+    g_object_class_install_property(object_class, PROP_ROLL,
+        g_param_spec_double("roll", "Roll", "Roll in degrees when not following the attitude", -180, 180, 0, flags));
+
+    gst_element_class_set_static_metadata(element_class, "Masthead ROI H.264 encoder", "Codec/Encoder/Video",
+                                          "libx264 with a quality boost on the horizon band",
+                                          "Masthead Camera");
+    gst_element_class_add_static_pad_template(element_class, &sink_template);
+    gst_element_class_add_static_pad_template(element_class, &src_template);
+
+    encoder_class->start        = masthead_roi_enc_start;
+    encoder_class->stop         = masthead_roi_enc_stop;
+    encoder_class->set_format   = masthead_roi_enc_set_format;
+    encoder_class->handle_frame = masthead_roi_enc_handle_frame;
+    encoder_class->finish       = masthead_roi_enc_finish;
+}
+
+static void masthead_roi_enc_init(MastheadRoiEnc *self) {
+    self->bitrate         = 2048;
+    self->threads         = 0;
+    self->key_int_max     = 30;
+    self->roi             = TRUE;
+    self->follow_attitude = TRUE;
+}
+
+/**
+ * @brief Register the element.
+ *
+ * @return error - 0 for no error, 1 if it could not be registered.
+ */
+int registerRoiEncoder() {
+    return gst_element_register(NULL, ROI_ENCODER_NAME, GST_RANK_NONE, masthead_roi_enc_get_type()) ? 0 : 1;
+}
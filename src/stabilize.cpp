@@ -0,0 +1,133 @@
+#include <gst/gst.h>
+#include <gst/video/video.h>
+
+#include <algorithm>
+#include <cmath>
+#include <attitude.hpp>
+#include <frame_stage.hpp>
+#include <stabilize.hpp>
+#include <video.hpp>
+#include <warp.hpp>
+#include <worker_pool.hpp>
+
+// State of the horizon leveling stage of one camera. It lives as long as the
+// probe on the pad.
+struct Stabilizer {
+    WorkerPool     pool {STABILIZE_THREADS};
+    FrameStage     stage       = {"Horizon leveling"};
+    double         zoom;
+    double         roll_deg    = 0.0;   // Smoothed roll of the frame being leveled.
+    GstClockTime   last_pts    = GST_CLOCK_TIME_NONE;
+};
+
+/**
+ * @brief Zoom needed to hide the corners of a rotated frame.
+ *
+ * A width x height window rotated by max_roll must still fit inside the
+ * frame once the frame is zoomed by this factor.
+ *
+ * @param width    Frame width.
+ * @param height   Frame height.
+ * @param max_roll Largest rotation in degrees.
+ * @return zoom factor (>= 1).
+ */
+static double cropZoom(int width, int height, double max_roll) {
+    double c = cos(std::abs(max_roll) * DEG_TO_RAD);
+    double s = sin(std::abs(max_roll) * DEG_TO_RAD);
+
+    double zoom_x = c + s * (double)height / width;
+    double zoom_y = c + s * (double)width / height;
+    return std::max(1.0, std::max(zoom_x, zoom_y));
+}
+
+/**
+ * @brief Smooth the roll angle with a one pole low pass filter.
+ *
+ * The IMU updates at 20 Hz while frames arrive at 30 Hz. Filtering on the
+ * frame timestamps spreads each roll step over several frames.
+ *
+ * @param stab Stabilizer state.
+ * @param pts  Timestamp of the current frame.
+ * @return smoothed roll angle in degrees.
+ */
+static double filterRoll(Stabilizer *stab, GstClockTime pts) {
+    double pitch, roll, yaw;
+    peekAttitude(&pitch, &roll, &yaw);
+
+    roll = std::clamp(roll, (double)-STABILIZE_MAX_ROLL_DEG, (double)STABILIZE_MAX_ROLL_DEG);
+
+    double dt = 1.0 / 30.0;
+    if (GST_CLOCK_TIME_IS_VALID(pts) && GST_CLOCK_TIME_IS_VALID(stab->last_pts) && pts > stab->last_pts) {
+        dt = (double)(pts - stab->last_pts) / GST_SECOND;
+    }
+    stab->last_pts = pts;
+
+    double alpha = 1.0 - exp(-dt / STABILIZE_TIME_CONSTANT_S);
+    stab->roll_deg += alpha * (roll - stab->roll_deg);
+    return stab->roll_deg;
+}
+
+/**
+ * @brief Level one frame, as the pixel work of the stage.
+ */
+static void levelFrame(const Nv12Frame &src, const Nv12Frame &dst, void *context) {
+    Stabilizer *stab = (Stabilizer *)context;
+    // The ladder appears rotated by -roll, so rotating by +roll levels it
+    rotateNV12(src, dst, stab->roll_deg * DEG_TO_RAD, stab->zoom, stab->pool);
+}
+
+/**
+ * @brief Buffer probe that levels each frame.
+ *
+ * Warps the incoming frame into a buffer from the pool and hands that buffer
+ * downstream instead. If anything fails the frame is passed on unchanged.
+ *
+ * @param pad       Pad the probe is attached to.
+ * @param info      Probe info holding the buffer.
+ * @param user_data Stabilizer state.
+ * @return GST_PAD_PROBE_OK to keep the data flowing.
+ */
+static GstPadProbeReturn on_level_frame(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    Stabilizer *stab = (Stabilizer *)user_data;
+
+    // The crop zoom follows the frame size, which is set up again after a caps change
+    if (!stab->stage.buffer_pool) {
+        if (!setupFrameStage(&stab->stage, pad)) return GST_PAD_PROBE_OK;
+        stab->zoom = cropZoom(GST_VIDEO_INFO_WIDTH(&stab->stage.info), GST_VIDEO_INFO_HEIGHT(&stab->stage.info),
+                              STABILIZE_MAX_ROLL_DEG);
+    }
+
+    filterRoll(stab, GST_BUFFER_PTS(GST_PAD_PROBE_INFO_BUFFER(info)));
+    runFrameStage(&stab->stage, info, levelFrame, stab);
+    return GST_PAD_PROBE_OK;
+}
+
+/**
+ * @brief Free the leveling state of a camera once its frame probe is removed.
+ *
+ * The caps probe is removed along with it when the pad goes away.
+ */
+static void free_stabilizer(gpointer user_data) {
+    Stabilizer *stab = (Stabilizer *)user_data;
+    releaseFrameStage(&stab->stage);
+    delete stab;
+}
+
+/**
+ * @brief Attach the horizon leveling stage to a pipeline.
+ *
+ * Adds a buffer probe to the source pad of the named element. The element
+ * is normally an identity placed after the overlay has been converted to NV12.
+ *
+ * @param pipeline     Pipeline containing the element.
+ * @param element_name Name of the element to attach to.
+ * @return error - 0 for no error, 1 if the element was not found.
+ */
+int attachStabilizer(GstElement *pipeline, const char *element_name) {
+    Stabilizer *stab = new Stabilizer();
+    if (attachFrameStage(pipeline, element_name, &stab->stage, on_level_frame, stab, free_stabilizer) != 0) {
+        delete stab;
+        return 1;
+    }
+    return 0;
+}
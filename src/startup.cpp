@@ -0,0 +1,62 @@
+#include <gst/gst.h>
+
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <unistd.h>
+#include <startup.hpp>
+
+/**
+ * @brief Read the start time of the process in seconds since boot.
+ *
+ * @return start time, 0 if /proc cannot be read.
+ */
+static double processStartS() {
+    FILE *file = fopen("/proc/self/stat", "r");
+    if (!file) return 0.0;
+
+    // The command name can hold spaces, so the fields are counted from its closing parenthesis
+    char line[1024];
+    size_t length = fread(line, 1, sizeof(line) - 1, file);
+    fclose(file);
+    line[length] = '\0';
+
+    const char *p = strrchr(line, ')');
+    if (!p) return 0.0;
+
+    // starttime is field 22, the 20th after the command name
+    unsigned long long start_ticks = 0;
+    int field = 2;
+    for (p++; *p && field < 22; p++) {
+        if (*p == ' ') field++;
+    }
+    if (sscanf(p, "%llu", &start_ticks) != 1) return 0.0;
+    return (double)start_ticks / sysconf(_SC_CLK_TCK);
+}
+
+/**
+ * @brief Get the time since the process was started.
+ *
+ * @return milliseconds since the process was started.
+ */
+double processUptimeMs() {
+    static const double start_s = processStartS();
+
+    timespec now;
+    clock_gettime(CLOCK_BOOTTIME, &now);
+    return (now.tv_sec + now.tv_nsec / 1e9 - start_s) * 1000.0;
+}
+
+/**
+ * @brief Log that a startup phase has been reached.
+ *
+ * @param phase  Phase name.
+ * @param camera Camera the phase belongs to, NULL for the whole program.
+ */
+void logStartupPhase(const char *phase, const char *camera) {
+    if (camera) {
+        g_print("Startup: camera %s %s at %.0f ms\n", camera, phase, processUptimeMs());
+    } else {
+        g_print("Startup: %s at %.0f ms\n", phase, processUptimeMs());
+    }
+}
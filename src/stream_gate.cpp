@@ -0,0 +1,195 @@
+#include <gst/gst.h>
+
+#include <mutex>
+#include <string>
+#include <vector>
+#include <sys/socket.h>
+#include <stream_gate.hpp>
+#include <trace.hpp>
+
+// Client count of one valve.
+struct ValveGate {
+    GstElement *valve;
+    int         clients = 0;
+    std::string trace_name;  // Client count counter of the trace.
+};
+
+// Connection from one sink to one gate.
+struct GateLink {
+    ValveGate  *gate;
+    std::string label;
+};
+
+static std::mutex               m_gate_mutex;
+static std::vector<ValveGate *> m_gates;
+
+/**
+ * @brief Client connected to a gating sink.
+ */
+static void on_caller_added(GstElement *sink, int unused, sockaddr *addr, gpointer user_data) {
+    GateLink *link = (GateLink *)user_data;
+    std::lock_guard<std::mutex> lock(m_gate_mutex);
+
+    TRACE_COUNTER(link->gate->trace_name.c_str(), link->gate->clients + 1);
+    if (link->gate->clients++ == 0) {
+        if (!link->label.empty()) g_print("Client connected to %s! Starting encoder...\n", link->label.c_str());
+        g_object_set(G_OBJECT(link->gate->valve), "drop", FALSE, NULL);
+    }
+}
+
+/**
+ * @brief Client disconnected from a gating sink.
+ */
+static void on_caller_removed(GstElement *sink, int unused, sockaddr *addr, gpointer user_data) {
+    GateLink *link = (GateLink *)user_data;
+    std::lock_guard<std::mutex> lock(m_gate_mutex);
+
+    TRACE_COUNTER(link->gate->trace_name.c_str(), link->gate->clients > 0 ? link->gate->clients - 1 : 0);
+    if (link->gate->clients > 0 && --link->gate->clients == 0) {
+        if (!link->label.empty()) g_print("Client disconnected from %s. Throttling CPU...\n", link->label.c_str());
+        g_object_set(G_OBJECT(link->gate->valve), "drop", TRUE, NULL);
+    }
+}
+
+/**
+ * @brief Find the gate of a valve, making it on first use.
+ *
+ * The gates live for the life of the program.
+ *
+ * @param pipeline   Pipeline containing the valve.
+ * @param valve_name Name of the valve element.
+ * @return gate, NULL if the valve was not found.
+ */
+static ValveGate *findGate(GstElement *pipeline, const char *valve_name) {
+    GstElement *valve = gst_bin_get_by_name(GST_BIN(pipeline), valve_name);
+    if (!valve) return NULL;
+
+    std::lock_guard<std::mutex> lock(m_gate_mutex);
+    for (ValveGate *gate : m_gates) {
+        if (gate->valve == valve) {
+            gst_object_unref(valve);
+            return gate;
+        }
+    }
+    ValveGate *gate = new ValveGate {valve, 0, std::string(valve_name) + " clients"};
+    m_gates.push_back(gate);
+    return gate;
+}
+
+/**
+ * @brief Gate a valve on the clients of an SRT sink.
+ *
+ * The valve keeps one client count however many sinks gate it.
+ *
+ * @param pipeline   Pipeline containing both elements.
+ * @param sink_name  Name of the srtsink element.
+ * @param valve_name Name of the valve element.
+ * @param label      Stream name for the log messages, NULL for none.
+ * @return error - 0 for no error, 1 if an element was not found.
+ */
+int gateValve(GstElement *pipeline, const char *sink_name, const char *valve_name, const char *label) {
+    GstElement *sink = gst_bin_get_by_name(GST_BIN(pipeline), sink_name);
+    if (!sink) return 1;
+    ValveGate *gate = findGate(pipeline, valve_name);
+    if (!gate) {
+        gst_object_unref(sink);
+        return 1;
+    }
+
+    GateLink *link = new GateLink {gate, label ? label : ""};
+    g_signal_connect(sink, "caller-added",   G_CALLBACK(on_caller_added),   link);
+    g_signal_connect(sink, "caller-removed", G_CALLBACK(on_caller_removed), link);
+
+    gst_object_unref(sink);
+    return 0;
+}
+
+/**
+ * @brief Hold a valve open with a client that never leaves.
+ *
+ * For outputs whose viewers cannot be counted, such as a multicast stream.
+ * The valve stays gated, so gateClients counts the held client.
+ *
+ * @param pipeline   Pipeline containing the valve.
+ * @param valve_name Name of the valve element.
+ * @param label      Stream name for the log message, NULL for none.
+ * @return error - 0 for no error, 1 if the valve was not found.
+ */
+int holdValve(GstElement *pipeline, const char *valve_name, const char *label) {
+    ValveGate *gate = findGate(pipeline, valve_name);
+    if (!gate) return 1;
+
+    GateLink link = {gate, label ? label : ""};
+    on_caller_added(NULL, 0, NULL, &link);
+    return 0;
+}
+
+/**
+ * @brief Number of clients currently gating a valve.
+ *
+ * @param pipeline   Pipeline containing the valve.
+ * @param valve_name Name of the valve element.
+ * @return client count, 0 if the valve is not gated.
+ */
+int gateClients(GstElement *pipeline, const char *valve_name) {
+    GstElement *valve = gst_bin_get_by_name(GST_BIN(pipeline), valve_name);
+    if (!valve) return 0;
+
+    int clients = 0;
+    {
+        std::lock_guard<std::mutex> lock(m_gate_mutex);
+        for (ValveGate *gate : m_gates) {
+            if (gate->valve == valve) clients = gate->clients;
+        }
+    }
+
+    gst_object_unref(valve);
+    return clients;
+}
+
+/**
+ * @brief Set the drop state of a gated valve that has no clients.
+ *
+ * @param pipeline   Pipeline containing the valve.
+ * @param valve_name Name of the valve element.
+ * @param drop       New drop state.
+ * @return error - 0 for no error, 1 if the valve is not gated.
+ */
+static int setIdleValve(GstElement *pipeline, const char *valve_name, gboolean drop) {
+    GstElement *valve = gst_bin_get_by_name(GST_BIN(pipeline), valve_name);
+    if (!valve) return 1;
+
+    int error = 1;
+    {
+        std::lock_guard<std::mutex> lock(m_gate_mutex);
+        for (ValveGate *gate : m_gates) {
+            if (gate->valve != valve) continue;
+            if (gate->clients == 0) g_object_set(G_OBJECT(valve), "drop", drop, NULL);
+            error = 0;
+        }
+    }
+
+    gst_object_unref(valve);
+    return error;
+}
+
+/**
+ * @brief Open a gated valve ahead of its first client.
+ *
+ * @param pipeline   Pipeline containing the valve.
+ * @param valve_name Name of the valve element.
+ * @return error - 0 for no error, 1 if the valve is not gated.
+ */
+int prerollValve(GstElement *pipeline, const char *valve_name) {
+    return setIdleValve(pipeline, valve_name, FALSE);
+}
+
+/**
+ * @brief Close a prerolled valve again if it still has no clients.
+ *
+ * @param pipeline   Pipeline containing the valve.
+ * @param valve_name Name of the valve element.
+ */
+void endValvePreroll(GstElement *pipeline, const char *valve_name) {
+    setIdleValve(pipeline, valve_name, TRUE);
+}
@@ -0,0 +1,348 @@
+#include <gst/gst.h>
+#include <gst/video/video.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <element_chain.hpp>
+#include <stream_gate.hpp>
+#include <stream_profile.hpp>
+
+// One stream whose profile follows its callers. Its profiles are guarded by
+// m_streams_mutex.
+struct ProfileStream {
+    GstElement   *pipeline;
+    std::string   valve_name;
+    std::string   prefix;
+    GstElement   *rate_filter;
+    GstElement   *scale_filter;
+    GstElement   *encoder;
+    StreamProfile full;
+    StreamProfile requested;       // Profile asked for by the first caller.
+    StreamProfile current;         // Profile applied, within the limit.
+    bool          pinned = false;  // Held at current by pinStreamProfile.
+};
+
+// All profile streams and the limit put on them.
+static std::mutex                   m_streams_mutex;
+static std::vector<ProfileStream *> m_streams;
+static ProfileLimit                 m_limit = NO_PROFILE_LIMIT;
+
+/**
+ * @brief Parse a positive integer.
+ *
+ * @param text  Text to parse.
+ * @param end   Returned first character after the number.
+ * @param value Returned value.
+ * @return false if text does not start with a digit.
+ */
+static bool parseNumber(const char *text, const char **end, int *value) {
+    if (*text < '0' || *text > '9') return false;
+    char *stop;
+    long  number = strtol(text, &stop, 10);
+    if (number <= 0 || number > 100000) return false;
+    *value = (int)number;
+    *end   = stop;
+    return true;
+}
+
+/**
+ * @brief Parse a streamid into a stream profile.
+ *
+ * Sizes are rounded down to even numbers for the 4:2:0 chroma planes.
+ *
+ * @param stream_id Streamid sent by the caller. NULL or empty gives `full`.
+ * @param full      Settings of the full stream. Requests are clamped to them.
+ * @param profile   Returned profile.
+ * @return false if the streamid is malformed.
+ */
+bool parseStreamProfile(const char *stream_id, const StreamProfile &full, StreamProfile *profile) {
+    *profile = full;
+    if (!stream_id) return true;
+    if (strncmp(stream_id, "#!::", 4) == 0) stream_id += 4;
+
+    const char *p = stream_id;
+    while (*p) {
+        const char *equals = strchr(p, '=');
+        if (!equals) return false;
+        std::string key(p, equals - p);
+        const char *value = equals + 1;
+        const char *end   = value;
+        int         number;
+
+        if (key == "res") {
+            int width, height;
+            if (!parseNumber(value, &end, &number)) return false;
+            if (*end == 'p') {
+                height = number;
+                width  = (int)lround((double)full.width * height / full.height);
+                end++;
+            } else if (*end == 'x') {
+                width = number;
+                if (!parseNumber(end + 1, &end, &height)) return false;
+            } else {
+                return false;
+            }
+            profile->width  = std::clamp(width,  STREAM_PROFILE_MIN_SIZE, full.width)  & ~1;
+            profile->height = std::clamp(height, STREAM_PROFILE_MIN_SIZE, full.height) & ~1;
+        } else if (key == "fps") {
+            if (!parseNumber(value, &end, &number)) return false;
+            profile->fps = std::clamp(number, 1, full.fps);
+        } else if (key == "br") {
+            if (!parseNumber(value, &end, &number)) return false;
+            profile->bitrate_kbps = std::clamp(number, STREAM_PROFILE_MIN_KBPS, full.bitrate_kbps);
+        } else {
+            // Other keys (user names, resource names) are none of our business
+            end = value + strcspn(value, ",");
+        }
+
+        if (*end == ',') {
+            end++;
+        } else if (*end) {
+            return false;
+        }
+        p = end;
+    }
+    return true;
+}
+
+/**
+ * @brief Make the elements of the rate and scale stage.
+ *
+ * At the full profile videorate and videoscale pass the frames through
+ * untouched.
+ *
+ * @param prefix Element name prefix of the stream.
+ * @param full   Settings of the full stream.
+ * @return chain to put ahead of the encoder.
+ */
+std::vector<GstElement *> profileElements(const char *prefix, const StreamProfile &full) {
+    std::string name(prefix);
+    GstElement *rate  = makeElement("videorate", "");
+    GstElement *scale = makeElement("videoscale", "");
+    if (rate)  g_object_set(G_OBJECT(rate), "drop-only", TRUE, NULL);
+    if (scale) gst_util_set_object_arg(G_OBJECT(scale), "method", "bilinear");
+
+    return {rate, makeCapsFilter(name + "_rate_caps", "video/x-raw,framerate=" + std::to_string(full.fps) + "/1"),
+            scale, makeCapsFilter(name + "_scale_caps", "video/x-raw,width=" + std::to_string(full.width) +
+                                                        ",height=" + std::to_string(full.height))};
+}
+
+/**
+ * @brief Get a profile within a limit.
+ *
+ * @param profile Requested profile.
+ * @param full    Settings of the full stream the limit is relative to.
+ * @param limit   Limit.
+ * @return profile no larger than the limit.
+ */
+StreamProfile limitProfile(const StreamProfile &profile, const StreamProfile &full, const ProfileLimit &limit) {
+    StreamProfile limited = profile;
+    limited.width        = std::min(profile.width,  std::max((full.width  * limit.size_percent / 100) & ~1, STREAM_PROFILE_MIN_SIZE));
+    limited.height       = std::min(profile.height, std::max((full.height * limit.size_percent / 100) & ~1, STREAM_PROFILE_MIN_SIZE));
+    limited.fps          = std::min(profile.fps, std::max(limit.max_fps, 1));
+    limited.bitrate_kbps = std::min(profile.bitrate_kbps,
+                                    std::max(full.bitrate_kbps * limit.bitrate_percent / 100, STREAM_PROFILE_MIN_KBPS));
+    return limited;
+}
+
+/**
+ * @brief Set a profile on the stream elements.
+ *
+ * For a caller profile the stream is idle (its valve is closed) when this is
+ * called, so the new caps are negotiated with the first frame let through,
+ * and the encoder starts that frame as a key frame. A new profile limit is
+ * applied to running streams as well. Called with m_streams_mutex held.
+ *
+ * @param stream  Profile stream.
+ * @param profile Profile to apply.
+ */
+static void applyProfile(ProfileStream *stream, const StreamProfile &profile) {
+    // The frame rate is a range up to the profile's. videorate only drops frames, so it fixates the range
+    // to the rate of its input when that is lower, as when docking mode slows the source (see docking_mode.hpp).
+    GstCaps *rate_caps  = gst_caps_new_simple("video/x-raw", "framerate", GST_TYPE_FRACTION_RANGE, 1, 1,
+                                              profile.fps, 1, NULL);
+    GstCaps *scale_caps = gst_caps_new_simple("video/x-raw", "width",  G_TYPE_INT, profile.width,
+                                                             "height", G_TYPE_INT, profile.height, NULL);
+    g_object_set(G_OBJECT(stream->rate_filter),  "caps", rate_caps,  NULL);
+    g_object_set(G_OBJECT(stream->scale_filter), "caps", scale_caps, NULL);
+    gst_caps_unref(rate_caps);
+    gst_caps_unref(scale_caps);
+    // The bitrate is the only encoder setting x264enc takes while playing
+    g_object_set(G_OBJECT(stream->encoder), "bitrate", (guint)profile.bitrate_kbps, NULL);
+    stream->current = profile;
+}
+
+/**
+ * @brief A caller is about to connect. Applies its profile if the stream is idle.
+ *
+ * Runs on the srtsink thread, so the profiles are read and applied under
+ * m_streams_mutex, like the governor, control and docking mode changes.
+ *
+ * @return TRUE to accept the caller.
+ */
+static gboolean on_caller_connecting(GstElement *sink, gpointer addr, gchar *stream_id, gpointer user_data) {
+    ProfileStream *stream = (ProfileStream *)user_data;
+    const bool     idle   = gateClients(stream->pipeline, stream->valve_name.c_str()) == 0;
+
+    std::lock_guard<std::mutex> lock(m_streams_mutex);
+    StreamProfile requested;
+    if (!parseStreamProfile(stream_id, stream->full, &requested)) {
+        g_print("Ignoring malformed streamid \"%s\" on %s.\n", stream_id, stream->prefix.c_str());
+        requested = stream->full;
+    }
+    StreamProfile profile = limitProfile(requested, stream->full, m_limit);
+
+    if (stream->pinned) {
+        // Kept for when the stream is let go
+        if (idle) stream->requested = requested;
+        g_print("Stream %s is pinned. The caller gets the pinned profile.\n", stream->prefix.c_str());
+    } else if (idle) {
+        stream->requested = requested;
+        applyProfile(stream, profile);
+        g_print("Stream %s set to %dx%d at %d fps, %d kbps.\n", stream->prefix.c_str(),
+                profile.width, profile.height, profile.fps, profile.bitrate_kbps);
+    } else if (memcmp(&profile, &stream->current, sizeof(profile)) != 0) {
+        g_print("Stream %s is already running. The new caller shares its current profile.\n", stream->prefix.c_str());
+    }
+    return TRUE;
+}
+
+/**
+ * @brief A caller connected. Starts it off with a key frame.
+ */
+static void on_profile_caller_added(GstElement *sink, int unused, gpointer addr, gpointer user_data) {
+    ProfileStream *stream = (ProfileStream *)user_data;
+    gst_element_send_event(stream->encoder, gst_video_event_new_upstream_force_key_unit(GST_CLOCK_TIME_NONE, TRUE, 0));
+}
+
+/**
+ * @brief Start following the streamid profiles of a stream's callers.
+ *
+ * @param pipeline   Pipeline containing the stream.
+ * @param sink_name  Name of the srtsink of the stream.
+ * @param valve_name Name of the valve the sink gates.
+ * @param prefix     Element name prefix used with profileElements.
+ * @param full       Settings of the full stream.
+ * @return error - 0 for no error, 1 if an element was not found.
+ */
+int startStreamProfiles(GstElement *pipeline, const char *sink_name, const char *valve_name,
+                        const char *prefix, const StreamProfile &full) {
+    std::string name(prefix);
+    GstElement *sink         = gst_bin_get_by_name(GST_BIN(pipeline), sink_name);
+    GstElement *rate_filter  = gst_bin_get_by_name(GST_BIN(pipeline), (name + "_rate_caps").c_str());
+    GstElement *scale_filter = gst_bin_get_by_name(GST_BIN(pipeline), (name + "_scale_caps").c_str());
+    GstElement *encoder      = gst_bin_get_by_name(GST_BIN(pipeline), (name + "_encoder").c_str());
+
+    if (!sink || !rate_filter || !scale_filter || !encoder) {
+        if (sink)         gst_object_unref(sink);
+        if (rate_filter)  gst_object_unref(rate_filter);
+        if (scale_filter) gst_object_unref(scale_filter);
+        if (encoder)      gst_object_unref(encoder);
+        return 1;
+    }
+
+    // The stream keeps the element references for the life of the program
+    ProfileStream *stream = new ProfileStream();
+    stream->pipeline     = pipeline;
+    stream->valve_name   = valve_name;
+    stream->prefix       = name;
+    stream->rate_filter  = rate_filter;
+    stream->scale_filter = scale_filter;
+    stream->encoder      = encoder;
+    stream->full         = full;
+    stream->requested    = full;
+    stream->current      = full;
+
+    {
+        std::lock_guard<std::mutex> lock(m_streams_mutex);
+        m_streams.push_back(stream);
+        StreamProfile profile = limitProfile(full, full, m_limit);
+        if (memcmp(&profile, &full, sizeof(profile)) != 0) applyProfile(stream, profile);
+    }
+
+    if (STREAM_PROFILES_ENABLED) {
+        g_signal_connect(sink, "caller-connecting", G_CALLBACK(on_caller_connecting), stream);
+    }
+    g_signal_connect(sink, "caller-added", G_CALLBACK(on_profile_caller_added), stream);
+
+    gst_object_unref(sink);
+    return 0;
+}
+
+/**
+ * @brief Limit the profiles of all streams.
+ *
+ * Each stream is set to its requested profile within the new limit. A
+ * running stream renegotiates its caps on the next frame, and the encoder is
+ * asked for a key frame so the change starts cleanly.
+ *
+ * @param limit New limit.
+ */
+void setProfileLimit(const ProfileLimit &limit) {
+    std::lock_guard<std::mutex> lock(m_streams_mutex);
+    m_limit = limit;
+
+    for (ProfileStream *stream : m_streams) {
+        if (stream->pinned) continue;
+        StreamProfile profile = limitProfile(stream->requested, stream->full, limit);
+        if (memcmp(&profile, &stream->current, sizeof(profile)) == 0) continue;
+        applyProfile(stream, profile);
+        gst_element_send_event(stream->encoder, gst_video_event_new_upstream_force_key_unit(GST_CLOCK_TIME_NONE, TRUE, 0));
+    }
+}
+
+/**
+ * @brief Change the full bitrate of a stream.
+ *
+ * A caller that asked for the full rate follows it, a lower request is kept
+ * up to it. Unless the stream is pinned, the requested profile within the
+ * profile limit is applied right away, starting with a key frame.
+ *
+ * @param prefix Element name prefix used with profileElements.
+ * @param kbps   New full bitrate.
+ * @return error - 0 for no error, 1 if there is no such stream.
+ */
+int setStreamBitrate(const char *prefix, int kbps) {
+    std::lock_guard<std::mutex> lock(m_streams_mutex);
+    for (ProfileStream *stream : m_streams) {
+        if (stream->prefix != prefix) continue;
+        bool full_rate = stream->requested.bitrate_kbps >= stream->full.bitrate_kbps;
+        stream->full.bitrate_kbps      = kbps;
+        stream->requested.bitrate_kbps = full_rate ? kbps : std::min(stream->requested.bitrate_kbps, kbps);
+        if (stream->pinned) return 0;
+
+        applyProfile(stream, limitProfile(stream->requested, stream->full, m_limit));
+        gst_element_send_event(stream->encoder, gst_video_event_new_upstream_force_key_unit(GST_CLOCK_TIME_NONE, TRUE, 0));
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * @brief Pin a stream to a profile, or let it go.
+ *
+ * A pinned stream ignores its callers and the profile limit until it is let
+ * go, when it goes back to its requested profile within the limit. Either way
+ * the change is applied to the running stream, starting with a key frame.
+ *
+ * @param prefix  Element name prefix used with profileElements.
+ * @param profile Profile to pin, NULL to let the stream go.
+ * @return error - 0 for no error, 1 if there is no such stream.
+ */
+int pinStreamProfile(const char *prefix, const StreamProfile *profile) {
+    std::lock_guard<std::mutex> lock(m_streams_mutex);
+    for (ProfileStream *stream : m_streams) {
+        if (stream->prefix != prefix) continue;
+        stream->pinned = profile != NULL;
+        if (profile) applyProfile(stream, *profile);
+        else         applyProfile(stream, limitProfile(stream->requested, stream->full, m_limit));
+        gst_element_send_event(stream->encoder, gst_video_event_new_upstream_force_key_unit(GST_CLOCK_TIME_NONE, TRUE, 0));
+        return 0;
+    }
+    return 1;
+}
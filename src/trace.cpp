@@ -0,0 +1,382 @@
+#include <gst/gst.h>
+
+#include <algorithm>
+#include <atomic>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <pthread.h>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+#include <sys/syscall.h>
+#include <trace.hpp>
+
+static const int TRACE_ENCODER_SLOTS = 16;  // Frames that can be inside an encoder at once.
+
+static_assert((TRACE_RING_EVENTS & (TRACE_RING_EVENTS - 1)) == 0, "TRACE_RING_EVENTS must be a power of 2");
+
+struct TraceEvent {
+    uint64_t    time_ns;
+    const char *name;
+    int64_t     value;
+    TraceType   type;
+};
+
+// Ring of one thread. Only its thread writes to it. head counts the events
+// written and is published after each event, so a reader knows which slots
+// hold whole events.
+struct TraceRing {
+    std::atomic<uint64_t> head {0};
+    std::atomic<uint64_t> start {0};       // First event of the current thread.
+    std::atomic<bool>     retired {false};  // The thread has exited and the ring can be reused.
+    int                   tid = 0;
+    char                  thread_name[16] = {};
+    TraceEvent            events[TRACE_RING_EVENTS];
+};
+
+// A ring and the thread it belonged to when a dump started.
+struct TraceRingInfo {
+    const TraceRing *ring;
+    uint64_t         start;
+    int              tid;
+    char             thread_name[16];
+};
+
+static std::mutex                               m_rings_mutex;
+static std::vector<std::unique_ptr<TraceRing>>  m_rings;
+
+// Retires the ring of a thread when the thread exits.
+struct TraceThread {
+    TraceRing *ring = NULL;
+    bool       registered = false;
+    ~TraceThread() {
+        if (ring) ring->retired.store(true, std::memory_order_release);
+    }
+};
+
+static thread_local TraceThread m_thread;
+
+#if defined(__aarch64__)
+/**
+ * @brief Nanoseconds per generic timer tick, as a 32.32 fixed point number.
+ */
+static uint64_t timerScale() {
+    uint64_t frequency;
+    asm volatile("mrs %0, cntfrq_el0" : "=r"(frequency));
+    return (1000000000ULL << 32) / frequency;
+}
+
+static const uint64_t m_timer_scale = timerScale();
+#endif
+
+/**
+ * @brief Get the trace clock.
+ *
+ * On the Pi this reads the generic timer counter that CLOCK_MONOTONIC is
+ * kept with, straight from user space, which takes a few nanoseconds where
+ * clock_gettime takes tens.
+ *
+ * @return monotonic time in nanoseconds.
+ */
+uint64_t traceNowNs() {
+#if defined(__aarch64__)
+    uint64_t ticks;
+    asm volatile("mrs %0, cntvct_el0" : "=r"(ticks));
+    return (uint64_t)(((unsigned __int128)ticks * m_timer_scale) >> 32);
+#else
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+#endif
+}
+
+/**
+ * @brief Give the calling thread a ring, reusing one of an exited thread if there is one.
+ *
+ * @return ring, NULL if TRACE_MAX_THREADS are already traced.
+ */
+static TraceRing *registerThread() {
+    m_thread.registered = true;
+    std::lock_guard<std::mutex> lock(m_rings_mutex);
+
+    TraceRing *ring = NULL;
+    for (const std::unique_ptr<TraceRing> &candidate : m_rings) {
+        if (candidate->retired.load(std::memory_order_acquire)) {
+            ring = candidate.get();
+            break;
+        }
+    }
+    if (!ring && (int)m_rings.size() < TRACE_MAX_THREADS) {
+        m_rings.push_back(std::make_unique<TraceRing>());
+        ring = m_rings.back().get();
+    }
+    if (!ring) return NULL;
+
+    // Events of the previous thread are dropped from the snapshots
+    ring->start.store(ring->head.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    ring->tid = (int)syscall(SYS_gettid);
+    pthread_getname_np(pthread_self(), ring->thread_name, sizeof(ring->thread_name));
+    ring->retired.store(false, std::memory_order_release);
+    m_thread.ring = ring;
+    return ring;
+}
+
+/**
+ * @brief Record an event on the calling thread.
+ *
+ * @param type    Event type.
+ * @param name    Event name, kept as a pointer.
+ * @param value   Counter value, or the duration of a complete event in nanoseconds.
+ * @param time_ns Start of a complete event. Other events are stamped now.
+ */
+void traceRecord(TraceType type, const char *name, int64_t value, uint64_t time_ns) {
+    TraceRing *ring = m_thread.ring;
+    if (!ring) {
+        if (m_thread.registered) return;
+        ring = registerThread();
+        if (!ring) return;
+    }
+
+    uint64_t    head  = ring->head.load(std::memory_order_relaxed);
+    TraceEvent &event = ring->events[head & (TRACE_RING_EVENTS - 1)];
+    event.time_ns = type == TRACE_COMPLETE ? time_ns : traceNowNs();
+    event.name    = name;
+    event.value   = value;
+    event.type    = type;
+    ring->head.store(head + 1, std::memory_order_release);
+}
+
+/**
+ * @brief Write a name as a JSON string.
+ */
+static void writeJsonString(FILE *file, const char *text) {
+    fputc('"', file);
+    for (const char *c = text; *c; c++) {
+        if (*c == '"' || *c == '\\') fputc('\\', file);
+        if ((unsigned char)*c >= 0x20) fputc(*c, file);
+    }
+    fputc('"', file);
+}
+
+/**
+ * @brief Write a snapshot of all rings in the Chrome trace JSON format.
+ *
+ * The ring list is copied under m_rings_mutex, so a thread starting up is
+ * never held behind the file writes. The rings are then copied while their
+ * threads keep recording. Events that may have been overwritten during the
+ * copy are left out, and so is a ring handed to a new thread meanwhile.
+ *
+ * @param path Output, set to the file written.
+ * @return 0 on success, 1 on error.
+ */
+int dumpTrace(std::string *path) {
+    char name[256];
+    time_t now = time(NULL);
+    tm     local;
+    localtime_r(&now, &local);
+    if (strftime(name, sizeof(name), TRACE_DUMP_PATTERN, &local) == 0) return 1;
+    *path = name;
+
+    FILE *file = fopen(name, "w");
+    if (!file) return 1;
+
+    // Rings are never freed, so they can be read after the lock is released
+    std::vector<TraceRingInfo> rings;
+    {
+        std::lock_guard<std::mutex> lock(m_rings_mutex);
+        rings.reserve(m_rings.size());
+        for (const std::unique_ptr<TraceRing> &ring : m_rings) {
+            TraceRingInfo info;
+            info.ring  = ring.get();
+            info.start = ring->start.load(std::memory_order_relaxed);
+            info.tid   = ring->tid;
+            memcpy(info.thread_name, ring->thread_name, sizeof(info.thread_name));
+            rings.push_back(info);
+        }
+    }
+
+    std::vector<TraceEvent> events(TRACE_RING_EVENTS);
+    bool                    first = true;
+    fprintf(file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+
+    for (const TraceRingInfo &info : rings) {
+        const TraceRing *ring = info.ring;
+        uint64_t before = ring->head.load(std::memory_order_acquire);
+        uint64_t copied = std::max(info.start, before > (uint64_t)TRACE_RING_EVENTS ? before - TRACE_RING_EVENTS : 0);
+        for (uint64_t i = copied; i < before; i++) events[i - copied] = ring->events[i & (TRACE_RING_EVENTS - 1)];
+
+        // The thread may be writing event `after` into the slot of after - TRACE_RING_EVENTS
+        uint64_t after = ring->head.load(std::memory_order_acquire);
+        uint64_t from  = after >= (uint64_t)TRACE_RING_EVENTS ? std::max(copied, after - TRACE_RING_EVENTS + 1) : copied;
+        if (from >= before) continue;
+        // The ring went to another thread during the copy
+        if (ring->start.load(std::memory_order_acquire) != info.start) continue;
+
+        fprintf(file, "%s{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":",
+                first ? "" : ",\n", info.tid);
+        writeJsonString(file, info.thread_name[0] ? info.thread_name : "thread");
+        fprintf(file, "}}");
+        first = false;
+
+        int depth = 0;
+        for (uint64_t i = from; i < before; i++) {
+            const TraceEvent &event = events[i - copied];
+            // A span whose start was overwritten has nothing to end
+            if (event.type == TRACE_END && depth == 0) continue;
+            static const char PHASES[] = {'B', 'E', 'X', 'i', 'C'};
+            fprintf(file, ",\n{\"ph\":\"%c\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"name\":", PHASES[event.type],
+                    info.tid, event.time_ns / 1000.0);
+            writeJsonString(file, event.name);
+            switch (event.type) {
+            case TRACE_BEGIN:    depth++; break;
+            case TRACE_END:      depth--; break;
+            case TRACE_COMPLETE: fprintf(file, ",\"dur\":%.3f", event.value / 1000.0); break;
+            case TRACE_INSTANT:  fprintf(file, ",\"s\":\"t\""); break;
+            case TRACE_COUNTER:  fprintf(file, ",\"args\":{\"value\":%lld}", (long long)event.value); break;
+            }
+            fputc('}', file);
+        }
+    }
+
+    fprintf(file, "\n]}\n");
+    fclose(file);
+    return 0;
+}
+
+/**
+ * @brief Dump the trace each time SIGUSR1 arrives.
+ */
+static void signalLoop(sigset_t signals) {
+    while (true) {
+        int signal = 0;
+        if (sigwait(&signals, &signal) != 0) continue;
+        std::string path;
+        if (dumpTrace(&path) == 0) std::cout << "Trace written to " << path << "." << std::endl;
+        else                       std::cerr << "Failed to write the trace to " << path << "." << std::endl;
+    }
+}
+
+/**
+ * @brief Start dumping the trace on SIGUSR1.
+ *
+ * SIGUSR1 is blocked on the calling thread, and so on all threads it starts
+ * later, and taken by a thread of its own with sigwait. The dump then runs
+ * outside of a signal handler.
+ *
+ * @return error - 0 for no error, 1 if the signal could not be blocked.
+ */
+int startTracer() {
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGUSR1);
+    if (pthread_sigmask(SIG_BLOCK, &signals, NULL) != 0) return 1;
+    std::thread(signalLoop, signals).detach();
+    return 0;
+}
+
+// Trace names and encoder timing of one camera. Kept for the life of the process.
+struct CameraTrace {
+    std::string  capture;
+    std::string  encode;
+    std::string  srt_bytes;
+    std::mutex   mutex;
+    GstClockTime pts[TRACE_ENCODER_SLOTS];
+    uint64_t     in_ns[TRACE_ENCODER_SLOTS];
+    int          next = 0;
+};
+
+/**
+ * @brief Buffer probe on the source pad of the camera. Marks each capture.
+ */
+static GstPadProbeReturn on_trace_capture(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    TRACE_INSTANT(((CameraTrace *)user_data)->capture.c_str());
+    return GST_PAD_PROBE_OK;
+}
+
+/**
+ * @brief Buffer probe on the encoder sink pad. Notes when each frame went in.
+ */
+static GstPadProbeReturn on_trace_encoder_input(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    CameraTrace *trace = (CameraTrace *)user_data;
+    std::lock_guard<std::mutex> lock(trace->mutex);
+    trace->pts[trace->next]   = GST_BUFFER_PTS(GST_PAD_PROBE_INFO_BUFFER(info));
+    trace->in_ns[trace->next] = traceNowNs();
+    trace->next = (trace->next + 1) % TRACE_ENCODER_SLOTS;
+    return GST_PAD_PROBE_OK;
+}
+
+/**
+ * @brief Buffer probe on the encoder source pad. Records the encode of the frame
+ *        as one complete event, since it can leave on another thread.
+ */
+static GstPadProbeReturn on_trace_encoder_output(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    CameraTrace  *trace = (CameraTrace *)user_data;
+    GstClockTime  pts   = GST_BUFFER_PTS(GST_PAD_PROBE_INFO_BUFFER(info));
+    uint64_t      now   = traceNowNs();
+    std::lock_guard<std::mutex> lock(trace->mutex);
+    for (int i = 0; i < TRACE_ENCODER_SLOTS && GST_CLOCK_TIME_IS_VALID(pts); i++) {
+        if (trace->pts[i] != pts) continue;
+        TRACE_COMPLETE(trace->encode.c_str(), trace->in_ns[i], (int64_t)(now - trace->in_ns[i]));
+        trace->pts[i] = GST_CLOCK_TIME_NONE;
+        break;
+    }
+    return GST_PAD_PROBE_OK;
+}
+
+/**
+ * @brief Buffer probe on the SRT sink pad. Counts the bytes sent.
+ */
+static GstPadProbeReturn on_trace_send(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    TRACE_COUNTER(((CameraTrace *)user_data)->srt_bytes.c_str(),
+                  (int64_t)gst_buffer_get_size(GST_PAD_PROBE_INFO_BUFFER(info)));
+    return GST_PAD_PROBE_OK;
+}
+
+/**
+ * @brief Add a buffer probe to a pad of a named element.
+ *
+ * @return 0 on success, 1 if the element or pad does not exist.
+ */
+static int probePad(GstElement *pipeline, const std::string &element_name, const char *pad_name,
+                    GstPadProbeCallback callback, CameraTrace *trace) {
+    GstElement *element = gst_bin_get_by_name(GST_BIN(pipeline), element_name.c_str());
+    if (!element) return 1;
+    GstPad *pad = gst_element_get_static_pad(element, pad_name);
+    gst_object_unref(element);
+    if (!pad) return 1;
+    gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, callback, trace, NULL);
+    gst_object_unref(pad);
+    return 0;
+}
+
+/**
+ * @brief Trace the frames of a camera pipeline.
+ *
+ * @param pipeline Camera pipeline, with elements named "<camera>_...".
+ * @param camera   Camera name.
+ * @return error - 0 for no error, 1 if an element is missing.
+ */
+int attachCameraTrace(GstElement *pipeline, const char *camera) {
+#ifdef TRACE
+    CameraTrace *trace = new CameraTrace;
+    trace->capture   = std::string(camera) + " capture";
+    trace->encode    = std::string(camera) + " encode";
+    trace->srt_bytes = std::string(camera) + " srt bytes";
+    for (GstClockTime &pts : trace->pts) pts = GST_CLOCK_TIME_NONE;
+
+    const std::string prefix = std::string(camera) + "_";
+    if (probePad(pipeline, prefix + "source",  "src",  on_trace_capture,        trace) != 0 ||
+        probePad(pipeline, prefix + "encoder", "sink", on_trace_encoder_input,  trace) != 0 ||
+        probePad(pipeline, prefix + "encoder", "src",  on_trace_encoder_output, trace) != 0 ||
+        probePad(pipeline, prefix + "sink",    "sink", on_trace_send,           trace) != 0) {
+        return 1;
+    }
+#endif
+    return 0;
+}
@@ -0,0 +1,249 @@
+#include <gst/gst.h>
+#include <gst/video/video.h>
+
+#include <algorithm>
+#include <cmath>
+#include <frame_stage.hpp>
+#include <undistort.hpp>
+#include <video.hpp>
+#include <worker_pool.hpp>
+
+// State of the undistortion stage of one camera. It lives as long as the
+// probe on the pad.
+struct Undistorter {
+    WorkerPool     pool {UNDISTORT_THREADS};
+    FrameStage     stage       = {"Lens undistortion"};
+    UndistortMap   map;
+    double         map_cx      = NAN;  // Principal point the map was built for
+    double         map_cy      = NAN;
+};
+
+/**
+ * @brief Fill one plane of the remap table.
+ *
+ * Node (i, j) sits on output pixel (i * step, j * step) of a plane that is
+ * `subsample` times smaller than the luma plane. Pixel centers are used, so
+ * an undistorted camera gives an exact identity map.
+ *
+ * @param camera    Distorted camera model in luma pixels.
+ * @param subsample 1 for the luma plane, 2 for the chroma plane.
+ * @param step      Grid step in pixels of the plane.
+ * @param columns   Number of node columns.
+ * @param rows      Number of node rows.
+ * @param sx        Returned fixed point source x per node.
+ * @param sy        Returned fixed point source y per node.
+ */
+static void buildPlane(const CameraModel &camera, int subsample, int step, int columns, int rows,
+                       std::vector<int32_t> &sx, std::vector<int32_t> &sy) {
+    const double scale = (double)(1 << WARP_FRAC_BITS);
+    sx.resize(columns * rows);
+    sy.resize(columns * rows);
+
+    for (int j = 0; j < rows; j++) {
+        for (int i = 0; i < columns; i++) {
+            // Output pixel center in luma pixels, as a ray of the ideal pinhole view
+            double u = (i * step + 0.5) * subsample;
+            double v = (j * step + 0.5) * subsample;
+
+            double su, sv;
+            lensPixel(camera, (u - camera.cx) / camera.fx, (v - camera.cy) / camera.fy, 1.0, &su, &sv);
+
+            sx[j * columns + i] = (int32_t)std::lround((su / subsample - 0.5) * scale);
+            sy[j * columns + i] = (int32_t)std::lround((sv / subsample - 0.5) * scale);
+        }
+    }
+}
+
+/**
+ * @brief Build the remap table for a camera model.
+ *
+ * The output view is an ideal pinhole lens with the focal length and
+ * principal point of `camera`, so anything drawn through the distorted model
+ * ends up straight. Building the table costs a few thousand projections and
+ * is cheap enough to redo when the principal point moves.
+ *
+ * @param camera Distorted camera model of the source frames.
+ * @param width  Frame width.
+ * @param height Frame height.
+ * @param map    Returned remap table.
+ */
+void buildUndistortMap(const CameraModel &camera, int width, int height, UndistortMap &map) {
+    const int step = UNDISTORT_GRID_STEP;
+
+    map.width      = width;
+    map.height     = height;
+    map.y_columns  = (width  + step - 1) / step + 1;
+    map.y_rows     = (height + step - 1) / step + 1;
+    map.uv_columns = (width  / 2 + step / 2 - 1) / (step / 2) + 1;
+    map.uv_rows    = (height / 2 + step / 2 - 1) / (step / 2) + 1;
+
+    buildPlane(camera, 1, step,     map.y_columns,  map.y_rows,  map.y_sx,  map.y_sy);
+    buildPlane(camera, 2, step / 2, map.uv_columns, map.uv_rows, map.uv_sx, map.uv_sy);
+}
+
+/**
+ * @brief Interpolate the table across one row of a tile.
+ *
+ * The coordinates are bilinear within each grid cell. Everything is kept in
+ * integers scaled by step * step until the final shift, so the error is
+ * below one fixed point step.
+ *
+ * @param gx      Table x coordinates of the plane.
+ * @param gy      Table y coordinates of the plane.
+ * @param columns Node columns of the plane.
+ * @param cell    Grid row of the tile.
+ * @param r       Row within the grid cell (0 - step - 1).
+ * @param shift   Grid step in pixels of the plane, as a power of 2.
+ * @param x0      First pixel of the tile row.
+ * @param n       Number of pixels in the tile row.
+ * @param sx      Returned x coordinates.
+ * @param sy      Returned y coordinates.
+ */
+static void tileCoordinates(const int32_t *gx, const int32_t *gy, int columns, int cell, int r, int shift,
+                            int x0, int n, int32_t *sx, int32_t *sy) {
+    const int32_t *top_x = gx + cell * columns, *bottom_x = top_x + columns;
+    const int32_t *top_y = gy + cell * columns, *bottom_y = top_y + columns;
+    const int      step  = 1 << shift;
+
+    for (int k = 0; k < n;) {
+        int c = (x0 + k) >> shift;
+        int f = (x0 + k) & (step - 1);
+        int m = std::min(step - f, n - k);
+
+        // Cell edges at this row, scaled by step
+        int64_t left_x  = ((int64_t)top_x[c]     << shift) + (int64_t)(bottom_x[c]     - top_x[c])     * r;
+        int64_t right_x = ((int64_t)top_x[c + 1] << shift) + (int64_t)(bottom_x[c + 1] - top_x[c + 1]) * r;
+        int64_t left_y  = ((int64_t)top_y[c]     << shift) + (int64_t)(bottom_y[c]     - top_y[c])     * r;
+        int64_t right_y = ((int64_t)top_y[c + 1] << shift) + (int64_t)(bottom_y[c + 1] - top_y[c + 1]) * r;
+
+        int64_t acc_x = (left_x << shift) + (right_x - left_x) * f;
+        int64_t acc_y = (left_y << shift) + (right_y - left_y) * f;
+        for (int i = 0; i < m; i++) {
+            sx[k + i] = (int32_t)(acc_x >> (2 * shift));
+            sy[k + i] = (int32_t)(acc_y >> (2 * shift));
+            acc_x += right_x - left_x;
+            acc_y += right_y - left_y;
+        }
+        k += m;
+    }
+}
+
+/**
+ * @brief Remap an NV12 frame through an undistortion table.
+ *
+ * Work is split across the pool by grid rows. Each grid row is done in tiles
+ * of UNDISTORT_TILE_WIDTH pixels, luma then chroma of the same area, so the
+ * source rows a tile reads are still in cache for the next tile row.
+ *
+ * @param src  Source frame.
+ * @param dst  Destination frame. Must have the same size as src.
+ * @param map  Remap table built for this frame size.
+ * @param pool Worker pool the grid rows are split across.
+ */
+void undistortNV12(const Nv12Frame &src, const Nv12Frame &dst, const UndistortMap &map, WorkerPool &pool) {
+    const int step       = UNDISTORT_GRID_STEP;
+    const int cells      = map.y_rows - 1;
+    const int uv_width   = dst.width  / 2;
+    const int uv_height  = dst.height / 2;
+
+    auto band_job = [&](int band, int bands) {
+        alignas(16) int32_t sx[UNDISTORT_TILE_WIDTH], sy[UNDISTORT_TILE_WIDTH];
+
+        for (int cell = cells * band / bands; cell < cells * (band + 1) / bands; cell++) {
+            for (int x0 = 0; x0 < dst.width; x0 += UNDISTORT_TILE_WIDTH) {
+                int n = std::min(UNDISTORT_TILE_WIDTH, dst.width - x0);
+
+                // Luma
+                for (int r = 0; r < step && cell * step + r < dst.height; r++) {
+                    tileCoordinates(map.y_sx.data(), map.y_sy.data(), map.y_columns, cell, r,
+                                    UNDISTORT_GRID_SHIFT, x0, n, sx, sy);
+                    remapRowY(src, dst.y + (cell * step + r) * dst.y_stride + x0, sx, sy, n);
+                }
+
+                // Chroma of the same area
+                int uv_x0 = x0 / 2;
+                int uv_n  = std::min(n / 2, uv_width - uv_x0);
+                for (int r = 0; r < step / 2 && cell * (step / 2) + r < uv_height; r++) {
+                    tileCoordinates(map.uv_sx.data(), map.uv_sy.data(), map.uv_columns, cell, r,
+                                    UNDISTORT_GRID_SHIFT - 1, uv_x0, uv_n, sx, sy);
+                    remapRowUV(src, dst.uv + (cell * (step / 2) + r) * dst.uv_stride + 2 * uv_x0, sx, sy, uv_n);
+                }
+            }
+        }
+    };
+
+    // A few bands per thread so a slow thread does not hold up the frame
+    pool.run(std::min(cells, pool.size() * 4), band_job);
+}
+
+/**
+ * @brief Undistort one frame, as the pixel work of the stage.
+ */
+static void undistortFrame(const Nv12Frame &src, const Nv12Frame &dst, void *context) {
+    Undistorter *und = (Undistorter *)context;
+    undistortNV12(src, dst, und->map, und->pool);
+}
+
+/**
+ * @brief Buffer probe that undistorts each frame.
+ *
+ * Remaps the incoming frame into a buffer from the pool and hands that buffer
+ * downstream instead. The table is rebuilt only when the principal point
+ * moves, which happens when the region of interest window moves, or the frame
+ * size changes. If anything fails the frame is passed on unchanged.
+ *
+ * @param pad       Pad the probe is attached to.
+ * @param info      Probe info holding the buffer.
+ * @param user_data Undistorter state.
+ * @return GST_PAD_PROBE_OK to keep the data flowing.
+ */
+static GstPadProbeReturn on_undistort_frame(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    Undistorter *und = (Undistorter *)user_data;
+
+    if (!und->stage.buffer_pool && !setupFrameStage(&und->stage, pad)) return GST_PAD_PROBE_OK;
+
+    // A caps change can change the frame size without moving the principal point
+    const int   width  = GST_VIDEO_INFO_WIDTH(&und->stage.info);
+    const int   height = GST_VIDEO_INFO_HEIGHT(&und->stage.info);
+    CameraModel camera = forwardCameraModel();
+    if (camera.cx != und->map_cx || camera.cy != und->map_cy || und->map.width != width ||
+        und->map.height != height) {
+        buildUndistortMap(camera, width, height, und->map);
+        und->map_cx = camera.cx;
+        und->map_cy = camera.cy;
+    }
+
+    runFrameStage(&und->stage, info, undistortFrame, und);
+    return GST_PAD_PROBE_OK;
+}
+
+/**
+ * @brief Free the undistortion state of a camera once its frame probe is removed.
+ *
+ * The caps probe is removed along with it when the pad goes away.
+ */
+static void free_undistorter(gpointer user_data) {
+    Undistorter *und = (Undistorter *)user_data;
+    releaseFrameStage(&und->stage);
+    delete und;
+}
+
+/**
+ * @brief Attach the lens undistortion stage to a pipeline.
+ *
+ * Adds a buffer probe to the source pad of the named element. The element
+ * is normally an identity placed after the overlay has been converted to
+ * NV12 and ahead of the horizon leveler.
+ *
+ * @param pipeline     Pipeline containing the element.
+ * @param element_name Name of the element to attach to.
+ * @return error - 0 for no error, 1 if the element was not found.
+ */
+int attachUndistort(GstElement *pipeline, const char *element_name) {
+    Undistorter *und = new Undistorter();
+    if (attachFrameStage(pipeline, element_name, &und->stage, on_undistort_frame, und, free_undistorter) != 0) {
+        delete und;
+        return 1;
+    }
+    return 0;
+}
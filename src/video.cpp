@@ -3,260 +3,282 @@
 #include <cairo.h>
 
 #include <iostream>
+#include <algorithm>
+#include <cstdio>
+#include <thread>
 #include <attitude.hpp>
 #include <video.hpp>
+#include <stabilize.hpp>
+#include <undistort.hpp>
+#include <denoise.hpp>
+#include <docking_mode.hpp>
+#include <governor.hpp>
+#include <pip.hpp>
+#include <proxy.hpp>
+#include <stream_profile.hpp>
+#include <stream_gate.hpp>
+#include <bridge_detect.hpp>
+#include <motion_watch.hpp>
+#include <multicast.hpp>
+#include <roi_crop.hpp>
+#include <camera_model.hpp>
+#include <control.hpp>
+#include <capture_stamp.hpp>
+#include <camera_capture.hpp>
+#include <roi_encoder.hpp>
+#include <overlay_layers.hpp>
+#include <trace.hpp>
+#include <pipeline_builder.hpp>
+#include <startup.hpp>
 #include <string>
 #include <cstring>
-#include <sys/socket.h>
 
 /**
- * @brief Overlay Drawing Callback 
+ * @brief Get the camera model of a forward camera frame.
  *
- * Handles the callback from the pipeline. It reads the pitch and roll andgles
- * from the attitude sensor and builds a pitch ladder to be overlayed onto the
- * forward facing camera.
+ * Without the region of interest crop the frame is the full field of view.
+ * With it, the frame is a window of the sensor, so the calibration is scaled
+ * to the sensor resolution and the principal point moves with the window.
  *
- * @param overlay Overlay GST Element that will be returned.
- * @param cr Data structure (context) for the Cairo graphics library.
- * @param timestamp Timestamp for the current video frame.
- * @param duration  Length of the media stream.
- * @param user_data
- * @return error - 0 for no error, 1 for I2C initialization failure.
+ * @param width  Frame width.
+ * @param height Frame height.
+ * @return camera model in pixels of the frame.
  */
-static void on_draw_overlay(GstElement *overlay, cairo_t *cr, guint64 timestamp, 
-                           guint64 duration, gpointer user_data) {
+static CameraModel forwardOverlayModel(int width, int height) {
 
-    double center_x = WIDTH / 2.0;
-    double center_y = HEIGHT / 2.0;
-    double height_per_deg = HEIGHT / VERTICAL_FOV_DEG;
+    if (ROI_CROP_ENABLED) {
+        int left, top;
+        getRoiOrigin(&left, &top);
+        return makeCameraModel(FORWARD_CAMERA_CALIBRATION, ROI_SENSOR_WIDTH, ROI_SENSOR_HEIGHT,
+                               width, height, left, top);
+    }
+    return makeCameraModel(FORWARD_CAMERA_CALIBRATION, width, height, width, height, 0, 0);
+}
+
+/**
+ * @brief Get the camera model of the forward camera frame.
+ *
+ * @return camera model in pixels of the WIDTH x HEIGHT frame the overlay draws on.
+ */
+CameraModel forwardCameraModel() {
+    return forwardOverlayModel(WIDTH, HEIGHT);
+}
 
-    double pitch = 0.0;
-    double roll = 0.0;
-    double yaw = 0.0;
+/**
+ * @brief Attach the processing stages and stream gates of one camera.
+ *
+ * @param cameras Camera pipelines.
+ * @param camera  Camera to wire up.
+ */
+static void wireCamera(const std::vector<CameraPipeline> &cameras, const CameraPipeline &camera) {
+    GstElement       *pipeline     = camera.pipeline;
+    const std::string name         = camera.config.name;
+    const std::string stream_valve = cameraElement(camera, "stream_valve");
+    const std::string sink         = cameraElement(camera, "sink");
+    const std::string valve        = camera.tee ? cameraElement(camera, "valve") : stream_valve;
+
+    /******************* Stream Valves ******************/
+    // This only allows the encoder to run when the stream is connected. Since
+    // only one stream will be connected at a time it allows for all 4 cores to 
+    // be used for encoding and increases thruput for the one video stream.
+    // With a tee the processing up to the tee runs for any of the streams and each encode
+    // only runs for its own clients.
+    gateValve(pipeline, sink.c_str(), stream_valve.c_str(), camera.tee ? NULL : name.c_str());
+    if (camera.tee) gateValve(pipeline, sink.c_str(), valve.c_str(), name.c_str());
+    if (camera.proxy_sink) {
+        const std::string proxy_sink = cameraElement(camera, "proxy_sink");
+        gateValve(pipeline, proxy_sink.c_str(), stream_valve.c_str(), NULL);
+        gateValve(pipeline, proxy_sink.c_str(), cameraElement(camera, "proxy_valve").c_str(), (name + " proxy").c_str());
+    }
+    // Multicast viewers cannot be counted, so a multicast camera keeps its main encode running
+    if (MULTICAST_ENABLED && !camera.config.multicast_group.empty()) {
+        const std::string label = name + " multicast";
+        if (holdValve(pipeline, stream_valve.c_str(), camera.tee ? NULL : label.c_str()) != 0 ||
+            (camera.tee && holdValve(pipeline, valve.c_str(), label.c_str()) != 0)) {
+            std::cerr << "Failed to open the multicast stream of " << name << "." << std::endl;
+        }
+    }
 
-    getAttitude(&pitch, &roll, &yaw);
+    // Capture from the sensor directly, in place of libcamerasrc. Frames flow once the pipeline plays.
+    if (CAMERA_CAPTURE_ENABLED && camera.config.sensor != TEST_SENSOR && startCapture(pipeline, camera.config) != 0) {
+        std::cerr << "Failed to start the capture of " << name << "." << std::endl;
+    }
 
-    // Convert degrees to radians for Cairo rotation
-    double roll_rad = roll * DEG_TO_RAD;
+    // Follow the streamid profiles of the callers of the main stream, the quality governor and docking mode
+    const StreamProfile full = {camera.config.width, camera.config.height, camera.config.fps,
+                                camera.config.encoder.bitrate_kbps};
+    if ((STREAM_PROFILES_ENABLED || GOVERNOR_ENABLED || DOCKING_MODE_ENABLED) && startStreamProfiles(pipeline, sink.c_str(), valve.c_str(), name.c_str(), full) != 0) {
+        std::cerr << "Failed to start the stream profiles of " << name << "." << std::endl;
+    }
 
-    // --- DRAW PITCH LADDER ---
-    // The "Horizon Center" is moved vertically by the current pitch
-    double vertical_pitch_offset = (pitch + (VERTICAL_OFFSET_DEG * cos(roll_rad))) * height_per_deg; // The Vertical offset is for the camera tilt up. As the camera rolls, that tilt needs to be removed from the offset
+    // Trace the captures, encodes and sends of the camera
+    if (attachCameraTrace(pipeline, name.c_str()) != 0) {
+        std::cerr << "Failed to trace " << name << "." << std::endl;
+    }
 
-    // Add each of the pitch lines based on their definitions in ANGLE_LINE_SETTINGS
-    for (auto cur_line : ANGLE_LINE_SETTINGS) {
-        cairo_save(cr);
+    // Stamp the capture times into the main stream for latency measurement
+    if (CAPTURE_STAMPS_ENABLED && startCaptureStamps(pipeline, cameraElement(camera, "encoder").c_str(), name.c_str()) != 0) {
+        std::cerr << "Failed to start the capture stamps of " << name << "." << std::endl;
+    }
 
-        // 1. Move to the screen center
-        cairo_translate(cr, center_x, center_y);
+    // Picture in picture. The inset is taken ahead of the valve of its camera so it keeps coming
+    // when only the composite is watched.
+    const std::string compositor_name = cameraElement(camera, "pip_compositor");
+    GstElement       *compositor      = gst_bin_get_by_name(GST_BIN(pipeline), compositor_name.c_str());
+    if (compositor) {
+        gst_object_unref(compositor);
+        const std::string pip_sink = cameraElement(camera, "pip_sink");
+        gateValve(pipeline, pip_sink.c_str(), stream_valve.c_str(),                       NULL);
+        gateValve(pipeline, pip_sink.c_str(), cameraElement(camera, "pip_valve").c_str(), "picture in picture");
+        for (const CameraPipeline &inset : cameras) {
+            if (!inset.config.pip_inset) continue;
+            PipInset *pip_inset = startPipInset(inset.pipeline, cameraElement(inset, "stream_valve").c_str());
+            if (!pip_inset || attachPipCompositor(pipeline, compositor_name.c_str(), pip_inset) != 0) {
+                std::cerr << "Failed to start the picture in picture composite." << std::endl;
+            }
+        }
+    }
 
-        // 2. Rotate the entire canvas by the roll angle
-        // Using -roll_rad because cairo rotates clockwise
-        cairo_rotate(cr, -roll_rad);
+    // Watch the camera for motion while its stream is idle. It sits ahead of the valve so it
+    // keeps running when nobody is connected.
+    if (MOTION_WATCH_ENABLED && camera.config.motion_watch && startMotionWatch(pipeline, stream_valve.c_str(), name.c_str()) != 0) {
+        std::cerr << "Failed to start the motion watch." << std::endl;
+    }
 
-        // 3. Offset vertically for the current pitch + the specific line angle
-        // Subtract because in screen space, higher pitch moves the horizon down
-        double line_y_offset = vertical_pitch_offset - (cur_line.angle * height_per_deg);
-        cairo_translate(cr, 0, line_y_offset);
+    // Denoise the camera if enabled
+    if (DENOISE_ENABLED && camera.config.denoise && attachDenoise(pipeline, cameraElement(camera, "denoise").c_str()) != 0) {
+        std::cerr << "Failed to attach the denoise." << std::endl;
+    }
 
-        // 4. Draw the horizontal line (relative to new 0,0)
-        cairo_set_source_rgb(cr, 1.0, 1.0, 1.0); 
-        cairo_set_line_width(cr, 3.0);
+    // Fender and distance guides on the docking camera if enabled
+    if (OVERLAY_DOCKING_ENABLED && camera.config.docking &&
+        attachOverlay(pipeline, cameraElement(camera, "overlay").c_str(), name.c_str(), DOCKING_OVERLAY_LAYERS,
+                      dockingCameraModel, NULL) != 0) {
+        std::cerr << "Failed to attach the docking overlay." << std::endl;
+    }
 
-        double line_half_width = (WIDTH * cur_line.width_ratio) / 2.0;
-        cairo_move_to(cr, -line_half_width, 0);
-        cairo_line_to(cr, line_half_width, 0);
-        cairo_stroke(cr);
+    if (!camera.config.horizon) return;
 
-        // 5. Draw text next to the line if enabled
-        if (cur_line.display_text) {
-            cairo_select_font_face(cr, "Sans", CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_BOLD);
-            cairo_set_font_size(cr, 20.0);
-            cairo_move_to(cr, line_half_width + 10, 7); // Offset to the right of the line
-            cairo_show_text(cr, std::to_string((int)cur_line.angle).c_str());
-        }
+    // Start measuring the bridge underside on the forward camera if enabled. It samples the
+    // frames ahead of the overlay, which draws its readout.
+    const std::string overlay = cameraElement(camera, "horizon_overlay");
+    BridgeDetector   *bridge  = NULL;
+    if (BRIDGE_DETECT_ENABLED && !(bridge = startBridgeDetector(pipeline, overlay.c_str()))) {
+        std::cerr << "Failed to start the bridge detector." << std::endl;
+    }
 
-        cairo_restore(cr);
+    // Draw the pitch ladder and the readouts from the Cairo Overlay
+    if (attachOverlay(pipeline, overlay.c_str(), name.c_str(), HORIZON_OVERLAY_LAYERS, forwardOverlayModel,
+                      bridge) != 0) {
+        std::cerr << "Failed to attach the horizon overlay." << std::endl;
     }
 
-// When defined, it prints the current pitch, roll and yaw angles to the video overlay.
-#ifdef DEBUG
-    // Fixed debug text (non-rotating)
-    cairo_save(cr);
-    cairo_set_source_rgb(cr, 1.0, 1.0, 0.0); // Yellow for debug
-    cairo_select_font_face(cr, "Sans", CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_BOLD);
-    cairo_set_font_size(cr, 20.0);
-
-    cairo_move_to(cr, 20, HEIGHT - 70);
-    cairo_show_text(cr, ("Pitch: " + std::to_string(pitch)).c_str());
-    cairo_move_to(cr, 20, HEIGHT - 45);
-    cairo_show_text(cr, ("Roll:  " + std::to_string(roll)).c_str());
-    cairo_move_to(cr, 20, HEIGHT - 20);
-    cairo_show_text(cr, ("Yaw:   " + std::to_string(yaw)).c_str());
-    cairo_restore(cr);
-#endif
+    // Drive the region of interest window on the forward camera if enabled
+    if (ROI_CROP_ENABLED && startRoiCrop(pipeline, cameraElement(camera, "roi_crop").c_str()) != 0) {
+        std::cerr << "Failed to start the region of interest crop." << std::endl;
+    }
+
+    // Straighten the lens distortion on the forward camera if enabled
+    if (UNDISTORT_ENABLED && attachUndistort(pipeline, cameraElement(camera, "undistort").c_str()) != 0) {
+        std::cerr << "Failed to attach the lens undistortion." << std::endl;
+    }
+
+    // Level the horizon on the forward camera if enabled
+    if (STABILIZE_HORIZON && attachStabilizer(pipeline, cameraElement(camera, "leveler").c_str()) != 0) {
+        std::cerr << "Failed to attach the horizon leveler." << std::endl;
+    }
 }
 
 /**
  * @brief Setup and start the video streams.
  *
- * Sets up the video stream pipelines and starts them.
+ * Builds one pipeline per camera of the camera list (CAMERA_CONFIG_FILE, or
+ * the two cameras of the mast) and starts them.
  *
- * @param overlay Overlay GST Element that will be returned.
- * @param cr Data structure (context) for the Cairo graphics library.
- * @param timestamp Timestamp for the current video frame.
- * @param duration  Length of the media stream.
- * @param user_data
- * @return error - 0 for no error, 1 for I2C initialization failure.
+ * @return error - 0 for no error, -1 if the pipelines could not be created.
  */
 int startStreaming() {
-    GstElement *pipeline, *pipeline2;
-    GstBus *bus, *bus2;
-    GstMessage *msg, *msg2;
-
     gst_init(NULL, NULL);
-
-    // Pipeline 1: Forward looking camera used for determining whether or not the camera will 
-    // pass below the bridge. It includes Dynamic Cairo Overlay that puts the horizon and a
-    // angle ladder on the display. If the bridge is some degrees above the horizon, the 
-    // camera (and mast) will pass below it.
-    // Note: videoconvert to BGRA is required for Cairo, then back to NV12 for x264enc
-    const std::string pipeline_desc =
-
-        // Select the forward facing camera to stream from
-        "libcamerasrc camera-name=\"/base/axi/pcie@1000120000/rp1/i2c@88000/imx708@1a\" ! "
-        // Set the desired format, resolution and frame rate
-        "video/x-raw,format=BGRx,width=" + std::to_string(WIDTH) + ",height=" + std::to_string(HEIGHT) + ",framerate=30/1 ! "
-        // Add a queue to separate the camera hardware reading from the software image processing
-        "queue max-size-buffers=1 leaky=downstream ! "
-        // Valve - The valve passes on data to the next step when the stream is active and throws out the
-        //         data when it is not. This disables all of the down stream processing when this stream
-        //         is not in use. This is valuable, because there are two camera streams, but only one
-        //         is used at a time and allows the active one to use all of the computing power of the Pi.
-        "valve name=stream_valve drop=true ! "
-        // Generate the pitch ladder overlay and add it to the video signal
-        "cairooverlay name=horizon_overlay ! "
-        // Convert back to the NV12 format used by the x264 encoder
-        "videoconvert ! video/x-raw,format=NV12 ! "
-        // Add a queue to seperate the overlay computations from the encoding.
-        "queue max-size-buffers=1 leaky=downstream ! "
-        // Encode the video using x264enc. This is software encoding. A future improvemnet would be to
-        // update this to use the graphics chip to encode the video.
-        "x264enc tune=zerolatency speed-preset=ultrafast bitrate=8000 threads=4 key-int-max=30 ! "
-        // Add a queue to seperate the encoding from parsing and streaming.
-        "queue max-size-buffers=1 leaky=downstream ! "
-        // Parse the encoded video in preperation for streaming it.
-        //"h264parse config-interval=-1 ! "
-        // Wrap the encoded video in mpegtsmux for use with the ipad video players.
-        "mpegtsmux alignment=7 latency=0 pcr-interval=20 scte-35-null-interval=0 ! " 
-        // Stream the video on port 5000 in SRT UDP SRT format. Do no start the stream until a connection is requested
-        "srtsink name=mysink uri=srt://:5000?mode=listener&latency=20&payloadsize=1316&tlpktdrop=true&too_late_delay_ignore=true wait-for-connection=true sync=false";
-
-    // Pipeline 2: Standard stream
-    const std::string pipeline_desc2 =
-        // Select the downwared facing camera to stream from
-        "libcamerasrc camera-name=\"/base/axi/pcie@1000120000/rp1/i2c@80000/imx477@1a\" ! "
-        // Set the desired format, resolution and frame rate
-        "video/x-raw,format=NV12,width=" + std::to_string(WIDTH_2) + ",height=" + std::to_string(HEIGHT_2) + ",framerate=30/1 ! "
-        // Add a queue to separate the camera hardware reading from the software image processing
-        "queue max-size-buffers=1 leaky=downstream ! "
-        // Valve - The valve passes on data to the next step when the stream is active and throws out the
-        //         data when it is not. This disables all of the down stream processing when this stream
-        //         is not in use. This is valuable, because there are two camera streams, but only one
-        //         is used at a time and allows the active one to use all of the computing power of the Pi.
-        "valve name=stream_valve2 drop=true ! "
-        // Encode the video using x264enc. This is software encoding. A future improvemnet would be to
-        // update this to use the graphics chip to encode the video.
-        "x264enc tune=zerolatency speed-preset=ultrafast bitrate=8000 threads=4 key-int-max=30 ! "
-        // Add a queue to seperate the encoding from parsing and streaming.
-        "queue max-size-buffers=1 leaky=downstream ! "
-        // Parse the encoded video in preperation for streaming it.
-        //"h264parse ! "
-        // Wrap the encoded video in mpegtsmux for use with the ipad video players.
-        "mpegtsmux alignment=7 latency=0 pcr-interval=20 scte-35-null-interval=0 ! " 
-        // Stream the video on port 5001 in SRT UDP SRT format. Do no start the stream until a connection is requested
-        "srtsink name=mysink2 uri=srt://:5001?mode=listener&latency=20&payloadsize=1316&tlpktdrop=true&too_late_delay_ignore=true wait-for-connection=true sync=false";
-
-    // Parse the pipeline strings to create the pipelines.
-    pipeline = gst_parse_launch(pipeline_desc.c_str(), NULL);
-    pipeline2 = gst_parse_launch(pipeline_desc2.c_str(), NULL);
-
-    if (!pipeline || !pipeline2) {
+    logStartupPhase("gstreamer initialized");
+    if (ROI_ENCODER_ENABLED && registerRoiEncoder() != 0) std::cerr << "Failed to register the ROI encoder" << std::endl;
+
+    // Load the element plugins while the camera list is read
+    std::thread plugins([]() {
+        preloadPlugins();
+        logStartupPhase("plugins loaded");
+    });
+
+    // The forward camera is used for determining whether or not the camera will pass below
+    // the bridge. It includes Dynamic Cairo Overlay that puts the horizon and a angle ladder
+    // on the display. If the bridge is some degrees above the horizon, the camera (and mast)
+    // will pass below it. The docking camera is a standard stream.
+    std::vector<CameraConfig>   configs = loadCameraConfig(CAMERA_CONFIG_FILE);
+    std::vector<CameraPipeline> cameras;
+    plugins.join();
+
+    if (buildCameraPipelines(configs, &cameras) != 0) {
         std::cerr << "Failed to create pipelines." << std::endl;
         return -1;
     }
 
-    /******************* Stream Valves ******************/
-    // This only allows the encoder to run when the stream is connected. Since
-    // only one stream will be connected at a time it allows for all 4 cores to 
-    // be used for encoding and increases thruput for the one video stream.
-
-    // Get references to the elements
-    GstElement *sink = gst_bin_get_by_name(GST_BIN(pipeline), "mysink");
-    GstElement *valve = gst_bin_get_by_name(GST_BIN(pipeline), "stream_valve");
-
-    // Signal: Client Connects -> Open Valve (Start Encoding)
-    g_signal_connect(sink, "caller-added", G_CALLBACK(+[](GstElement* sink, int unused, sockaddr* addr, gpointer valve_ptr) {
-        g_print("Client connected to camera 1! Starting encoder...\n");
-        g_object_set(G_OBJECT(valve_ptr), "drop", FALSE, NULL);
-    }), valve);
-
-    // Signal: Client Disconnects -> Close Valve (Stop Encoding)
-    g_signal_connect(sink, "caller-removed", G_CALLBACK(+[](GstElement* sink, int unused, sockaddr* addr, gpointer valve_ptr) {
-        g_print("Client disconnected to camera 1. Throttling CPU...\n");
-        g_object_set(G_OBJECT(valve_ptr), "drop", TRUE, NULL);
-    }), valve);
-
-
+    for (const CameraPipeline &camera : cameras) wireCamera(cameras, camera);
 
-    // Get references to the elements
-    GstElement *sink2 = gst_bin_get_by_name(GST_BIN(pipeline2), "mysink2");
-    GstElement *valve2 = gst_bin_get_by_name(GST_BIN(pipeline2), "stream_valve2");
-
-    // Signal: Client Connects -> Open Valve (Start Encoding)
-    g_signal_connect(sink2, "caller-added", G_CALLBACK(+[](GstElement* sink, int unused, sockaddr* addr, gpointer valve_ptr) {
-        g_print("Client connected to camera 2! Starting encoder...\n");
-        g_object_set(G_OBJECT(valve_ptr), "drop", FALSE, NULL);
-    }), valve2);
-
-    // Signal: Client Disconnects -> Close Valve (Stop Encoding)
-    g_signal_connect(sink2, "caller-removed", G_CALLBACK(+[](GstElement* sink, int unused, sockaddr* addr, gpointer valve_ptr) {
-        g_print("Client disconnected to camera 2. Throttling CPU...\n");
-        g_object_set(G_OBJECT(valve_ptr), "drop", TRUE, NULL);
-    }), valve2);
-
-
-
-    
+    // Let the control socket switch the docking camera to docking mode if enabled
+    if (DOCKING_MODE_ENABLED && startDockingMode(cameras) != 0) {
+        std::cerr << "Failed to start docking mode." << std::endl;
+    }
 
-    // Connect the drawing signal to the Cairo Overlay in Pipeline 1
-    GstElement *overlay = gst_bin_get_by_name(GST_BIN(pipeline), "horizon_overlay");
-    if (overlay) {
-        g_signal_connect(overlay, "draw", G_CALLBACK(on_draw_overlay), NULL);
-        gst_object_unref(overlay);
+    // Accept setting changes while streaming if enabled
+    if (CONTROL_ENABLED && startControlSocket(cameras) != 0) {
+        std::cerr << "Failed to open the control socket " << CONTROL_SOCKET << "." << std::endl;
     }
 
-    std::cout << "Streaming Camera 1 (Horizon) on port 5000..." << std::endl;
-    std::cout << "Streaming Camera 2 on port 5001..." << std::endl;
+    // Announce the multicast streams on the LAN if enabled
+    if (MULTICAST_ENABLED && startMulticastAnnouncer(configs) != 0) {
+        std::cerr << "Failed to announce the multicast streams." << std::endl;
+    }
 
-    gst_element_set_state(pipeline,  GST_STATE_PLAYING);
-    gst_element_set_state(pipeline2, GST_STATE_PLAYING);
+    // Step the stream quality down when the Pi gets hot or the encoders fall behind
+    if (GOVERNOR_ENABLED && startGovernor(cameras, GOVERNOR_PATHS) != 0) {
+        std::cerr << "Failed to start the quality governor." << std::endl;
+    }
 
-    // Standard GStreamer bus management
-    bus = gst_element_get_bus(pipeline);
-    bus2 = gst_element_get_bus(pipeline2);
+    for (const CameraPipeline &camera : cameras) {
+        std::cout << "Streaming camera " << camera.config.name << " on port " << camera.config.port << "..." << std::endl;
+        if (camera.proxy_sink) {
+            std::cout << "Streaming camera " << camera.config.name << " proxy on port " << PROXY_PORT + camera.index << "..." << std::endl;
+        }
+        if (MULTICAST_ENABLED && !camera.config.multicast_group.empty()) {
+            std::cout << "Streaming camera " << camera.config.name << " to multicast " << camera.config.multicast_group
+                      << ":" << camera.config.multicast_port << "..." << std::endl;
+        }
+        if (camera.pip_sink) {
+            std::cout << "Streaming picture in picture on port " << PIP_PORT << "..." << std::endl;
+        }
+    }
 
-    // This waits for the first pipeline's bus; in a real app, you'd use a GLib MainLoop
-    msg = gst_bus_timed_pop_filtered(bus, GST_CLOCK_TIME_NONE, 
-        (GstMessageType)(GST_MESSAGE_ERROR | GST_MESSAGE_EOS));
+    startCameraPipelines(cameras);
+
+    // Standard GStreamer bus management. Runs until any pipeline reports an error or the end of its stream.
+    // Element messages are popped too, so the motion events are logged and never pile up on the bus.
+    std::vector<GstBus *> buses;
+    for (const CameraPipeline &camera : cameras) buses.push_back(gst_element_get_bus(camera.pipeline));
+
+    bool running = true;
+    while (running) {
+        for (GstBus *bus : buses) {
+            GstMessage *msg = gst_bus_timed_pop_filtered(bus, 100 * GST_MSECOND,
+                (GstMessageType)(GST_MESSAGE_ERROR | GST_MESSAGE_EOS | GST_MESSAGE_ELEMENT));
+            if (msg == NULL) continue;
+            if (GST_MESSAGE_TYPE(msg) != GST_MESSAGE_ELEMENT) running = false;
+            else                                              handleMotionMessage(msg);
+            gst_message_unref(msg);
+        }
+    }
 
-    if (msg != NULL) gst_message_unref(msg);
-    gst_object_unref(bus);
-    gst_object_unref(bus2);
-    gst_element_set_state(pipeline, GST_STATE_NULL);
-    gst_element_set_state(pipeline2, GST_STATE_NULL);
-    gst_object_unref(pipeline);
-    gst_object_unref(pipeline2);
+    for (GstBus *bus : buses) gst_object_unref(bus);
+    stopCameraPipelines(cameras);
+    if (MULTICAST_ENABLED) stopMulticastAnnouncer();
 
     return 0;
 }
@@ -0,0 +1,268 @@
+#include <warp.hpp>
+#include <worker_pool.hpp>
+
+#include <cmath>
+#include <vector>
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Number of pixels gathered before they are blended. Small enough that the
+// tap buffers stay in L1, large enough to keep the SIMD loop busy.
+static const int CHUNK = 64;
+
+/**
+ * @brief Blend n bilinear samples from four tap buffers.
+ *
+ * out = lerp(lerp(p00, p01, fx), lerp(p10, p11, fy), fy) with 7 bit weights.
+ * Each lerp rounds back to 8 bits, so every intermediate fits in 16 bits and
+ * the SIMD paths give exactly the same result as the scalar tail.
+ *
+ * @param p00 Top left taps.
+ * @param p01 Top right taps.
+ * @param p10 Bottom left taps.
+ * @param p11 Bottom right taps.
+ * @param fx  Horizontal weights (0 - WARP_WEIGHT_ONE).
+ * @param fy  Vertical weights (0 - WARP_WEIGHT_ONE).
+ * @param out Output pixels.
+ * @param n   Number of pixels.
+ */
+static void blendBilinear(const uint8_t *p00, const uint8_t *p01, const uint8_t *p10, const uint8_t *p11,
+                          const uint8_t *fx, const uint8_t *fy, uint8_t *out, int n) {
+    int i = 0;
+
+#if defined(__ARM_NEON)
+    const uint8x16_t one = vdupq_n_u8(WARP_WEIGHT_ONE);
+
+    // lerp of 16 pixels: (a * (1 - w) + b * w + 64) >> 7
+    auto lerp = [](uint8x16_t a, uint8x16_t b, uint8x16_t w0, uint8x16_t w1) {
+        uint16x8_t lo = vmlal_u8(vmull_u8(vget_low_u8(a),  vget_low_u8(w0)),  vget_low_u8(b),  vget_low_u8(w1));
+        uint16x8_t hi = vmlal_u8(vmull_u8(vget_high_u8(a), vget_high_u8(w0)), vget_high_u8(b), vget_high_u8(w1));
+        return vcombine_u8(vrshrn_n_u16(lo, WARP_WEIGHT_BITS), vrshrn_n_u16(hi, WARP_WEIGHT_BITS));
+    };
+
+    for (; i + 16 <= n; i += 16) {
+        uint8x16_t wx1 = vld1q_u8(fx + i);
+        uint8x16_t wy1 = vld1q_u8(fy + i);
+        uint8x16_t wx0 = vsubq_u8(one, wx1);
+        uint8x16_t wy0 = vsubq_u8(one, wy1);
+
+        uint8x16_t top    = lerp(vld1q_u8(p00 + i), vld1q_u8(p01 + i), wx0, wx1);
+        uint8x16_t bottom = lerp(vld1q_u8(p10 + i), vld1q_u8(p11 + i), wx0, wx1);
+        vst1q_u8(out + i, lerp(top, bottom, wy0, wy1));
+    }
+#elif defined(__SSE2__)
+    const __m128i zero  = _mm_setzero_si128();
+    const __m128i one   = _mm_set1_epi16(WARP_WEIGHT_ONE);
+    const __m128i round = _mm_set1_epi16(WARP_WEIGHT_ONE / 2);
+
+    // lerp of 8 pixels held in 16 bit lanes
+    auto lerp = [&](__m128i a, __m128i b, __m128i w1) {
+        __m128i sum = _mm_add_epi16(_mm_mullo_epi16(a, _mm_sub_epi16(one, w1)), _mm_mullo_epi16(b, w1));
+        return _mm_srli_epi16(_mm_add_epi16(sum, round), WARP_WEIGHT_BITS);
+    };
+
+    for (; i + 8 <= n; i += 8) {
+        auto load = [&](const uint8_t *p) {
+            return _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(p + i)), zero);
+        };
+        __m128i wx1 = load(fx);
+        __m128i wy1 = load(fy);
+
+        __m128i top    = lerp(load(p00), load(p01), wx1);
+        __m128i bottom = lerp(load(p10), load(p11), wx1);
+        __m128i result = lerp(top, bottom, wy1);
+        _mm_storel_epi64((__m128i *)(out + i), _mm_packus_epi16(result, zero));
+    }
+#endif
+
+    const int half = WARP_WEIGHT_ONE / 2;
+    for (; i < n; i++) {
+        int top    = (p00[i] * (WARP_WEIGHT_ONE - fx[i]) + p01[i] * fx[i] + half) >> WARP_WEIGHT_BITS;
+        int bottom = (p10[i] * (WARP_WEIGHT_ONE - fx[i]) + p11[i] * fx[i] + half) >> WARP_WEIGHT_BITS;
+        out[i] = (uint8_t)((top * (WARP_WEIGHT_ONE - fy[i]) + bottom * fy[i] + half) >> WARP_WEIGHT_BITS);
+    }
+}
+
+/**
+ * @brief Split a fixed point coordinate into a tap index and a weight.
+ *
+ * Coordinates outside the plane are clamped to the edge pixel.
+ *
+ * @param s     Fixed point coordinate.
+ * @param last  Index of the last pixel in this direction.
+ * @param index Returned index of the first tap. The second tap is index + 1.
+ * @param w     Returned weight of the second tap.
+ */
+static inline void splitCoordinate(int32_t s, int last, int &index, uint8_t &w) {
+    if (s <= 0) {
+        index = 0;
+        w     = 0;
+        return;
+    }
+    index = s >> WARP_FRAC_BITS;
+    if (index >= last) {
+        index = last - 1;
+        w     = WARP_WEIGHT_ONE;
+        return;
+    }
+    w = (s >> (WARP_FRAC_BITS - WARP_WEIGHT_BITS)) & (WARP_WEIGHT_ONE - 1);
+}
+
+/**
+ * @brief Bilinear remap of one row of the Y plane.
+ *
+ * The taps are gathered in chunks into small buffers and then blended with
+ * the SIMD kernel.
+ *
+ * @param src   Source frame.
+ * @param dst   Destination pixels.
+ * @param sx    Fixed point source x coordinate per pixel.
+ * @param sy    Fixed point source y coordinate per pixel.
+ * @param count Number of pixels.
+ */
+void remapRowY(const Nv12Frame &src, uint8_t *dst, const int32_t *sx, const int32_t *sy, int count) {
+    alignas(16) uint8_t p00[CHUNK], p01[CHUNK], p10[CHUNK], p11[CHUNK], fx[CHUNK], fy[CHUNK];
+
+    for (int start = 0; start < count; start += CHUNK) {
+        int n = (count - start < CHUNK) ? count - start : CHUNK;
+
+        for (int i = 0; i < n; i++) {
+            int x, y;
+            splitCoordinate(sx[start + i], src.width  - 1, x, fx[i]);
+            splitCoordinate(sy[start + i], src.height - 1, y, fy[i]);
+
+            const uint8_t *row = src.y + y * src.y_stride + x;
+            p00[i] = row[0];
+            p01[i] = row[1];
+            p10[i] = row[src.y_stride];
+            p11[i] = row[src.y_stride + 1];
+        }
+
+        blendBilinear(p00, p01, p10, p11, fx, fy, dst + start, n);
+    }
+}
+
+/**
+ * @brief Bilinear remap of one row of the interleaved UV plane.
+ *
+ * @param src   Source frame.
+ * @param dst   Destination bytes (2 per sample).
+ * @param sx    Fixed point source x coordinate per chroma sample.
+ * @param sy    Fixed point source y coordinate per chroma sample.
+ * @param count Number of chroma samples.
+ */
+void remapRowUV(const Nv12Frame &src, uint8_t *dst, const int32_t *sx, const int32_t *sy, int count) {
+    alignas(16) uint8_t p00[CHUNK], p01[CHUNK], p10[CHUNK], p11[CHUNK], fx[CHUNK], fy[CHUNK];
+    const int chroma_width  = src.width  / 2;
+    const int chroma_height = src.height / 2;
+
+    for (int start = 0; start < count; start += CHUNK / 2) {
+        int n = (count - start < CHUNK / 2) ? count - start : CHUNK / 2;
+
+        for (int i = 0; i < n; i++) {
+            int x, y;
+            uint8_t wx, wy;
+            splitCoordinate(sx[start + i], chroma_width  - 1, x, wx);
+            splitCoordinate(sy[start + i], chroma_height - 1, y, wy);
+
+            const uint8_t *row = src.uv + y * src.uv_stride + 2 * x;
+            for (int c = 0; c < 2; c++) {
+                p00[2 * i + c] = row[c];
+                p01[2 * i + c] = row[c + 2];
+                p10[2 * i + c] = row[src.uv_stride + c];
+                p11[2 * i + c] = row[src.uv_stride + c + 2];
+                fx[2 * i + c]  = wx;
+                fy[2 * i + c]  = wy;
+            }
+        }
+
+        blendBilinear(p00, p01, p10, p11, fx, fy, dst + 2 * start, 2 * n);
+    }
+}
+
+/**
+ * @brief Fill a row of fixed point coordinates along a straight line.
+ *
+ * @param sx    Returned x coordinates.
+ * @param sy    Returned y coordinates.
+ * @param count Number of coordinates.
+ * @param x0    Source x of the first pixel.
+ * @param y0    Source y of the first pixel.
+ * @param dx    Source x step per output pixel.
+ * @param dy    Source y step per output pixel.
+ */
+static void lineCoordinates(int32_t *sx, int32_t *sy, int count, double x0, double y0, double dx, double dy) {
+    const double scale = (double)(1 << WARP_FRAC_BITS);
+    int32_t x  = (int32_t)std::lround(x0 * scale);
+    int32_t y  = (int32_t)std::lround(y0 * scale);
+    int32_t ix = (int32_t)std::lround(dx * scale);
+    int32_t iy = (int32_t)std::lround(dy * scale);
+
+    for (int i = 0; i < count; i++) {
+        sx[i] = x;
+        sy[i] = y;
+        x += ix;
+        y += iy;
+    }
+}
+
+/**
+ * @brief Rotate and zoom an NV12 frame about its center.
+ *
+ * Each output pixel samples the source at the inverse rotation of its offset
+ * from the center. Since that is an affine map, the source coordinates of a
+ * row are a straight line and are generated incrementally in fixed point.
+ *
+ * @param src       Source frame.
+ * @param dst       Destination frame. Must have the same size as src.
+ * @param angle_rad Rotation of the picture, in the Cairo rotation direction.
+ * @param zoom      Zoom factor. Values above 1 crop the rotated corners.
+ * @param pool      Worker pool the rows are split across.
+ */
+void rotateNV12(const Nv12Frame &src, const Nv12Frame &dst, double angle_rad, double zoom, WorkerPool &pool) {
+    const double c = cos(angle_rad) / zoom;
+    const double s = sin(angle_rad) / zoom;
+
+    auto band_job = [&](int band, int bands) {
+        thread_local std::vector<int32_t> sx, sy;
+        if ((int)sx.size() < dst.width) {
+            sx.resize(dst.width);
+            sy.resize(dst.width);
+        }
+
+        // Luma
+        const double cx = (dst.width  - 1) / 2.0;
+        const double cy = (dst.height - 1) / 2.0;
+        int row_begin = dst.height * band / bands;
+        int row_end   = dst.height * (band + 1) / bands;
+
+        for (int row = row_begin; row < row_end; row++) {
+            double oy = row - cy;
+            lineCoordinates(sx.data(), sy.data(), dst.width,
+                            cx + (c * -cx + s * oy), cy + (-s * -cx + c * oy), c, -s);
+            remapRowY(src, dst.y + row * dst.y_stride, sx.data(), sy.data(), dst.width);
+        }
+
+        // Chroma
+        const int    chroma_width  = dst.width  / 2;
+        const int    chroma_height = dst.height / 2;
+        const double ccx = (chroma_width  - 1) / 2.0;
+        const double ccy = (chroma_height - 1) / 2.0;
+        row_begin = chroma_height * band / bands;
+        row_end   = chroma_height * (band + 1) / bands;
+
+        for (int row = row_begin; row < row_end; row++) {
+            double oy = row - ccy;
+            lineCoordinates(sx.data(), sy.data(), chroma_width,
+                            ccx + (c * -ccx + s * oy), ccy + (-s * -ccx + c * oy), c, -s);
+            remapRowUV(src, dst.uv + row * dst.uv_stride, sx.data(), sy.data(), chroma_width);
+        }
+    };
+
+    // A few bands per thread so a slow thread does not hold up the frame
+    pool.run(pool.size() * 4, band_job);
+}
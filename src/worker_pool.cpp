@@ -0,0 +1,105 @@
+#include <worker_pool.hpp>
+
+/**
+ * @brief Create the pool and start the helper threads.
+ *
+ * @param threads Number of threads that work on each job, including the caller.
+ */
+WorkerPool::WorkerPool(int threads) : m_threads(threads < 1 ? 1 : threads) {
+    for (int i = 1; i < m_threads; i++) {
+        m_workers.emplace_back(&WorkerPool::workerLoop, this);
+    }
+}
+
+/**
+ * @brief Stop and join the helper threads.
+ */
+WorkerPool::~WorkerPool() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_wake.notify_all();
+    for (auto &worker : m_workers) worker.join();
+}
+
+/**
+ * @brief Split a job into bands and run them across the pool.
+ *
+ * The bands are handed out one at a time, so a thread that finishes early
+ * picks up the next band instead of idling. Returns when every band is done.
+ *
+ * @param bands   Number of bands the job is split into.
+ * @param job     Function called once per band with (context, band, bands).
+ * @param context Job state passed to the function.
+ */
+void WorkerPool::run(int bands, BandJob job, const void *context) {
+    if (bands <= 0) return;
+
+    if (m_workers.empty() || bands == 1) {
+        for (int band = 0; band < bands; band++) job(context, band, bands);
+        return;
+    }
+
+    unsigned generation;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_job       = job;
+        m_context   = context;
+        m_bands     = bands;
+        m_next_band = 0;
+        m_remaining = bands;
+        generation  = ++m_generation;
+    }
+    m_wake.notify_all();
+
+    // The caller works on bands as well
+    drainBands(generation);
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_done.wait(lock, [this] { return m_remaining == 0; });
+    m_job     = nullptr;
+    m_context = nullptr;
+}
+
+/**
+ * @brief Take bands from the current job until none are left.
+ *
+ * Bands are handed out under the mutex. There are only a handful per frame,
+ * and it keeps a thread that wakes up late from taking bands of a newer job.
+ *
+ * @param generation Job generation the calling thread was woken for.
+ */
+void WorkerPool::drainBands(unsigned generation) {
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    while (m_generation == generation && m_next_band < m_bands) {
+        int band  = m_next_band++;
+        int bands = m_bands;
+        BandJob     job     = m_job;
+        const void *context = m_context;
+
+        lock.unlock();
+        job(context, band, bands);
+        lock.lock();
+
+        if (--m_remaining == 0) m_done.notify_one();
+    }
+}
+
+/**
+ * @brief Helper thread body. Sleeps until a new job is posted.
+ */
+void WorkerPool::workerLoop() {
+    unsigned seen_generation = 0;
+
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_wake.wait(lock, [&] { return m_stop || m_generation != seen_generation; });
+            if (m_stop) return;
+            seen_generation = m_generation;
+        }
+        drainBands(seen_generation);
+    }
+}
@@ -0,0 +1,194 @@
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <vector>
+#include <calibration.hpp>
+
+// Lens calibration test. A checkerboard is placed at a spread of poses in
+// front of a camera of known calibration and its inner corners projected
+// through lensPixel, as a corner detector would find them. The fit starts
+// from the nominal calibration of the camera and must recover the true
+// intrinsics, exactly from clean corners and within a fraction of a pixel
+// when the corners carry detector noise. Exits nonzero on the first failed
+// check.
+//
+//   MastheadCamera_calibration_test
+
+static const int    CALIBRATION_TEST_WIDTH   = 1280;
+static const int    CALIBRATION_TEST_HEIGHT  = 720;
+static const int    CALIBRATION_TEST_COLUMNS = 9;      // Inner corners of the board.
+static const int    CALIBRATION_TEST_ROWS    = 6;
+static const double CALIBRATION_TEST_SQUARE  = 0.04;   // Square size, metres.
+static const double CALIBRATION_TEST_NOISE   = 0.2;    // Corner detector noise, pixels.
+
+// A lens with a little barrel distortion and an offset centre, away from the
+// nominal FORWARD_CAMERA_CALIBRATION the fit starts from.
+static const CameraCalibration CALIBRATION_TEST_PINHOLE = {
+    LensModel::PINHOLE, 0.78, 1.36, 0.51, 0.49, {-0.12, 0.03, 0.0, 0.0}
+};
+
+// A wide lens for the fisheye model, started from the ideal equidistant lens.
+static const CameraCalibration CALIBRATION_TEST_FISHEYE = {
+    LensModel::FISHEYE, 0.33, 0.58, 0.495, 0.505, {0.02, -0.01, 0.004, -0.001}
+};
+static const CameraCalibration CALIBRATION_TEST_FISHEYE_START = {
+    LensModel::FISHEYE, 0.3, 0.55, 0.5, 0.5, {0.0, 0.0, 0.0, 0.0}
+};
+
+static int m_failures = 0;
+
+/**
+ * @brief Count and report a failed check.
+ */
+static void check(bool ok, const char *what) {
+    if (ok) return;
+    fprintf(stderr, "FAILED: %s\n", what);
+    m_failures++;
+}
+
+/**
+ * @brief Corners of the board seen at one pose.
+ *
+ * The board is centred at distance metres along the optical axis, tilted
+ * by tilt_x and tilt_y degrees and turned by spin degrees, then shifted by
+ * (shift_x, shift_y) metres.
+ *
+ * @param noise Gaussian corner noise in pixels, 0 for none.
+ */
+static TargetView boardView(const CameraModel &camera, double distance, double tilt_x, double tilt_y, double spin,
+                            double shift_x, double shift_y, double noise, std::mt19937 &random) {
+    const double a = tilt_x * M_PI / 180.0, b = tilt_y * M_PI / 180.0, c = spin * M_PI / 180.0;
+    const double rx[3][3] = {{1, 0, 0}, {0, cos(a), -sin(a)}, {0, sin(a), cos(a)}};
+    const double ry[3][3] = {{cos(b), 0, sin(b)}, {0, 1, 0}, {-sin(b), 0, cos(b)}};
+    const double rz[3][3] = {{cos(c), -sin(c), 0}, {sin(c), cos(c), 0}, {0, 0, 1}};
+    double ryz[3][3], m[3][3];
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++) {
+            ryz[i][j] = 0.0;
+            for (int k = 0; k < 3; k++) ryz[i][j] += ry[i][k] * rz[k][j];
+        }
+    }
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++) {
+            m[i][j] = 0.0;
+            for (int k = 0; k < 3; k++) m[i][j] += rx[i][k] * ryz[k][j];
+        }
+    }
+
+    std::normal_distribution<double> detector(0.0, noise > 0.0 ? noise : 1.0);
+    const double half_x = (CALIBRATION_TEST_COLUMNS - 1) * CALIBRATION_TEST_SQUARE / 2.0;
+    const double half_y = (CALIBRATION_TEST_ROWS - 1) * CALIBRATION_TEST_SQUARE / 2.0;
+
+    TargetView view;
+    for (int row = 0; row < CALIBRATION_TEST_ROWS; row++) {
+        for (int column = 0; column < CALIBRATION_TEST_COLUMNS; column++) {
+            TargetPoint p;
+            p.x = column * CALIBRATION_TEST_SQUARE;
+            p.y = row * CALIBRATION_TEST_SQUARE;
+            double bx = p.x - half_x, by = p.y - half_y;
+            double x  = m[0][0] * bx + m[0][1] * by + shift_x;
+            double y  = m[1][0] * bx + m[1][1] * by + shift_y;
+            double z  = m[2][0] * bx + m[2][1] * by + distance;
+            lensPixel(camera, x, y, z, &p.u, &p.v);
+            if (noise > 0.0) {
+                p.u += detector(random);
+                p.v += detector(random);
+            }
+            view.points.push_back(p);
+        }
+    }
+    return view;
+}
+
+/**
+ * @brief A calibration session: the board moved around the frame and tilted.
+ */
+static std::vector<TargetView> session(const CameraCalibration &truth, double noise, unsigned seed) {
+    const CameraModel camera = makeCameraModel(truth, CALIBRATION_TEST_WIDTH, CALIBRATION_TEST_HEIGHT,
+                                               CALIBRATION_TEST_WIDTH, CALIBRATION_TEST_HEIGHT, 0, 0);
+    std::mt19937 random(seed);
+    // distance, tilt x, tilt y, spin, shift x, shift y
+    const double poses[][6] = {
+        {0.60,   0.0,   0.0,   0.0,  0.00,  0.00},
+        {0.55,  25.0,   0.0,   5.0,  0.05, -0.02},
+        {0.55, -25.0,   0.0,  -5.0, -0.05,  0.02},
+        {0.60,   0.0,  30.0,  10.0,  0.08,  0.00},
+        {0.60,   0.0, -30.0, -10.0, -0.08,  0.00},
+        {0.45,  15.0,  15.0,  20.0,  0.15,  0.06},
+        {0.45, -15.0,  15.0, -20.0, -0.15,  0.06},
+        {0.45,  15.0, -15.0,  30.0,  0.15, -0.06},
+        {0.45, -15.0, -15.0, -30.0, -0.15, -0.06},
+        {0.75,  10.0, -20.0,  45.0,  0.00,  0.10},
+        {0.75, -10.0,  20.0,  90.0,  0.00, -0.10},
+        {0.40,   5.0,   5.0,   0.0,  0.20,  0.00},
+    };
+    std::vector<TargetView> views;
+    for (const auto &pose : poses) {
+        views.push_back(boardView(camera, pose[0], pose[1], pose[2], pose[3], pose[4], pose[5], noise, random));
+    }
+    return views;
+}
+
+/**
+ * @brief Check a fit against the true calibration.
+ *
+ * @param focal  Allowed relative error of the focal lengths.
+ * @param centre Allowed error of the principal point, fraction of the frame.
+ * @param rms    Allowed reprojection error, pixels.
+ */
+static void checkFit(const char *name, const CalibrationResult &result, const CameraCalibration &truth,
+                     double focal, double centre, double rms) {
+    const CameraCalibration &fit = result.calibration;
+    printf("%s: fx %.5f fy %.5f cx %.5f cy %.5f k %.5f %.5f %.5f %.5f rms %.3f px, %d iterations\n", name,
+           fit.fx, fit.fy, fit.cx, fit.cy, fit.k[0], fit.k[1], fit.k[2], fit.k[3], result.rms_px, result.iterations);
+
+    char what[128];
+    snprintf(what, sizeof(what), "%s: fit converged", name);
+    check(result.converged, what);
+    snprintf(what, sizeof(what), "%s: focal length x", name);
+    check(std::abs(fit.fx / truth.fx - 1.0) <= focal, what);
+    snprintf(what, sizeof(what), "%s: focal length y", name);
+    check(std::abs(fit.fy / truth.fy - 1.0) <= focal, what);
+    snprintf(what, sizeof(what), "%s: principal point x", name);
+    check(std::abs(fit.cx - truth.cx) <= centre, what);
+    snprintf(what, sizeof(what), "%s: principal point y", name);
+    check(std::abs(fit.cy - truth.cy) <= centre, what);
+    snprintf(what, sizeof(what), "%s: reprojection error", name);
+    check(result.rms_px <= rms, what);
+}
+
+int main() {
+    CalibrationResult result;
+
+    // Clean corners give back the lens exactly
+    std::vector<TargetView> clean = session(CALIBRATION_TEST_PINHOLE, 0.0, 1);
+    check(calibrateCamera(clean, CALIBRATION_TEST_WIDTH, CALIBRATION_TEST_HEIGHT, FORWARD_CAMERA_CALIBRATION,
+                          &result) == 0, "pinhole: clean fit solved");
+    checkFit("pinhole clean", result, CALIBRATION_TEST_PINHOLE, 1e-6, 1e-6, 1e-4);
+    check(std::abs(result.calibration.k[0] - CALIBRATION_TEST_PINHOLE.k[0]) < 1e-5, "pinhole clean: k1");
+    check(std::abs(result.calibration.k[1] - CALIBRATION_TEST_PINHOLE.k[1]) < 1e-5, "pinhole clean: k2");
+
+    // Detector noise moves it by a fraction of a percent
+    std::vector<TargetView> noisy = session(CALIBRATION_TEST_PINHOLE, CALIBRATION_TEST_NOISE, 2);
+    check(calibrateCamera(noisy, CALIBRATION_TEST_WIDTH, CALIBRATION_TEST_HEIGHT, FORWARD_CAMERA_CALIBRATION,
+                          &result) == 0, "pinhole: noisy fit solved");
+    checkFit("pinhole noisy", result, CALIBRATION_TEST_PINHOLE, 0.005, 0.005, 1.5 * CALIBRATION_TEST_NOISE);
+
+    // The fisheye model fits its four terms the same way
+    std::vector<TargetView> fisheye = session(CALIBRATION_TEST_FISHEYE, CALIBRATION_TEST_NOISE, 3);
+    check(calibrateCamera(fisheye, CALIBRATION_TEST_WIDTH, CALIBRATION_TEST_HEIGHT, CALIBRATION_TEST_FISHEYE_START,
+                          &result) == 0, "fisheye: noisy fit solved");
+    checkFit("fisheye noisy", result, CALIBRATION_TEST_FISHEYE, 0.005, 0.005, 1.5 * CALIBRATION_TEST_NOISE);
+
+    // Too few views or corners are refused
+    std::vector<TargetView> two(clean.begin(), clean.begin() + 2);
+    check(calibrateCamera(two, CALIBRATION_TEST_WIDTH, CALIBRATION_TEST_HEIGHT, FORWARD_CAMERA_CALIBRATION,
+                          &result) == 1, "two views are refused");
+    std::vector<TargetView> sparse = clean;
+    sparse[0].points.resize(CALIBRATION_MIN_POINTS - 1);
+    check(calibrateCamera(sparse, CALIBRATION_TEST_WIDTH, CALIBRATION_TEST_HEIGHT, FORWARD_CAMERA_CALIBRATION,
+                          &result) == 1, "a view with too few corners is refused");
+
+    if (m_failures == 0) printf("calibration: all checks passed\n");
+    return m_failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,204 @@
+#include <gst/gst.h>
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <camera_capture.hpp>
+
+// Native capture test. The fake camera is captured into "appsrc ! fakesink"
+// as a camera pipeline would be, and a probe on the sink checks that:
+//   - every plane received is the fake camera's own memfd buffer, so the
+//     frame reached the sink without a copy;
+//   - while the sink holds every buffer none is with the sensor, and once
+//     they are let go the queue is back to its depth;
+//   - the frames the sensor skipped meanwhile are counted as dropped, as
+//     many as the gaps in the sequence numbers reaching the sink.
+// Exits nonzero on the first failed check.
+//
+//   MastheadCamera_camera_capture_test
+
+static const int  CAPTURE_TEST_DEPTH   = 4;
+static const int  CAPTURE_TEST_FPS     = 30;
+static const int  CAPTURE_TEST_HOLD_MS = 300;    // Time the sink holds every buffer.
+static const int  CAPTURE_TEST_WAIT_MS = 3000;   // Longest wait for a state of the capture.
+static const char CAPTURE_TEST_NAME[]  = "capture_test";
+
+// What the sink saw. Touched on the streaming thread and the test thread.
+struct SinkState {
+    std::mutex               mutex;
+    bool                     hold = false;    // Keep every buffer received.
+    std::vector<GstBuffer *> held;
+    std::vector<uintptr_t>   planes;          // Address of every plane received.
+    long                     frames = 0;
+    long                     gaps   = 0;      // Sequence numbers skipped between frames.
+    uint64_t                 last_sequence = 0;
+};
+
+static int m_failures = 0;
+
+/**
+ * @brief Count and report a failed check.
+ */
+static void check(bool ok, const char *what) {
+    if (ok) return;
+    fprintf(stderr, "FAILED: %s\n", what);
+    m_failures++;
+}
+
+/**
+ * @brief Buffer probe on the fakesink. Records the planes and sequence of each frame.
+ */
+static GstPadProbeReturn on_test_frame(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    SinkState *sink   = (SinkState *)user_data;
+    GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+
+    std::lock_guard<std::mutex> lock(sink->mutex);
+    for (guint i = 0; i < gst_buffer_n_memory(buffer); i++) {
+        GstMemory *memory = gst_buffer_peek_memory(buffer, i);
+        GstMapInfo map;
+        if (!gst_memory_map(memory, &map, GST_MAP_READ)) continue;
+        sink->planes.push_back((uintptr_t)map.data);
+        gst_memory_unmap(memory, &map);
+    }
+    // The buffer offset is the sensor sequence number
+    uint64_t sequence = GST_BUFFER_OFFSET(buffer);
+    if (sink->frames > 0 && sequence > sink->last_sequence + 1) {
+        sink->gaps += (long)(sequence - sink->last_sequence - 1);
+    }
+    sink->last_sequence = sequence;
+    sink->frames++;
+    if (sink->hold) sink->held.push_back(gst_buffer_ref(buffer));
+    return GST_PAD_PROBE_OK;
+}
+
+/**
+ * @brief Address ranges of the fake camera buffers mapped into this process.
+ */
+static std::vector<std::pair<uintptr_t, uintptr_t>> fakeCameraMappings() {
+    std::vector<std::pair<uintptr_t, uintptr_t>> ranges;
+    std::ifstream                                maps("/proc/self/maps");
+    std::string                                  line;
+    while (std::getline(maps, line)) {
+        if (line.find("memfd:masthead-fake-camera") == std::string::npos) continue;
+        unsigned long start, end;
+        if (sscanf(line.c_str(), "%lx-%lx", &start, &end) == 2) ranges.push_back({start, end});
+    }
+    return ranges;
+}
+
+/**
+ * @brief Wait until a condition on the capture holds.
+ *
+ * @return true if it held within CAPTURE_TEST_WAIT_MS.
+ */
+template <typename Condition> static bool waitFor(Condition condition) {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(CAPTURE_TEST_WAIT_MS);
+    while (std::chrono::steady_clock::now() < deadline) {
+        if (condition()) return true;
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    }
+    return condition();
+}
+
+int main(int argc, char *argv[]) {
+    gst_init(&argc, &argv);
+
+    GError     *error    = NULL;
+    GstElement *pipeline = gst_parse_launch("appsrc name=capture_test_source is-live=true format=time ! "
+                                            "fakesink name=capture_test_sink sync=false", &error);
+    if (!pipeline) {
+        fprintf(stderr, "FAILED: pipeline: %s\n", error ? error->message : "unknown error");
+        if (error) g_error_free(error);
+        return 1;
+    }
+    SinkState   sink;
+    GstElement *source   = gst_bin_get_by_name(GST_BIN(pipeline), "capture_test_source");
+    GstElement *fakesink = gst_bin_get_by_name(GST_BIN(pipeline), "capture_test_sink");
+    GstPad     *sink_pad = gst_element_get_static_pad(fakesink, "sink");
+    gst_pad_add_probe(sink_pad, GST_PAD_PROBE_TYPE_BUFFER, on_test_frame, &sink, NULL);
+    gst_object_unref(sink_pad);
+    gst_object_unref(fakesink);
+
+    const CaptureFormat format = {"NV12", 320, 240, CAPTURE_TEST_FPS, 0};
+    check(startCaptureSource(source, makeFakeBackend(), format, CAPTURE_TEST_DEPTH, CAPTURE_TEST_NAME) == 0,
+          "fake camera started");
+    gst_object_unref(source);
+    gst_element_set_state(pipeline, GST_STATE_PLAYING);
+
+    // Frames flow, each one the sensor buffer itself
+    check(waitFor([&] { std::lock_guard<std::mutex> lock(sink.mutex); return sink.frames >= 10; }),
+          "frames reach the sink");
+    const std::vector<std::pair<uintptr_t, uintptr_t>> mappings = fakeCameraMappings();
+    check(!mappings.empty(), "the fake camera buffers are mapped");
+    {
+        std::lock_guard<std::mutex> lock(sink.mutex);
+        check(sink.planes.size() == (size_t)sink.frames * 2, "NV12 frames arrive as two planes");
+        long copied = 0;
+        for (uintptr_t plane : sink.planes) {
+            bool mapped = false;
+            for (const auto &range : mappings) mapped |= plane >= range.first && plane < range.second;
+            if (!mapped) copied++;
+        }
+        check(copied == 0, "every plane received is a sensor buffer, not a copy");
+        check(sink.gaps == 0, "no frame is skipped while the sink lets go of them");
+        sink.hold = true;
+    }
+
+    // Downstream holds every buffer, so the sensor has none and skips frames
+    check(waitFor([&] {
+              std::lock_guard<std::mutex> lock(sink.mutex);
+              return sink.held.size() >= (size_t)CAPTURE_TEST_DEPTH;
+          }), "the sink holds the whole queue");
+    std::this_thread::sleep_for(std::chrono::milliseconds(CAPTURE_TEST_HOLD_MS));
+    CaptureStatus status;
+    check(captureStatus(CAPTURE_TEST_NAME, &status) == 0, "capture status while held");
+    check(status.depth == CAPTURE_TEST_DEPTH, "the queue has its depth");
+    check(status.queued == 0, "no buffer is with the sensor while the sink holds them all");
+    {
+        std::lock_guard<std::mutex> lock(sink.mutex);
+        check(sink.held.size() == (size_t)CAPTURE_TEST_DEPTH, "no frame arrives while the sink holds them all");
+    }
+
+    // Letting go of them requeues every one
+    std::vector<GstBuffer *> held;
+    {
+        std::lock_guard<std::mutex> lock(sink.mutex);
+        sink.hold = false;
+        held.swap(sink.held);
+    }
+    for (GstBuffer *buffer : held) gst_buffer_unref(buffer);
+    check(waitFor([&] {
+              return captureStatus(CAPTURE_TEST_NAME, &status) == 0 && status.queued == CAPTURE_TEST_DEPTH;
+          }), "the queue is back to its depth once the buffers are let go");
+
+    // The skipped frames show as a sequence gap and are counted as dropped
+    long frames_after;
+    {
+        std::lock_guard<std::mutex> lock(sink.mutex);
+        frames_after = sink.frames;
+    }
+    check(waitFor([&] { std::lock_guard<std::mutex> lock(sink.mutex); return sink.frames >= frames_after + 5; }),
+          "frames flow again");
+    captureStatus(CAPTURE_TEST_NAME, &status);
+    {
+        std::lock_guard<std::mutex> lock(sink.mutex);
+        const long expected = CAPTURE_TEST_HOLD_MS * CAPTURE_TEST_FPS / 1000;
+        printf("camera_capture: %ld frames, %ld dropped, %ld skipped at the sink, %d of %d queued\n", sink.frames,
+               status.dropped, sink.gaps, status.queued, status.depth);
+        check(sink.gaps >= expected / 2, "the hold skips sensor frames");
+        check(status.dropped == sink.gaps, "dropped counts the sequence gaps");
+    }
+
+    gst_element_set_state(pipeline, GST_STATE_NULL);
+    gst_object_unref(pipeline);
+    stopCaptures();
+
+    if (m_failures == 0) printf("camera_capture: all checks passed\n");
+    return m_failures == 0 ? 0 : 1;
+}
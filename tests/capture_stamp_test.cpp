@@ -0,0 +1,163 @@
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <capture_stamp.hpp>
+
+// Capture stamp test. Stamps are built with stampNal, put into access units
+// the way the encoder probe does and read back with findCaptureStamp:
+//   - times whose bytes hold 00 00 0x runs, so the NAL unit needs emulation
+//     prevention and must not carry a start code by accident;
+//   - the stamp ahead of a slice with a 4-byte start code, after the AUD,
+//     SPS, PPS and an x264 version SEI of the encoder;
+//   - the stamp after foreign SEI messages in the same NAL unit, short ones
+//     and one longer than 255 bytes;
+//   - foreign user data with no stamp, which must not be taken for one.
+// Exits nonzero on the first failed check.
+//
+//   MastheadCamera_capture_stamp_test
+
+static const uint8_t STAMP_TEST_FOREIGN_UUID[16] = {0xdc, 0x45, 0xe9, 0xbd, 0xe6, 0xd9, 0x48, 0xb7,
+                                                    0x96, 0x2c, 0xd8, 0x20, 0xd9, 0x23, 0xee, 0xef};  // x264
+
+static int m_failures = 0;
+
+/**
+ * @brief Count and report a failed check.
+ */
+static void check(bool ok, const char *what) {
+    if (ok) return;
+    fprintf(stderr, "FAILED: %s\n", what);
+    m_failures++;
+}
+
+/**
+ * @brief Append a NAL unit with a start code, escaping its RBSP.
+ *
+ * @param unit        Access unit receiving the NAL unit.
+ * @param header      NAL unit header byte.
+ * @param rbsp        Payload before emulation prevention.
+ * @param long_start  Use a 4-byte start code.
+ */
+static void appendNal(std::vector<uint8_t> &unit, uint8_t header, const std::vector<uint8_t> &rbsp, bool long_start) {
+    if (long_start) unit.push_back(0);
+    unit.insert(unit.end(), {0, 0, 1, header});
+    int zeros = 0;
+    for (uint8_t byte : rbsp) {
+        if (zeros >= 2 && byte <= 3) {
+            unit.push_back(3);
+            zeros = 0;
+        }
+        unit.push_back(byte);
+        zeros = byte == 0 ? zeros + 1 : 0;
+    }
+}
+
+/**
+ * @brief Append an SEI message to an SEI RBSP, with ff-coded type and size.
+ */
+static void appendSeiMessage(std::vector<uint8_t> &rbsp, int type, const std::vector<uint8_t> &payload) {
+    for (; type >= 255; type -= 255) rbsp.push_back(0xff);
+    rbsp.push_back((uint8_t)type);
+    size_t size = payload.size();
+    for (; size >= 255; size -= 255) rbsp.push_back(0xff);
+    rbsp.push_back((uint8_t)size);
+    rbsp.insert(rbsp.end(), payload.begin(), payload.end());
+}
+
+/**
+ * @brief User data unregistered payload, as x264 writes its version and settings.
+ */
+static std::vector<uint8_t> foreignUserData(size_t text_size) {
+    std::vector<uint8_t> payload(STAMP_TEST_FOREIGN_UUID, STAMP_TEST_FOREIGN_UUID + 16);
+    std::string          text = "x264 - core 164 - H.264/MPEG-4 AVC codec - options: cabac=0 ref=1";
+    while (text.size() < text_size) text += " deblock=1:0:0";
+    payload.insert(payload.end(), text.begin(), text.begin() + text_size);
+    payload.push_back(0);
+    return payload;
+}
+
+/**
+ * @brief Stamp payload, built independently of stampNal.
+ */
+static std::vector<uint8_t> stampPayload(const CaptureStamp &stamp) {
+    std::vector<uint8_t> payload(CAPTURE_STAMP_UUID, CAPTURE_STAMP_UUID + 16);
+    for (int64_t time : {stamp.capture_ns, stamp.encoder_in_ns, stamp.encoder_out_ns}) {
+        for (int i = 0; i < 8; i++) payload.push_back((uint8_t)((uint64_t)time >> (56 - 8 * i)));
+    }
+    return payload;
+}
+
+/**
+ * @brief Check that a stamp was found in an access unit and came back whole.
+ */
+static void checkFound(const std::vector<uint8_t> &unit, const CaptureStamp &stamp, const char *what) {
+    CaptureStamp found = {-1, -1, -1};
+    check(findCaptureStamp(unit.data(), unit.size(), &found) == 0 && found.capture_ns == stamp.capture_ns &&
+          found.encoder_in_ns == stamp.encoder_in_ns && found.encoder_out_ns == stamp.encoder_out_ns, what);
+}
+
+int main() {
+    const CaptureStamp stamps[] = {
+        {1760000000123456789, 1760000000140000000, 1760000000152000000},  // Realtime clock
+        {0, 0, 0},                                                         // All zero bytes
+        {0x0000000100000002, 0x0000000000000003, 0x0000030000000000},      // 00 00 01, 00 00 02, 00 00 03 runs
+        {0x0300000003000000, 0x0000000000000100, INT64_MAX},
+    };
+    // Ahead of the stamp in its own NAL unit: picture timing, a short and a long user data
+    std::vector<uint8_t> foreign_messages;
+    appendSeiMessage(foreign_messages, 1, {0x00, 0x00, 0x00, 0x01, 0x80});
+    appendSeiMessage(foreign_messages, 5, foreignUserData(20));
+    appendSeiMessage(foreign_messages, 5, foreignUserData(400));
+
+    for (const CaptureStamp &stamp : stamps) {
+        uint8_t nal[CAPTURE_STAMP_NAL_MAX];
+        size_t  size = stampNal(stamp, nal);
+
+        // A 4-byte start code, an SEI header, and no start code emulated inside
+        check(size <= sizeof(nal) && size > 5 && memcmp(nal, "\0\0\0\1\6", 5) == 0, "the stamp is an SEI NAL unit");
+        bool emulated = false;
+        for (size_t i = 5; i + 2 < size; i++) emulated |= nal[i] == 0 && nal[i + 1] == 0 && nal[i + 2] <= 2;
+        check(!emulated, "the stamp carries no start code");
+
+        // The NAL unit on its own
+        checkFound(std::vector<uint8_t>(nal, nal + size), stamp, "a stamp reads back");
+
+        // As the encoder probe puts it: after the parameter sets and the encoder's own SEI,
+        // ahead of the 4-byte start code of the first slice
+        std::vector<uint8_t> unit;
+        appendNal(unit, 0x09, {0xf0}, true);
+        appendNal(unit, 0x67, {0x42, 0xc0, 0x1f, 0x8c, 0x8d, 0x40}, true);
+        appendNal(unit, 0x68, {0xce, 0x3c, 0x80}, false);
+        std::vector<uint8_t> x264_sei;
+        appendSeiMessage(x264_sei, 5, foreignUserData(600));
+        x264_sei.push_back(0x80);
+        appendNal(unit, 0x06, x264_sei, false);
+        unit.insert(unit.end(), nal, nal + size);
+        appendNal(unit, 0x65, {0x88, 0x84, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x03, 0xff}, true);
+        checkFound(unit, stamp, "a stamp ahead of a slice with a 4-byte start code reads back");
+
+        // After foreign messages in the same NAL unit
+        std::vector<uint8_t> rbsp = foreign_messages;
+        appendSeiMessage(rbsp, 5, stampPayload(stamp));
+        rbsp.push_back(0x80);
+        unit.clear();
+        appendNal(unit, 0x06, rbsp, true);
+        appendNal(unit, 0x65, {0x88, 0x84, 0x21}, true);
+        checkFound(unit, stamp, "a stamp after foreign SEI messages reads back");
+    }
+
+    // Foreign user data only
+    std::vector<uint8_t> rbsp = foreign_messages;
+    rbsp.push_back(0x80);
+    std::vector<uint8_t> unit;
+    appendNal(unit, 0x06, rbsp, true);
+    appendNal(unit, 0x65, {0x88, 0x84, 0x21}, true);
+    CaptureStamp found;
+    check(findCaptureStamp(unit.data(), unit.size(), &found) != 0, "foreign user data is not a stamp");
+    check(findCaptureStamp(unit.data(), 0, &found) != 0, "an empty access unit has no stamp");
+
+    if (m_failures == 0) printf("capture_stamp: all checks passed\n");
+    return m_failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,87 @@
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <denoise.hpp>
+
+// Temporal denoise blend test. temporalBlendRow runs 16 bytes at a time with
+// NEON or SSE2 and finishes the row in scalar code. Every pair of current
+// and reference bytes is run through the vector body at each lane, and rows
+// of every length up to a few vectors at odd offsets mix the body and the
+// tail. The output must equal the scalar blend byte for byte. Exits nonzero
+// on the first failed check.
+//
+//   MastheadCamera_denoise_test
+
+static const int DENOISE_TEST_MAX_COUNT = 67;   // Longest odd row, four vectors and a tail.
+static const int DENOISE_TEST_OFFSETS   = 3;    // Start offsets tried for each row length.
+
+static int m_failures = 0;
+
+/**
+ * @brief Count and report a failed check.
+ */
+static void check(bool ok, const char *what) {
+    if (ok) return;
+    fprintf(stderr, "FAILED: %s\n", what);
+    m_failures++;
+}
+
+/**
+ * @brief Scalar blend of one byte, the formula of temporalBlendRow.
+ */
+static uint8_t blendByte(uint8_t current, uint8_t reference) {
+    const int slope  = (128 - DENOISE_STILL_WEIGHT + DENOISE_MOTION_DIFF - 1) / DENOISE_MOTION_DIFF;
+    int       diff   = current - reference;
+    int       weight = DENOISE_STILL_WEIGHT + std::abs(diff) * slope;
+    if (weight > 128) weight = 128;
+    return (uint8_t)(reference + ((diff * weight + 64) >> 7));
+}
+
+int main() {
+    // Every pair of bytes, 256 at a time so each lane of the vector body sees them all
+    std::vector<uint8_t> current(256), reference(256), out(256);
+    long                 mismatches = 0;
+    for (int ref = 0; ref < 256; ref++) {
+        for (int lane_shift = 0; lane_shift < 16; lane_shift++) {
+            for (int i = 0; i < 256; i++) {
+                current[i]   = (uint8_t)((i + lane_shift) & 0xff);
+                reference[i] = (uint8_t)ref;
+            }
+            temporalBlendRow(current.data(), reference.data(), out.data(), 256);
+            for (int i = 0; i < 256; i++) mismatches += out[i] != blendByte(current[i], reference[i]);
+        }
+    }
+    if (mismatches) fprintf(stderr, "%ld of %d bytes differ\n", mismatches, 256 * 256 * 16);
+    check(mismatches == 0, "the vector body equals the scalar blend for every pair of bytes");
+
+    // Row lengths across the vector size, at unaligned starts
+    std::vector<uint8_t> cur_row(DENOISE_TEST_MAX_COUNT + DENOISE_TEST_OFFSETS);
+    std::vector<uint8_t> ref_row(cur_row.size());
+    std::vector<uint8_t> out_row(cur_row.size());
+    for (size_t i = 0; i < cur_row.size(); i++) {
+        cur_row[i] = (uint8_t)(i * 37 + 11);
+        ref_row[i] = (uint8_t)(i * 91 + 200);
+    }
+    bool rows_match = true;
+    for (int count = 0; count <= DENOISE_TEST_MAX_COUNT; count++) {
+        for (int offset = 0; offset < DENOISE_TEST_OFFSETS; offset++) {
+            const uint8_t guard = 0xA5;
+            out_row.assign(out_row.size(), guard);
+            temporalBlendRow(cur_row.data() + offset, ref_row.data() + offset, out_row.data() + offset, count);
+            for (int i = 0; i < (int)out_row.size(); i++) {
+                bool    inside = i >= offset && i < offset + count;
+                uint8_t want   = inside ? blendByte(cur_row[i], ref_row[i]) : guard;
+                rows_match    &= out_row[i] == want;
+            }
+        }
+    }
+    check(rows_match, "rows of any length and offset equal the scalar blend and stay within the row");
+
+    // Blending a frame into itself leaves it unchanged
+    temporalBlendRow(cur_row.data(), cur_row.data(), out_row.data(), (int)cur_row.size());
+    check(out_row == cur_row, "a still pixel keeps its value");
+
+    if (m_failures == 0) printf("denoise: all checks passed\n");
+    return m_failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,130 @@
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <unistd.h>
+#include <governor.hpp>
+
+// Quality governor test. The sysfs files are faked in a temporary directory,
+// then the readings and the level steps are checked. Exits nonzero on the
+// first failed check.
+//
+//   MastheadCamera_governor_test
+
+static int m_failures = 0;
+
+/**
+ * @brief Count and report a failed check.
+ */
+static void check(bool ok, const char *what) {
+    if (ok) return;
+    fprintf(stderr, "FAILED: %s\n", what);
+    m_failures++;
+}
+
+/**
+ * @brief Replace the contents of a fake sysfs file.
+ */
+static void writeFile(const std::string &path, const char *text) {
+    FILE *file = fopen(path.c_str(), "w");
+    if (!file) {
+        perror(path.c_str());
+        exit(1);
+    }
+    fputs(text, file);
+    fclose(file);
+}
+
+/**
+ * @brief A reading as the governor loop would see it.
+ */
+static GovernorReading reading(double temperature_c, bool throttled, double latency_ratio) {
+    return {temperature_c, throttled, latency_ratio};
+}
+
+int main() {
+    char directory[] = "/tmp/governor_test_XXXXXX";
+    if (!mkdtemp(directory)) {
+        perror("mkdtemp");
+        return 1;
+    }
+    const std::string temperature = std::string(directory) + "/temp";
+    const std::string throttled   = std::string(directory) + "/get_throttled";
+    const std::string limit_freq  = std::string(directory) + "/scaling_max_freq";
+    const std::string max_freq    = std::string(directory) + "/cpuinfo_max_freq";
+    const std::string missing     = std::string(directory) + "/missing";
+
+    GovernorPaths paths = {temperature.c_str(), throttled.c_str(), limit_freq.c_str(), max_freq.c_str(), NULL};
+
+    // --- Readings ---
+    writeFile(temperature, "71500\n");
+    writeFile(throttled,   "0x0\n");
+    writeFile(limit_freq,  "1500000\n");
+    writeFile(max_freq,    "1500000\n");
+    GovernorReading r = readGovernorSensors(paths);
+    check(r.temperature_c > 71.49 && r.temperature_c < 71.51, "temperature is read in degrees");
+    check(!r.throttled,                                       "no flags is not throttled");
+    check(r.latency_ratio == 0.0,                             "sensors leave the latency at 0");
+
+    writeFile(throttled, "0x50005\n");
+    check(readGovernorSensors(paths).throttled, "the throttled flag counts");
+
+    writeFile(throttled, "0x8\n");
+    check(readGovernorSensors(paths).throttled, "the soft temperature limit counts");
+
+    writeFile(throttled, "0x50000\n");
+    check(!readGovernorSensors(paths).throttled, "throttling in the past does not count");
+
+    writeFile(throttled, "0x1\n");
+    check(!readGovernorSensors(paths).throttled, "under voltage alone does not count");
+
+    // The firmware flags win over the clock limit
+    writeFile(throttled,  "0x0\n");
+    writeFile(limit_freq, "600000\n");
+    check(!readGovernorSensors(paths).throttled, "the firmware flags are used where they exist");
+
+    // Without the firmware flags the clock limit is used
+    paths.throttled = missing.c_str();
+    check(readGovernorSensors(paths).throttled, "a lowered clock limit is throttled");
+
+    writeFile(limit_freq, "1500000\n");
+    check(!readGovernorSensors(paths).throttled, "the full clock limit is not throttled");
+
+    paths.throttled = NULL;
+    writeFile(limit_freq, "1000000\n");
+    check(readGovernorSensors(paths).throttled, "no firmware flags path falls back to the clock limit");
+
+    paths.temperature    = missing.c_str();
+    paths.cpu_limit_freq = missing.c_str();
+    r = readGovernorSensors(paths);
+    check(r.temperature_c < 0.0, "a missing temperature is unknown");
+    check(!r.throttled,          "missing files are not throttled");
+
+    // --- Level steps ---
+    check(nextGovernorLevel(0, reading(60.0, false, 0.1), 0.0, 100.0) == 0, "calm at full quality stays");
+    check(nextGovernorLevel(0, reading(GOVERNOR_HOT_C, false, 0.1), 0.0, GOVERNOR_DOWN_HOLD_S) == 1,
+          "hot steps down");
+    check(nextGovernorLevel(1, reading(GOVERNOR_HOT_C, false, 0.1), 0.0, GOVERNOR_DOWN_HOLD_S - 1) == 1,
+          "a step down waits for the last one to take effect");
+    check(nextGovernorLevel(0, reading(60.0, true, 0.1), 0.0, 100.0) == 1, "throttled steps down");
+    check(nextGovernorLevel(0, reading(60.0, false, GOVERNOR_LATENCY_BUDGET + 0.1), 0.0, 100.0) == 1,
+          "a late encoder steps down");
+    check(nextGovernorLevel(GOVERNOR_LEVELS - 1, reading(90.0, true, 2.0), 0.0, 100.0) == GOVERNOR_LEVELS - 1,
+          "the lowest level is the floor");
+    check(nextGovernorLevel(2, reading(60.0, false, 0.1), GOVERNOR_UP_HOLD_S, GOVERNOR_UP_HOLD_S) == 1,
+          "calm long enough steps up");
+    check(nextGovernorLevel(2, reading(60.0, false, 0.1), GOVERNOR_UP_HOLD_S - 1, 100.0) == 2,
+          "a step up needs the full calm time");
+    check(nextGovernorLevel(2, reading(60.0, false, 0.1), 100.0, GOVERNOR_UP_HOLD_S - 1) == 2,
+          "a step up waits after the last step");
+    check(nextGovernorLevel(2, reading((GOVERNOR_HOT_C + GOVERNOR_COOL_C) / 2, false, 0.1), 0.0, 100.0) == 2,
+          "between cool and hot the level holds");
+
+    unlink(temperature.c_str());
+    unlink(throttled.c_str());
+    unlink(limit_freq.c_str());
+    unlink(max_freq.c_str());
+    rmdir(directory);
+
+    if (m_failures == 0) printf("governor: all checks passed\n");
+    return m_failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,113 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <vector>
+#include <motion_watch.hpp>
+
+// Motion watch test. A synthetic downward view of textured water with sensor
+// noise is checked at the watch rate (every MOTION_WATCH_INTERVAL frames at
+// 30 fps), first empty, then with a dinghy crossing it, then empty again. The
+// noise and a slow change of the light must not start an event, the dinghy
+// must start one within a few checks, and the event must end
+// MOTION_WATCH_HOLD_S after the dinghy has gone. Exits nonzero on the first
+// failed check.
+//
+//   MastheadCamera_motion_watch_test
+
+static const int    MOTION_TEST_WIDTH   = 640;
+static const int    MOTION_TEST_HEIGHT  = 480;
+static const double MOTION_TEST_CHECK_S = MOTION_WATCH_INTERVAL / 30.0;  // Time between checks.
+static const double MOTION_TEST_NOISE   = 4.0;                          // Sensor noise, luma levels.
+static const int    MOTION_TEST_DINGHY  = 96;                           // Dinghy size, pixels.
+
+static int m_failures = 0;
+
+/**
+ * @brief Count and report a failed check.
+ */
+static void check(bool ok, const char *what) {
+    if (ok) return;
+    fprintf(stderr, "FAILED: %s\n", what);
+    m_failures++;
+}
+
+/**
+ * @brief Draw one luma plane of the scene.
+ *
+ * @param light    Brightness offset of the whole scene.
+ * @param dinghy_x Left edge of the dinghy, or a negative value for none.
+ */
+static void drawLuma(std::vector<uint8_t> &luma, double light, int dinghy_x, std::mt19937 *random) {
+    std::normal_distribution<double> noise(0.0, MOTION_TEST_NOISE);
+    const int top = (MOTION_TEST_HEIGHT - MOTION_TEST_DINGHY) / 2;
+    for (int y = 0; y < MOTION_TEST_HEIGHT; y++) {
+        for (int x = 0; x < MOTION_TEST_WIDTH; x++) {
+            double value = 70.0 + light + 15.0 * sin(x * 0.07) * cos(y * 0.05);
+            if (dinghy_x >= 0 && x >= dinghy_x && x < dinghy_x + MOTION_TEST_DINGHY && y >= top &&
+                y < top + MOTION_TEST_DINGHY) {
+                value = 200.0;
+            }
+            luma[(size_t)y * MOTION_TEST_WIDTH + x] = (uint8_t)std::clamp(lround(value + noise(*random)), 0L, 255L);
+        }
+    }
+}
+
+int main() {
+    std::vector<uint8_t> luma((size_t)MOTION_TEST_WIDTH * MOTION_TEST_HEIGHT);
+    std::mt19937         random(1);
+    MotionState          state;
+    double               now_s   = 0.0;
+    double               changed = 0.0;
+    int                  starts  = 0, ends = 0;
+
+    // Empty water, with the light slowly rising 20 levels over a minute
+    const int quiet_checks = (int)(60.0 / MOTION_TEST_CHECK_S);
+    for (int i = 0; i < quiet_checks; i++, now_s += MOTION_TEST_CHECK_S) {
+        drawLuma(luma, 20.0 * i / quiet_checks, -1, &random);
+        int event = checkMotion(&state, luma.data(), MOTION_TEST_WIDTH, MOTION_TEST_WIDTH, MOTION_TEST_HEIGHT, now_s,
+                                &changed);
+        if (event > 0) starts++;
+    }
+    check(starts == 0,    "noise and a slow light change do not start an event");
+    check(!state.active,  "no event is active on empty water");
+
+    // The dinghy crosses the frame at about 1 m/s, 60 pixels per check
+    int checks_to_start = -1;
+    int check_number    = 0;
+    for (int x = 0; x + MOTION_TEST_DINGHY <= MOTION_TEST_WIDTH; x += 60, check_number++, now_s += MOTION_TEST_CHECK_S) {
+        drawLuma(luma, 20.0, x, &random);
+        int event = checkMotion(&state, luma.data(), MOTION_TEST_WIDTH, MOTION_TEST_WIDTH, MOTION_TEST_HEIGHT, now_s,
+                                &changed);
+        if (event > 0 && checks_to_start < 0) checks_to_start = check_number;
+        if (event > 0) starts++;
+    }
+    check(starts == 1,                                  "the dinghy starts one event");
+    check(checks_to_start == MOTION_WATCH_CONFIRM - 1,  "the event starts once the motion is confirmed");
+    check(state.active,                                 "the event is active while the dinghy moves");
+
+    // Gone again. The event holds from the last check that saw the dinghy, then ends once
+    double gone_s = now_s - MOTION_TEST_CHECK_S, ended_s = -1.0;
+    for (int i = 0; i < (int)(3 * MOTION_WATCH_HOLD_S / MOTION_TEST_CHECK_S); i++, now_s += MOTION_TEST_CHECK_S) {
+        drawLuma(luma, 20.0, -1, &random);
+        int event = checkMotion(&state, luma.data(), MOTION_TEST_WIDTH, MOTION_TEST_WIDTH, MOTION_TEST_HEIGHT, now_s,
+                                &changed);
+        if (event < 0 && ended_s < 0.0) ended_s = now_s;
+        if (event < 0) ends++;
+        if (event > 0) starts++;
+    }
+    check(ends == 1,                                        "the event ends once");
+    check(starts == 1,                                      "the empty water does not start another event");
+    check(ended_s - gone_s > MOTION_WATCH_HOLD_S,           "the event holds for the hold time");
+    check(ended_s - gone_s <= MOTION_WATCH_HOLD_S + 1.0,    "the event ends soon after the hold time");
+
+    // A cleared state learns the next plane without an event
+    state.learned = false;
+    drawLuma(luma, 60.0, 200, &random);
+    check(checkMotion(&state, luma.data(), MOTION_TEST_WIDTH, MOTION_TEST_WIDTH, MOTION_TEST_HEIGHT, now_s,
+                      &changed) == 0, "a new background is learned without an event");
+
+    if (m_failures == 0) printf("motion watch: all checks passed\n");
+    return m_failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,89 @@
+#include <cstdio>
+#include <stream_profile.hpp>
+
+// Stream profile test. Streamids as SRT callers send them are parsed
+// against a 1080p camera: heights keep the aspect ratio, sizes come out
+// even, requests are clamped to the camera settings, the access control
+// prefix and keys of other users are skipped, and malformed streamids are
+// refused. Exits nonzero on the first failed check.
+//
+//   MastheadCamera_stream_profile_test
+
+static const StreamProfile STREAM_PROFILE_TEST_FULL = {1920, 1080, 30, 8000};
+
+static int m_failures = 0;
+
+/**
+ * @brief Count and report a failed check.
+ */
+static void check(bool ok, const char *what) {
+    if (ok) return;
+    fprintf(stderr, "FAILED: %s\n", what);
+    m_failures++;
+}
+
+/**
+ * @brief Check that a streamid parses into a profile.
+ */
+static void checkParse(const char *stream_id, int width, int height, int fps, int bitrate_kbps) {
+    StreamProfile profile;
+    char          what[160];
+    snprintf(what, sizeof(what), "\"%s\" parses", stream_id ? stream_id : "(null)");
+    check(parseStreamProfile(stream_id, STREAM_PROFILE_TEST_FULL, &profile), what);
+
+    snprintf(what, sizeof(what), "\"%s\" gives %dx%d at %d fps, %d kbps, not %dx%d at %d fps, %d kbps",
+             stream_id ? stream_id : "(null)", width, height, fps, bitrate_kbps, profile.width, profile.height,
+             profile.fps, profile.bitrate_kbps);
+    check(profile.width == width && profile.height == height && profile.fps == fps &&
+          profile.bitrate_kbps == bitrate_kbps, what);
+}
+
+/**
+ * @brief Check that a streamid is refused.
+ */
+static void checkMalformed(const char *stream_id) {
+    StreamProfile profile;
+    char          what[160];
+    snprintf(what, sizeof(what), "\"%s\" is refused", stream_id);
+    check(!parseStreamProfile(stream_id, STREAM_PROFILE_TEST_FULL, &profile), what);
+}
+
+int main() {
+    // No streamid is the full stream
+    checkParse(NULL, 1920, 1080, 30, 8000);
+    checkParse("", 1920, 1080, 30, 8000);
+
+    // A height keeps the aspect ratio, and sizes are rounded down to even
+    checkParse("res=720p", 1280, 720, 30, 8000);
+    checkParse("res=481p", 854, 480, 30, 8000);
+    checkParse("res=640x360", 640, 360, 30, 8000);
+    checkParse("res=641x361", 640, 360, 30, 8000);
+    checkParse("res=720p,fps=15,br=2000", 1280, 720, 15, 2000);
+
+    // Requests are clamped to the camera settings and the smallest stream served
+    checkParse("res=2160p", 1920, 1080, 30, 8000);
+    checkParse("res=4000x3000,fps=120,br=99999", 1920, 1080, 30, 8000);
+    checkParse("res=10p,br=1", STREAM_PROFILE_MIN_SIZE, STREAM_PROFILE_MIN_SIZE, 30, STREAM_PROFILE_MIN_KBPS);
+
+    // The SRT access control form, with keys meant for others
+    checkParse("#!::res=720p,fps=15", 1280, 720, 15, 8000);
+    checkParse("#!::u=alice,r=masthead,res=360p,m=request", 640, 360, 30, 8000);
+    checkParse("res=720p,", 1280, 720, 30, 8000);
+
+    // Anything else is refused
+    checkMalformed("res");
+    checkMalformed("720p");
+    checkMalformed("res=");
+    checkMalformed("res=abc");
+    checkMalformed("res=720");
+    checkMalformed("res=720q");
+    checkMalformed("res=640x");
+    checkMalformed("res=-5p");
+    checkMalformed("fps=0");
+    checkMalformed("fps=15x");
+    checkMalformed("br=2000,,");
+    checkMalformed("res=720p;fps=15");
+
+    if (m_failures == 0) printf("stream_profile: all checks passed\n");
+    return m_failures == 0 ? 0 : 1;
+}
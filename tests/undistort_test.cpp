@@ -0,0 +1,152 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+#include <camera_model.hpp>
+#include <undistort.hpp>
+#include <worker_pool.hpp>
+
+// Lens undistortion golden image test. A scene of straight bands is drawn
+// through a barrel distorted lens, each source pixel taking the scene value
+// at the pinhole point its ray lands on (pixelRay, the inverse of the lens
+// model). undistortNV12 must give back the golden image, the same scene
+// drawn straight at the output pixel centers, within the error of the grid
+// interpolated table and the bilinear sampling. An undistorted lens must give
+// an exact copy. Exits nonzero on the first failed check.
+//
+//   MastheadCamera_undistort_test
+
+static const int    UNDISTORT_TEST_WIDTH     = 640;
+static const int    UNDISTORT_TEST_HEIGHT    = 480;
+static const int    UNDISTORT_TEST_MAX_ERROR = 4;     // Worst pixel, in levels.
+static const double UNDISTORT_TEST_MAX_MEAN  = 0.8;   // Mean absolute error, in levels.
+
+// Forward camera field of view with a strong barrel distortion.
+static const CameraCalibration UNDISTORT_TEST_LENS = {
+    LensModel::PINHOLE,
+    0.7554, 1.3373,
+    0.5,    0.5,
+    {-0.2, 0.05, 0.0, 0.0}
+};
+
+static int m_failures = 0;
+
+/**
+ * @brief Count and report a failed check.
+ */
+static void check(bool ok, const char *what) {
+    if (ok) return;
+    fprintf(stderr, "FAILED: %s\n", what);
+    m_failures++;
+}
+
+/**
+ * @brief Scene value at a point of the ideal pinhole view, in luma pixels.
+ *
+ * Bands along both axes, which the lens bends and the stage must straighten.
+ *
+ * @param plane 0 for Y, 1 for U, 2 for V.
+ */
+static double scene(int plane, double u, double v) {
+    switch (plane) {
+    case 0:  return 128.0 + 50.0 * sin(2.0 * M_PI * u / 48.0) + 50.0 * sin(2.0 * M_PI * v / 40.0);
+    case 1:  return 128.0 + 60.0 * sin(2.0 * M_PI * u / 96.0);
+    default: return 128.0 + 60.0 * cos(2.0 * M_PI * v / 80.0);
+    }
+}
+
+/**
+ * @brief Draw the scene into an NV12 frame.
+ *
+ * @param camera Lens the scene is seen through, or NULL for the ideal view.
+ */
+static void drawFrame(const CameraModel *camera, std::vector<uint8_t> &storage, Nv12Frame *frame) {
+    const int width = UNDISTORT_TEST_WIDTH, height = UNDISTORT_TEST_HEIGHT;
+    storage.assign((size_t)width * height * 3 / 2, 0);
+    *frame = {storage.data(), storage.data() + width * height, width, height, width, width};
+
+    // Pixel centers in luma pixels, through the lens back to the ideal view
+    auto ideal = [&](double u, double v, double *iu, double *iv) {
+        *iu = u, *iv = v;
+        if (!camera) return;
+        double ray[3];
+        pixelRay(*camera, u, v, ray);
+        *iu = camera->fx * ray[0] / ray[2] + camera->cx;
+        *iv = camera->fy * ray[1] / ray[2] + camera->cy;
+    };
+
+    double iu, iv;
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            ideal(x + 0.5, y + 0.5, &iu, &iv);
+            frame->y[y * width + x] = (uint8_t)std::clamp(lround(scene(0, iu, iv)), 0L, 255L);
+        }
+    }
+    for (int y = 0; y < height / 2; y++) {
+        for (int x = 0; x < width / 2; x++) {
+            ideal((x + 0.5) * 2, (y + 0.5) * 2, &iu, &iv);
+            frame->uv[y * width + 2 * x]     = (uint8_t)std::clamp(lround(scene(1, iu, iv)), 0L, 255L);
+            frame->uv[y * width + 2 * x + 1] = (uint8_t)std::clamp(lround(scene(2, iu, iv)), 0L, 255L);
+        }
+    }
+}
+
+/**
+ * @brief Compare a frame with the golden image, over both planes.
+ */
+static void compareGolden(const std::vector<uint8_t> &frame, const std::vector<uint8_t> &golden) {
+    int    max   = 0;
+    double total = 0.0;
+    for (size_t i = 0; i < frame.size(); i++) {
+        int error = std::abs((int)frame[i] - (int)golden[i]);
+        max    = std::max(max, error);
+        total += error;
+    }
+    printf("undistort: worst error %d, mean error %.3f levels\n", max, total / frame.size());
+    check(max <= UNDISTORT_TEST_MAX_ERROR,                 "worst error against the golden image");
+    check(total / frame.size() <= UNDISTORT_TEST_MAX_MEAN, "mean error against the golden image");
+}
+
+int main() {
+    const int  width = UNDISTORT_TEST_WIDTH, height = UNDISTORT_TEST_HEIGHT;
+    WorkerPool pool(UNDISTORT_THREADS);
+
+    std::vector<uint8_t> out_storage((size_t)width * height * 3 / 2);
+    Nv12Frame out = {out_storage.data(), out_storage.data() + width * height, width, height, width, width};
+
+    // An undistorted lens is an exact copy
+    CameraCalibration pinhole = UNDISTORT_TEST_LENS;
+    pinhole.k[0] = pinhole.k[1] = 0.0;
+    CameraModel  ideal_camera = makeCameraModel(pinhole, width, height, width, height, 0, 0);
+    UndistortMap map;
+    buildUndistortMap(ideal_camera, width, height, map);
+
+    std::vector<uint8_t> straight_storage;
+    Nv12Frame            straight;
+    drawFrame(NULL, straight_storage, &straight);
+    undistortNV12(straight, out, map, pool);
+    check(out_storage == straight_storage, "an undistorted lens gives a copy");
+
+    // The distorted scene is straightened back to the golden image
+    CameraModel camera = makeCameraModel(UNDISTORT_TEST_LENS, width, height, width, height, 0, 0);
+    buildUndistortMap(camera, width, height, map);
+
+    std::vector<uint8_t> bent_storage;
+    Nv12Frame            bent;
+    drawFrame(&camera, bent_storage, &bent);
+    check(bent_storage != straight_storage, "the lens bends the scene");
+
+    undistortNV12(bent, out, map, pool);
+    compareGolden(out_storage, straight_storage);
+
+    // A moved principal point, as the region of interest window gives
+    camera = makeCameraModel(UNDISTORT_TEST_LENS, width, height, width, height, 24, -16);
+    buildUndistortMap(camera, width, height, map);
+    drawFrame(&camera, bent_storage, &bent);
+    undistortNV12(bent, out, map, pool);
+    compareGolden(out_storage, straight_storage);
+
+    if (m_failures == 0) printf("undistort: all checks passed\n");
+    return m_failures == 0 ? 0 : 1;
+}
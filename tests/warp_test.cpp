@@ -0,0 +1,159 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+#include <warp.hpp>
+#include <worker_pool.hpp>
+
+// Horizon leveling warp test. rotateNV12 is compared with a reference warp in
+// double precision, which samples each plane at the exact inverse rotation
+// with the same edge clamping. The fixed point coordinates, 7 bit weights and
+// per-lerp rounding of the fast path must stay within a few levels of it on
+// a textured frame, at the angles and zooms the stabilizer uses. Exits
+// nonzero on the first failed check.
+//
+//   MastheadCamera_warp_test
+
+static const int    WARP_TEST_WIDTH     = 320;
+static const int    WARP_TEST_HEIGHT    = 240;
+static const int    WARP_TEST_MAX_ERROR = 3;     // Worst pixel, in levels.
+static const double WARP_TEST_MAX_MEAN  = 0.6;   // Mean absolute error, in levels.
+
+static int m_failures = 0;
+
+/**
+ * @brief Count and report a failed check.
+ */
+static void check(bool ok, const char *what, double angle_deg, double zoom) {
+    if (ok) return;
+    fprintf(stderr, "FAILED: %s at %.1f degrees, zoom %.3f\n", what, angle_deg, zoom);
+    m_failures++;
+}
+
+/**
+ * @brief Fill a frame with a smooth texture, as a camera would see.
+ */
+static void fillFrame(std::vector<uint8_t> &storage, Nv12Frame *frame) {
+    const int width = WARP_TEST_WIDTH, height = WARP_TEST_HEIGHT;
+    storage.assign((size_t)width * height * 3 / 2, 0);
+    *frame = {storage.data(), storage.data() + width * height, width, height, width, width};
+
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            double value = 128.0 + 60.0 * sin(x * 0.11 + y * 0.05) + 40.0 * cos(y * 0.17 - x * 0.03);
+            frame->y[y * width + x] = (uint8_t)std::clamp(lround(value), 0L, 255L);
+        }
+    }
+    for (int y = 0; y < height / 2; y++) {
+        for (int x = 0; x < width / 2; x++) {
+            frame->uv[y * width + 2 * x]     = (uint8_t)lround(128.0 + 50.0 * sin(x * 0.13 + y * 0.07));
+            frame->uv[y * width + 2 * x + 1] = (uint8_t)lround(128.0 + 50.0 * cos(x * 0.09 - y * 0.11));
+        }
+    }
+}
+
+/**
+ * @brief Bilinear sample of one byte of a plane, in double precision.
+ *
+ * @param plane  Plane data.
+ * @param stride Bytes per row.
+ * @param step   Bytes per sample (1 for Y, 2 for UV).
+ * @param width  Samples per row.
+ * @param height Rows.
+ * @param x      Source x in samples, clamped to the plane.
+ * @param y      Source y in rows, clamped to the plane.
+ */
+static double sample(const uint8_t *plane, int stride, int step, int width, int height, double x, double y) {
+    x = std::clamp(x, 0.0, (double)(width - 1));
+    y = std::clamp(y, 0.0, (double)(height - 1));
+    int    x0 = std::min((int)x, width - 2), y0 = std::min((int)y, height - 2);
+    double fx = x - x0, fy = y - y0;
+
+    const uint8_t *row = plane + y0 * stride + x0 * step;
+    double top    = row[0]      * (1 - fx) + row[step]          * fx;
+    double bottom = row[stride] * (1 - fx) + row[stride + step] * fx;
+    return top * (1 - fy) + bottom * fy;
+}
+
+/**
+ * @brief Compare one plane of the warp with the reference.
+ *
+ * @param samples Samples per row of the plane.
+ * @param rows    Rows of the plane.
+ * @param step    Bytes per sample.
+ * @param max     Updated worst error.
+ * @param total   Updated sum of the errors.
+ * @param count   Updated number of bytes compared.
+ */
+static void comparePlane(const uint8_t *src, const uint8_t *dst, int stride, int samples, int rows, int step,
+                         double angle_rad, double zoom, int *max, double *total, long *count) {
+    const double c  = cos(angle_rad) / zoom, s = sin(angle_rad) / zoom;
+    const double cx = (samples - 1) / 2.0, cy = (rows - 1) / 2.0;
+
+    for (int y = 0; y < rows; y++) {
+        for (int x = 0; x < samples; x++) {
+            double ox = x - cx, oy = y - cy;
+            double sx = cx + c * ox + s * oy;
+            double sy = cy - s * ox + c * oy;
+            for (int b = 0; b < step; b++) {
+                double reference = sample(src + b, stride, step, samples, rows, sx, sy);
+                int    error     = (int)std::abs(lround(reference) - dst[y * stride + x * step + b]);
+                *max    = std::max(*max, error);
+                *total += error;
+                (*count)++;
+            }
+        }
+    }
+}
+
+int main() {
+    std::vector<uint8_t> src_storage, dst_storage((size_t)WARP_TEST_WIDTH * WARP_TEST_HEIGHT * 3 / 2);
+    Nv12Frame            src;
+    fillFrame(src_storage, &src);
+    Nv12Frame dst = {dst_storage.data(), dst_storage.data() + WARP_TEST_WIDTH * WARP_TEST_HEIGHT,
+                     WARP_TEST_WIDTH, WARP_TEST_HEIGHT, WARP_TEST_WIDTH, WARP_TEST_WIDTH};
+
+    WorkerPool pool(4);
+
+    // No rotation and no zoom is an exact copy
+    rotateNV12(src, dst, 0.0, 1.0, pool);
+    check(std::equal(src_storage.begin(), src_storage.end(), dst_storage.begin()), "identity warp is a copy", 0.0, 1.0);
+
+    // The angles and zooms of the stabilizer, both ways
+    const double angles[] = {-15.0, -7.3, -1.0, 0.4, 2.5, 9.9, 15.0};
+    const double zooms[]  = {1.0, 1.1, 1.35};
+    for (double angle_deg : angles) {
+        for (double zoom : zooms) {
+            const double angle_rad = angle_deg * M_PI / 180.0;
+            rotateNV12(src, dst, angle_rad, zoom, pool);
+
+            int    max   = 0;
+            double total = 0.0;
+            long   count = 0;
+            comparePlane(src.y, dst.y, WARP_TEST_WIDTH, WARP_TEST_WIDTH, WARP_TEST_HEIGHT, 1,
+                         angle_rad, zoom, &max, &total, &count);
+            check(max <= WARP_TEST_MAX_ERROR,               "luma worst error", angle_deg, zoom);
+            check(total / count <= WARP_TEST_MAX_MEAN,      "luma mean error",  angle_deg, zoom);
+
+            max = 0, total = 0.0, count = 0;
+            comparePlane(src.uv, dst.uv, WARP_TEST_WIDTH, WARP_TEST_WIDTH / 2, WARP_TEST_HEIGHT / 2, 2,
+                         angle_rad, zoom, &max, &total, &count);
+            check(max <= WARP_TEST_MAX_ERROR,               "chroma worst error", angle_deg, zoom);
+            check(total / count <= WARP_TEST_MAX_MEAN,      "chroma mean error",  angle_deg, zoom);
+        }
+    }
+
+    // A single thread gives the same frame as the pool
+    std::vector<uint8_t> single_storage(dst_storage.size());
+    Nv12Frame single = dst;
+    single.y  = single_storage.data();
+    single.uv = single_storage.data() + WARP_TEST_WIDTH * WARP_TEST_HEIGHT;
+    WorkerPool one(1);
+    rotateNV12(src, dst, 0.2, 1.2, pool);
+    rotateNV12(src, single, 0.2, 1.2, one);
+    check(single_storage == dst_storage, "thread count does not change the frame", 0.2 * 180.0 / M_PI, 1.2);
+
+    if (m_failures == 0) printf("warp: all checks passed\n");
+    return m_failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,376 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <attitude_filter.hpp>
+
+// Attitude smoothing rig. Runs each filter of attitude_filter.hpp over the
+// same trajectories, with each way of timing the filter steps, and reports,
+// for pitch and roll together:
+//   jitter_deg  - RMS of the sample to sample change of the output that is
+//                 not in the reference: the shimmer left on the ladder.
+//   error_deg   - RMS difference from the reference.
+//   latency_ms  - Delay of the reference that fits the output best, found by
+//                 searching 0 - RIG_MAX_LAG_MS in 1 ms steps.
+//   ns_per_sample - Cost of one filter step.
+// The synthetic trajectories are sampled at the 20 Hz of the sensor, with
+// mast vibration and sensor noise added to the motion of the boat, which is
+// the reference:
+//   swell - Pitch and roll swaying in a beam sea.
+//   tack  - Roll swinging across through 24 degrees every 20 s.
+//   calm  - Swell without vibration, to see the lag on clean motion.
+// The reports are read as getAttitude reads them, once per frame of the
+// RIG_POLL_HZ overlay, RIG_POLL_JITTER_MS late on average, and
+// RIG_DROP_PERCENT of them are lost. The filter steps are timed by:
+//   sequence  - The report sequence numbers, as filterAttitudeSample does.
+//   read_time - The time between the reads.
+//   fixed     - ATTITUDE_SAMPLE_PERIOD_S, whatever was lost.
+// A recording is a text file of "seconds pitch roll yaw" lines in degrees,
+// as the overlay shows them. Its reference is the recording smoothed without
+// delay by a centered RIG_REFERENCE_WINDOW_S moving average. Its lines are
+// taken as read in a row, at their times.
+//
+//   MastheadCamera_attitude_smoothing [--recording PATH]... [--duration S] [--seed N]
+//                                     [--min-cutoff HZ] [--beta B] [--rest-tau S] [--motion-rate DPS]
+//                                     [--accel-noise DPS2] [--measurement-noise DEG]
+//
+// The tuning options change the filter settings from their defaults.
+
+static const double RIG_RATE_HZ            = 1.0 / ATTITUDE_SAMPLE_PERIOD_S;
+static const double RIG_MAX_LAG_MS         = 500.0;
+static const double RIG_REFERENCE_WINDOW_S = 0.5;
+static const double RIG_DEG_TO_RAD         = M_PI / 180.0;
+static const double RIG_POLL_HZ            = 30.0;  // Reads of the sensor, one per overlay frame.
+static const double RIG_POLL_JITTER_MS     = 2.0;   // Mean lateness of a read after its frame tick.
+static const double RIG_DROP_PERCENT       = 1.0;   // Reports lost before they are read.
+
+// How the filter steps are timed.
+enum class StepTiming { SEQUENCE, READ_TIME, FIXED };
+
+static const char *STEP_TIMING_NAMES[] = {"sequence", "read_time", "fixed"};
+
+// One attitude sample. Pitch and roll in the sensor frame, before the remap of parseAndRemap.
+struct Sample {
+    double t;
+    double pitch, roll, yaw;
+    long   sequence;   // Number of the sensor report.
+    double read_t;     // When getAttitude read it.
+};
+
+// A trajectory: what the sensor reported and the motion it should have shown.
+struct Trajectory {
+    std::string         name;
+    std::vector<Sample> measured;
+    std::vector<Sample> reference;
+};
+
+// Result of one filter on one trajectory.
+struct SmoothingStats {
+    double jitter_deg;
+    double error_deg;
+    double latency_ms;
+    double ns_per_sample;
+};
+
+/**
+ * @brief Build a quaternion (x, y, z, w) from pitch, roll and yaw in degrees.
+ */
+static void eulerQuaternion(double pitch, double roll, double yaw, double q[4]) {
+    double cr = cos(roll * RIG_DEG_TO_RAD / 2),  sr = sin(roll * RIG_DEG_TO_RAD / 2);
+    double cp = cos(pitch * RIG_DEG_TO_RAD / 2), sp = sin(pitch * RIG_DEG_TO_RAD / 2);
+    double cy = cos(yaw * RIG_DEG_TO_RAD / 2),   sy = sin(yaw * RIG_DEG_TO_RAD / 2);
+    q[3] = cr * cp * cy + sr * sp * sy;
+    q[0] = sr * cp * cy - cr * sp * sy;
+    q[1] = cr * sp * cy + sr * cp * sy;
+    q[2] = cr * cp * sy - sr * sp * cy;
+}
+
+/**
+ * @brief Pitch and roll in degrees of a quaternion, as parseAndRemap works them out.
+ */
+static void quaternionEuler(const double q[4], double *pitch, double *roll) {
+    double sinp = std::clamp(2 * (q[3] * q[1] - q[2] * q[0]), -1.0, 1.0);
+    *pitch = asin(sinp) / RIG_DEG_TO_RAD;
+    *roll  = atan2(2 * (q[3] * q[0] + q[1] * q[2]), 1 - 2 * (q[0] * q[0] + q[1] * q[1])) / RIG_DEG_TO_RAD;
+}
+
+/**
+ * @brief Motion of the boat for a synthetic trajectory.
+ *
+ * The sensor sits on its side: a level boat reads 90 degrees of roll.
+ */
+static Sample boatMotion(const std::string &name, double t) {
+    Sample sample = {t, 0.0, 90.0, 0.3 * t, 0, t};
+    if (name == "tack") {
+        // Smoothstep from one tack to the other over 3 s, every 20 s
+        double phase = fmod(t, 40.0);
+        double x     = std::clamp((fmod(phase, 20.0) - 8.5) / 3.0, 0.0, 1.0);
+        double heel  = 12.0 - 24.0 * x * x * (3.0 - 2.0 * x);
+        sample.roll  += phase < 20.0 ? heel : -heel;
+        sample.pitch += 1.5 * sin(2 * M_PI * 0.15 * t);
+    } else {
+        sample.pitch += 4.0 * sin(2 * M_PI * 0.12 * t);
+        sample.roll  += 8.0 * sin(2 * M_PI * 0.08 * t + 1.0);
+    }
+    return sample;
+}
+
+/**
+ * @brief Make a synthetic trajectory.
+ *
+ * @param name    swell, tack or calm.
+ * @param seconds Length.
+ * @param seed    Noise seed.
+ * @return trajectory sampled at RIG_RATE_HZ, less the lost reports.
+ */
+static Trajectory syntheticTrajectory(const std::string &name, double seconds, unsigned seed) {
+    std::mt19937                           random(seed);
+    std::normal_distribution<double>       noise(0.0, 0.05);
+    std::exponential_distribution<double>  lateness(1000.0 / RIG_POLL_JITTER_MS);
+    std::uniform_real_distribution<double> percent(0.0, 100.0);
+    const bool                             vibration = name != "calm";
+
+    Trajectory trajectory;
+    trajectory.name = name;
+    for (long i = 0; i < (long)(seconds * RIG_RATE_HZ); i++) {
+        double t      = i / RIG_RATE_HZ;
+        Sample motion = boatMotion(name, t);
+        if (percent(random) < RIG_DROP_PERCENT) continue;
+        Sample sample   = motion;
+        sample.sequence = i;
+        // Read on the first frame tick after the report, a little late
+        sample.read_t = floor(t * RIG_POLL_HZ + 1.0) / RIG_POLL_HZ + lateness(random);
+        if (vibration) {
+            // Rigging modes, aliased by the 20 Hz sampling, and a slow beat in their strength
+            double strength = 0.75 + 0.25 * sin(2 * M_PI * 0.05 * t);
+            sample.pitch += strength * (0.6 * sin(2 * M_PI * 3.7 * t) + 0.3 * sin(2 * M_PI * 7.9 * t + 0.4));
+            sample.roll  += strength * (0.8 * sin(2 * M_PI * 4.3 * t + 1.1) + 0.3 * sin(2 * M_PI * 8.6 * t));
+        }
+        sample.pitch += noise(random);
+        sample.roll  += noise(random);
+        trajectory.measured.push_back(sample);
+        trajectory.reference.push_back(motion);
+    }
+    return trajectory;
+}
+
+/**
+ * @brief Read a recorded trajectory.
+ *
+ * @param path       Text file of "seconds pitch roll yaw" lines.
+ * @param trajectory Returned trajectory, with its zero delay reference.
+ * @return 0 for no error, 1 if the file could not be read.
+ */
+static int recordedTrajectory(const char *path, Trajectory *trajectory) {
+    std::ifstream file(path);
+    if (!file) return 1;
+
+    trajectory->name = path;
+    std::string line;
+    while (std::getline(file, line)) {
+        std::istringstream fields(line);
+        Sample             sample;
+        if (!(fields >> sample.t >> sample.pitch >> sample.roll >> sample.yaw)) continue;
+        sample.sequence = (long)trajectory->measured.size();
+        sample.read_t   = sample.t;
+        // Undo the remap of parseAndRemap
+        sample.roll = 90.0 - sample.roll;
+        sample.yaw  = sample.yaw + 90.0;
+        trajectory->measured.push_back(sample);
+    }
+    if (trajectory->measured.size() < 2) return 1;
+
+    const std::vector<Sample> &measured = trajectory->measured;
+    for (size_t i = 0; i < measured.size(); i++) {
+        Sample sum   = {measured[i].t, 0.0, 0.0, measured[i].yaw, measured[i].sequence, measured[i].read_t};
+        int    count = 0;
+        for (size_t j = 0; j < measured.size(); j++) {
+            if (fabs(measured[j].t - measured[i].t) > RIG_REFERENCE_WINDOW_S / 2) continue;
+            sum.pitch += measured[j].pitch;
+            sum.roll  += measured[j].roll;
+            count++;
+        }
+        sum.pitch /= count;
+        sum.roll  /= count;
+        trajectory->reference.push_back(sum);
+    }
+    return 0;
+}
+
+/**
+ * @brief Reference pitch and roll at a time, interpolated.
+ */
+static void referenceAt(const std::vector<Sample> &reference, double t, double *pitch, double *roll) {
+    auto after = std::lower_bound(reference.begin(), reference.end(), t,
+                                  [](const Sample &sample, double time) { return sample.t < time; });
+    if (after == reference.begin()) after++;
+    if (after == reference.end()) after--;
+    const Sample &a = *(after - 1), &b = *after;
+    double        x = (t - a.t) / (b.t - a.t);
+    *pitch = a.pitch + x * (b.pitch - a.pitch);
+    *roll  = a.roll  + x * (b.roll  - a.roll);
+}
+
+/**
+ * @brief RMS difference between an output and the reference delayed by lag_s.
+ *
+ * The first second is left out, while the filters settle and the delayed
+ * reference has no data yet.
+ */
+static double laggedError(const std::vector<Sample> &output, const std::vector<Sample> &reference, double lag_s) {
+    double sum   = 0.0;
+    long   count = 0;
+    for (const Sample &sample : output) {
+        if (sample.t - reference.front().t < 1.0) continue;
+        double pitch, roll;
+        referenceAt(reference, sample.t - lag_s, &pitch, &roll);
+        sum += (sample.pitch - pitch) * (sample.pitch - pitch) + (sample.roll - roll) * (sample.roll - roll);
+        count += 2;
+    }
+    return count > 0 ? sqrt(sum / count) : 0.0;
+}
+
+/**
+ * @brief Time of a filter step.
+ *
+ * @param i Sample to step to, after the first.
+ */
+static double stepTime(const std::vector<Sample> &measured, size_t i, StepTiming timing) {
+    if (timing == StepTiming::SEQUENCE) return (measured[i].sequence - measured[i - 1].sequence) * ATTITUDE_SAMPLE_PERIOD_S;
+    if (timing == StepTiming::READ_TIME) {
+        double dt = measured[i].read_t - measured[i - 1].read_t;
+        return dt > 0.0 ? dt : ATTITUDE_SAMPLE_PERIOD_S;
+    }
+    return ATTITUDE_SAMPLE_PERIOD_S;
+}
+
+/**
+ * @brief Run one filter over a trajectory.
+ */
+static SmoothingStats smoothTrajectory(const Trajectory &trajectory, const AttitudeFilterSettings &settings,
+                                       StepTiming timing) {
+    const std::vector<Sample> &measured = trajectory.measured;
+
+    std::vector<double> quaternions(measured.size() * 4);
+    for (size_t i = 0; i < measured.size(); i++) {
+        eulerQuaternion(measured[i].pitch, measured[i].roll, measured[i].yaw, &quaternions[i * 4]);
+    }
+
+    AttitudeFilter filter;
+    resetAttitudeFilter(&filter, settings);
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < measured.size(); i++) {
+        double dt = i > 0 ? stepTime(measured, i, timing) : ATTITUDE_SAMPLE_PERIOD_S;
+        stepAttitudeFilter(&filter, &quaternions[i * 4], dt);
+    }
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+    std::vector<Sample> output(measured.size());
+    for (size_t i = 0; i < measured.size(); i++) {
+        output[i].t = measured[i].t;
+        quaternionEuler(&quaternions[i * 4], &output[i].pitch, &output[i].roll);
+    }
+
+    SmoothingStats stats = {};
+    stats.ns_per_sample = ns / measured.size();
+    stats.error_deg     = laggedError(output, trajectory.reference, 0.0);
+
+    double best = stats.error_deg;
+    for (double lag_ms = 1.0; lag_ms <= RIG_MAX_LAG_MS; lag_ms += 1.0) {
+        double error = laggedError(output, trajectory.reference, lag_ms / 1000.0);
+        if (error < best) {
+            best             = error;
+            stats.latency_ms = lag_ms;
+        }
+    }
+
+    double sum   = 0.0;
+    long   count = 0;
+    for (size_t i = 1; i < output.size(); i++) {
+        if (output[i].t - output.front().t < 1.0) continue;
+        double pitch0, roll0, pitch1, roll1;
+        referenceAt(trajectory.reference, output[i - 1].t, &pitch0, &roll0);
+        referenceAt(trajectory.reference, output[i].t,     &pitch1, &roll1);
+        double pitch_jitter = (output[i].pitch - output[i - 1].pitch) - (pitch1 - pitch0);
+        double roll_jitter  = (output[i].roll  - output[i - 1].roll)  - (roll1  - roll0);
+        sum   += pitch_jitter * pitch_jitter + roll_jitter * roll_jitter;
+        count += 2;
+    }
+    stats.jitter_deg = count > 0 ? sqrt(sum / count) : 0.0;
+    return stats;
+}
+
+int main(int argc, char *argv[]) {
+    AttitudeFilterSettings   tuning     = defaultAttitudeFilterSettings();
+    double                   seconds    = 120.0;
+    unsigned                 seed       = 1;
+    std::vector<const char *> recordings;
+
+    for (int i = 1; i < argc; i++) {
+        const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+        if      (strcmp(argv[i], "--recording") == 0 && value)         recordings.push_back(argv[++i]);
+        else if (strcmp(argv[i], "--duration") == 0 && value)          seconds                      = atof(argv[++i]);
+        else if (strcmp(argv[i], "--seed") == 0 && value)              seed                         = (unsigned)atoi(argv[++i]);
+        else if (strcmp(argv[i], "--min-cutoff") == 0 && value)        tuning.min_cutoff_hz         = atof(argv[++i]);
+        else if (strcmp(argv[i], "--beta") == 0 && value)              tuning.beta                  = atof(argv[++i]);
+        else if (strcmp(argv[i], "--rest-tau") == 0 && value)          tuning.rest_time_constant_s  = atof(argv[++i]);
+        else if (strcmp(argv[i], "--motion-rate") == 0 && value)       tuning.motion_rate_dps       = atof(argv[++i]);
+        else if (strcmp(argv[i], "--accel-noise") == 0 && value)       tuning.accel_noise_dps2      = atof(argv[++i]);
+        else if (strcmp(argv[i], "--measurement-noise") == 0 && value) tuning.measurement_noise_deg = atof(argv[++i]);
+        else {
+            fprintf(stderr, "Usage: %s [--recording PATH]... [--duration S] [--seed N] [--min-cutoff HZ] [--beta B] "
+                            "[--rest-tau S] [--motion-rate DPS] [--accel-noise DPS2] [--measurement-noise DEG]\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+    if (seconds < 5.0) seconds = 5.0;
+
+    std::vector<Trajectory> trajectories;
+    for (const char *name : {"swell", "tack", "calm"}) trajectories.push_back(syntheticTrajectory(name, seconds, seed));
+    int status = 0;
+    for (const char *path : recordings) {
+        Trajectory trajectory;
+        if (recordedTrajectory(path, &trajectory) != 0) {
+            fprintf(stderr, "Could not read the recording %s\n", path);
+            status = 1;
+            continue;
+        }
+        trajectories.push_back(trajectory);
+    }
+
+    const AttitudeFilterType types[]   = {AttitudeFilterType::NONE, AttitudeFilterType::ONE_EURO,
+                                          AttitudeFilterType::COMPLEMENTARY, AttitudeFilterType::KALMAN};
+    const StepTiming         timings[] = {StepTiming::SEQUENCE, StepTiming::READ_TIME, StepTiming::FIXED};
+
+    printf("{\n  \"settings\": %s,\n  \"poll_hz\": %.0f, \"poll_jitter_ms\": %.1f, \"drop_percent\": %.1f,\n"
+           "  \"trajectories\": [\n", attitudeFilterJson(tuning).c_str(), RIG_POLL_HZ, RIG_POLL_JITTER_MS,
+           RIG_DROP_PERCENT);
+    for (size_t t = 0; t < trajectories.size(); t++) {
+        printf("    {\"name\": \"%s\", \"samples\": %zu, \"steps\": [\n", trajectories[t].name.c_str(),
+               trajectories[t].measured.size());
+        for (size_t s = 0; s < std::size(timings); s++) {
+            printf("      {\"timing\": \"%s\", \"filters\": [\n", STEP_TIMING_NAMES[(int)timings[s]]);
+            for (size_t f = 0; f < std::size(types); f++) {
+                AttitudeFilterSettings settings = tuning;
+                settings.type = types[f];
+                SmoothingStats stats = smoothTrajectory(trajectories[t], settings, timings[s]);
+                printf("        {\"filter\": \"%s\", \"jitter_deg\": %.4f, \"error_deg\": %.4f, "
+                       "\"latency_ms\": %.0f, \"ns_per_sample\": %.1f}%s\n", attitudeFilterName(types[f]),
+                       stats.jitter_deg, stats.error_deg, stats.latency_ms, stats.ns_per_sample,
+                       f + 1 < std::size(types) ? "," : "");
+            }
+            printf("      ]}%s\n", s + 1 < std::size(timings) ? "," : "");
+        }
+        printf("    ]}%s\n", t + 1 < trajectories.size() ? "," : "");
+    }
+    printf("  ]\n}\n");
+    return status;
+}
@@ -0,0 +1,96 @@
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <calibration.hpp>
+
+// Lens calibration from a corner file. Each line is "view x y u v": the
+// number of the frame, the corner on the target in metres and where the
+// corner detector found it in pixels. The fit starts from the forward camera
+// calibration, or from an ideal equidistant lens of the same field of view
+// with --fisheye, and prints the result as a CameraCalibration in fractions
+// of the frame, ready for camera_model.hpp.
+//
+//   MastheadCamera_calibrate [--width W] [--height H] [--fisheye] CORNERS
+
+/**
+ * @brief Read a corner file.
+ *
+ * @param path  Text file of "view x y u v" lines.
+ * @param views Returned corners, one view per view number.
+ * @return 0 for no error, 1 if the file could not be read.
+ */
+static int readCorners(const char *path, std::vector<TargetView> *views) {
+    std::ifstream file(path);
+    if (!file) return 1;
+
+    std::map<int, TargetView> numbered;
+    std::string               line;
+    while (std::getline(file, line)) {
+        std::istringstream fields(line);
+        int                view;
+        TargetPoint        point;
+        if (!(fields >> view >> point.x >> point.y >> point.u >> point.v)) continue;
+        numbered[view].points.push_back(point);
+    }
+    for (auto &entry : numbered) views->push_back(entry.second);
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    int         width   = 1280;
+    int         height  = 720;
+    bool        fisheye = false;
+    const char *path    = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+        if      (strcmp(argv[i], "--width") == 0 && value)  width   = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--height") == 0 && value) height  = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--fisheye") == 0)         fisheye = true;
+        else if (argv[i][0] != '-' && !path)                path    = argv[i];
+        else {
+            fprintf(stderr, "Usage: %s [--width W] [--height H] [--fisheye] CORNERS\n", argv[0]);
+            return 1;
+        }
+    }
+    if (!path || width <= 0 || height <= 0) {
+        fprintf(stderr, "Usage: %s [--width W] [--height H] [--fisheye] CORNERS\n", argv[0]);
+        return 1;
+    }
+
+    std::vector<TargetView> views;
+    if (readCorners(path, &views) != 0) {
+        fprintf(stderr, "Could not read the corners %s\n", path);
+        return 1;
+    }
+
+    // An equidistant lens has a focal length of the angle, not its tangent
+    CameraCalibration initial = FORWARD_CAMERA_CALIBRATION;
+    if (fisheye) {
+        initial.model = LensModel::FISHEYE;
+        initial.fx    = 0.5 / (67.0 / 2.0 * M_PI / 180.0);
+        initial.fy    = 0.5 / (41.0 / 2.0 * M_PI / 180.0);
+    }
+
+    CalibrationResult result;
+    if (calibrateCamera(views, width, height, initial, &result) != 0) {
+        fprintf(stderr, "Could not fit %zu views: at least %d views of %d corners are needed\n", views.size(),
+                CALIBRATION_MIN_VIEWS, CALIBRATION_MIN_POINTS);
+        return 1;
+    }
+
+    const CameraCalibration &c = result.calibration;
+    printf("{\n  \"model\": \"%s\", \"width\": %d, \"height\": %d, \"views\": %zu,\n",
+           c.model == LensModel::PINHOLE ? "pinhole" : "fisheye", width, height, views.size());
+    printf("  \"fx\": %.6f, \"fy\": %.6f, \"cx\": %.6f, \"cy\": %.6f,\n", c.fx, c.fy, c.cx, c.cy);
+    printf("  \"k\": [%.6f, %.6f, %.6f, %.6f],\n", c.k[0], c.k[1], c.k[2], c.k[3]);
+    printf("  \"rms_px\": %.4f, \"iterations\": %d, \"converged\": %s\n}\n", result.rms_px, result.iterations,
+           result.converged ? "true" : "false");
+    return 0;
+}
@@ -0,0 +1,242 @@
+#include <gst/gst.h>
+#include <gst/video/video.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <camera_capture.hpp>
+#include <camera_config.hpp>
+
+// Capture benchmark. Runs the capture end of a camera pipeline, the source
+// and its leaky queue, with libcamerasrc and then with native capture (see
+// camera_capture.hpp), and prints one JSON document. A tap after the queue
+// maps each frame for reading, as the processing stages do, and measures:
+//   copies_per_frame - Frames whose memory is not the memory the source
+//                      pushed, so something copied them on the way.
+//   map_us           - Time to map a frame. Sensor memory that is not kept
+//                      mapped is mapped again for every frame.
+//   latency_ms       - Running time at the tap minus the buffer PTS, which
+//                      both sources set from the sensor timestamp.
+//
+//   MastheadCamera_capture_bench [--camera NAME] [--format NV12|BGRx] [--width W] [--height H]
+//                                [--fps N] [--depth N] [--duration S] [--fake]
+//
+// --fake runs native capture from the fake camera only, for use off the boat.
+
+// What the tap saw during one run.
+struct BenchStats {
+    std::mutex                     mutex;
+    std::map<GstClockTime, void *> pushed;      // Memory pushed by the source, by PTS.
+    long                           frames = 0;
+    long                           copies = 0;
+    std::vector<double>            map_us;
+    std::vector<double>            latency_ms;
+    GstClockTime                   first = GST_CLOCK_TIME_NONE, last = GST_CLOCK_TIME_NONE;
+};
+
+// Benchmark settings.
+struct BenchOptions {
+    std::string camera;
+    std::string format;
+    int         width;
+    int         height;
+    int         fps;
+    int         depth;
+    int         seconds;
+    bool        fake;
+};
+
+static GstPadProbeReturn on_bench_pushed(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    BenchStats *stats  = (BenchStats *)user_data;
+    GstBuffer  *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+    std::lock_guard<std::mutex> lock(stats->mutex);
+    stats->pushed[GST_BUFFER_PTS(buffer)] = gst_buffer_peek_memory(buffer, 0);
+    // Frames dropped by the leaky queue never reach the tap
+    while (stats->pushed.size() > 64) stats->pushed.erase(stats->pushed.begin());
+    return GST_PAD_PROBE_OK;
+}
+
+static GstPadProbeReturn on_bench_tap(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    BenchStats *stats  = (BenchStats *)user_data;
+    GstBuffer  *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+
+    GstClockTime running = GST_CLOCK_TIME_NONE;
+    GstElement  *element = GST_ELEMENT(gst_pad_get_parent(pad));
+    GstClock    *clock   = element ? gst_element_get_clock(element) : NULL;
+    if (clock) {
+        running = gst_clock_get_time(clock) - gst_element_get_base_time(element);
+        gst_object_unref(clock);
+    }
+    if (element) gst_object_unref(element);
+
+    GstVideoInfo video_info;
+    GstCaps     *caps = gst_pad_get_current_caps(pad);
+    const bool   have_info = caps && gst_video_info_from_caps(&video_info, caps);
+    if (caps) gst_caps_unref(caps);
+
+    double map_us = -1.0;
+    if (have_info) {
+        GstVideoFrame frame;
+        auto start = std::chrono::steady_clock::now();
+        if (gst_video_frame_map(&frame, &video_info, buffer, GST_MAP_READ)) {
+            map_us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+            gst_video_frame_unmap(&frame);
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(stats->mutex);
+    stats->frames++;
+    auto pushed = stats->pushed.find(GST_BUFFER_PTS(buffer));
+    if (pushed == stats->pushed.end() || pushed->second != gst_buffer_peek_memory(buffer, 0)) stats->copies++;
+    if (map_us >= 0.0) stats->map_us.push_back(map_us);
+    if (GST_CLOCK_TIME_IS_VALID(running) && GST_BUFFER_PTS_IS_VALID(buffer) && running >= GST_BUFFER_PTS(buffer)) {
+        stats->latency_ms.push_back((running - GST_BUFFER_PTS(buffer)) / 1e6);
+    }
+    if (!GST_CLOCK_TIME_IS_VALID(stats->first)) stats->first = GST_BUFFER_PTS(buffer);
+    stats->last = GST_BUFFER_PTS(buffer);
+    return GST_PAD_PROBE_OK;
+}
+
+static double percentile(std::vector<double> values, double p) {
+    if (values.empty()) return -1.0;
+    std::sort(values.begin(), values.end());
+    size_t index = (size_t)std::ceil(p / 100.0 * values.size());
+    return values[std::clamp<size_t>(index, 1, values.size()) - 1];
+}
+
+/**
+ * @brief Run one source for the duration.
+ *
+ * @param native  Native capture instead of libcamerasrc.
+ * @param options Benchmark settings.
+ * @param stats   What the tap saw, written.
+ * @param dropped Frames the sensor dropped, -1 where the source does not say.
+ * @return error - 0 for no error, 1 if the pipeline failed.
+ */
+static int runSource(bool native, const BenchOptions &options, BenchStats *stats, long *dropped) {
+    const std::string source = native ?
+        "appsrc name=bench_source is-live=true format=time max-buffers=1 leaky-type=downstream ! " :
+        "libcamerasrc name=bench_source camera-name=\"" + options.camera + "\" ! ";
+    const std::string description = source +
+        "video/x-raw,format=" + options.format + ",width=" + std::to_string(options.width) +
+        ",height=" + std::to_string(options.height) + ",framerate=" + std::to_string(options.fps) + "/1 ! "
+        "queue max-size-buffers=1 leaky=downstream ! identity name=bench_tap ! fakesink sync=false";
+
+    GError     *error    = NULL;
+    GstElement *pipeline = gst_parse_launch(description.c_str(), &error);
+    if (!pipeline) {
+        fprintf(stderr, "Could not create the pipeline: %s\n", error ? error->message : "unknown error");
+        if (error) g_error_free(error);
+        return 1;
+    }
+    GstElement *element = gst_bin_get_by_name(GST_BIN(pipeline), "bench_source");
+    GstPad     *pad     = gst_element_get_static_pad(element, "src");
+    gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, on_bench_pushed, stats, NULL);
+    gst_object_unref(pad);
+
+    int status = 0;
+    if (native) {
+        const CaptureFormat format = {options.format, options.width, options.height, options.fps, 0};
+        status = startCaptureSource(element, options.fake ? makeFakeBackend() : makeLibcameraBackend(options.camera),
+                                    format, options.depth, "bench");
+    }
+    gst_object_unref(element);
+
+    element = gst_bin_get_by_name(GST_BIN(pipeline), "bench_tap");
+    pad     = gst_element_get_static_pad(element, "src");
+    gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, on_bench_tap, stats, NULL);
+    gst_object_unref(pad);
+    gst_object_unref(element);
+
+    if (status == 0 && gst_element_set_state(pipeline, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE) status = 1;
+    if (status == 0) {
+        GstBus     *bus     = gst_element_get_bus(pipeline);
+        GstMessage *message = gst_bus_timed_pop_filtered(bus, (GstClockTime)options.seconds * GST_SECOND,
+                                                         (GstMessageType)(GST_MESSAGE_ERROR | GST_MESSAGE_EOS));
+        if (message) {
+            fprintf(stderr, "The %s pipeline stopped early\n", native ? "native" : "libcamerasrc");
+            gst_message_unref(message);
+            status = 1;
+        }
+        gst_object_unref(bus);
+    }
+
+    // The sensor is stopped after the pipeline, once every frame is back with it
+    *dropped = -1;
+    CaptureStatus capture;
+    if (native && captureStatus("bench", &capture) == 0) *dropped = capture.dropped;
+    gst_element_set_state(pipeline, GST_STATE_NULL);
+    gst_object_unref(pipeline);
+    if (native) stopCaptures();
+    return status;
+}
+
+int main(int argc, char *argv[]) {
+    const CameraConfig forward = defaultCameraConfig()[0];
+    BenchOptions options = {forward.sensor, "NV12", forward.width, forward.height, forward.fps,
+                            CAPTURE_DEFAULT_DEPTH, 10, false};
+
+    for (int i = 1; i < argc; i++) {
+        const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+        if      (strcmp(argv[i], "--camera") == 0 && value)   options.camera  = argv[++i];
+        else if (strcmp(argv[i], "--format") == 0 && value)   options.format  = argv[++i];
+        else if (strcmp(argv[i], "--width") == 0 && value)    options.width   = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--height") == 0 && value)   options.height  = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--fps") == 0 && value)      options.fps     = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--depth") == 0 && value)    options.depth   = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--duration") == 0 && value) options.seconds = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--fake") == 0)              options.fake    = true;
+        else {
+            fprintf(stderr, "Usage: %s [--camera NAME] [--format NV12|BGRx] [--width W] [--height H] "
+                            "[--fps N] [--depth N] [--duration S] [--fake]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (options.format != "NV12" && options.format != "BGRx") {
+        fprintf(stderr, "The format must be NV12 or BGRx\n");
+        return 1;
+    }
+    options.fps     = std::max(options.fps, 1);
+    options.depth   = std::clamp(options.depth, 2, 16);
+    options.seconds = std::max(options.seconds, 1);
+
+    gst_init(&argc, &argv);
+
+    printf("{\n  \"camera\": \"%s\", \"format\": \"%s\", \"width\": %d, \"height\": %d, \"fps\": %d, "
+           "\"depth\": %d, \"duration_s\": %d,\n  \"runs\": [\n",
+           options.fake ? CAPTURE_FAKE_SENSOR : options.camera.c_str(), options.format.c_str(), options.width,
+           options.height, options.fps, options.depth, options.seconds);
+    // libcamerasrc first: it holds its own camera manager, which has to be gone before native capture makes one
+    int  status = 0;
+    bool first  = true;
+    for (bool native : {false, true}) {
+        if (!native && options.fake) continue;
+        BenchStats stats;
+        long       dropped;
+        if (runSource(native, options, &stats, &dropped) != 0) {
+            fprintf(stderr, "Run with %s failed\n", native ? "native capture" : "libcamerasrc");
+            status = 1;
+            continue;
+        }
+        const double seconds = stats.frames > 1 ? (stats.last - stats.first) / 1e9 : 0.0;
+        printf("%s    {\"source\": \"%s\", \"frames\": %ld, \"fps\": %.2f, \"dropped\": %ld, "
+               "\"copies_per_frame\": %.3f, \"map_us\": {\"p50\": %.1f, \"p99\": %.1f}, "
+               "\"latency_ms\": {\"p50\": %.2f, \"p90\": %.2f, \"p99\": %.2f}}",
+               first ? "" : ",\n", native ? "native" : "libcamerasrc", stats.frames,
+               seconds > 0 ? (stats.frames - 1) / seconds : 0.0, dropped,
+               stats.frames ? (double)stats.copies / stats.frames : 0.0,
+               percentile(stats.map_us, 50), percentile(stats.map_us, 99),
+               percentile(stats.latency_ms, 50), percentile(stats.latency_ms, 90), percentile(stats.latency_ms, 99));
+        fflush(stdout);
+        first = false;
+    }
+    printf("\n  ]\n}\n");
+    return status;
+}
@@ -0,0 +1,227 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <vector>
+#include <x264.h>
+#include <denoise.hpp>
+
+// Bitrate saved by the temporal denoise (see denoise.hpp) on a synthetic
+// downward camera sequence. The frames are textured water drifting past a
+// hull edge, with Gaussian sensor noise on every pixel. The sequence is
+// encoded by libx264 with the settings of the camera pipelines, once as it
+// is and once through the denoise blend, at a constant rate factor so the
+// noise the encoder no longer spends bits on shows up as bitrate. The luma
+// PSNR of the encoder input against the noise free frames is reported too,
+// for how much of the noise the blend removed. One JSON document is printed.
+//
+//   MastheadCamera_denoise_bitrate [--width W] [--height H] [--frames N] [--crf N] [--noise SIGMA]...
+//
+// --noise can be repeated. Without it DENOISE_BITRATE_NOISE levels are run.
+
+static const int    DENOISE_BITRATE_FPS     = 30;
+static const double DENOISE_BITRATE_NOISE[] = {2.0, 4.0, 8.0};   // Sensor noise, luma levels.
+static const double DENOISE_BITRATE_DRIFT   = 1.5;               // Water drift, pixels per frame.
+
+// Result of one encode of the sequence.
+struct BitrateRun {
+    long   bytes         = 0;
+    double squared_error = 0.0;   // Encoder input against the clean frames.
+    long   pixels        = 0;
+};
+
+/**
+ * @brief Hash of a lattice point, in [0, 1).
+ */
+static double latticeValue(int x, int y) {
+    uint32_t h = (uint32_t)x * 374761393u + (uint32_t)y * 668265263u;
+    h = (h ^ (h >> 13)) * 1274126177u;
+    return ((h ^ (h >> 16)) & 0xffff) / 65536.0;
+}
+
+/**
+ * @brief Smooth value noise, in [0, 1).
+ */
+static double valueNoise(double x, double y) {
+    const double fx = floor(x), fy = floor(y);
+    const int    ix = (int)fx, iy = (int)fy;
+    const double sx = (x - fx) * (x - fx) * (3 - 2 * (x - fx));
+    const double sy = (y - fy) * (y - fy) * (3 - 2 * (y - fy));
+    const double top    = latticeValue(ix, iy)     + sx * (latticeValue(ix + 1, iy)     - latticeValue(ix, iy));
+    const double bottom = latticeValue(ix, iy + 1) + sx * (latticeValue(ix + 1, iy + 1) - latticeValue(ix, iy + 1));
+    return top + sy * (bottom - top);
+}
+
+/**
+ * @brief Draw the clean NV12 frame of a frame number.
+ *
+ * The hull covers the left fifth of the frame, the water drifts down past it.
+ */
+static void cleanFrame(long number, int width, int height, uint8_t *luma, uint8_t *chroma) {
+    const double drift = number * DENOISE_BITRATE_DRIFT;
+    const int    hull  = width / 5;
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            double value = x < hull ? 180.0 + 10.0 * valueNoise(x / 64.0, y / 64.0) :
+                60.0 + 50.0 * valueNoise(x / 48.0, (y - drift) / 24.0) + 20.0 * valueNoise(x / 9.0, (y - drift) / 6.0);
+            luma[(size_t)y * width + x] = (uint8_t)std::clamp(lround(value), 16L, 235L);
+        }
+    }
+    for (int y = 0; y < height / 2; y++) {
+        for (int x = 0; x < width / 2; x++) {
+            bool hull_side = x * 2 < hull;
+            chroma[(size_t)y * width + 2 * x]     = hull_side ? 128 : 140;   // U, the water is blue green.
+            chroma[(size_t)y * width + 2 * x + 1] = hull_side ? 128 : 110;   // V
+        }
+    }
+}
+
+/**
+ * @brief Add Gaussian sensor noise to a plane.
+ */
+static void addNoise(const uint8_t *clean, uint8_t *noisy, size_t count, double sigma, std::mt19937 *random) {
+    std::normal_distribution<double> noise(0.0, sigma);
+    for (size_t i = 0; i < count; i++) noisy[i] = (uint8_t)std::clamp(lround(clean[i] + noise(*random)), 0L, 255L);
+}
+
+/**
+ * @brief Encode the sequence at one noise level.
+ *
+ * @param denoise Pass the frames through the denoise blend first.
+ * @return error - 0 for no error, 1 if libx264 could not be opened.
+ */
+static int runSequence(bool denoise, double sigma, int crf, int width, int height, long frames, BitrateRun *run) {
+    x264_param_t param;
+    x264_param_default_preset(&param, "ultrafast", "zerolatency");
+    param.i_width          = width;
+    param.i_height         = height;
+    param.i_csp            = X264_CSP_NV12;
+    param.i_fps_num        = DENOISE_BITRATE_FPS;
+    param.i_fps_den        = 1;
+    param.i_keyint_max     = DENOISE_BITRATE_FPS;
+    param.i_threads        = 4;
+    param.i_log_level      = X264_LOG_WARNING;
+    param.rc.i_rc_method   = X264_RC_CRF;
+    param.rc.f_rf_constant = (float)crf;
+    x264_param_apply_profile(&param, "baseline");
+    x264_t *encoder = x264_encoder_open(&param);
+    if (!encoder) return 1;
+
+    const size_t         luma_size   = (size_t)width * height;
+    const size_t         chroma_size = luma_size / 2;
+    std::vector<uint8_t> clean(luma_size + chroma_size), noisy(clean.size()), reference(clean.size()),
+                         out(clean.size());
+    std::mt19937         random(1);
+
+    *run = {};
+    for (long number = 0; number < frames; number++) {
+        cleanFrame(number, width, height, clean.data(), clean.data() + luma_size);
+        addNoise(clean.data(), noisy.data(), clean.size(), sigma, &random);
+
+        // The same blend as the pipeline stage, row by row, with the output as the next reference
+        const uint8_t *input = noisy.data();
+        if (denoise) {
+            if (number == 0) {
+                out = noisy;
+            } else {
+                for (int row = 0; row < height * 3 / 2; row++) {
+                    temporalBlendRow(noisy.data() + (size_t)row * width, reference.data() + (size_t)row * width,
+                                     out.data() + (size_t)row * width, width);
+                }
+            }
+            reference = out;
+            input     = out.data();
+        }
+        for (size_t i = 0; i < luma_size; i++) {
+            double error = (double)input[i] - clean[i];
+            run->squared_error += error * error;
+        }
+        run->pixels += luma_size;
+
+        x264_picture_t picture, encoded;
+        x264_picture_init(&picture);
+        picture.img.i_csp       = X264_CSP_NV12;
+        picture.img.i_plane     = 2;
+        picture.img.plane[0]    = (uint8_t *)input;
+        picture.img.plane[1]    = (uint8_t *)input + luma_size;
+        picture.img.i_stride[0] = width;
+        picture.img.i_stride[1] = width;
+        picture.i_pts           = number;
+
+        x264_nal_t *nals;
+        int         nal_count;
+        int         size = x264_encoder_encode(encoder, &nals, &nal_count, &picture, &encoded);
+        if (size > 0) run->bytes += size;
+    }
+    while (x264_encoder_delayed_frames(encoder) > 0) {
+        x264_nal_t    *nals;
+        int            nal_count;
+        x264_picture_t encoded;
+        int            size = x264_encoder_encode(encoder, &nals, &nal_count, NULL, &encoded);
+        if (size <= 0) break;
+        run->bytes += size;
+    }
+    x264_encoder_close(encoder);
+    return 0;
+}
+
+/**
+ * @brief Print one run as JSON.
+ */
+static void printRun(const BitrateRun &run, long frames) {
+    double mse = run.pixels > 0 ? run.squared_error / run.pixels : 0.0;
+    printf("{\"kbps\": %.0f, \"input_psnr_db\": %.2f}", run.bytes * 8.0 * DENOISE_BITRATE_FPS / frames / 1000.0,
+           mse > 0.0 ? 10.0 * log10(255.0 * 255.0 / mse) : 99.0);
+}
+
+int main(int argc, char *argv[]) {
+    int                 width  = 1280;
+    int                 height = 720;
+    long                frames = 10 * DENOISE_BITRATE_FPS;
+    int                 crf    = 23;
+    std::vector<double> levels;
+
+    for (int i = 1; i < argc; i++) {
+        const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+        if      (strcmp(argv[i], "--width") == 0 && value)  width  = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--height") == 0 && value) height = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--frames") == 0 && value) frames = atol(argv[++i]);
+        else if (strcmp(argv[i], "--crf") == 0 && value)    crf    = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--noise") == 0 && value)  levels.push_back(atof(argv[++i]));
+        else {
+            fprintf(stderr, "Usage: %s [--width W] [--height H] [--frames N] [--crf N] [--noise SIGMA]...\n", argv[0]);
+            return 1;
+        }
+    }
+    if (levels.empty()) levels.assign(std::begin(DENOISE_BITRATE_NOISE), std::end(DENOISE_BITRATE_NOISE));
+    if (width < 16 || height < 16 || width % 2 || height % 2 || frames < 1) {
+        fprintf(stderr, "The frame size must be even and at least 16 x 16, with at least one frame\n");
+        return 1;
+    }
+
+    printf("{\n  \"width\": %d, \"height\": %d, \"frames\": %ld, \"crf\": %d,\n  \"runs\": [\n",
+           width, height, frames, crf);
+    int status = 0;
+    for (size_t i = 0; i < levels.size(); i++) {
+        BitrateRun plain, denoised;
+        if (runSequence(false, levels[i], crf, width, height, frames, &plain) != 0 ||
+            runSequence(true, levels[i], crf, width, height, frames, &denoised) != 0) {
+            fprintf(stderr, "Could not open libx264\n");
+            status = 1;
+            break;
+        }
+        printf("    {\"noise\": %.1f, \"plain\": ", levels[i]);
+        printRun(plain, frames);
+        printf(", \"denoised\": ");
+        printRun(denoised, frames);
+        printf(", \"bitrate_saved_percent\": %.1f}%s\n",
+               plain.bytes > 0 ? 100.0 * (plain.bytes - denoised.bytes) / plain.bytes : 0.0,
+               i + 1 < levels.size() ? "," : "");
+        fflush(stdout);
+    }
+    printf("  ]\n}\n");
+    return status;
+}
@@ -0,0 +1,129 @@
+#include <gst/gst.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <capture_stamp.hpp>
+
+// Companion receiver for the capture stamps (see capture_stamp.hpp). Calls an
+// SRT stream, decodes it and reads the stamps back to measure the latency of
+// every frame, split into hops. Once a second it prints the quantiles of each
+// hop and, with --metrics, writes the histograms in the Prometheus text format
+// for node_exporter. Clocks must be synchronised with the sender, which they
+// are over loopback.
+//
+//   MastheadCamera_latency_receiver [--duration S] [--metrics PATH] srt://HOST:PORT
+//
+// The frames are taken as shown when decoded, so the end to end latency
+// leaves out the display.
+
+/**
+ * @brief Write the hop histograms, replacing the file in one rename.
+ *
+ * @param path     Metrics file.
+ * @param receiver Receiver state.
+ */
+static void writeMetrics(const char *path, StampReceiver *receiver) {
+    const std::string temp_path = std::string(path) + ".tmp";
+    FILE *file = fopen(temp_path.c_str(), "w");
+    if (!file) return;
+
+    fprintf(file, "# HELP masthead_receiver_latency_ms Latency of each received frame by hop.\n"
+                  "# TYPE masthead_receiver_latency_ms histogram\n");
+    std::lock_guard<std::mutex> lock(receiver->mutex);
+    for (int hop = 0; hop < LATENCY_HOPS; hop++) {
+        std::string labels = std::string("hop=\"") + LATENCY_HOP_NAMES[hop] + "\"";
+        writeLatencyHistogram(file, "masthead_receiver_latency_ms", labels.c_str(), receiver->hops[hop]);
+    }
+    fprintf(file, "# HELP masthead_receiver_unstamped_total Access units received without a capture stamp.\n"
+                  "# TYPE masthead_receiver_unstamped_total counter\n"
+                  "masthead_receiver_unstamped_total %ld\n", receiver->unstamped);
+    fclose(file);
+    rename(temp_path.c_str(), path);
+}
+
+/**
+ * @brief Print the quantiles of each hop on one line.
+ */
+static void printHops(StampReceiver *receiver) {
+    std::lock_guard<std::mutex> lock(receiver->mutex);
+    for (int hop = 0; hop < LATENCY_HOPS; hop++) {
+        const LatencyHistogram &histogram = receiver->hops[hop];
+        printf("%s p50 %.1f p90 %.1f p99 %.1f ms%s", LATENCY_HOP_NAMES[hop], latencyQuantile(histogram, 0.5),
+               latencyQuantile(histogram, 0.9), latencyQuantile(histogram, 0.99), hop + 1 < LATENCY_HOPS ? ", " : "");
+    }
+    printf(" (%ld frames)\n", receiver->hops[HOP_END_TO_END].count);
+    fflush(stdout);
+}
+
+int main(int argc, char *argv[]) {
+    const char *uri     = NULL;
+    const char *metrics = NULL;
+    int         seconds = 0;
+    for (int i = 1; i < argc; i++) {
+        if      (strcmp(argv[i], "--duration") == 0 && i + 1 < argc) seconds = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--metrics") == 0 && i + 1 < argc)  metrics = argv[++i];
+        else if (strncmp(argv[i], "srt://", 6) == 0 && !uri)         uri     = argv[i];
+        else {
+            uri = NULL;
+            break;
+        }
+    }
+    if (!uri) {
+        fprintf(stderr, "Usage: %s [--duration S] [--metrics PATH] srt://HOST:PORT\n", argv[0]);
+        return 1;
+    }
+
+    gst_init(&argc, &argv);
+
+    const std::string description =
+        std::string("srtsrc uri=\"") + uri + (strchr(uri, '?') ? "&" : "?") + "mode=caller\" ! tsdemux ! "
+        "h264parse name=parser ! video/x-h264,stream-format=byte-stream,alignment=au ! "
+        "avdec_h264 ! fakesink name=decoded sync=false";
+    GError     *error    = NULL;
+    GstElement *pipeline = gst_parse_launch(description.c_str(), &error);
+    if (!pipeline) {
+        fprintf(stderr, "Failed to build the receiver: %s\n", error ? error->message : "unknown error");
+        if (error) g_error_free(error);
+        return 1;
+    }
+
+    StampReceiver receiver;
+    if (attachStampReceiver(pipeline, "parser", "decoded", &receiver) != 0) {
+        fprintf(stderr, "Failed to attach the stamp receiver.\n");
+        gst_object_unref(pipeline);
+        return 1;
+    }
+    gst_element_set_state(pipeline, GST_STATE_PLAYING);
+
+    int     status = 0;
+    GstBus *bus    = gst_element_get_bus(pipeline);
+    auto    start  = std::chrono::steady_clock::now();
+    while (seconds <= 0 || std::chrono::steady_clock::now() - start < std::chrono::seconds(seconds)) {
+        GstMessage *msg = gst_bus_timed_pop_filtered(bus, GST_SECOND, (GstMessageType)(GST_MESSAGE_ERROR | GST_MESSAGE_EOS));
+        if (msg) {
+            if (GST_MESSAGE_TYPE(msg) == GST_MESSAGE_ERROR) {
+                GError *err   = NULL;
+                gchar  *debug = NULL;
+                gst_message_parse_error(msg, &err, &debug);
+                fprintf(stderr, "Error: %s\n", err->message);
+                g_error_free(err);
+                g_free(debug);
+                status = 1;
+            }
+            gst_message_unref(msg);
+            break;
+        }
+        printHops(&receiver);
+        if (metrics) writeMetrics(metrics, &receiver);
+    }
+
+    gst_object_unref(bus);
+    gst_element_set_state(pipeline, GST_STATE_NULL);
+    gst_object_unref(pipeline);
+    printHops(&receiver);
+    if (metrics) writeMetrics(metrics, &receiver);
+    return status;
+}
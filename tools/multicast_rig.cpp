@@ -0,0 +1,431 @@
+#include <gst/gst.h>
+
+#include <arpa/inet.h>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <netinet/in.h>
+#include <poll.h>
+#include <spawn.h>
+#include <string>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+#include <camera_config.hpp>
+#include <element_chain.hpp>
+#include <multicast.hpp>
+
+// RTP multicast rig. Runs the multicast branch and the SAP announcer of a
+// camera (see multicast.hpp) on a test pattern encode, sending on the
+// loopback interface, and adds local viewers in steps. Each viewer is its own
+// process joining the group: it depayloads and decodes the stream and
+// reports what it received, how long it waited for its first decoded frame
+// (the late joiner wait for a key frame) and for the SAP announcement of the
+// stream. For every step the rig measures the CPU time of the sending
+// process, the bytes its udpsink sent and the bytes loopback transmitted.
+// All of them should stay flat as viewers are added. The results are printed
+// as one JSON document.
+//
+//   MastheadCamera_multicast_rig [--group ADDRESS] [--port N] [--iface NAME] [--duration S] [--viewers N]...
+//
+// --viewers can be repeated. Without it the rig runs RIG_VIEWER_STEPS.
+// Loopback needs multicast switched on first: ip link set lo multicast on.
+// The sender is the camera encode in a plain pipeline, because the camera
+// pipelines only get the multicast branch with MULTICAST_ENABLED.
+
+static const int  RIG_FPS            = 30;
+static const int  RIG_JOIN_MS        = 1000;   // Viewers join and settle before the measurement.
+static const int  RIG_VIEWER_STEPS[] = {0, 1, 2, 4, 8};
+static const char RIG_LO_TX_BYTES[]  = "/sys/class/net/lo/statistics/tx_bytes";
+
+// What one viewer saw.
+struct ViewerStats {
+    long   packets;
+    long   bytes;
+    long   frames;
+    double seconds;
+    double first_frame_ms;  // From joining to the first decoded frame, -1 for none.
+    double sap_ms;          // From joining to the first announcement of the group, -1 for none.
+};
+
+// What the sender did during one step.
+struct StepStats {
+    int                      viewers;
+    double                   cpu_percent;
+    double                   sent_kbps;
+    double                   lo_tx_kbps;
+    std::vector<ViewerStats> receivers;
+};
+
+// Receive counters of a viewer. Touched on its streaming threads.
+struct ViewerProbe {
+    int64_t           start_ns;
+    std::atomic<long> packets {0};
+    std::atomic<long> bytes {0};
+    std::atomic<long> frames {0};
+    std::atomic<long> first_frame_ns {-1};
+};
+
+static int64_t nowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * @brief Buffer probe on the viewer udpsrc. Counts the RTP packets.
+ */
+static GstPadProbeReturn on_viewer_packet(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    ViewerProbe *probe = (ViewerProbe *)user_data;
+    probe->packets++;
+    probe->bytes += gst_buffer_get_size(GST_PAD_PROBE_INFO_BUFFER(info));
+    return GST_PAD_PROBE_OK;
+}
+
+/**
+ * @brief Buffer probe on the viewer fakesink. Counts the decoded frames.
+ */
+static GstPadProbeReturn on_viewer_frame(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    ViewerProbe *probe = (ViewerProbe *)user_data;
+    long         none  = -1;
+    probe->first_frame_ns.compare_exchange_strong(none, nowNs() - probe->start_ns);
+    probe->frames++;
+    return GST_PAD_PROBE_OK;
+}
+
+/**
+ * @brief Add a buffer probe to a pad of a named element.
+ */
+static void addProbe(GstElement *pipeline, const char *element_name, const char *pad_name,
+                     GstPadProbeCallback callback, gpointer user_data) {
+    GstElement *element = gst_bin_get_by_name(GST_BIN(pipeline), element_name);
+    GstPad     *pad     = gst_element_get_static_pad(element, pad_name);
+    gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, callback, user_data, NULL);
+    gst_object_unref(pad);
+    gst_object_unref(element);
+}
+
+/**
+ * @brief Wait for the SAP announcement of a group.
+ *
+ * @param group    Multicast group of the stream.
+ * @param iface    IPv4 address of the interface to listen on.
+ * @param deadline Steady clock nanoseconds to give up at.
+ * @return nanoseconds of the clock when it arrived, -1 if it did not.
+ */
+static int64_t waitAnnouncement(const std::string &group, const std::string &iface, int64_t deadline) {
+    int fd  = socket(AF_INET, SOCK_DGRAM, 0);
+    int yes = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+
+    sockaddr_in address = {};
+    address.sin_family      = AF_INET;
+    address.sin_port        = htons(MULTICAST_SAP_PORT);
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    ip_mreq membership;
+    inet_pton(AF_INET, MULTICAST_SAP_GROUP, &membership.imr_multiaddr);
+    inet_pton(AF_INET, iface.c_str(), &membership.imr_interface);
+    if (bind(fd, (sockaddr *)&address, sizeof(address)) != 0 ||
+        setsockopt(fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &membership, sizeof(membership)) != 0) {
+        close(fd);
+        return -1;
+    }
+
+    // The announced SDP names the group in its connection line
+    const std::string connection = "c=IN IP4 " + group + "/";
+    int64_t           arrived    = -1;
+    char              packet[2048];
+    while (arrived < 0 && nowNs() < deadline) {
+        pollfd poll_fd = {fd, POLLIN, 0};
+        if (poll(&poll_fd, 1, (int)((deadline - nowNs()) / 1000000) + 1) <= 0) continue;
+        ssize_t size = recv(fd, packet, sizeof(packet), 0);
+        if (size > 0 && (packet[0] & 0x04) == 0 &&
+            std::string(packet, size).find(connection) != std::string::npos) {
+            arrived = nowNs();
+        }
+    }
+    close(fd);
+    return arrived;
+}
+
+/**
+ * @brief Run one viewer and print what it saw on one line for the rig.
+ *
+ * @return 0 if the viewer ran, 1 if its pipeline did not start.
+ */
+static int runViewer(const std::string &group, int port, const std::string &iface, int seconds) {
+    std::string iface_address = "127.0.0.1";
+    interfaceAddress(iface, &iface_address);
+
+    const std::string description =
+        "udpsrc name=viewer_source address=" + group + " port=" + std::to_string(port) +
+        (iface.empty() ? "" : " multicast-iface=" + iface) + " auto-multicast=true "
+        "caps=\"application/x-rtp,media=video,encoding-name=H264,clock-rate=90000,payload=" +
+        std::to_string(MULTICAST_PAYLOAD_TYPE) + "\" ! "
+        "rtph264depay ! h264parse ! avdec_h264 ! fakesink name=viewer_sink sync=false";
+    GError     *error    = NULL;
+    GstElement *pipeline = gst_parse_launch(description.c_str(), &error);
+    if (pipeline == NULL) {
+        fprintf(stderr, "Viewer: %s\n", error != NULL ? error->message : "unknown error");
+        if (error != NULL) g_error_free(error);
+        return 1;
+    }
+
+    ViewerProbe probe;
+    addProbe(pipeline, "viewer_source", "src", on_viewer_packet, &probe);
+    addProbe(pipeline, "viewer_sink",   "sink", on_viewer_frame, &probe);
+
+    probe.start_ns = nowNs();
+    if (gst_element_set_state(pipeline, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE) {
+        gst_object_unref(pipeline);
+        return 1;
+    }
+    int64_t sap_ns = waitAnnouncement(group, iface_address, probe.start_ns + (int64_t)seconds * 1000000000);
+    int64_t left   = probe.start_ns + (int64_t)seconds * 1000000000 - nowNs();
+    if (left > 0) std::this_thread::sleep_for(std::chrono::nanoseconds(left));
+    gst_element_set_state(pipeline, GST_STATE_NULL);
+    gst_object_unref(pipeline);
+
+    long first_frame = probe.first_frame_ns.load();
+    printf("%ld %ld %ld %.3f %.1f %.1f\n", probe.packets.load(), probe.bytes.load(), probe.frames.load(),
+           (nowNs() - probe.start_ns) / 1e9, first_frame < 0 ? -1.0 : first_frame / 1e6,
+           sap_ns < 0 ? -1.0 : (sap_ns - probe.start_ns) / 1e6);
+    return 0;
+}
+
+/**
+ * @brief Buffer and buffer list probe on the multicast udpsink. Counts the
+ *        bytes sent.
+ */
+static GstPadProbeReturn on_multicast_send(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    std::atomic<long> *sent = (std::atomic<long> *)user_data;
+    if (GST_PAD_PROBE_INFO_TYPE(info) & GST_PAD_PROBE_TYPE_BUFFER_LIST) {
+        *sent += gst_buffer_list_calculate_size(GST_PAD_PROBE_INFO_BUFFER_LIST(info));
+    } else {
+        *sent += gst_buffer_get_size(GST_PAD_PROBE_INFO_BUFFER(info));
+    }
+    return GST_PAD_PROBE_OK;
+}
+
+/**
+ * @brief Bytes loopback has transmitted, -1 if unknown.
+ */
+static long loTxBytes() {
+    std::ifstream file(RIG_LO_TX_BYTES);
+    long          bytes = -1;
+    file >> bytes;
+    return file ? bytes : -1;
+}
+
+/**
+ * @brief CPU time of this process, user and system, in seconds.
+ */
+static double cpuSeconds() {
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+}
+
+// One viewer process and the read end of its stdout.
+struct ViewerProcess {
+    pid_t pid;
+    int   output;
+};
+
+/**
+ * @brief Start a viewer process, running this rig with --receive.
+ *
+ * @return 0 if it started, 1 if not.
+ */
+static int spawnViewer(const CameraConfig &camera, int seconds, ViewerProcess *viewer) {
+    int fds[2];
+    if (pipe(fds) != 0) return 1;
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, fds[1], STDOUT_FILENO);
+    posix_spawn_file_actions_addclose(&actions, fds[0]);
+    posix_spawn_file_actions_addclose(&actions, fds[1]);
+
+    const std::string port     = std::to_string(camera.multicast_port);
+    const std::string duration = std::to_string(seconds);
+    const char *argv[] = {"/proc/self/exe", "--receive", "--group", camera.multicast_group.c_str(), "--port",
+                          port.c_str(), "--iface", camera.multicast_iface.c_str(), "--duration", duration.c_str(),
+                          NULL};
+    int error = posix_spawn(&viewer->pid, argv[0], &actions, NULL, (char *const *)argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    close(fds[1]);
+    if (error != 0) {
+        close(fds[0]);
+        return 1;
+    }
+    viewer->output = fds[0];
+    return 0;
+}
+
+/**
+ * @brief Wait for a viewer process and read its report.
+ *
+ * @return 0 if the viewer reported, 1 if not.
+ */
+static int collectViewer(const ViewerProcess &viewer, ViewerStats *stats) {
+    std::string report;
+    char        chunk[256];
+    ssize_t     size;
+    while ((size = read(viewer.output, chunk, sizeof(chunk))) > 0) report.append(chunk, size);
+    close(viewer.output);
+
+    int status;
+    waitpid(viewer.pid, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) return 1;
+    return sscanf(report.c_str(), "%ld %ld %ld %lf %lf %lf", &stats->packets, &stats->bytes, &stats->frames,
+                  &stats->seconds, &stats->first_frame_ms, &stats->sap_ms) == 6 ? 0 : 1;
+}
+
+/**
+ * @brief Measure the sender with a number of viewers joined.
+ *
+ * @return 0 if the step ran, 1 if a viewer failed.
+ */
+static int runStep(const CameraConfig &camera, int viewers, int seconds, std::atomic<long> *sent, StepStats *stats) {
+    std::vector<ViewerProcess> processes;
+    int                        error = 0;
+    for (int i = 0; i < viewers; i++) {
+        ViewerProcess viewer;
+        if (spawnViewer(camera, seconds + RIG_JOIN_MS / 1000 + 1, &viewer) != 0) {
+            error = 1;
+            break;
+        }
+        processes.push_back(viewer);
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(RIG_JOIN_MS));
+
+    double  cpu_start  = cpuSeconds();
+    long    sent_start = sent->load();
+    long    lo_start   = loTxBytes();
+    int64_t start      = nowNs();
+    std::this_thread::sleep_for(std::chrono::seconds(seconds));
+    double  elapsed    = (nowNs() - start) / 1e9;
+    long    lo_end     = loTxBytes();
+
+    stats->viewers     = viewers;
+    stats->cpu_percent = (cpuSeconds() - cpu_start) / elapsed * 100.0;
+    stats->sent_kbps   = (sent->load() - sent_start) * 8.0 / 1000.0 / elapsed;
+    stats->lo_tx_kbps  = lo_start < 0 || lo_end < 0 ? -1.0 : (lo_end - lo_start) * 8.0 / 1000.0 / elapsed;
+    stats->receivers.clear();
+    for (const ViewerProcess &viewer : processes) {
+        ViewerStats received;
+        if (collectViewer(viewer, &received) != 0) {
+            error = 1;
+            continue;
+        }
+        stats->receivers.push_back(received);
+    }
+    return error;
+}
+
+int main(int argc, char *argv[]) {
+    CameraConfig camera = {};
+    camera.name            = "rig";
+    camera.fps             = RIG_FPS;
+    camera.multicast_group = "239.255.42.1";
+    camera.multicast_port  = 5004;
+    camera.multicast_ttl   = 1;
+    camera.multicast_iface = "lo";
+    int              seconds = 10;
+    bool             receive = false;
+    std::vector<int> steps;
+
+    for (int i = 1; i < argc; i++) {
+        const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+        if      (strcmp(argv[i], "--group") == 0 && value)    camera.multicast_group = argv[++i];
+        else if (strcmp(argv[i], "--port") == 0 && value)     camera.multicast_port  = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--iface") == 0 && value)    camera.multicast_iface = argv[++i];
+        else if (strcmp(argv[i], "--duration") == 0 && value) seconds                = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--viewers") == 0 && value)  steps.push_back(atoi(argv[++i]));
+        else if (strcmp(argv[i], "--receive") == 0)           receive                = true;
+        else {
+            fprintf(stderr, "Usage: %s [--group ADDRESS] [--port N] [--iface NAME] [--duration S] "
+                            "[--viewers N]...\n", argv[0]);
+            return 1;
+        }
+    }
+    if (steps.empty()) steps.assign(std::begin(RIG_VIEWER_STEPS), std::end(RIG_VIEWER_STEPS));
+    if (seconds < 1) seconds = 1;
+
+    gst_init(&argc, &argv);
+    if (receive) return runViewer(camera.multicast_group, camera.multicast_port, camera.multicast_iface, seconds);
+
+    // The camera encode, teed to a fakesink in place of the SRT branch and to the multicast branch
+    const std::string description =
+        "videotestsrc is-live=true pattern=ball ! video/x-raw,format=NV12,width=1280,height=720,framerate=" +
+        std::to_string(RIG_FPS) + "/1 ! "
+        "x264enc tune=zerolatency speed-preset=ultrafast bitrate=4000 threads=4 key-int-max=" +
+        std::to_string(RIG_FPS * MULTICAST_KEY_INTERVAL_S) + " ! "
+        "tee name=rig_encoded ! queue max-size-buffers=1 leaky=downstream ! fakesink sync=false";
+    GError     *error  = NULL;
+    GstElement *sender = gst_parse_launch(description.c_str(), &error);
+    if (sender == NULL) {
+        fprintf(stderr, "Sender: %s\n", error != NULL ? error->message : "unknown error");
+        if (error != NULL) g_error_free(error);
+        return 1;
+    }
+    GstElement *encoded = gst_bin_get_by_name(GST_BIN(sender), "rig_encoded");
+    bool        linked  = addChain(GST_BIN(sender), encoded, multicastBranch(camera));
+    gst_object_unref(encoded);
+    if (!linked) {
+        fprintf(stderr, "Sender: could not add the multicast branch\n");
+        gst_object_unref(sender);
+        return 1;
+    }
+
+    std::atomic<long> sent {0};
+    GstElement *udpsink  = gst_bin_get_by_name(GST_BIN(sender), "rig_multicast_sink");
+    GstPad     *sink_pad = gst_element_get_static_pad(udpsink, "sink");
+    gst_pad_add_probe(sink_pad, (GstPadProbeType)(GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST),
+                      on_multicast_send, &sent, NULL);
+    gst_object_unref(sink_pad);
+    gst_object_unref(udpsink);
+
+    if (gst_element_set_state(sender, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE ||
+        startMulticastAnnouncer({camera}) != 0) {
+        fprintf(stderr, "Sender failed to start\n");
+        gst_element_set_state(sender, GST_STATE_NULL);
+        gst_object_unref(sender);
+        return 1;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(RIG_JOIN_MS));
+
+    printf("{\n  \"group\": \"%s:%d\", \"iface\": \"%s\", \"duration_s\": %d,\n  \"steps\": [\n",
+           camera.multicast_group.c_str(), camera.multicast_port, camera.multicast_iface.c_str(), seconds);
+    int status = 0;
+    for (size_t i = 0; i < steps.size(); i++) {
+        StepStats stats;
+        if (runStep(camera, steps[i], seconds, &sent, &stats) != 0) {
+            fprintf(stderr, "Step with %d viewers had failed viewers\n", steps[i]);
+            status = 1;
+        }
+        printf("    {\"viewers\": %d, \"sender_cpu_percent\": %.1f, \"sent_kbps\": %.0f, \"lo_tx_kbps\": %.0f, "
+               "\"receivers\": [", stats.viewers, stats.cpu_percent, stats.sent_kbps, stats.lo_tx_kbps);
+        for (size_t r = 0; r < stats.receivers.size(); r++) {
+            const ViewerStats &received = stats.receivers[r];
+            printf("%s{\"kbps\": %.0f, \"packets\": %ld, \"frames\": %ld, \"first_frame_ms\": %.0f, \"sap_ms\": %.0f}",
+                   r > 0 ? ", " : "", received.seconds > 0 ? received.bytes * 8.0 / 1000.0 / received.seconds : 0.0,
+                   received.packets, received.frames, received.first_frame_ms, received.sap_ms);
+        }
+        printf("]}%s\n", i + 1 < steps.size() ? "," : "");
+        fflush(stdout);
+    }
+    printf("  ]\n}\n");
+
+    stopMulticastAnnouncer();
+    gst_element_set_state(sender, GST_STATE_NULL);
+    gst_object_unref(sender);
+    return status;
+}
@@ -0,0 +1,233 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <vector>
+#include <x264.h>
+#include <pip.hpp>
+
+// CPU cost of the picture in picture composite (see pip.hpp) against
+// streaming both cameras as two separate encodes, which is what docking
+// without the composite takes. Both are run on synthetic NV12 sequences with
+// libx264 at the settings of the camera pipelines:
+//   separate  - The forward and the docking frames each encoded on their own.
+//   composite - The docking frame halved and blended into the corner of a
+//               copy of the forward frame, as the compositor does, and the
+//               result encoded once.
+// The frames are made up front, so the process CPU time of the timed loop is
+// the encode and composite work alone, x264 threads included. One JSON
+// document is printed.
+//
+//   MastheadCamera_pip_cost [--width W] [--height H] [--frames N] [--bitrate KBPS] [--threads N]
+
+static const int PIP_COST_FPS        = 30;
+static const int PIP_COST_SEQUENCE   = 30;   // Distinct frames made per camera, played in a loop.
+
+// Result of one run.
+struct CostRun {
+    double cpu_ms  = 0.0;
+    double wall_ms = 0.0;
+    long   bytes   = 0;
+};
+
+/**
+ * @brief Time of a clock in milliseconds.
+ */
+static double clockMs(clockid_t clock) {
+    timespec now;
+    clock_gettime(clock, &now);
+    return now.tv_sec * 1000.0 + now.tv_nsec / 1e6;
+}
+
+/**
+ * @brief Draw a textured NV12 frame that pans with the frame number.
+ *
+ * @param seed Changes the texture, so the two cameras differ.
+ */
+static void drawFrame(long number, int seed, int width, int height, uint8_t *frame) {
+    uint8_t *uv = frame + (size_t)width * height;
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            int u = x + (int)number * 3, v = y + (int)number * seed;
+            uint32_t h = (uint32_t)(u / 8) * 374761393u + (uint32_t)(v / 8) * 668265263u + seed;
+            h = (h ^ (h >> 13)) * 1274126177u;
+            frame[(size_t)y * width + x] = (uint8_t)(40 + (u + v) % 96 + ((h >> 16) & 63));
+        }
+    }
+    for (int y = 0; y < height / 2; y++) {
+        for (int x = 0; x < width; x++) uv[(size_t)y * width + x] = (uint8_t)(112 + ((x / 16 + y / 8 + seed) & 31));
+    }
+}
+
+/**
+ * @brief Open libx264 with the settings of the camera pipelines.
+ */
+static x264_t *openEncoder(int width, int height, int bitrate_kbps, int threads) {
+    x264_param_t param;
+    x264_param_default_preset(&param, "ultrafast", "zerolatency");
+    param.i_width          = width;
+    param.i_height         = height;
+    param.i_csp            = X264_CSP_NV12;
+    param.i_fps_num        = PIP_COST_FPS;
+    param.i_fps_den        = 1;
+    param.i_keyint_max     = PIP_COST_FPS;
+    param.i_threads        = threads;
+    param.i_log_level      = X264_LOG_WARNING;
+    param.rc.i_rc_method   = X264_RC_ABR;
+    param.rc.i_bitrate     = bitrate_kbps;
+    x264_param_apply_profile(&param, "baseline");
+    return x264_encoder_open(&param);
+}
+
+/**
+ * @brief Encode one NV12 frame.
+ *
+ * @return encoded bytes.
+ */
+static long encodeFrame(x264_t *encoder, const uint8_t *frame, int width, int height, long number) {
+    x264_picture_t picture, encoded;
+    x264_picture_init(&picture);
+    picture.img.i_csp       = X264_CSP_NV12;
+    picture.img.i_plane     = 2;
+    picture.img.plane[0]    = (uint8_t *)frame;
+    picture.img.plane[1]    = (uint8_t *)frame + (size_t)width * height;
+    picture.img.i_stride[0] = width;
+    picture.img.i_stride[1] = width;
+    picture.i_pts           = number;
+
+    x264_nal_t *nals;
+    int         nal_count;
+    int         size = x264_encoder_encode(encoder, &nals, &nal_count, &picture, &encoded);
+    return size > 0 ? size : 0;
+}
+
+/**
+ * @brief Halve the docking frame into the bottom right corner of the output, as the compositor does.
+ */
+static void compositeFrame(const uint8_t *forward, const uint8_t *docking, uint8_t *inset, uint8_t *out,
+                           int width, int height) {
+    const size_t luma_size = (size_t)width * height;
+    memcpy(out, forward, luma_size * 3 / 2);
+
+    const int half_width = width / 2, half_height = height / 2;
+    for (int row = 0; row < half_height; row++) {
+        halveRowY(docking + 2 * row * width, docking + (2 * row + 1) * width, inset + row * half_width, half_width);
+    }
+    uint8_t *inset_uv = inset + (size_t)half_width * half_height;
+    for (int row = 0; row < half_height / 2; row++) {
+        halveRowUV(docking + luma_size + 2 * row * width, docking + luma_size + (2 * row + 1) * width,
+                   inset_uv + row * half_width, half_width / 2);
+    }
+
+    const int left = (width - half_width - PIP_INSET_MARGIN) & ~1;
+    const int top  = (height - half_height - PIP_INSET_MARGIN) & ~1;
+    for (int row = 0; row < half_height; row++) {
+        blendRow(out + (size_t)(top + row) * width + left, inset + row * half_width, PIP_INSET_OPACITY, half_width);
+    }
+    for (int row = 0; row < half_height / 2; row++) {
+        blendRow(out + luma_size + (size_t)(top / 2 + row) * width + left, inset_uv + row * half_width,
+                 PIP_INSET_OPACITY, half_width);
+    }
+}
+
+/**
+ * @brief Run one way of streaming both cameras.
+ *
+ * @param composite Composite and encode once, instead of two encodes.
+ * @return error - 0 for no error, 1 if libx264 could not be opened.
+ */
+static int runCost(bool composite, const std::vector<std::vector<uint8_t>> &forward,
+                   const std::vector<std::vector<uint8_t>> &docking, int width, int height, long frames,
+                   int bitrate_kbps, int threads, CostRun *run) {
+    x264_t *first  = openEncoder(width, height, bitrate_kbps, threads);
+    x264_t *second = composite ? NULL : openEncoder(width, height, bitrate_kbps, threads);
+    if (!first || (!composite && !second)) {
+        if (first)  x264_encoder_close(first);
+        if (second) x264_encoder_close(second);
+        return 1;
+    }
+
+    std::vector<uint8_t> out(forward[0].size()), inset(forward[0].size() / 4);
+
+    *run = {};
+    double cpu_start  = clockMs(CLOCK_PROCESS_CPUTIME_ID);
+    double wall_start = clockMs(CLOCK_MONOTONIC);
+    for (long number = 0; number < frames; number++) {
+        const std::vector<uint8_t> &a = forward[number % forward.size()];
+        const std::vector<uint8_t> &b = docking[number % docking.size()];
+        if (composite) {
+            compositeFrame(a.data(), b.data(), inset.data(), out.data(), width, height);
+            run->bytes += encodeFrame(first, out.data(), width, height, number);
+        } else {
+            run->bytes += encodeFrame(first, a.data(), width, height, number);
+            run->bytes += encodeFrame(second, b.data(), width, height, number);
+        }
+    }
+    run->cpu_ms  = clockMs(CLOCK_PROCESS_CPUTIME_ID) - cpu_start;
+    run->wall_ms = clockMs(CLOCK_MONOTONIC) - wall_start;
+
+    x264_encoder_close(first);
+    if (second) x264_encoder_close(second);
+    return 0;
+}
+
+/**
+ * @brief Print one run as JSON.
+ */
+static void printRun(const CostRun &run, long frames) {
+    printf("{\"cpu_ms_per_frame\": %.2f, \"wall_ms_per_frame\": %.2f, \"cores\": %.2f, \"kbps\": %.0f}",
+           run.cpu_ms / frames, run.wall_ms / frames, run.wall_ms > 0.0 ? run.cpu_ms / run.wall_ms : 0.0,
+           run.bytes * 8.0 * PIP_COST_FPS / frames / 1000.0);
+}
+
+int main(int argc, char *argv[]) {
+    int  width   = 1280;
+    int  height  = 1080;
+    long frames  = 10 * PIP_COST_FPS;
+    int  bitrate = 4000;
+    int  threads = 4;
+
+    for (int i = 1; i < argc; i++) {
+        const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+        if      (strcmp(argv[i], "--width") == 0 && value)   width   = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--height") == 0 && value)  height  = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--frames") == 0 && value)  frames  = atol(argv[++i]);
+        else if (strcmp(argv[i], "--bitrate") == 0 && value) bitrate = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--threads") == 0 && value) threads = atoi(argv[++i]);
+        else {
+            fprintf(stderr, "Usage: %s [--width W] [--height H] [--frames N] [--bitrate KBPS] [--threads N]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (width < 64 || height < 64 || width % 4 || height % 4 || frames < 1 || threads < 1) {
+        fprintf(stderr, "The frame size must be a multiple of 4 and at least 64 x 64, with at least one frame\n");
+        return 1;
+    }
+
+    std::vector<std::vector<uint8_t>> forward(PIP_COST_SEQUENCE), docking(PIP_COST_SEQUENCE);
+    for (int i = 0; i < PIP_COST_SEQUENCE; i++) {
+        forward[i].resize((size_t)width * height * 3 / 2);
+        docking[i].resize(forward[i].size());
+        drawFrame(i, 1, width, height, forward[i].data());
+        drawFrame(i, 2, width, height, docking[i].data());
+    }
+
+    CostRun separate, composite;
+    if (runCost(false, forward, docking, width, height, frames, bitrate, threads, &separate) != 0 ||
+        runCost(true, forward, docking, width, height, frames, bitrate, threads, &composite) != 0) {
+        fprintf(stderr, "Could not open libx264\n");
+        return 1;
+    }
+
+    printf("{\n  \"width\": %d, \"height\": %d, \"frames\": %ld, \"bitrate_kbps\": %d, \"threads\": %d,\n",
+           width, height, frames, bitrate, threads);
+    printf("  \"separate\": ");
+    printRun(separate, frames);
+    printf(",\n  \"composite\": ");
+    printRun(composite, frames);
+    printf(",\n  \"cpu_saved_percent\": %.1f\n}\n",
+           separate.cpu_ms > 0.0 ? 100.0 * (separate.cpu_ms - composite.cpu_ms) / separate.cpu_ms : 0.0);
+    return 0;
+}
@@ -0,0 +1,227 @@
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <vector>
+#include <x264.h>
+#include <pip.hpp>
+#include <proxy.hpp>
+
+// CPU cost of the low resolution proxy stream (see proxy.hpp) on top of the
+// full stream of a camera. Both are run on a synthetic NV12 sequence with
+// libx264 at the settings of the camera pipelines:
+//   full       - The full stream encode alone.
+//   with_proxy - The full stream, and every frame that survives the drop to
+//                PROXY_FPS halved and encoded again at PROXY_BITRATE_KBPS
+//                on PROXY_THREADS threads, as the proxy branch does.
+// The halving is the 2 x 2 average of the picture in picture scaler, which is
+// what a bilinear scale to exactly half gives. The frames are made up front,
+// so the process CPU time of the timed loop is the encode and scale work
+// alone, x264 threads included. One JSON document is printed.
+//
+//   MastheadCamera_proxy_cost [--width W] [--height H] [--fps N] [--frames N] [--bitrate KBPS] [--threads N]
+
+static const int PROXY_COST_SEQUENCE = 30;   // Distinct frames made, played in a loop.
+
+static_assert(PROXY_SCALE == 2, "the proxy cost is measured with the half size scaler");
+
+// Result of one run.
+struct CostRun {
+    double cpu_ms      = 0.0;
+    double wall_ms     = 0.0;
+    long   bytes       = 0;
+    long   proxy_bytes = 0;
+};
+
+/**
+ * @brief Time of a clock in milliseconds.
+ */
+static double clockMs(clockid_t clock) {
+    timespec now;
+    clock_gettime(clock, &now);
+    return now.tv_sec * 1000.0 + now.tv_nsec / 1e6;
+}
+
+/**
+ * @brief Draw a textured NV12 frame that pans with the frame number.
+ */
+static void drawFrame(long number, int width, int height, uint8_t *frame) {
+    uint8_t *uv = frame + (size_t)width * height;
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            int u = x + (int)number * 3, v = y + (int)number;
+            uint32_t h = (uint32_t)(u / 8) * 374761393u + (uint32_t)(v / 8) * 668265263u;
+            h = (h ^ (h >> 13)) * 1274126177u;
+            frame[(size_t)y * width + x] = (uint8_t)(40 + (u + v) % 96 + ((h >> 16) & 63));
+        }
+    }
+    for (int y = 0; y < height / 2; y++) {
+        for (int x = 0; x < width; x++) uv[(size_t)y * width + x] = (uint8_t)(112 + ((x / 16 + y / 8) & 31));
+    }
+}
+
+/**
+ * @brief Open libx264 with the settings of the camera pipelines.
+ */
+static x264_t *openEncoder(int width, int height, int fps, int key_int_max, int bitrate_kbps, int threads) {
+    x264_param_t param;
+    x264_param_default_preset(&param, "ultrafast", "zerolatency");
+    param.i_width          = width;
+    param.i_height         = height;
+    param.i_csp            = X264_CSP_NV12;
+    param.i_fps_num        = fps;
+    param.i_fps_den        = 1;
+    param.i_keyint_max     = key_int_max;
+    param.i_threads        = threads;
+    param.i_log_level      = X264_LOG_WARNING;
+    param.rc.i_rc_method   = X264_RC_ABR;
+    param.rc.i_bitrate     = bitrate_kbps;
+    x264_param_apply_profile(&param, "baseline");
+    return x264_encoder_open(&param);
+}
+
+/**
+ * @brief Encode one NV12 frame.
+ *
+ * @return encoded bytes.
+ */
+static long encodeFrame(x264_t *encoder, const uint8_t *frame, int width, int height, long number) {
+    x264_picture_t picture, encoded;
+    x264_picture_init(&picture);
+    picture.img.i_csp       = X264_CSP_NV12;
+    picture.img.i_plane     = 2;
+    picture.img.plane[0]    = (uint8_t *)frame;
+    picture.img.plane[1]    = (uint8_t *)frame + (size_t)width * height;
+    picture.img.i_stride[0] = width;
+    picture.img.i_stride[1] = width;
+    picture.i_pts           = number;
+
+    x264_nal_t *nals;
+    int         nal_count;
+    int         size = x264_encoder_encode(encoder, &nals, &nal_count, &picture, &encoded);
+    return size > 0 ? size : 0;
+}
+
+/**
+ * @brief Halve a frame into a proxy frame.
+ */
+static void halveFrame(const uint8_t *frame, uint8_t *proxy, int width, int height) {
+    const size_t luma_size    = (size_t)width * height;
+    const int    proxy_width  = width / 2, proxy_height = height / 2;
+    for (int row = 0; row < proxy_height; row++) {
+        halveRowY(frame + 2 * row * width, frame + (2 * row + 1) * width, proxy + row * proxy_width, proxy_width);
+    }
+    uint8_t *proxy_uv = proxy + (size_t)proxy_width * proxy_height;
+    for (int row = 0; row < proxy_height / 2; row++) {
+        halveRowUV(frame + luma_size + 2 * row * width, frame + luma_size + (2 * row + 1) * width,
+                   proxy_uv + row * proxy_width, proxy_width / 2);
+    }
+}
+
+/**
+ * @brief Run the full stream, with or without the proxy.
+ *
+ * @param proxy Also drop, halve and encode the proxy stream.
+ * @return error - 0 for no error, 1 if libx264 could not be opened.
+ */
+static int runCost(bool proxy, const std::vector<std::vector<uint8_t>> &sequence, int width, int height, int fps,
+                   long frames, int bitrate_kbps, int threads, CostRun *run) {
+    const int proxy_width = width / 2, proxy_height = height / 2;
+    x264_t *full  = openEncoder(width, height, fps, fps, bitrate_kbps, threads);
+    x264_t *small = proxy ? openEncoder(proxy_width, proxy_height, PROXY_FPS, PROXY_FPS, PROXY_BITRATE_KBPS,
+                                        PROXY_THREADS) : NULL;
+    if (!full || (proxy && !small)) {
+        if (full)  x264_encoder_close(full);
+        if (small) x264_encoder_close(small);
+        return 1;
+    }
+
+    std::vector<uint8_t> scaled((size_t)proxy_width * proxy_height * 3 / 2);
+    long                 proxy_number = 0;
+
+    *run = {};
+    double cpu_start  = clockMs(CLOCK_PROCESS_CPUTIME_ID);
+    double wall_start = clockMs(CLOCK_MONOTONIC);
+    for (long number = 0; number < frames; number++) {
+        const std::vector<uint8_t> &frame = sequence[number % sequence.size()];
+        run->bytes += encodeFrame(full, frame.data(), width, height, number);
+        // videorate drop-only keeps a frame whenever the proxy clock has moved on a frame
+        if (proxy && number * PROXY_FPS / fps >= proxy_number) {
+            halveFrame(frame.data(), scaled.data(), width, height);
+            run->proxy_bytes += encodeFrame(small, scaled.data(), proxy_width, proxy_height, proxy_number);
+            proxy_number++;
+        }
+    }
+    run->cpu_ms  = clockMs(CLOCK_PROCESS_CPUTIME_ID) - cpu_start;
+    run->wall_ms = clockMs(CLOCK_MONOTONIC) - wall_start;
+
+    x264_encoder_close(full);
+    if (small) x264_encoder_close(small);
+    return 0;
+}
+
+/**
+ * @brief Print one run as JSON.
+ */
+static void printRun(const CostRun &run, long frames, int fps) {
+    printf("{\"cpu_ms_per_frame\": %.2f, \"wall_ms_per_frame\": %.2f, \"cores\": %.2f, \"kbps\": %.0f, "
+           "\"proxy_kbps\": %.0f}",
+           run.cpu_ms / frames, run.wall_ms / frames, run.wall_ms > 0.0 ? run.cpu_ms / run.wall_ms : 0.0,
+           run.bytes * 8.0 * fps / frames / 1000.0, run.proxy_bytes * 8.0 * fps / frames / 1000.0);
+}
+
+int main(int argc, char *argv[]) {
+    int  width   = 1280;
+    int  height  = 1080;
+    int  fps     = 30;
+    long frames  = 0;
+    int  bitrate = 8000;
+    int  threads = 4;
+
+    for (int i = 1; i < argc; i++) {
+        const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+        if      (strcmp(argv[i], "--width") == 0 && value)   width   = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--height") == 0 && value)  height  = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--fps") == 0 && value)     fps     = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--frames") == 0 && value)  frames  = atol(argv[++i]);
+        else if (strcmp(argv[i], "--bitrate") == 0 && value) bitrate = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--threads") == 0 && value) threads = atoi(argv[++i]);
+        else {
+            fprintf(stderr, "Usage: %s [--width W] [--height H] [--fps N] [--frames N] [--bitrate KBPS] "
+                            "[--threads N]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (frames == 0) frames = 10L * fps;
+    if (width < 64 || height < 64 || width % 4 || height % 4 || fps < PROXY_FPS || frames < 1 || threads < 1) {
+        fprintf(stderr, "The frame size must be a multiple of 4 and at least 64 x 64, at %d fps or more, "
+                        "with at least one frame\n", PROXY_FPS);
+        return 1;
+    }
+
+    std::vector<std::vector<uint8_t>> sequence(PROXY_COST_SEQUENCE);
+    for (int i = 0; i < PROXY_COST_SEQUENCE; i++) {
+        sequence[i].resize((size_t)width * height * 3 / 2);
+        drawFrame(i, width, height, sequence[i].data());
+    }
+
+    CostRun full, with_proxy;
+    if (runCost(false, sequence, width, height, fps, frames, bitrate, threads, &full) != 0 ||
+        runCost(true, sequence, width, height, fps, frames, bitrate, threads, &with_proxy) != 0) {
+        fprintf(stderr, "Could not open libx264\n");
+        return 1;
+    }
+
+    printf("{\n  \"width\": %d, \"height\": %d, \"fps\": %d, \"frames\": %ld, \"bitrate_kbps\": %d, \"threads\": %d,\n",
+           width, height, fps, frames, bitrate, threads);
+    printf("  \"proxy\": {\"width\": %d, \"height\": %d, \"fps\": %d, \"bitrate_kbps\": %d, \"threads\": %d},\n",
+           width / 2, height / 2, PROXY_FPS, PROXY_BITRATE_KBPS, PROXY_THREADS);
+    printf("  \"full\": ");
+    printRun(full, frames, fps);
+    printf(",\n  \"with_proxy\": ");
+    printRun(with_proxy, frames, fps);
+    printf(",\n  \"cpu_added_percent\": %.1f\n}\n",
+           full.cpu_ms > 0.0 ? 100.0 * (with_proxy.cpu_ms - full.cpu_ms) / full.cpu_ms : 0.0);
+    return 0;
+}
@@ -0,0 +1,451 @@
+#include <gst/gst.h>
+#include <gst/app/gstappsink.h>
+#include <gst/app/gstappsrc.h>
+#include <gst/video/video.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+#include <camera_model.hpp>
+#include <overlay_config.hpp>
+#include <roi_encoder.hpp>
+#include <video.hpp>
+
+// Quality of the ROI encoder (see roi_encoder.hpp) with and without its
+// quantizer offsets, on a synthetic forward camera sequence. Every pixel of
+// the sequence is made from the direction it looks in, through the same
+// camera model and boresight the encoder uses, while the boat pitches and
+// rolls in a swell: sky with moving cloud, a bridge underside with posts
+// and rivets, boats crossing at the horizon and textured water with sensor
+// noise on everything. Each frame is encoded, decoded and compared with the
+// source in lock step, so the element encodes it at the attitude it was made
+// at. PSNR and SSIM of the luma are reported for the band, outside it (past
+// the ramp) and over the whole frame, with the bitrate reached, as one JSON
+// document.
+//
+//   MastheadCamera_roi_quality [--width W] [--height H] [--frames N] [--bitrate KBPS]... [--check]
+//
+// --bitrate can be repeated. Without it QUALITY_BITRATES are run. --check
+// scores the sequence against itself with QUALITY_CHECK_NOISE of added noise
+// instead of an encode, which needs no encoder or decoder: the PSNR must come
+// out at the one the noise gives, and the share of the frame in each region
+// and the time to make a frame are reported with it.
+
+static const int    QUALITY_FPS          = 30;
+static const int    QUALITY_BITRATES[]   = {1000, 2000, 4000};
+static const double QUALITY_SWELL_PITCH  = 4.0;   // Pitch amplitude, degrees.
+static const double QUALITY_SWELL_ROLL   = 6.0;   // Roll amplitude, degrees.
+static const double QUALITY_CAMERA_M     = 4.0;   // Height of the camera over the water.
+static const int    QUALITY_SSIM_WINDOW  = 8;     // SSIM over non-overlapping windows of this size.
+static const double QUALITY_CHECK_NOISE  = 4.0;   // Noise of --check, luma levels.
+
+enum QualityRegion { REGION_BAND, REGION_OUTSIDE, REGION_FRAME, REGIONS };
+static const char *REGION_NAMES[REGIONS] = {"band", "outside", "frame"};
+
+// Error sums of one region over a run.
+struct RegionScore {
+    double squared_error = 0.0;
+    long   pixels        = 0;
+    double ssim          = 0.0;
+    long   windows       = 0;
+};
+
+// Result of one encode of the sequence.
+struct QualityRun {
+    long        bytes = 0;
+    long        frames = 0;
+    RegionScore regions[REGIONS];
+};
+
+/**
+ * @brief Hash of a lattice point, in [0, 1).
+ */
+static double latticeValue(int x, int y) {
+    uint32_t h = (uint32_t)x * 374761393u + (uint32_t)y * 668265263u;
+    h = (h ^ (h >> 13)) * 1274126177u;
+    return ((h ^ (h >> 16)) & 0xffff) / 65536.0;
+}
+
+/**
+ * @brief Smooth value noise, in [0, 1).
+ */
+static double valueNoise(double x, double y) {
+    const double fx = floor(x), fy = floor(y);
+    const int    ix = (int)fx, iy = (int)fy;
+    const double sx = (x - fx) * (x - fx) * (3 - 2 * (x - fx));
+    const double sy = (y - fy) * (y - fy) * (3 - 2 * (y - fy));
+    const double top    = latticeValue(ix, iy)     + sx * (latticeValue(ix + 1, iy)     - latticeValue(ix, iy));
+    const double bottom = latticeValue(ix, iy + 1) + sx * (latticeValue(ix + 1, iy + 1) - latticeValue(ix, iy + 1));
+    return top + sy * (bottom - top);
+}
+
+/**
+ * @brief Luma of the scene in a direction.
+ *
+ * @param elevation Elevation in degrees, level frame.
+ * @param azimuth   Azimuth right of the bow in degrees.
+ * @param t         Time in seconds.
+ * @return luma before noise.
+ */
+static double sceneLuma(double elevation, double azimuth, double t) {
+    // Bridge underside: a riveted beam with posts down to its deck
+    if (elevation > 9.0 && elevation < 12.0) {
+        const double rivets = valueNoise(azimuth * 6.0, elevation * 6.0) > 0.5 ? 25.0 : 0.0;
+        return 70.0 + rivets + 30.0 * valueNoise(azimuth * 2.0, elevation * 2.0);
+    }
+    if (elevation > 3.0 && elevation <= 9.0 && fmod(azimuth + 100.0, 5.0) < 0.6) {
+        return 45.0 + 20.0 * valueNoise(azimuth * 8.0, elevation * 8.0);
+    }
+    // Sky, lighter towards the horizon, with drifting cloud
+    if (elevation >= 0.0) {
+        return 200.0 - std::min(elevation, 45.0) + 30.0 * valueNoise(azimuth * 0.2 + t * 0.3, elevation * 0.4);
+    }
+    // Boats crossing at the horizon: dark hulls with light windows
+    const double boats[2] = {-20.0 + 2.5 * t, 25.0 - 1.5 * t};
+    for (double boat : boats) {
+        if (elevation > -1.2 && fabs(azimuth - boat) < 2.0) {
+            const bool window = elevation > -0.6 && fmod(azimuth - boat + 2.0, 0.4) < 0.2;
+            return window ? 210.0 : 35.0;
+        }
+    }
+    // Water on a plane below the camera, with the waves moving towards the boat
+    const double depression = -elevation * M_PI / 180.0;
+    const double range      = QUALITY_CAMERA_M / tan(depression);
+    const double across     = range * tan(azimuth * M_PI / 180.0);
+    return 60.0 + 50.0 * valueNoise(across * 0.5, range * 0.3 + t * 1.5) +
+           20.0 * valueNoise(across * 2.0 + t, range * 1.5);
+}
+
+/**
+ * @brief Make one frame of the sequence.
+ *
+ * @param rays      Camera frame ray of every pixel, xyz.
+ * @param rotation  Attitude of the frame.
+ * @param frame     Frame number.
+ * @param width     Frame width.
+ * @param height    Frame height.
+ * @param nv12      Frame, written.
+ * @param elevation Elevation of every pixel, written.
+ */
+static void makeFrame(const std::vector<float> &rays, const CameraRotation &rotation, long frame, int width,
+                      int height, std::vector<uint8_t> *nv12, std::vector<float> *elevation) {
+    const double  t = (double)frame / QUALITY_FPS;
+    const double (*m)[3] = rotation.m;
+    for (int i = 0; i < width * height; i++) {
+        const double ray[3] = {rays[3 * i], rays[3 * i + 1], rays[3 * i + 2]};
+        const double e      = rayElevation(rotation, ray);
+        // Back to the level frame for the azimuth
+        const double x      = m[0][0] * ray[0] + m[1][0] * ray[1] + m[2][0] * ray[2];
+        const double z      = m[0][2] * ray[0] + m[1][2] * ray[1] + m[2][2] * ray[2];
+        const double noise  = 8.0 * (latticeValue(i, (int)frame) - 0.5);
+        (*elevation)[i]     = (float)e;
+        (*nv12)[i]          = (uint8_t)std::clamp(sceneLuma(e, atan2(x, z) * 180.0 / M_PI, t) + noise, 0.0, 255.0);
+    }
+    std::fill(nv12->begin() + width * height, nv12->end(), 128);
+}
+
+/**
+ * @brief Region of a pixel at an elevation, other than the whole frame.
+ *
+ * @return REGION_BAND, REGION_OUTSIDE, or REGIONS on the ramp between them.
+ */
+static int pixelRegion(double elevation) {
+    if (elevation >= -ROI_BAND_BELOW_DEG && elevation <= ROI_BAND_ABOVE_DEG) return REGION_BAND;
+    if (elevation < -ROI_BAND_BELOW_DEG - ROI_BAND_RAMP_DEG || elevation > ROI_BAND_ABOVE_DEG + ROI_BAND_RAMP_DEG) {
+        return REGION_OUTSIDE;
+    }
+    return REGIONS;
+}
+
+/**
+ * @brief Add the error of a decoded frame to the scores.
+ */
+static void scoreFrame(const uint8_t *source, const uint8_t *decoded, int stride, int width, int height,
+                       const std::vector<float> &elevation, QualityRun *run) {
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            const double error  = (double)source[y * width + x] - decoded[y * stride + x];
+            const int    region = pixelRegion(elevation[y * width + x]);
+            run->regions[REGION_FRAME].squared_error += error * error;
+            run->regions[REGION_FRAME].pixels++;
+            if (region != REGIONS) {
+                run->regions[region].squared_error += error * error;
+                run->regions[region].pixels++;
+            }
+        }
+    }
+
+    const double c1 = (0.01 * 255) * (0.01 * 255), c2 = (0.03 * 255) * (0.03 * 255);
+    const int    n  = QUALITY_SSIM_WINDOW * QUALITY_SSIM_WINDOW;
+    for (int wy = 0; wy + QUALITY_SSIM_WINDOW <= height; wy += QUALITY_SSIM_WINDOW) {
+        for (int wx = 0; wx + QUALITY_SSIM_WINDOW <= width; wx += QUALITY_SSIM_WINDOW) {
+            double sa = 0, sb = 0, saa = 0, sbb = 0, sab = 0;
+            for (int y = wy; y < wy + QUALITY_SSIM_WINDOW; y++) {
+                for (int x = wx; x < wx + QUALITY_SSIM_WINDOW; x++) {
+                    const double a = source[y * width + x], b = decoded[y * stride + x];
+                    sa += a; sb += b; saa += a * a; sbb += b * b; sab += a * b;
+                }
+            }
+            const double ma = sa / n, mb = sb / n;
+            const double va = saa / n - ma * ma, vb = sbb / n - mb * mb, cov = sab / n - ma * mb;
+            const double ssim = (2 * ma * mb + c1) * (2 * cov + c2) / ((ma * ma + mb * mb + c1) * (va + vb + c2));
+            const int    center = (wy + QUALITY_SSIM_WINDOW / 2) * width + wx + QUALITY_SSIM_WINDOW / 2;
+            const int    region = pixelRegion(elevation[center]);
+            run->regions[REGION_FRAME].ssim += ssim;
+            run->regions[REGION_FRAME].windows++;
+            if (region != REGIONS) {
+                run->regions[region].ssim += ssim;
+                run->regions[region].windows++;
+            }
+        }
+    }
+}
+
+/**
+ * @brief Camera frame ray of every pixel, through the same camera model as the encoder.
+ *
+ * @return rays, xyz per pixel.
+ */
+static std::vector<float> sequenceRays(int width, int height) {
+    CameraModel camera = forwardCameraModel();
+    if (camera.width != width || camera.height != height) {
+        camera = makeCameraModel(FORWARD_CAMERA_CALIBRATION, width, height, width, height, 0, 0);
+    }
+    std::vector<float> rays(3 * width * height);
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            double ray[3];
+            pixelRay(camera, x + 0.5, y + 0.5, ray);
+            std::copy(ray, ray + 3, &rays[3 * (y * width + x)]);
+        }
+    }
+    return rays;
+}
+
+/**
+ * @brief Attitude of a frame of the sequence, in the swell.
+ */
+static void swellAttitude(long frame, double *pitch, double *roll) {
+    const double t = (double)frame / QUALITY_FPS;
+    *pitch = QUALITY_SWELL_PITCH * sin(2 * M_PI * t / 7.0);
+    *roll  = QUALITY_SWELL_ROLL * sin(2 * M_PI * t / 5.0 + 1.0);
+}
+
+static GstPadProbeReturn on_encoded(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    ((QualityRun *)user_data)->bytes += gst_buffer_get_size(GST_PAD_PROBE_INFO_BUFFER(info));
+    return GST_PAD_PROBE_OK;
+}
+
+/**
+ * @brief Encode and score the sequence once.
+ *
+ * @param roi     Apply the quantizer offsets.
+ * @param bitrate Bitrate in kbps.
+ * @param width   Frame width.
+ * @param height  Frame height.
+ * @param frames  Frames in the sequence.
+ * @param run     Scores, written.
+ * @return error - 0 for no error, 1 if the pipeline failed.
+ */
+static int runSequence(bool roi, int bitrate, int width, int height, long frames, QualityRun *run) {
+    const std::string description =
+        "appsrc name=quality_source format=time ! "
+        "video/x-raw,format=NV12,width=" + std::to_string(width) + ",height=" + std::to_string(height) +
+        ",framerate=" + std::to_string(QUALITY_FPS) + "/1 ! " +
+        ROI_ENCODER_NAME + " name=quality_encoder follow-attitude=false bitrate=" + std::to_string(bitrate) +
+        " roi=" + (roi ? "true" : "false") + " ! "
+        "avdec_h264 max-threads=1 ! videoconvert ! video/x-raw,format=GRAY8 ! "
+        "appsink name=quality_sink sync=false";
+    GError     *error    = NULL;
+    GstElement *pipeline = gst_parse_launch(description.c_str(), &error);
+    if (!pipeline) {
+        fprintf(stderr, "Could not create the pipeline: %s\n", error ? error->message : "unknown error");
+        if (error) g_error_free(error);
+        return 1;
+    }
+    GstElement *source  = gst_bin_get_by_name(GST_BIN(pipeline), "quality_source");
+    GstElement *encoder = gst_bin_get_by_name(GST_BIN(pipeline), "quality_encoder");
+    GstElement *sink    = gst_bin_get_by_name(GST_BIN(pipeline), "quality_sink");
+    GstPad     *encoded = gst_element_get_static_pad(encoder, "src");
+    gst_pad_add_probe(encoded, GST_PAD_PROBE_TYPE_BUFFER, on_encoded, run, NULL);
+    gst_object_unref(encoded);
+    gst_element_set_state(pipeline, GST_STATE_PLAYING);
+
+    const Boresight    boresight = overlayConfig()->boresight;
+    std::vector<float> rays      = sequenceRays(width, height);
+
+    std::vector<uint8_t> nv12(width * height * 3 / 2);
+    std::vector<float>   elevation(width * height);
+    int                  status = 0;
+    for (long frame = 0; frame < frames && status == 0; frame++) {
+        double pitch, roll;
+        swellAttitude(frame, &pitch, &roll);
+        makeFrame(rays, cameraRotation(pitch, roll, boresight), frame, width, height, &nv12, &elevation);
+        g_object_set(encoder, "pitch", pitch, "roll", roll, NULL);
+
+        GstBuffer *buffer = gst_buffer_new_allocate(NULL, nv12.size(), NULL);
+        gst_buffer_fill(buffer, 0, nv12.data(), nv12.size());
+        GST_BUFFER_PTS(buffer)      = gst_util_uint64_scale(frame, GST_SECOND, QUALITY_FPS);
+        GST_BUFFER_DURATION(buffer) = gst_util_uint64_scale(1, GST_SECOND, QUALITY_FPS);
+        if (gst_app_src_push_buffer(GST_APP_SRC(source), buffer) != GST_FLOW_OK) {
+            status = 1;
+            break;
+        }
+
+        // Lock step: the next attitude is only set once this frame is through
+        GstSample *sample = gst_app_sink_try_pull_sample(GST_APP_SINK(sink), 5 * GST_SECOND);
+        if (!sample) {
+            fprintf(stderr, "No decoded frame %ld\n", frame);
+            status = 1;
+            break;
+        }
+        GstVideoInfo info;
+        GstMapInfo   map;
+        gst_video_info_from_caps(&info, gst_sample_get_caps(sample));
+        gst_buffer_map(gst_sample_get_buffer(sample), &map, GST_MAP_READ);
+        scoreFrame(nv12.data(), map.data, GST_VIDEO_INFO_PLANE_STRIDE(&info, 0), width, height, elevation, run);
+        gst_buffer_unmap(gst_sample_get_buffer(sample), &map);
+        gst_sample_unref(sample);
+        run->frames++;
+    }
+
+    gst_app_src_end_of_stream(GST_APP_SRC(source));
+    gst_element_set_state(pipeline, GST_STATE_NULL);
+    gst_object_unref(sink);
+    gst_object_unref(encoder);
+    gst_object_unref(source);
+    gst_object_unref(pipeline);
+    return status;
+}
+
+/**
+ * @brief Score the sequence against itself with added noise, without an encoder.
+ *
+ * @param width   Frame width.
+ * @param height  Frame height.
+ * @param frames  Frames in the sequence.
+ * @param run     Scores, written.
+ * @param shares  Share of the pixels in each region, written.
+ * @param make_ms Time to make one frame, written.
+ */
+static void runCheck(int width, int height, long frames, QualityRun *run, double shares[REGIONS], double *make_ms) {
+    const Boresight    boresight = overlayConfig()->boresight;
+    std::vector<float> rays      = sequenceRays(width, height);
+
+    std::vector<uint8_t>             nv12(width * height * 3 / 2), noisy(width * height);
+    std::vector<float>               elevation(width * height);
+    std::mt19937                     random(1);
+    std::normal_distribution<double> noise(0.0, QUALITY_CHECK_NOISE);
+    long                             pixels[REGIONS] = {};
+    double                           total_ms = 0.0;
+
+    for (long frame = 0; frame < frames; frame++) {
+        double pitch, roll;
+        swellAttitude(frame, &pitch, &roll);
+        auto start = std::chrono::steady_clock::now();
+        makeFrame(rays, cameraRotation(pitch, roll, boresight), frame, width, height, &nv12, &elevation);
+        total_ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        for (int i = 0; i < width * height; i++) {
+            noisy[i] = (uint8_t)std::clamp(lround(nv12[i] + noise(random)), 0L, 255L);
+            const int region = pixelRegion(elevation[i]);
+            if (region != REGIONS) pixels[region]++;
+        }
+        scoreFrame(nv12.data(), noisy.data(), width, width, height, elevation, run);
+        run->frames++;
+    }
+
+    const double all = (double)width * height * frames;
+    shares[REGION_BAND]    = pixels[REGION_BAND] / all;
+    shares[REGION_OUTSIDE] = pixels[REGION_OUTSIDE] / all;
+    shares[REGION_FRAME]   = 1.0;
+    *make_ms = total_ms / frames;
+}
+
+/**
+ * @brief Print the scores of a run as JSON.
+ */
+static void printRun(const QualityRun &run) {
+    printf("{\"kbps\": %.0f", run.frames ? run.bytes * 8.0 / 1000.0 * QUALITY_FPS / run.frames : 0.0);
+    for (int region = 0; region < REGIONS; region++) {
+        const RegionScore &score = run.regions[region];
+        const double       mse   = score.pixels ? score.squared_error / score.pixels : 0.0;
+        printf(", \"%s\": {\"psnr_y\": %.2f, \"ssim_y\": %.4f}", REGION_NAMES[region],
+               mse > 0.0 ? 10.0 * log10(255.0 * 255.0 / mse) : 99.0, score.windows ? score.ssim / score.windows : 0.0);
+    }
+    printf("}");
+}
+
+int main(int argc, char *argv[]) {
+    int              width  = WIDTH;
+    int              height = HEIGHT;
+    long             frames = 10 * QUALITY_FPS;
+    std::vector<int> bitrates;
+    bool             check  = false;
+
+    for (int i = 1; i < argc; i++) {
+        const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+        if      (strcmp(argv[i], "--width") == 0 && value)   width  = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--height") == 0 && value)  height = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--frames") == 0 && value)  frames = atol(argv[++i]);
+        else if (strcmp(argv[i], "--bitrate") == 0 && value) bitrates.push_back(atoi(argv[++i]));
+        else if (strcmp(argv[i], "--check") == 0)            check  = true;
+        else {
+            fprintf(stderr, "Usage: %s [--width W] [--height H] [--frames N] [--bitrate KBPS]... [--check]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (bitrates.empty()) bitrates.assign(std::begin(QUALITY_BITRATES), std::end(QUALITY_BITRATES));
+    if (width < 16 || height < 16 || width % 2 || height % 2 || frames < 1) {
+        fprintf(stderr, "The frame size must be even and at least 16 x 16, with at least one frame\n");
+        return 1;
+    }
+
+    gst_init(&argc, &argv);
+    if (check) {
+        QualityRun run;
+        double     shares[REGIONS], make_ms;
+        runCheck(width, height, frames, &run, shares, &make_ms);
+        printf("{\n  \"width\": %d, \"height\": %d, \"frames\": %ld, \"band_deg\": [%.1f, %.1f],\n",
+               width, height, frames, -ROI_BAND_BELOW_DEG, ROI_BAND_ABOVE_DEG);
+        printf("  \"band_share\": %.3f, \"outside_share\": %.3f, \"make_ms_per_frame\": %.1f,\n",
+               shares[REGION_BAND], shares[REGION_OUTSIDE], make_ms);
+        printf("  \"noise\": %.1f, \"expected_psnr_y\": %.2f, \"check\": ", QUALITY_CHECK_NOISE,
+               10.0 * log10(255.0 * 255.0 / (QUALITY_CHECK_NOISE * QUALITY_CHECK_NOISE)));
+        printRun(run);
+        printf("\n}\n");
+        return 0;
+    }
+    if (registerRoiEncoder() != 0) {
+        fprintf(stderr, "Could not register %s\n", ROI_ENCODER_NAME);
+        return 1;
+    }
+
+    printf("{\n  \"width\": %d, \"height\": %d, \"frames\": %ld, \"band_deg\": [%.1f, %.1f],\n  \"runs\": [\n",
+           width, height, frames, -ROI_BAND_BELOW_DEG, ROI_BAND_ABOVE_DEG);
+    int status = 0;
+    for (size_t i = 0; i < bitrates.size(); i++) {
+        QualityRun plain, roi;
+        if (runSequence(false, bitrates[i], width, height, frames, &plain) != 0 ||
+            runSequence(true, bitrates[i], width, height, frames, &roi) != 0) {
+            fprintf(stderr, "Run at %d kbps failed\n", bitrates[i]);
+            status = 1;
+            continue;
+        }
+        printf("    {\"bitrate\": %d, \"plain\": ", bitrates[i]);
+        printRun(plain);
+        printf(", \"roi\": ");
+        printRun(roi);
+        printf("}%s\n", i + 1 < bitrates.size() ? "," : "");
+        fflush(stdout);
+    }
+    printf("  ]\n}\n");
+    return status;
+}
@@ -0,0 +1,833 @@
+#include <gst/gst.h>
+#include <gst/video/video.h>
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <netinet/in.h>
+#include <poll.h>
+#include <random>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+#include <camera_config.hpp>
+#include <capture_stamp.hpp>
+#include <control.hpp>
+#include <docking_mode.hpp>
+#include <governor.hpp>
+#include <pipeline_builder.hpp>
+#include <stream_gate.hpp>
+#include <stream_profile.hpp>
+
+// SRT impairment rig. Streams the camera pipeline, fed by a test pattern,
+// through an in-process UDP relay to a local srtsrc receiver. The relay drops,
+// delays, jitters and reorders the packets in both directions. Every frame
+// gets its number stamped into the picture ahead of the encoder, so the
+// receiver can tell which frame it decoded, when it was sent, and whether it
+// came out intact. One run is made per SRT parameter set, under the same
+// impairment, and the results are printed as one JSON document. The capture
+// stamps are on, so the latency is also split into its hops (see
+// capture_stamp.hpp).
+//
+//   MastheadCamera_srt_rig [--loss PCT] [--delay MS] [--jitter MS] [--reorder PCT]
+//                          [--duration S] [--seed N] [--bitrate-step KBPS] [--srt OPTIONS]...
+//   MastheadCamera_srt_rig --profiles [--duration S] [--srt OPTIONS]
+//   MastheadCamera_srt_rig --docking [--duration S] [--srt OPTIONS]
+//
+// --srt takes the listener options as in cameras.conf, and can be repeated.
+// Without it the rig runs RIG_SRT_SETS. --bitrate-step changes the encoder
+// bitrate halfway through each run, as the control socket does, and the
+// frames lost and freezes in the RIG_RECONFIGURE_WINDOW_S after it are also
+// counted on their own.
+//
+// --profiles checks the stream profiles (see stream_profile.hpp) instead,
+// without impairment. Each of RIG_PROFILE_IDS calls the idle stream on its
+// own with that streamid, then a second caller joins a running stream. The
+// decoded caps, the frame rate and the encoder bitrate each caller gets are
+// compared with the profile it should get: its own when it found the stream
+// idle, the running one when it joined. Without STREAM_PROFILES_ENABLED
+// every caller should get the full stream.
+//
+// --docking switches docking mode (see docking_mode.hpp) on and off on the
+// rig camera, as the docking camera, while a caller is connected. Each switch
+// must succeed within DOCKING_SWITCH_TIMEOUT_MS and the caller must stay
+// connected, with frames coming again after it. The longest gap between the
+// caller's frames around each switch and dockingStatusJson are reported.
+
+static const int RIG_SENDER_PORT   = 7000;  // SRT listener of the pipeline.
+static const int RIG_RELAY_PORT    = 7001;  // Relay port the receiver calls.
+static const int RIG_FPS           = 30;
+static const int RIG_MARK_BITS     = 32;    // 24 bit frame number and 8 bit check.
+static const int RIG_MARK_BLOCK    = 32;    // Size of one stamped bit in pixels.
+static const double RIG_FREEZE_GAP = 2.5;   // Frame intervals without a frame counted as a freeze.
+static const double RIG_RECONFIGURE_WINDOW_S = 2.0;
+static const int RIG_IDLE_WAIT_MS  = 1000;  // Time for the listener to drop a caller and close its valve.
+static const double RIG_FPS_TOLERANCE = 0.2;  // Allowed relative error of a caller's frame rate.
+
+static const char *RIG_SRT_SETS[] = {
+    "latency=20&payloadsize=1316&tlpktdrop=true&too_late_delay_ignore=true",
+    "latency=60&payloadsize=1316&tlpktdrop=true&too_late_delay_ignore=true",
+    "latency=120&payloadsize=1316&tlpktdrop=true&too_late_delay_ignore=true",
+    "latency=120&payloadsize=1316&tlpktdrop=false",
+};
+
+// Streamids of the profile callers, the first one none.
+static const char *RIG_PROFILE_IDS[] = {
+    "",
+    "res=720p,fps=15,br=2000",
+    "#!::u=rig,res=360p,fps=10,br=800",
+    "res=640x480,br=1500",
+};
+
+// Network impairment applied by the relay, in each direction.
+struct Impairment {
+    double   loss_percent;
+    double   delay_ms;
+    double   jitter_ms;      // Uniform, +/- around the delay.
+    double   reorder_percent; // Packets held back behind later ones.
+    unsigned seed;
+};
+
+// What the receiver saw during one run.
+struct RigStats {
+    long                sent;
+    long                delivered;
+    long                lost;        // Frame numbers never decoded.
+    long                corrupted;   // Frames with an unreadable stamp or flagged by the decoder.
+    long                decode_warnings;
+    long                freezes;
+    double              frozen_ms;
+    double              seconds;     // First to last delivered frame.
+    std::vector<double> latency_ms;  // Ahead of the encoder to decoded.
+    long                reconfigure_lost;      // The same within RIG_RECONFIGURE_WINDOW_S of a bitrate step.
+    long                reconfigure_freezes;
+    double              reconfigure_frozen_ms;
+    LatencyHistogram    hops[LATENCY_HOPS];
+};
+
+// Send times of the stamped frames, in steady clock nanoseconds, by frame number.
+struct FrameClock {
+    std::unique_ptr<std::atomic<int64_t>[]> sent_ns;
+    long                                    capacity;
+    std::atomic<long>                       next;
+};
+
+// State of the receiver probe. Only touched on the receiver streaming thread
+// while it runs.
+struct Receiver {
+    FrameClock          *clock;
+    RigStats            *stats;
+    long                 last_frame;
+    int64_t              first_ns;
+    int64_t              last_ns;
+    std::atomic<int64_t> reconfigure_ns;   // Time of the bitrate step, 0 before it.
+};
+
+// A caller of the rig listener and what it received. The counts are touched
+// on its streaming threads.
+struct RigCaller {
+    std::string          stream_id;
+    GstElement          *pipeline = NULL;
+    std::atomic<long>    frames {0};
+    std::atomic<long>    bytes {0};     // Encoded video, ahead of the parser.
+    std::atomic<int64_t> first_ns {0};
+    std::atomic<int64_t> last_ns {0};
+    std::atomic<int64_t> max_gap_ns {0};  // Longest time between two frames.
+    int                  width  = 0;    // Decoded caps.
+    int                  height = 0;
+};
+
+static int64_t nowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * @brief Stamp value of a frame number: the number and a check byte.
+ */
+static uint32_t markValue(uint32_t frame) {
+    frame &= 0xffffff;
+    return (frame << 8) | ((frame ^ (frame >> 8) ^ (frame >> 16) ^ 0x5a) & 0xff);
+}
+
+/**
+ * @brief Buffer probe on the encoder sink pad. Stamps the frame number into
+ *        the top left of the luma plane, one black or white block per bit.
+ */
+static GstPadProbeReturn on_rig_send(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    FrameClock *clock  = (FrameClock *)user_data;
+    GstBuffer  *buffer = gst_buffer_make_writable(GST_PAD_PROBE_INFO_BUFFER(info));
+    GST_PAD_PROBE_INFO_DATA(info) = buffer;
+
+    GstCaps     *caps = gst_pad_get_current_caps(pad);
+    GstVideoInfo video_info;
+    bool         ok = caps != NULL && gst_video_info_from_caps(&video_info, caps);
+    if (caps != NULL) gst_caps_unref(caps);
+    if (!ok || GST_VIDEO_INFO_WIDTH(&video_info) < RIG_MARK_BITS * RIG_MARK_BLOCK) return GST_PAD_PROBE_OK;
+
+    GstVideoFrame frame;
+    if (!gst_video_frame_map(&frame, &video_info, buffer, GST_MAP_WRITE)) return GST_PAD_PROBE_OK;
+
+    long     number = clock->next.fetch_add(1);
+    uint32_t mark   = markValue(number);
+    uint8_t *luma   = (uint8_t *)GST_VIDEO_FRAME_PLANE_DATA(&frame, 0);
+    int      stride = GST_VIDEO_FRAME_PLANE_STRIDE(&frame, 0);
+    for (int y = 0; y < RIG_MARK_BLOCK; y++) {
+        for (int bit = 0; bit < RIG_MARK_BITS; bit++) {
+            uint8_t value = (mark >> (RIG_MARK_BITS - 1 - bit)) & 1 ? 235 : 16;
+            memset(luma + y * stride + bit * RIG_MARK_BLOCK, value, RIG_MARK_BLOCK);
+        }
+    }
+    gst_video_frame_unmap(&frame);
+
+    if (number < clock->capacity) clock->sent_ns[number].store(nowNs(), std::memory_order_release);
+    return GST_PAD_PROBE_OK;
+}
+
+/**
+ * @brief Read the frame number stamped by on_rig_send from a GRAY8 frame.
+ *
+ * @return frame number, or -1 if the stamp does not check out.
+ */
+static long readMark(const uint8_t *luma, int stride) {
+    uint32_t mark = 0;
+    for (int bit = 0; bit < RIG_MARK_BITS; bit++) {
+        // Average the middle of the block, away from the coding artifacts at its edges
+        int sum = 0;
+        for (int y = RIG_MARK_BLOCK / 4; y < RIG_MARK_BLOCK * 3 / 4; y++) {
+            const uint8_t *row = luma + y * stride + bit * RIG_MARK_BLOCK;
+            for (int x = RIG_MARK_BLOCK / 4; x < RIG_MARK_BLOCK * 3 / 4; x++) sum += row[x];
+        }
+        mark = (mark << 1) | (sum > 128 * (RIG_MARK_BLOCK / 2) * (RIG_MARK_BLOCK / 2) ? 1 : 0);
+    }
+    uint32_t frame = mark >> 8;
+    return markValue(frame) == mark ? (long)frame : -1;
+}
+
+/**
+ * @brief Buffer probe on the receiver sink. Checks each decoded frame.
+ */
+static GstPadProbeReturn on_rig_receive(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    Receiver  *receiver = (Receiver *)user_data;
+    RigStats  *stats    = receiver->stats;
+    GstBuffer *buffer   = GST_PAD_PROBE_INFO_BUFFER(info);
+    int64_t    now      = nowNs();
+
+    GstCaps     *caps = gst_pad_get_current_caps(pad);
+    GstVideoInfo video_info;
+    bool         ok = caps != NULL && gst_video_info_from_caps(&video_info, caps);
+    if (caps != NULL) gst_caps_unref(caps);
+    GstVideoFrame frame;
+    if (!ok || !gst_video_frame_map(&frame, &video_info, buffer, GST_MAP_READ)) return GST_PAD_PROBE_OK;
+    long number = GST_VIDEO_INFO_WIDTH(&video_info) < RIG_MARK_BITS * RIG_MARK_BLOCK ? -1 :
+        readMark((const uint8_t *)GST_VIDEO_FRAME_PLANE_DATA(&frame, 0), GST_VIDEO_FRAME_PLANE_STRIDE(&frame, 0));
+    gst_video_frame_unmap(&frame);
+
+    int64_t reconfigure = receiver->reconfigure_ns.load(std::memory_order_acquire);
+    bool    window      = reconfigure != 0 && now >= reconfigure && now - reconfigure < RIG_RECONFIGURE_WINDOW_S * 1e9;
+
+    // Freezes are gaps in the decoded output, whatever the frames hold
+    if (receiver->first_ns == 0) receiver->first_ns = now;
+    if (receiver->last_ns != 0) {
+        double gap_ms = (now - receiver->last_ns) / 1e6;
+        if (gap_ms > RIG_FREEZE_GAP * 1000.0 / RIG_FPS) {
+            stats->freezes++;
+            stats->frozen_ms += gap_ms - 1000.0 / RIG_FPS;
+            if (window) {
+                stats->reconfigure_freezes++;
+                stats->reconfigure_frozen_ms += gap_ms - 1000.0 / RIG_FPS;
+            }
+        }
+    }
+    receiver->last_ns = now;
+    stats->delivered++;
+
+    if (number < 0 || GST_BUFFER_FLAG_IS_SET(buffer, GST_BUFFER_FLAG_CORRUPTED)) {
+        stats->corrupted++;
+        return GST_PAD_PROBE_OK;
+    }
+    if (receiver->last_frame >= 0 && number > receiver->last_frame + 1) {
+        stats->lost += number - receiver->last_frame - 1;
+        if (window) stats->reconfigure_lost += number - receiver->last_frame - 1;
+    }
+    if (number > receiver->last_frame) receiver->last_frame = number;
+
+    int64_t sent = number < receiver->clock->capacity ?
+        receiver->clock->sent_ns[number].load(std::memory_order_acquire) : 0;
+    if (sent != 0) stats->latency_ms.push_back((now - sent) / 1e6);
+    return GST_PAD_PROBE_OK;
+}
+
+/**
+ * @brief Relay between the receiver and the SRT listener, impairing both directions.
+ *
+ * Packets from the receiver arrive on the relay port and leave through a
+ * second socket towards the listener, whose replies go back to the address
+ * the receiver last sent from.
+ */
+static void runRelay(const Impairment impairment, std::atomic<bool> *stop) {
+    int outside = socket(AF_INET, SOCK_DGRAM, 0);
+    int inside  = socket(AF_INET, SOCK_DGRAM, 0);
+    if (outside < 0 || inside < 0) {
+        perror("relay socket");
+        return;
+    }
+    sockaddr_in relay_address = {};
+    relay_address.sin_family      = AF_INET;
+    relay_address.sin_port        = htons(RIG_RELAY_PORT);
+    relay_address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    int reuse = 1;
+    setsockopt(outside, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    if (bind(outside, (sockaddr *)&relay_address, sizeof(relay_address)) != 0) {
+        perror("relay bind");
+        close(outside);
+        close(inside);
+        return;
+    }
+    sockaddr_in listener = relay_address;
+    listener.sin_port    = htons(RIG_SENDER_PORT);
+    sockaddr_in receiver = {};
+    bool        have_receiver = false;
+
+    // Packets in flight, by release time. A packet keeps the socket it leaves through.
+    struct Packet {
+        int                  socket;
+        sockaddr_in          to;
+        std::vector<uint8_t> data;
+    };
+    std::multimap<int64_t, Packet>         in_flight;
+    std::mt19937                           random(impairment.seed);
+    std::uniform_real_distribution<double> percent(0.0, 100.0);
+    std::uniform_real_distribution<double> jitter(-impairment.jitter_ms, impairment.jitter_ms);
+    uint8_t                                data[2048];
+
+    while (!stop->load()) {
+        int timeout_ms = 5;
+        if (!in_flight.empty()) {
+            int64_t wait = (in_flight.begin()->first - nowNs()) / 1000000;
+            timeout_ms   = (int)std::clamp<int64_t>(wait, 0, 5);
+        }
+        pollfd fds[2] = {{outside, POLLIN, 0}, {inside, POLLIN, 0}};
+        poll(fds, 2, timeout_ms);
+
+        for (int i = 0; i < 2; i++) {
+            if (!(fds[i].revents & POLLIN)) continue;
+            sockaddr_in from = {};
+            socklen_t   from_length = sizeof(from);
+            ssize_t     length = recvfrom(fds[i].fd, data, sizeof(data), 0, (sockaddr *)&from, &from_length);
+            if (length <= 0) continue;
+            if (i == 0) {
+                receiver      = from;
+                have_receiver = true;
+            } else if (!have_receiver) {
+                continue;
+            }
+            if (percent(random) < impairment.loss_percent) continue;
+
+            double delay_ms = std::max(0.0, impairment.delay_ms + jitter(random));
+            // A reordered packet is held back long enough for the next ones to pass it
+            if (percent(random) < impairment.reorder_percent) delay_ms += 2.0 * impairment.jitter_ms + 5.0;
+            Packet packet = {i == 0 ? inside : outside, i == 0 ? listener : receiver,
+                             std::vector<uint8_t>(data, data + length)};
+            in_flight.emplace(nowNs() + (int64_t)(delay_ms * 1e6), std::move(packet));
+        }
+
+        int64_t now = nowNs();
+        while (!in_flight.empty() && in_flight.begin()->first <= now) {
+            const Packet &packet = in_flight.begin()->second;
+            sendto(packet.socket, packet.data.data(), packet.data.size(), 0, (const sockaddr *)&packet.to,
+                   sizeof(packet.to));
+            in_flight.erase(in_flight.begin());
+        }
+    }
+    close(outside);
+    close(inside);
+}
+
+/**
+ * @brief SRT latency of a listener option string, for the receiver to ask for the same.
+ */
+static int srtLatency(const std::string &options) {
+    size_t at = options.find("latency=");
+    return at == std::string::npos ? 120 : atoi(options.c_str() + at + strlen("latency="));
+}
+
+/**
+ * @brief Count the warnings and errors posted on a bus since the last call.
+ */
+static long drainBus(GstElement *pipeline) {
+    long    count = 0;
+    GstBus *bus   = gst_element_get_bus(pipeline);
+    while (GstMessage *msg = gst_bus_pop_filtered(bus, (GstMessageType)(GST_MESSAGE_WARNING | GST_MESSAGE_ERROR))) {
+        count++;
+        gst_message_unref(msg);
+    }
+    gst_object_unref(bus);
+    return count;
+}
+
+/**
+ * @brief Stream for the given time with one SRT parameter set.
+ *
+ * @param bitrate_step Bitrate set halfway through in kbps, 0 for none.
+ * @return 0 if the run completed, 1 on error.
+ */
+static int runSet(const std::string &srt, const Impairment &impairment, int seconds, int bitrate_step,
+                  RigStats *stats) {
+    CameraConfig camera = {};
+    camera.name      = "rig";
+    camera.sensor    = TEST_SENSOR;
+    camera.width     = 1280;
+    camera.height    = 720;
+    camera.fps       = RIG_FPS;
+    camera.port      = RIG_SENDER_PORT;
+    camera.srt       = srt;
+    camera.proxy_srt = srt;
+    camera.encoder   = {4000, 4, RIG_FPS};
+
+    std::vector<CameraPipeline> senders;
+    if (buildCameraPipelines({camera}, &senders) != 0) return 1;
+    CameraPipeline &sender = senders[0];
+
+    FrameClock clock;
+    clock.capacity = (long)(seconds + 10) * RIG_FPS;
+    clock.sent_ns  = std::make_unique<std::atomic<int64_t>[]>(clock.capacity);
+    clock.next     = 0;
+    GstPad *encoder_sink = gst_element_get_static_pad(sender.encoder, "sink");
+    gst_pad_add_probe(encoder_sink, GST_PAD_PROBE_TYPE_BUFFER, on_rig_send, &clock, NULL);
+    gst_object_unref(encoder_sink);
+    if (startCaptureStamps(sender.pipeline, cameraElement(sender, "encoder").c_str(), camera.name.c_str()) != 0) {
+        stopCameraPipelines(senders);
+        return 1;
+    }
+
+    gateValve(sender.pipeline, cameraElement(sender, "sink").c_str(), cameraElement(sender, "stream_valve").c_str(),
+              NULL);
+    if (startCameraPipelines(senders) != 0) {
+        stopCameraPipelines(senders);
+        return 1;
+    }
+
+    std::atomic<bool> stop_relay {false};
+    std::thread       relay(runRelay, impairment, &stop_relay);
+
+    const std::string receiver_description =
+        "srtsrc uri=\"srt://127.0.0.1:" + std::to_string(RIG_RELAY_PORT) + "?mode=caller&latency=" +
+        std::to_string(srtLatency(srt)) + "\" ! tsdemux ! h264parse name=rig_parser ! "
+        "video/x-h264,stream-format=byte-stream,alignment=au ! avdec_h264 ! "
+        "videoconvert ! video/x-raw,format=GRAY8 ! fakesink name=rig_receiver sync=false";
+    GError     *error    = NULL;
+    GstElement *receiver = gst_parse_launch(receiver_description.c_str(), &error);
+    if (receiver == NULL) {
+        fprintf(stderr, "Receiver: %s\n", error != NULL ? error->message : "unknown error");
+        if (error != NULL) g_error_free(error);
+        stop_relay = true;
+        relay.join();
+        stopCameraPipelines(senders);
+        return 1;
+    }
+
+    *stats = {};
+    stats->latency_ms.reserve(clock.capacity);
+    Receiver probe = {&clock, stats, -1, 0, 0, 0};
+    GstElement *fakesink = gst_bin_get_by_name(GST_BIN(receiver), "rig_receiver");
+    GstPad     *sink_pad = gst_element_get_static_pad(fakesink, "sink");
+    gst_pad_add_probe(sink_pad, GST_PAD_PROBE_TYPE_BUFFER, on_rig_receive, &probe, NULL);
+    gst_object_unref(sink_pad);
+    gst_object_unref(fakesink);
+    StampReceiver stamps;
+    attachStampReceiver(receiver, "rig_parser", "rig_receiver", &stamps);
+
+    gst_element_set_state(receiver, GST_STATE_PLAYING);
+    if (bitrate_step > 0) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(seconds * 500));
+        probe.reconfigure_ns.store(nowNs(), std::memory_order_release);
+        setEncoderBitrate(sender.encoder, bitrate_step);
+        std::this_thread::sleep_for(std::chrono::milliseconds(seconds * 500));
+    } else {
+        std::this_thread::sleep_for(std::chrono::seconds(seconds));
+    }
+    gst_element_set_state(receiver, GST_STATE_NULL);
+    stats->decode_warnings = drainBus(receiver);
+    gst_object_unref(receiver);
+    for (int hop = 0; hop < LATENCY_HOPS; hop++) stats->hops[hop] = stamps.hops[hop];
+
+    stop_relay = true;
+    relay.join();
+    stats->sent = clock.next.load();
+    stopCameraPipelines(senders);
+
+    stats->seconds = probe.last_ns > probe.first_ns ? (probe.last_ns - probe.first_ns) / 1e9 : 0.0;
+    std::sort(stats->latency_ms.begin(), stats->latency_ms.end());
+    return 0;
+}
+
+/**
+ * @brief Buffer probe on a caller's sink. Counts the decoded frames.
+ */
+static GstPadProbeReturn on_caller_frame(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    RigCaller *caller = (RigCaller *)user_data;
+    int64_t    now    = nowNs();
+    int64_t    none   = 0;
+    if (!caller->first_ns.compare_exchange_strong(none, now)) {
+        caller->max_gap_ns = std::max(caller->max_gap_ns.load(), now - caller->last_ns);
+    }
+    caller->last_ns = now;
+    caller->frames++;
+    return GST_PAD_PROBE_OK;
+}
+
+/**
+ * @brief Buffer probe ahead of a caller's parser. Counts the encoded bytes.
+ */
+static GstPadProbeReturn on_caller_bytes(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    ((RigCaller *)user_data)->bytes += gst_buffer_get_size(GST_PAD_PROBE_INFO_BUFFER(info));
+    return GST_PAD_PROBE_OK;
+}
+
+/**
+ * @brief Call the rig listener with a streamid and start decoding.
+ *
+ * @return error - 0 for no error, 1 if the caller pipeline could not be built.
+ */
+static int startCaller(const std::string &srt, RigCaller *caller) {
+    const std::string description =
+        "srtsrc name=rig_caller uri=\"srt://127.0.0.1:" + std::to_string(RIG_SENDER_PORT) + "?mode=caller&latency=" +
+        std::to_string(srtLatency(srt)) + "\" ! tsdemux ! h264parse name=rig_parser ! "
+        "video/x-h264,stream-format=byte-stream,alignment=au ! avdec_h264 ! fakesink name=rig_receiver sync=false";
+    GError *error = NULL;
+    caller->pipeline = gst_parse_launch(description.c_str(), &error);
+    if (caller->pipeline == NULL) {
+        fprintf(stderr, "Caller: %s\n", error != NULL ? error->message : "unknown error");
+        if (error != NULL) g_error_free(error);
+        return 1;
+    }
+
+    GstBin     *bin    = GST_BIN(caller->pipeline);
+    GstElement *source = gst_bin_get_by_name(bin, "rig_caller");
+    if (!caller->stream_id.empty()) g_object_set(G_OBJECT(source), "streamid", caller->stream_id.c_str(), NULL);
+    gst_object_unref(source);
+
+    GstElement *parser     = gst_bin_get_by_name(bin, "rig_parser");
+    GstPad     *parser_pad = gst_element_get_static_pad(parser, "sink");
+    gst_pad_add_probe(parser_pad, GST_PAD_PROBE_TYPE_BUFFER, on_caller_bytes, caller, NULL);
+    gst_object_unref(parser_pad);
+    gst_object_unref(parser);
+
+    GstElement *sink     = gst_bin_get_by_name(bin, "rig_receiver");
+    GstPad     *sink_pad = gst_element_get_static_pad(sink, "sink");
+    gst_pad_add_probe(sink_pad, GST_PAD_PROBE_TYPE_BUFFER, on_caller_frame, caller, NULL);
+    gst_object_unref(sink_pad);
+    gst_object_unref(sink);
+
+    gst_element_set_state(caller->pipeline, GST_STATE_PLAYING);
+    return 0;
+}
+
+/**
+ * @brief Read the decoded caps of a caller and hang up.
+ */
+static void stopCaller(RigCaller *caller) {
+    if (caller->pipeline == NULL) return;
+    GstElement *sink     = gst_bin_get_by_name(GST_BIN(caller->pipeline), "rig_receiver");
+    GstPad     *sink_pad = gst_element_get_static_pad(sink, "sink");
+    GstCaps    *caps     = gst_pad_get_current_caps(sink_pad);
+    GstVideoInfo info;
+    if (caps != NULL && gst_video_info_from_caps(&info, caps)) {
+        caller->width  = GST_VIDEO_INFO_WIDTH(&info);
+        caller->height = GST_VIDEO_INFO_HEIGHT(&info);
+    }
+    if (caps != NULL) gst_caps_unref(caps);
+    gst_object_unref(sink_pad);
+    gst_object_unref(sink);
+
+    gst_element_set_state(caller->pipeline, GST_STATE_NULL);
+    gst_object_unref(caller->pipeline);
+    caller->pipeline = NULL;
+}
+
+/**
+ * @brief Print a caller as JSON and check it got the expected profile.
+ *
+ * @param encoder_kbps Bitrate the encoder was set to while the caller ran.
+ * @return true if the caller got the expected profile.
+ */
+static bool printCaller(const RigCaller &caller, const StreamProfile &expected, int encoder_kbps) {
+    double seconds = caller.last_ns > caller.first_ns ? (caller.last_ns - caller.first_ns) / 1e9 : 0.0;
+    double fps     = seconds > 0.0 ? (caller.frames - 1) / seconds : 0.0;
+    double kbps    = seconds > 0.0 ? caller.bytes * 8.0 / seconds / 1000.0 : 0.0;
+    bool   ok      = caller.width == expected.width && caller.height == expected.height &&
+                     encoder_kbps == expected.bitrate_kbps && std::abs(fps / expected.fps - 1.0) <= RIG_FPS_TOLERANCE;
+    printf("{\"streamid\": \"%s\", \"expected\": {\"width\": %d, \"height\": %d, \"fps\": %d, \"kbps\": %d}, "
+           "\"width\": %d, \"height\": %d, \"fps\": %.2f, \"encoder_kbps\": %d, \"measured_kbps\": %.0f, "
+           "\"frames\": %ld, \"ok\": %s}",
+           caller.stream_id.c_str(), expected.width, expected.height, expected.fps, expected.bitrate_kbps,
+           caller.width, caller.height, fps, encoder_kbps, kbps, caller.frames.load(), ok ? "true" : "false");
+    return ok;
+}
+
+/**
+ * @brief Profile a caller should get from the idle rig stream.
+ */
+static StreamProfile expectedProfile(const std::string &stream_id, const StreamProfile &full) {
+    StreamProfile profile = full;
+    if (STREAM_PROFILES_ENABLED && !parseStreamProfile(stream_id.c_str(), full, &profile)) profile = full;
+    return profile;
+}
+
+/**
+ * @brief Encoder bitrate of the rig stream in kbps.
+ */
+static int encoderKbps(const CameraPipeline &sender) {
+    guint kbps = 0;
+    g_object_get(G_OBJECT(sender.encoder), "bitrate", &kbps, NULL);
+    return (int)kbps;
+}
+
+/**
+ * @brief Build and start the rig camera with its stream profiles.
+ *
+ * @param docking Make it the docking camera and get docking mode ready.
+ * @param senders Returned camera pipeline.
+ * @param full    Returned settings of the full stream.
+ * @return error - 0 for no error, 1 if the camera could not be started.
+ */
+static int startRigSender(const std::string &srt, bool docking, std::vector<CameraPipeline> *senders,
+                          StreamProfile *full) {
+    CameraConfig camera = {};
+    camera.name      = "rig";
+    camera.sensor    = TEST_SENSOR;
+    camera.width     = 1280;
+    camera.height    = 720;
+    camera.fps       = RIG_FPS;
+    camera.port      = RIG_SENDER_PORT;
+    camera.srt       = srt;
+    camera.proxy_srt = srt;
+    camera.docking   = docking;
+    camera.encoder   = {4000, 4, RIG_FPS};
+    *full = {camera.width, camera.height, camera.fps, camera.encoder.bitrate_kbps};
+
+    if (buildCameraPipelines({camera}, senders) != 0) return 1;
+    CameraPipeline   &sender = (*senders)[0];
+    const std::string sink   = cameraElement(sender, "sink");
+    const std::string valve  = cameraElement(sender, sender.tee ? "valve" : "stream_valve");
+    gateValve(sender.pipeline, sink.c_str(), cameraElement(sender, "stream_valve").c_str(), NULL);
+    if (sender.tee) gateValve(sender.pipeline, sink.c_str(), valve.c_str(), NULL);
+    // As the camera wiring does, the profile stage is there for the profiles, the governor or docking mode
+    if (((STREAM_PROFILES_ENABLED || GOVERNOR_ENABLED || DOCKING_MODE_ENABLED) &&
+         startStreamProfiles(sender.pipeline, sink.c_str(), valve.c_str(), camera.name.c_str(), *full) != 0) ||
+        (docking && startDockingMode(*senders) != 0) || startCameraPipelines(*senders) != 0) {
+        stopCameraPipelines(*senders);
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Check the stream profiles each caller gets and print them as JSON.
+ *
+ * @return 0 if every caller got its profile, 1 otherwise or on error.
+ */
+static int runProfiles(const std::string &srt, int seconds) {
+    std::vector<CameraPipeline> senders;
+    StreamProfile               full;
+    if (startRigSender(srt, false, &senders, &full) != 0) return 1;
+    CameraPipeline &sender = senders[0];
+
+    printf("{\n  \"profiles_enabled\": %s, \"srt\": \"%s\", \"duration_s\": %d,\n  \"callers\": [\n",
+           STREAM_PROFILES_ENABLED ? "true" : "false", srt.c_str(), seconds);
+    bool ok = true;
+    for (size_t i = 0; i < std::size(RIG_PROFILE_IDS); i++) {
+        RigCaller caller;
+        caller.stream_id = RIG_PROFILE_IDS[i];
+        if (startCaller(srt, &caller) != 0) {
+            stopCameraPipelines(senders);
+            return 1;
+        }
+        std::this_thread::sleep_for(std::chrono::seconds(seconds));
+        int kbps = encoderKbps(sender);
+        stopCaller(&caller);
+
+        printf("    ");
+        ok &= printCaller(caller, expectedProfile(caller.stream_id, full), kbps);
+        printf("%s\n", i + 1 < std::size(RIG_PROFILE_IDS) ? "," : "");
+        fflush(stdout);
+        std::this_thread::sleep_for(std::chrono::milliseconds(RIG_IDLE_WAIT_MS));
+    }
+
+    // A caller joining a running stream shares the profile of the first
+    RigCaller first, joining;
+    first.stream_id   = RIG_PROFILE_IDS[1];
+    joining.stream_id = RIG_PROFILE_IDS[2];
+    if (startCaller(srt, &first) != 0) {
+        stopCameraPipelines(senders);
+        return 1;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(RIG_IDLE_WAIT_MS));
+    if (startCaller(srt, &joining) != 0) {
+        stopCaller(&first);
+        stopCameraPipelines(senders);
+        return 1;
+    }
+    std::this_thread::sleep_for(std::chrono::seconds(seconds));
+    int kbps = encoderKbps(sender);
+    stopCaller(&joining);
+    stopCaller(&first);
+    stopCameraPipelines(senders);
+
+    const StreamProfile running = expectedProfile(first.stream_id, full);
+    printf("  ],\n  \"shared\": {\"first\": ");
+    ok &= printCaller(first, running, kbps);
+    printf(", \"joining\": ");
+    ok &= printCaller(joining, running, kbps);
+    printf("},\n  \"ok\": %s\n}\n", ok ? "true" : "false");
+    return ok ? 0 : 1;
+}
+
+/**
+ * @brief Count the errors and end of stream posted on a caller's bus.
+ */
+static long callerLost(GstElement *pipeline) {
+    long    count = 0;
+    GstBus *bus   = gst_element_get_bus(pipeline);
+    while (GstMessage *msg = gst_bus_pop_filtered(bus, (GstMessageType)(GST_MESSAGE_ERROR | GST_MESSAGE_EOS))) {
+        count++;
+        gst_message_unref(msg);
+    }
+    gst_object_unref(bus);
+    return count;
+}
+
+/**
+ * @brief Switch docking mode on and off under a connected caller and print the switches as JSON.
+ *
+ * @return 0 if every switch was in time and the caller stayed connected, 1 otherwise or on error.
+ */
+static int runDocking(const std::string &srt, int seconds) {
+    std::vector<CameraPipeline> senders;
+    StreamProfile               full;
+    if (startRigSender(srt, true, &senders, &full) != 0) return 1;
+
+    RigCaller caller;
+    if (startCaller(srt, &caller) != 0) {
+        stopCameraPipelines(senders);
+        return 1;
+    }
+    std::this_thread::sleep_for(std::chrono::seconds(seconds));
+
+    printf("{\n  \"docking_enabled\": %s, \"srt\": \"%s\", \"duration_s\": %d,\n  \"switches\": [\n",
+           DOCKING_MODE_ENABLED ? "true" : "false", srt.c_str(), seconds);
+    bool ok = caller.frames > 0;
+    for (bool on : {true, false}) {
+        caller.max_gap_ns = 0;
+        double switch_ms;
+        int    error  = setDockingMode(on, &switch_ms);
+        long   before = caller.frames;
+        std::this_thread::sleep_for(std::chrono::seconds(seconds));
+        long   after     = caller.frames - before;
+        bool   connected = callerLost(caller.pipeline) == 0 && after > 0;
+        bool   in_time   = error == 0 && switch_ms >= 0.0 && switch_ms < DOCKING_SWITCH_TIMEOUT_MS;
+        ok &= connected && in_time;
+        printf("    {\"on\": %s, \"error\": %d, \"switch_ms\": %.1f, \"connected\": %s, \"frames_after\": %ld, "
+               "\"max_gap_ms\": %.1f, \"ok\": %s}%s\n", on ? "true" : "false", error, switch_ms,
+               connected ? "true" : "false", after, caller.max_gap_ns / 1e6, connected && in_time ? "true" : "false",
+               on ? "," : "");
+        fflush(stdout);
+    }
+    const std::string status = dockingStatusJson();
+    stopCaller(&caller);
+    stopCameraPipelines(senders);
+
+    printf("  ],\n  \"status\": %s,\n  \"ok\": %s\n}\n", status.c_str(), ok ? "true" : "false");
+    return ok ? 0 : 1;
+}
+
+/**
+ * @brief Latency percentile of a sorted sample, or -1 without samples.
+ */
+static double percentile(const std::vector<double> &sorted, double p) {
+    if (sorted.empty()) return -1.0;
+    size_t index = (size_t)std::ceil(p / 100.0 * sorted.size());
+    return sorted[std::clamp<size_t>(index, 1, sorted.size()) - 1];
+}
+
+int main(int argc, char *argv[]) {
+    Impairment               impairment   = {1.0, 10.0, 5.0, 0.5, 1};
+    int                      seconds      = 20;
+    int                      bitrate_step = 0;
+    bool                     profiles     = false;
+    bool                     docking      = false;
+    std::vector<std::string> sets;
+
+    for (int i = 1; i < argc; i++) {
+        const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+        if      (strcmp(argv[i], "--loss") == 0 && value)     impairment.loss_percent    = atof(argv[++i]);
+        else if (strcmp(argv[i], "--delay") == 0 && value)    impairment.delay_ms        = atof(argv[++i]);
+        else if (strcmp(argv[i], "--jitter") == 0 && value)   impairment.jitter_ms       = atof(argv[++i]);
+        else if (strcmp(argv[i], "--reorder") == 0 && value)  impairment.reorder_percent = atof(argv[++i]);
+        else if (strcmp(argv[i], "--duration") == 0 && value) seconds                    = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--seed") == 0 && value)     impairment.seed            = (unsigned)atoi(argv[++i]);
+        else if (strcmp(argv[i], "--bitrate-step") == 0 && value) bitrate_step        = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--srt") == 0 && value)      sets.push_back(argv[++i]);
+        else if (strcmp(argv[i], "--profiles") == 0)          profiles                   = true;
+        else if (strcmp(argv[i], "--docking") == 0)           docking                    = true;
+        else {
+            fprintf(stderr, "Usage: %s [--loss PCT] [--delay MS] [--jitter MS] [--reorder PCT] "
+                            "[--duration S] [--seed N] [--bitrate-step KBPS] [--srt OPTIONS]...\n"
+                            "       %s --profiles|--docking [--duration S] [--srt OPTIONS]\n", argv[0], argv[0]);
+            return 1;
+        }
+    }
+    if (seconds < 1) seconds = 1;
+
+    gst_init(&argc, &argv);
+    if (profiles) return runProfiles(sets.empty() ? RIG_SRT_SETS[2] : sets[0], seconds);
+    if (docking)  return runDocking(sets.empty() ? RIG_SRT_SETS[2] : sets[0], seconds);
+    if (sets.empty()) sets.assign(std::begin(RIG_SRT_SETS), std::end(RIG_SRT_SETS));
+
+    printf("{\n  \"impairment\": {\"loss_percent\": %.2f, \"delay_ms\": %.1f, \"jitter_ms\": %.1f, "
+           "\"reorder_percent\": %.2f, \"seed\": %u, \"duration_s\": %d},\n  \"runs\": [\n",
+           impairment.loss_percent, impairment.delay_ms, impairment.jitter_ms, impairment.reorder_percent,
+           impairment.seed, seconds);
+    int status = 0;
+    for (size_t i = 0; i < sets.size(); i++) {
+        RigStats stats;
+        if (runSet(sets[i], impairment, seconds, bitrate_step, &stats) != 0) {
+            fprintf(stderr, "Run with \"%s\" failed\n", sets[i].c_str());
+            status = 1;
+            continue;
+        }
+        printf("    {\"srt\": \"%s\", \"frames_sent\": %ld, \"frames_delivered\": %ld, \"fps\": %.2f, "
+               "\"frames_lost\": %ld, \"frames_corrupted\": %ld, \"decoder_warnings\": %ld, "
+               "\"freezes\": %ld, \"frozen_ms\": %.0f, "
+               "\"latency_ms\": {\"p50\": %.1f, \"p90\": %.1f, \"p99\": %.1f, \"max\": %.1f}, \"hops_ms\": {",
+               sets[i].c_str(), stats.sent, stats.delivered, stats.seconds > 0 ? stats.delivered / stats.seconds : 0.0,
+               stats.lost, stats.corrupted, stats.decode_warnings, stats.freezes, stats.frozen_ms,
+               percentile(stats.latency_ms, 50), percentile(stats.latency_ms, 90),
+               percentile(stats.latency_ms, 99), percentile(stats.latency_ms, 100));
+        for (int hop = 0; hop < LATENCY_HOPS; hop++) {
+            printf("\"%s\": {\"p50\": %.1f, \"p99\": %.1f}%s", LATENCY_HOP_NAMES[hop],
+                   latencyQuantile(stats.hops[hop], 0.5), latencyQuantile(stats.hops[hop], 0.99),
+                   hop + 1 < LATENCY_HOPS ? ", " : "");
+        }
+        printf("}");
+        if (bitrate_step > 0) {
+            printf(", \"reconfigure\": {\"kbps\": %d, \"frames_lost\": %ld, \"freezes\": %ld, \"frozen_ms\": %.0f}",
+                   bitrate_step, stats.reconfigure_lost, stats.reconfigure_freezes, stats.reconfigure_frozen_ms);
+        }
+        printf("}%s\n", i + 1 < sets.size() ? "," : "");
+        fflush(stdout);
+    }
+    printf("  ]\n}\n");
+    return status;
+}